@@ -16,6 +16,12 @@ function(shuttlesock_test_features)
     ACCEPT4
     STRSIGNAL
     HYPERSCAN
+    MSG_ZEROCOPY
+    SPLICE
+    SENDFILE
+    MMSG
+    CPU_AFFINITY
+    REUSEPORT_CBPF
   )
   set(conditions
     USE_EVENTFD
@@ -140,6 +146,48 @@ function(shuttlesock_test_features)
     set(${RESULT_ACCEPT4} ${have_accept4} CACHE INTERNAL "system supports accept4")
   endif()
   
+  #MSG_ZEROCOPY
+  if(NOT DEFINED ${RESULT_MSG_ZEROCOPY})
+    include(TestMsgZerocopy)
+    test_msg_zerocopy(have_msg_zerocopy)
+    set(${RESULT_MSG_ZEROCOPY} ${have_msg_zerocopy} CACHE INTERNAL "system supports MSG_ZEROCOPY")
+  endif()
+  
+  #splice()
+  if(NOT DEFINED ${RESULT_SPLICE})
+    include(TestSplice)
+    test_splice(have_splice)
+    set(${RESULT_SPLICE} ${have_splice} CACHE INTERNAL "system has splice()")
+  endif()
+  
+  #sendfile()
+  if(NOT DEFINED ${RESULT_SENDFILE})
+    include(TestSendfile)
+    test_sendfile(have_sendfile)
+    set(${RESULT_SENDFILE} ${have_sendfile} CACHE INTERNAL "system has sendfile()")
+  endif()
+  
+  #recvmmsg() and sendmmsg()
+  if(NOT DEFINED ${RESULT_MMSG})
+    include(TestMmsg)
+    test_mmsg(have_mmsg)
+    set(${RESULT_MMSG} ${have_mmsg} CACHE INTERNAL "system has recvmmsg() and sendmmsg()")
+  endif()
+  
+  #pthread_setaffinity_np()
+  if(NOT DEFINED ${RESULT_CPU_AFFINITY})
+    include(TestCpuAffinity)
+    test_cpu_affinity("${CMAKE_THREAD_LIBS_INIT}" have_cpu_affinity)
+    set(${RESULT_CPU_AFFINITY} ${have_cpu_affinity} CACHE INTERNAL "system has pthread_setaffinity_np()")
+  endif()
+  
+  #SO_ATTACH_REUSEPORT_CBPF
+  if(NOT DEFINED ${RESULT_REUSEPORT_CBPF})
+    include(TestReuseportCBPF)
+    test_reuseport_cbpf(have_reuseport_cbpf)
+    set(${RESULT_REUSEPORT_CBPF} ${have_reuseport_cbpf} CACHE INTERNAL "system supports SO_ATTACH_REUSEPORT_CBPF")
+  endif()
+  
   #strsignal()
   if(NOT DEFINED ${RESULT_STRSIGNAL})
     include(TestStrsignal)
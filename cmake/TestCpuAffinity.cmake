@@ -0,0 +1,29 @@
+include(CheckCSourceCompiles)
+include(CMakePushCheckState)
+
+function(test_cpu_affinity threads_lib result_var)
+  message(STATUS "Check if system has pthread_setaffinity_np")
+  cmake_push_check_state(RESET)
+  set(CMAKE_REQUIRED_QUIET 1)
+  set(CMAKE_REQUIRED_LIBRARIES "${threads_lib}")
+  check_c_source_compiles("
+    #define _GNU_SOURCE
+    #include <pthread.h>
+    #include <sched.h>
+    int main(void) {
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      CPU_SET(0, &cpus);
+      return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+  " have_cpu_affinity)
+  cmake_reset_check_state()
+  
+  if(have_cpu_affinity)
+    message(STATUS "Check if system has pthread_setaffinity_np - yes")
+  else()
+    message(STATUS "Check if system has pthread_setaffinity_np - no")
+  endif()
+  set(${result_var} ${have_cpu_affinity} PARENT_SCOPE)
+  unset(have_cpu_affinity CACHE)
+endfunction()
@@ -0,0 +1,29 @@
+include(CheckCSourceCompiles)
+include(CMakePushCheckState)
+
+function(test_mmsg result_var)
+  message(STATUS "Check if system has recvmmsg and sendmmsg")
+  cmake_push_check_state(RESET)
+  set(CMAKE_REQUIRED_QUIET 1)
+  check_c_source_compiles("
+    #define _GNU_SOURCE
+    #include <sys/socket.h>
+    #include <stddef.h>
+    int main(void) {
+      struct mmsghdr msgs[2];
+      if(recvmmsg(0, msgs, 2, MSG_DONTWAIT, NULL) == -1) {
+        return 1;
+      }
+      return sendmmsg(1, msgs, 2, MSG_DONTWAIT);
+    }
+  " have_mmsg)
+  cmake_reset_check_state()
+  
+  if(have_mmsg)
+    message(STATUS "Check if system has recvmmsg and sendmmsg - yes")
+  else()
+    message(STATUS "Check if system has recvmmsg and sendmmsg - no")
+  endif()
+  set(${result_var} ${have_mmsg} PARENT_SCOPE)
+  unset(have_mmsg CACHE)
+endfunction()
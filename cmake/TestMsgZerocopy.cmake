@@ -0,0 +1,28 @@
+include(CheckCSourceCompiles)
+include(CMakePushCheckState)
+
+function(test_msg_zerocopy result_var)
+  message(STATUS "Check if system supports MSG_ZEROCOPY")
+  cmake_push_check_state(RESET)
+  set(CMAKE_REQUIRED_QUIET 1)
+  check_c_source_compiles("
+    #define _GNU_SOURCE
+    #include <sys/socket.h>
+    #include <linux/errqueue.h>
+    int main(void) {
+      int flags = MSG_ZEROCOPY | MSG_ERRQUEUE;
+      int opt = SO_ZEROCOPY;
+      int origin = SO_EE_ORIGIN_ZEROCOPY;
+      return flags + opt + origin;
+    }
+  " have_msg_zerocopy)
+  cmake_reset_check_state()
+  
+  if(have_msg_zerocopy)
+    message(STATUS "Check if system supports MSG_ZEROCOPY - yes")
+  else()
+    message(STATUS "Check if system supports MSG_ZEROCOPY - no")
+  endif()
+  set(${result_var} ${have_msg_zerocopy} PARENT_SCOPE)
+  unset(have_msg_zerocopy CACHE)
+endfunction()
@@ -0,0 +1,30 @@
+include(CheckCSourceCompiles)
+include(CMakePushCheckState)
+
+function(test_reuseport_cbpf result_var)
+  message(STATUS "Check if system has SO_ATTACH_REUSEPORT_CBPF")
+  cmake_push_check_state(RESET)
+  set(CMAKE_REQUIRED_QUIET 1)
+  check_c_source_compiles("
+    #include <sys/socket.h>
+    #include <linux/filter.h>
+    #include <stddef.h>
+    int main(void) {
+      struct sock_filter code[] = {
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+        { BPF_RET | BPF_A, 0, 0, 0 }
+      };
+      struct sock_fprog prog = { .len = 2, .filter = code };
+      return setsockopt(0, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+    }
+  " have_reuseport_cbpf)
+  cmake_reset_check_state()
+  
+  if(have_reuseport_cbpf)
+    message(STATUS "Check if system has SO_ATTACH_REUSEPORT_CBPF - yes")
+  else()
+    message(STATUS "Check if system has SO_ATTACH_REUSEPORT_CBPF - no")
+  endif()
+  set(${result_var} ${have_reuseport_cbpf} PARENT_SCOPE)
+  unset(have_reuseport_cbpf CACHE)
+endfunction()
@@ -0,0 +1,26 @@
+include(CheckCSourceCompiles)
+include(CMakePushCheckState)
+
+function(test_sendfile result_var)
+  message(STATUS "Check if system has sendfile")
+  cmake_push_check_state(RESET)
+  set(CMAKE_REQUIRED_QUIET 1)
+  check_c_source_compiles("
+    #include <sys/sendfile.h>
+    #include <sys/types.h>
+    #include <stddef.h>
+    int main(void) {
+      off_t offset = 0;
+      return sendfile(1, 0, &offset, 1);
+    }
+  " have_sendfile)
+  cmake_reset_check_state()
+  
+  if(have_sendfile)
+    message(STATUS "Check if system has sendfile - yes")
+  else()
+    message(STATUS "Check if system has sendfile - no")
+  endif()
+  set(${result_var} ${have_sendfile} PARENT_SCOPE)
+  unset(have_sendfile CACHE)
+endfunction()
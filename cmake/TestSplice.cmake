@@ -0,0 +1,30 @@
+include(CheckCSourceCompiles)
+include(CMakePushCheckState)
+
+function(test_splice result_var)
+  message(STATUS "Check if system has splice")
+  cmake_push_check_state(RESET)
+  set(CMAKE_REQUIRED_QUIET 1)
+  check_c_source_compiles("
+    #define _GNU_SOURCE
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <stddef.h>
+    int main(void) {
+      int fds[2];
+      if(pipe2(fds, O_NONBLOCK | O_CLOEXEC) == -1) {
+        return 1;
+      }
+      return splice(0, NULL, fds[1], NULL, 1, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    }
+  " have_splice)
+  cmake_reset_check_state()
+  
+  if(have_splice)
+    message(STATUS "Check if system has splice - yes")
+  else()
+    message(STATUS "Check if system has splice - no")
+  endif()
+  set(${result_var} ${have_splice} PARENT_SCOPE)
+  unset(have_splice CACHE)
+endfunction()
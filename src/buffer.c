@@ -7,7 +7,10 @@ void shuso_buffer_init(shuso_t *S, shuso_buffer_t *buf, shuso_buffer_memory_type
     .first = NULL,
     .last = NULL,
     .memory_type = mtype,
-    .allocator_data = allocator_data
+    .allocator_data = allocator_data,
+    .read = {
+      .size = SHUSO_BUFFER_READ_SIZE_DEFAULT
+    }
   };
   
   switch(mtype) {
@@ -90,8 +93,10 @@ void shuso_buffer_free(shuso_t *S, shuso_buffer_t *buf, shuso_buffer_link_t *lin
     case SHUSO_BUF_SHARED:
       shuso_shared_slab_free(buf->shm, link);
       break;
-    case SHUSO_BUF_DEFAULT:
     case SHUSO_BUF_EXTERNAL:
+      //not ours to free. the cleanup callback was all there was to do
+      break;
+    case SHUSO_BUF_DEFAULT:
     case SHUSO_BUF_MMAPPED:
       //that makes no sense
       abort();
@@ -107,6 +112,8 @@ void shuso_buffer_queue(shuso_t *S, shuso_buffer_t *buf, shuso_buffer_link_t *li
     last->next = link;
   }
   buf->last = link;
+  //whatever was queued, it wasn't read into
+  buf->read.tail_slack = 0;
 }
 
 shuso_buffer_link_t *shuso_buffer_dequeue(shuso_t *S, shuso_buffer_t *buf) {
@@ -117,6 +124,7 @@ shuso_buffer_link_t *shuso_buffer_dequeue(shuso_t *S, shuso_buffer_t *buf) {
   buf->first = link->next;
   if(buf->last == link) {
     buf->last = NULL;
+    buf->read.tail_slack = 0;
   }
   return link;
 }
@@ -147,6 +155,100 @@ char *shuso_buffer_add_charbuf(shuso_t *S, shuso_buffer_t *buf, size_t len) {
   return charbuf;
 }
 
+int shuso_buffer_read_prepare(shuso_t *S, shuso_buffer_t *buf, struct iovec *iov) {
+  int                  iovcnt = 0;
+  size_t               size = buf->read.size;
+  shuso_buffer_link_t *link;
+  
+  assert(buf->memory_type != SHUSO_BUF_EXTERNAL);
+  if(size == 0) {
+    size = buf->read.size = SHUSO_BUFFER_READ_SIZE_DEFAULT;
+  }
+  buf->read.requested = 0;
+  
+  if(buf->read.tail_slack > 0) {
+    link = buf->last;
+    iov[iovcnt++] = (struct iovec ) {
+      .iov_base = &link->buf[link->len],
+      .iov_len = buf->read.tail_slack
+    };
+    buf->read.requested = buf->read.tail_slack;
+    if(buf->read.tail_slack >= size) {
+      //plenty of room left. no need for a fresh link
+      return iovcnt;
+    }
+  }
+  
+  if(!buf->read.fresh) {
+    if((link = shuso_buffer_allocate(S, buf, sizeof(*link) + size)) == NULL) {
+      return iovcnt;
+    }
+    *link = (shuso_buffer_link_t ) {
+      .buf = (void *)&link[1],
+      .len = size,
+      .data_type = SHUSO_BUF_CHARBUF,
+      .memory_type = SHUSO_BUF_DEFAULT,
+      .next = NULL
+    };
+    buf->read.fresh = link;
+  }
+  link = buf->read.fresh;
+  iov[iovcnt++] = (struct iovec ) {
+    .iov_base = link->buf,
+    .iov_len = link->len
+  };
+  buf->read.requested += link->len;
+  return iovcnt;
+}
+
+void shuso_buffer_read_commit(shuso_t *S, shuso_buffer_t *buf, ssize_t len) {
+  size_t               remaining = len > 0 ? (size_t )len : 0;
+  size_t               used;
+  size_t               capacity;
+  shuso_buffer_link_t *link;
+  
+  if(buf->read.tail_slack > 0 && remaining > 0) {
+    used = remaining < buf->read.tail_slack ? remaining : buf->read.tail_slack;
+    buf->last->len += used;
+    buf->read.tail_slack -= used;
+    remaining -= used;
+  }
+  
+  if(remaining > 0) {
+    link = buf->read.fresh;
+    assert(link && remaining <= link->len);
+    buf->read.fresh = NULL;
+    capacity = link->len;
+    link->len = remaining;
+    shuso_buffer_queue(S, buf, link);
+    buf->read.tail_slack = capacity - remaining;
+  }
+  //an unfilled fresh link is kept for the next read
+  
+  //grow the read size when reads fill up all the space they're given, shrink it when they use little of it
+  if(len > 0 && (size_t )len >= buf->read.requested) {
+    buf->read.size *= 2;
+    if(buf->read.size > SHUSO_BUFFER_READ_SIZE_MAX) {
+      buf->read.size = SHUSO_BUFFER_READ_SIZE_MAX;
+    }
+  }
+  else if(len > 0 && (size_t )len < buf->read.size / 4) {
+    buf->read.size /= 2;
+    if(buf->read.size < SHUSO_BUFFER_READ_SIZE_MIN) {
+      buf->read.size = SHUSO_BUFFER_READ_SIZE_MIN;
+    }
+  }
+  buf->read.requested = 0;
+}
+
+void shuso_buffer_read_finish(shuso_t *S, shuso_buffer_t *buf) {
+  shuso_buffer_link_t *link = buf->read.fresh;
+  if(link) {
+    buf->read.fresh = NULL;
+    shuso_buffer_free(S, buf, link);
+  }
+}
+
 struct iovec *shuso_buffer_add_iovec(shuso_t *S, shuso_buffer_t *buf, int iovcnt) {
   shuso_buffer_link_t *link;
   struct iovec        *iov;
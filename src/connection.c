@@ -0,0 +1,117 @@
+#include <shuttlesock.h>
+#include <shuttlesock/connection.h>
+
+static bool connection_slab_add(shuso_t *S) {
+  shuso_connection_slab_t *slab = malloc(sizeof(*slab));
+  if(!slab) {
+    return false;
+  }
+  slab->next = S->connections.slabs;
+  S->connections.slabs = slab;
+  for(unsigned i = 0; i < SHUSO_CONNECTION_SLAB_SIZE; i++) {
+    shuso_connection_t *c = &slab->connection[i];
+    c->S = S;
+    c->buf = NULL;
+    c->size = 0;
+    c->pool_level = 0; //pool's set up when it's first used
+    c->next = S->connections.free;
+    S->connections.free = c;
+  }
+  S->connections.free_count += SHUSO_CONNECTION_SLAB_SIZE;
+  return true;
+}
+
+shuso_connection_t *shuso_connection_create(shuso_t *S, const shuso_socket_t *socket) {
+  shuso_connection_t *c;
+  if(!S->connections.free && !connection_slab_add(S)) {
+    shuso_set_error(S, "failed to allocate connection");
+    return NULL;
+  }
+  c = S->connections.free;
+  if(c->pool_level == 0) {
+    if(!shuso_pool_init(&c->pool, SHUSO_CONNECTION_POOL_PAGE_SIZE) || (c->pool_level = shuso_pool_mark_level(&c->pool)) == 0) {
+      shuso_pool_empty(&c->pool);
+      shuso_set_error(S, "failed to allocate connection pool");
+      return NULL;
+    }
+  }
+  S->connections.free = c->next;
+  S->connections.free_count--;
+  c->next = NULL;
+
+  c->socket = *socket;
+  if(socket->host.sockaddr) {
+    c->sockaddr = *socket->host.sockaddr;
+    c->socket.host.sockaddr = &c->sockaddr;
+  }
+  shuso_timer_init(&c->timer, NULL, NULL);
+  c->data = NULL;
+  c->claimed = false;
+  return c;
+}
+
+bool shuso_connection_buffer_reserve(shuso_connection_t *c, size_t len, size_t want) {
+  size_t  size = c->size > 0 ? c->size : 1024;
+  char   *buf;
+  if(c->buf && c->size - len >= want) {
+    return true;
+  }
+  while(size - len < want) {
+    size *= 2;
+  }
+  if((buf = realloc(c->buf, size)) == NULL) {
+    return shuso_set_error(c->S, "failed to grow connection buffer to %zu bytes", size);
+  }
+  c->buf = buf;
+  c->size = size;
+  return true;
+}
+
+void shuso_connection_recycle(shuso_connection_t *c) {
+  shuso_t *S = c->S;
+  if(shuso_timer_active(&c->timer)) {
+    shuso_timer_stop(&S->timer_wheel, &c->timer);
+  }
+  shuso_pool_drain_to_level(&c->pool, c->pool_level);
+  if((c->pool_level = shuso_pool_mark_level(&c->pool)) == 0) {
+    //start over next time
+    shuso_pool_empty(&c->pool);
+  }
+  if(c->size > SHUSO_CONNECTION_MAX_KEPT_BUFFER_SIZE) {
+    free(c->buf);
+    c->buf = NULL;
+    c->size = 0;
+  }
+  c->data = NULL;
+  c->claimed = false;
+  c->next = S->connections.free;
+  S->connections.free = c;
+  S->connections.free_count++;
+}
+
+static void connection_release_timer(shuso_loop *loop, shuso_ev_timer *w, int events) {
+  shuso_connection_recycle(shuso_ev_data(w));
+}
+
+void shuso_connection_release(shuso_connection_t *c) {
+  shuso_ev_timer_init(c->S, &c->release, 0, 0, connection_release_timer, c);
+  shuso_ev_timer_start(c->S, &c->release);
+}
+
+void shuso_connections_free(shuso_t *S) {
+  shuso_connection_slab_t *slab, *next;
+  for(slab = S->connections.slabs; slab != NULL; slab = next) {
+    next = slab->next;
+    for(unsigned i = 0; i < SHUSO_CONNECTION_SLAB_SIZE; i++) {
+      shuso_connection_t *c = &slab->connection[i];
+      if(c->pool_level != 0) {
+        shuso_pool_empty(&c->pool);
+      }
+      free(c->buf);
+    }
+    free(slab);
+  }
+  S->connections.slabs = NULL;
+  S->connections.free = NULL;
+  S->connections.free_count = 0;
+}
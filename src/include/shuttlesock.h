@@ -12,11 +12,14 @@
 #include <sys/time.h>
 #include <shuttlesock/common.h>
 #include <shuttlesock/watchers.h>
+#include <shuttlesock/timer_wheel.h>
 #include <shuttlesock/io.h>
 #include <shuttlesock/sbuf.h>
 #include <shuttlesock/llist.h>
 #include <shuttlesock/ipc.h>
 #include <shuttlesock/pool.h>
+#include <shuttlesock/connection.h>
+#include <shuttlesock/upgrade.h>
 #include <shuttlesock/resolver.h>
 #include <shuttlesock/shared_slab.h>
 #include <shuttlesock/log.h>
@@ -32,12 +35,23 @@
 #include <liburing.h>
 #endif
 
+#define SHUTTLESOCK_LOOP_LAG_SAMPLE_INTERVAL 0.25
+
+//how busy a process is, for other processes to see
+typedef struct {
+  _Atomic(uint32_t)   connections; //accepted connections open in this process
+  _Atomic(uint32_t)   pending_handoffs; //connections handed off to this process that haven't arrived yet
+  _Atomic(uint32_t)   loop_lag_usec; //smoothed event loop lag
+  _Atomic(int)        handoff_fd_ref; //IPC fd receiver for connections handed off by other workers, 0 if none
+} shuso_process_load_t;
+
 typedef struct shuso_process_s {
   shuso_t                          *S;
   pid_t                             pid;
   pthread_t                         tid;
   int                               procnum;
   _Atomic(shuso_runstate_t)        *state;
+  shuso_process_load_t             *load;
   uint16_t                          generation;
   shuso_ipc_channel_shared_t        ipc;
 } shuso_process_t;
@@ -84,11 +98,13 @@ typedef struct shuso_config_s {
     }                   hosts;
   }                   resolver;
   size_t              shared_slab_size;
+  double              timer_resolution; //seconds per timer wheel tick
   const char         *username;
   const char         *groupname;
   uid_t               uid;
   gid_t               gid;
   int                 workers;
+  bool                worker_cpu_affinity; //pin each worker thread to its own CPU
 } shuso_config_t;
 
 typedef struct {
@@ -136,6 +152,7 @@ typedef struct shuso_common_s {
     int                 fd;
   }                   log;
   shuso_shared_slab_t shm;
+  shuso_upgrade_t     upgrade; //only relevant on master
   bool                master_has_root;
 } shuso_common_t;
 
@@ -164,14 +181,39 @@ typedef struct shuso_s {
       shuso_io_uring_handle_t    *tail;
     }                           sqe_request_queue;
     shuso_ev_io                 watcher;
+    int                         zerocopy_supported; //SHUSO_MAYBE until the ring's been probed for it
 #endif
   }                           io_uring;
+  struct {                  //io
+    shuso_io_pipe_t            *free_pipes; //idle pipes for splicing
+    unsigned                    free_pipes_count;
+    shuso_io_datagram_batch_t  *free_datagram_batches;
+    unsigned                    free_datagram_batches_count;
+    shuso_io_iovec_batch_t     *free_iovec_batches;
+    unsigned                    free_iovec_batches_count;
+    shuso_io_coalesce_t        *coalesce_queue; //staged writes to flush at the end of this loop iteration
+    ev_prepare                  coalesce_flush;
+    shuso_io_t                 *zerocopy_polled; //waiting on zero-copy completions
+    unsigned                    watcher_starts; //io watchers armed and disarmed, to keep an eye on epoll churn
+    unsigned                    watcher_stops;
+    ev_timer                    zerocopy_poll;
+  }                           io;
+  struct {                  //connections
+    shuso_connection_t         *free; //recycled connection objects
+    unsigned                    free_count;
+    shuso_connection_slab_t    *slabs;
+  }                           connections;
   shuso_common_t             *common;
   struct {                  //base_watchers
     shuso_ev_signal              signal[8];
     shuso_ev_child               child;
     LLIST_STRUCT(shuso_ev_timer) timer;
   }                           base_watchers;
+  shuso_timer_wheel_t         timer_wheel; //for lots of coarse timeouts
+  struct {                  //load
+    shuso_ev_timer              lag_sample;
+    ev_tstamp                   sampled_at;
+  }                           load;
   struct {
     lua_State                  *state;
     bool                        external;
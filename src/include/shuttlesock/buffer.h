@@ -7,6 +7,11 @@
 #include <sys/uio.h>
 #include <sys/socket.h>
 
+//reads into a buffer start at the default size, and adapt to recent reads within these bounds
+#define SHUSO_BUFFER_READ_SIZE_MIN 1024
+#define SHUSO_BUFFER_READ_SIZE_DEFAULT 4096
+#define SHUSO_BUFFER_READ_SIZE_MAX 65536
+
 typedef enum {
   SHUSO_BUF_MSGHDR = 0,
   SHUSO_BUF_IOVEC = 1,
@@ -54,6 +59,12 @@ typedef struct {
     shuso_shared_slab_t      *shm;
     void                     *allocator_data;
   };
+  struct {
+    shuso_buffer_link_t      *fresh; //charbuf link allocated for reading into, not yet queued. its len is its capacity
+    size_t                    tail_slack; //unused bytes at the end of the last link, left over from reading into it
+    size_t                    size; //next read size, adapted to recent reads
+    size_t                    requested; //bytes the pending read can take
+  }                           read;
 } shuso_buffer_t;
 
 typedef void shuso_buffer_link_cleanup_fn(shuso_t *, shuso_buffer_t *, shuso_buffer_link_t *, void *);
@@ -87,6 +98,14 @@ shuso_buffer_link_t *shuso_buffer_dequeue(shuso_t *S, shuso_buffer_t *buf);
 void *shuso_buffer_allocate(shuso_t *S, shuso_buffer_t *buf, size_t sz);
 void shuso_buffer_free(shuso_t *S, shuso_buffer_t *buf, shuso_buffer_link_t *);
 
+// Reading straight into the buffer chain: prepare fills iov with up to 2 entries -- the tail slack of
+// the last link, then a fresh link -- and returns the iovec count, or 0 on allocation failure.
+// Commit the number of bytes read (or <= 0 for none) to append them to the buffer.
+int shuso_buffer_read_prepare(shuso_t *S, shuso_buffer_t *buf, struct iovec *iov);
+void shuso_buffer_read_commit(shuso_t *S, shuso_buffer_t *buf, ssize_t len);
+// free the unused fresh link, if there is one. The rest of the buffer is untouched.
+void shuso_buffer_read_finish(shuso_t *S, shuso_buffer_t *buf);
+
 void shuso_buffer_link_init_msg(shuso_t *S, shuso_buffer_link_t *link, struct msghdr *, int flags);
 void shuso_buffer_link_init_charbuf(shuso_t *S, shuso_buffer_link_t *link, const char *charbuf, size_t len);
 void shuso_buffer_link_init_shuso_str(shuso_t *S, shuso_buffer_link_t *link, const shuso_str_t *str);
@@ -116,6 +116,9 @@ typedef struct shuso_hostinfo_s {
 typedef struct shuso_socket_s {
   int               fd;
   shuso_hostinfo_t  host;
+  bool              accepted; //an incoming connection. an io for it counts toward the process load until closed
+  struct ssl_st    *tls; //OpenSSL connection, once the TLS handshake is done
+  uint8_t           tls_offload; //SHUSO_IO_READ and/or SHUSO_IO_WRITE if the kernel does the TLS records that way (kTLS)
 } shuso_socket_t;
 
 typedef struct shuso_str_s {
@@ -0,0 +1,60 @@
+#ifndef SHUTTLESOCK_CONNECTION_H
+#define SHUTTLESOCK_CONNECTION_H
+
+#include <shuttlesock/common.h>
+#include <shuttlesock/watchers.h>
+#include <shuttlesock/timer_wheel.h>
+#include <shuttlesock/io.h>
+#include <shuttlesock/pool.h>
+
+// Connection objects, recycled through a per-worker free list. They're allocated a slab at a time, and keep
+// their pool's first page and their read buffer when recycled, so a worker that's been up for a while
+// accepts connections without calling malloc().
+
+//connection objects allocated at once when the free list runs out
+#define SHUSO_CONNECTION_SLAB_SIZE 64
+#define SHUSO_CONNECTION_POOL_PAGE_SIZE 4096
+//read buffers larger than this are freed instead of being kept for the next connection
+#define SHUSO_CONNECTION_MAX_KEPT_BUFFER_SIZE 65536
+
+struct shuso_connection_s {
+  shuso_t                    *S;
+  shuso_socket_t              socket; //host.sockaddr points at sockaddr
+  shuso_sockaddr_t            sockaddr;
+  shuso_io_t                  io; //for the owner to shuso_io_init()
+  shuso_pool_t                pool; //connection-scoped. emptied down to its first page when recycled
+  char                       *buf; //the owner's read buffer, reused by the next connection
+  size_t                      size;
+  shuso_timer_t               timer; //for the owner's timeouts, on the worker's timer wheel. stopped when recycled
+  void                       *data; //the owner's
+  bool                        claimed; //someone's keeping it past the accept event
+
+  //private
+  int                         pool_level;
+  shuso_ev_timer              release;
+  shuso_connection_t         *next; //in the free list
+};
+
+typedef struct shuso_connection_slab_s {
+  struct shuso_connection_slab_s *next;
+  shuso_connection_t          connection[SHUSO_CONNECTION_SLAB_SIZE];
+} shuso_connection_slab_t;
+
+// a connection object for the socket, which is copied (sockaddr and all). the fd now belongs to whoever
+// ends up owning the connection.
+shuso_connection_t *shuso_connection_create(shuso_t *S, const shuso_socket_t *socket);
+
+// make sure the read buffer has room for 'want' more bytes past 'len', growing it if it doesn't
+bool shuso_connection_buffer_reserve(shuso_connection_t *c, size_t len, size_t want);
+
+// recycle the connection at the end of this loop iteration. safe from the connection's own io coroutine.
+// the fd isn't closed, and any io on it has to be stopped already.
+void shuso_connection_release(shuso_connection_t *c);
+
+// recycle the connection right away. only for connections nothing's running on yet
+void shuso_connection_recycle(shuso_connection_t *c);
+
+// free all the worker's connection objects, used or not. for when the loop's gone
+void shuso_connections_free(shuso_t *S);
+
+#endif //SHUTTLESOCK_CONNECTION_H
@@ -2,21 +2,55 @@
 #define SHUTTLESOCK_IO_H
 
 #include <shuttlesock/common.h>
+#include <shuttlesock/buffer.h>
+#include <shuttlesock/timer_wheel.h>
 #include <sys/uio.h>
 #include <sys/socket.h>
 #include <unistd.h>
+#include <limits.h>
 
 #ifdef SHUTTLESOCK_HAVE_IO_URING
 #include <liburing.h>
 #endif
 
 typedef struct shuso_io_s shuso_io_t;
+typedef struct shuso_io_coalesce_s shuso_io_coalesce_t;
 
 typedef void shuso_io_fn(shuso_t *S, shuso_io_t *io);
 
 #define SHUSO_IO_READ 1
 #define SHUSO_IO_WRITE 2
 
+//writes smaller than this aren't worth the page-pinning and completion-tracking overhead of zero-copy sends
+#define SHUSO_IO_ZEROCOPY_DEFAULT_THRESHOLD 10240
+//with libev, zero-copy completions are picked up off the socket's error queue this often while an op waits on them
+#define SHUSO_IO_ZEROCOPY_POLL_INTERVAL 0.001
+
+//idle splice pipes kept around per worker
+#define SHUSO_IO_SPLICE_MAX_FREE_PIPES 16
+
+//datagram batches: slots per batch, and bytes per slot. longer datagrams are truncated (MSG_TRUNC in msg_flags)
+#define SHUSO_IO_DATAGRAM_BATCH_SIZE 32
+#define SHUSO_IO_DATAGRAM_SLOT_SIZE 2048
+//with UDP GRO, one slot receives a run of coalesced datagrams, up to the maximum UDP payload
+#define SHUSO_IO_DATAGRAM_GRO_SLOT_SIZE 65535
+//per-slot ancillary data space, enough for a UDP_GRO or UDP_SEGMENT cmsg
+#define SHUSO_IO_DATAGRAM_CONTROL_SIZE 32
+//idle datagram batches kept around per worker
+#define SHUSO_IO_DATAGRAM_MAX_FREE_BATCHES 4
+
+//iovecs gathered from a buffer chain per writev
+#ifdef IOV_MAX
+#define SHUSO_IO_IOVEC_BATCH_SIZE IOV_MAX
+#else
+#define SHUSO_IO_IOVEC_BATCH_SIZE 1024
+#endif
+//idle iovec batches kept around per worker
+#define SHUSO_IO_IOVEC_MAX_FREE_BATCHES 4
+
+//with write coalescing on, staged writes are flushed once they add up to this many bytes
+#define SHUSO_IO_COALESCE_DEFAULT_THRESHOLD 16384
+
 typedef enum {
   SHUSO_IO_OP_NONE = 0,
   SHUSO_IO_OP_READV,
@@ -32,9 +66,48 @@ typedef enum {
   SHUSO_IO_OP_ACCEPT,
   SHUSO_IO_OP_CONNECT,
   SHUSO_IO_OP_CLOSE,
-  SHUSO_IO_OP_SHUTDOWN
+  SHUSO_IO_OP_SHUTDOWN,
+  SHUSO_IO_OP_SPLICE,
+  SHUSO_IO_OP_SENDFILE,
+  SHUSO_IO_OP_RECVMMSG,
+  SHUSO_IO_OP_SENDMMSG
 } shuso_io_opcode_t;
 
+typedef struct shuso_io_pipe_s {
+  int                       fd[2];
+  struct shuso_io_pipe_s   *next;
+} shuso_io_pipe_t;
+
+//same layout as struct mmsghdr, which isn't visible without _GNU_SOURCE
+typedef struct {
+  struct msghdr             msg_hdr;
+  unsigned int              msg_len;
+} shuso_mmsghdr_t;
+
+typedef struct shuso_io_datagram_batch_s {
+  shuso_mmsghdr_t           msg[SHUSO_IO_DATAGRAM_BATCH_SIZE];
+  struct iovec              iov[SHUSO_IO_DATAGRAM_BATCH_SIZE];
+  shuso_sockaddr_t          addr[SHUSO_IO_DATAGRAM_BATCH_SIZE];
+  union {
+    char                      buf[SHUSO_IO_DATAGRAM_CONTROL_SIZE];
+    struct cmsghdr            align;
+  }                         control[SHUSO_IO_DATAGRAM_BATCH_SIZE];
+  size_t                    slot_size;
+  struct shuso_io_datagram_batch_s *next;
+  char                      buf[]; //SHUSO_IO_DATAGRAM_BATCH_SIZE slots of slot_size bytes
+} shuso_io_datagram_batch_t;
+
+typedef struct shuso_io_iovec_batch_s {
+  struct shuso_io_iovec_batch_s *next;
+  struct iovec              iov[SHUSO_IO_IOVEC_BATCH_SIZE];
+} shuso_io_iovec_batch_t;
+
+//one datagram inside a received (possibly GRO-coalesced) buffer
+typedef struct {
+  char                     *data;
+  size_t                    len;
+} shuso_io_datagram_view_t;
+
 typedef enum {
   SHUSO_IO_WATCH_NONE = 0,
   SHUSO_IO_WATCH_OP_FINISH,
@@ -42,6 +115,7 @@ typedef enum {
   SHUSO_IO_WATCH_POLL_READ,
   SHUSO_IO_WATCH_POLL_WRITE,
   SHUSO_IO_WATCH_POLL_READWRITE,
+  SHUSO_IO_WATCH_OP_ZEROCOPY_FINISH,
 } shuso_io_watch_type_t;
 
 #ifdef SHUTTLESOCK_HAVE_IO_URING
@@ -50,6 +124,8 @@ typedef struct {
   shuso_io_uring_handle_t   timeout_handle;
   shuso_io_uring_handle_t   cancel_handle;
   socklen_t                 addrlen;
+  struct msghdr             msg; //for recvfrom/sendto, which io_uring does with recvmsg/sendmsg
+  struct iovec              iov;
   struct __kernel_timespec  timeout;
   uint8_t                   sqe_opcode;
   uint8_t                   sqe_flags;
@@ -57,6 +133,7 @@ typedef struct {
   unsigned                  active:1;
   unsigned                  timeout_active:1;
   unsigned                  cancel_active:1;
+  unsigned                  zerocopy_finish_pending:1;
 } shuso_io_ioring_state_t;
 #endif
 
@@ -67,6 +144,7 @@ typedef struct shuso_io_s {
   union {
     struct msghdr    *msg;
     struct iovec     *iov;
+    shuso_mmsghdr_t  *mmsg;
     char             *buf;
     shuso_socket_t   *socket;
     shuso_hostinfo_t *hostinfo; 
@@ -81,10 +159,7 @@ typedef struct shuso_io_s {
     ssize_t           len;
     int               intdata;
   };
-  union {
-    int               flags; //needs to be separate because sendto/recvfrom takes flags _and_ a length
-    struct iovec     *incomplete_temporary_iovec; //used for writev/readv/sendmsg/recvmsg
-  };
+  int               flags; //needs to be separate because sendto/recvfrom takes flags _and_ a length
   union {
     ssize_t           result;
     int               result_fd;
@@ -105,14 +180,60 @@ typedef struct shuso_io_s {
 #endif
   };
   
+  struct {
+    struct shuso_io_s *dst; //io to splice into
+    shuso_io_pipe_t  *pipe; //holds bytes read from this io's socket that haven't been written to dst yet
+    size_t            buffered; //bytes in the pipe
+  }                 splice;
+  
+  struct {
+    int               fd; //file to send
+    off_t             offset; //where to send from next
+  }                 sendfile;
+  
+  struct {
+    struct iovec     *iov; //caller's iovec that was trimmed to resume a partial writev/readv/sendmsg/recvmsg
+    struct iovec      original; //its untrimmed value, restored when the op is done
+  }                 incomplete_iovec;
+  
+  struct {
+    shuso_buffer_t   *buffer; //buffer being read into
+    struct iovec      iov[2]; //its last link's tail slack, and a fresh link
+  }                 read_buffer;
+  
+  struct {
+    shuso_buffer_t   *buffer; //buffer being written out
+    shuso_io_iovec_batch_t *batch; //iovecs gathered from the buffer's first links
+    int               link_iov; //next iovec to write in the first link, if it's an iovec link
+    size_t            link_offset; //bytes already written from the first link's charbuf or current iovec
+  }                 write_buffer;
+  
+  shuso_io_coalesce_t *coalesce; //staged writes, when write coalescing is on
+  
+  shuso_timer_t     deadline; //on the worker's timer wheel
+  
+  struct {
+    uint32_t          threshold; //minimum write size to send with zero-copy
+    uint32_t          sent; //zero-copy sends issued to the kernel
+    uint32_t          completed; //zero-copy sends whose buffers the kernel is done with
+    struct shuso_io_s *next_polled; //in the worker's list of ios waiting on completions
+  }                 zerocopy;
+  
   uint8_t           opcode;
   uint8_t           watch_type;
   unsigned          readwrite:2;
   unsigned          use_io_uring:1;
+  unsigned          use_zerocopy:1;
+  unsigned          persistent_watch:1;
+  unsigned          deadline_expired:1;
+  unsigned          counted_connection:1;
   
   unsigned          op_again:1;
   unsigned          op_repeat_to_completion:1;
   unsigned          op_registered_memory_buffer:1;
+  unsigned          op_zerocopy:1;
+  unsigned          op_zerocopy_polled:1;
+  unsigned          op_tls_events:2; //readiness a TLS read or write is waiting on. it may need the other direction
   
 #ifdef SHUTTLESOCK_DEBUG_IO
   shuso_fn_debug_info_t runner;
@@ -180,6 +301,16 @@ void shuso_io_readv(shuso_io_t *io, struct iovec *iov, int iovcnt);
 void shuso_io_writev_partial(shuso_io_t *io, struct iovec *iov, int iovcnt);
 void shuso_io_readv_partial(shuso_io_t *io, struct iovec *iov, int iovcnt);
 
+// Read whatever's available (at least 1 byte, like a partial read) and append it to the buffer,
+// in memory from the buffer's allocator. The read size adapts to recent reads. io->result is the number
+// of bytes appended, 0 if the socket was closed for reading.
+void shuso_io_read_into_buffer(shuso_io_t *io, shuso_buffer_t *buf);
+
+// Write out the buffer's charbuf and iovec links, as many at a time as fit in one writev. Written links
+// are dequeued and freed (running their cleanup), so the buffer ends up empty, or starting with the
+// first msghdr link, which has to be sent with sendmsg. io->result is the number of bytes written.
+void shuso_io_write_buffer(shuso_io_t *io, shuso_buffer_t *buf);
+
 void shuso_io_write(shuso_io_t *io, const void *buf, size_t len);
 void shuso_io_read(shuso_io_t *io, void *buf, size_t len);
 
@@ -199,12 +330,86 @@ void shuso_io_connect(shuso_io_t *io);
 void shuso_io_accept(shuso_io_t *io, shuso_sockaddr_t *sockaddr_buffer, socklen_t socklen);
 void shuso_io_close(shuso_io_t *io);
 void shuso_io_shutdown(shuso_io_t *io, int rw);
+// stop counting an accepted connection toward the process load. closing the io does this already
+void shuso_io_forget_connection(shuso_io_t *io);
+// send a TLS close_notify if it can be sent right away, and free the socket's TLS state. closing the io does this already
+void shuso_io_tls_free(shuso_socket_t *sock);
 
 void shuso_io_sendmsg(shuso_io_t *io, struct msghdr *msg, int flags);
 void shuso_io_recvmsg(shuso_io_t *io, struct msghdr *msg, int flags);
 
+// Receive up to vlen datagrams in one go. io->result is the number of datagrams received,
+// and each one's length is in its msgvec[i].msg_len. Finishes as soon as there's at least one.
+void shuso_io_recvmmsg(shuso_io_t *io, shuso_mmsghdr_t *msgvec, unsigned int vlen, int flags);
+// Send vlen datagrams. io->result is the number of datagrams sent.
+void shuso_io_sendmmsg(shuso_io_t *io, shuso_mmsghdr_t *msgvec, unsigned int vlen, int flags);
+void shuso_io_sendmmsg_partial(shuso_io_t *io, shuso_mmsghdr_t *msgvec, unsigned int vlen, int flags);
+
+// Per-worker pool of datagram batches for recvmmsg/sendmmsg. slot_size is SHUSO_IO_DATAGRAM_SLOT_SIZE,
+// or SHUSO_IO_DATAGRAM_GRO_SLOT_SIZE for a GRO-enabled socket. An acquired batch is ready to receive into;
+// reset it before receiving into it again.
+shuso_io_datagram_batch_t *shuso_io_datagram_batch_acquire(shuso_t *S, size_t slot_size);
+void shuso_io_datagram_batch_reset(shuso_io_datagram_batch_t *batch);
+char *shuso_io_datagram_batch_slot(shuso_io_datagram_batch_t *batch, unsigned i);
+// Set up slot i to send len bytes (already in the slot) to 'to'. With a nonzero segment_size, the kernel
+// splits the slot into datagrams of segment_size bytes (UDP GSO).
+bool shuso_io_datagram_batch_prepare_send(shuso_io_datagram_batch_t *batch, unsigned i, size_t len, const shuso_sockaddr_t *to, uint16_t segment_size);
+void shuso_io_datagram_batch_release(shuso_t *S, shuso_io_datagram_batch_t *batch);
+void shuso_io_datagram_batches_free(shuso_t *S);
+
+shuso_io_iovec_batch_t *shuso_io_iovec_batch_acquire(shuso_t *S);
+void shuso_io_iovec_batch_release(shuso_t *S, shuso_io_iovec_batch_t *batch);
+void shuso_io_iovec_batches_free(shuso_t *S);
+
+// UDP segmentation offload. With GRO on, one received message may hold several datagrams from the same
+// peer; shuso_io_datagram_split() finds them without copying. Returns the number of datagrams in the message,
+// like snprintf() does with lengths: if that's more than max_views, only the first max_views were filled in,
+// and the rest of the datagrams start at views[max_views - 1].data + views[max_views - 1].len.
+bool shuso_io_set_udp_gro(shuso_io_t *io, bool enabled);
+bool shuso_io_set_udp_segment_size(shuso_io_t *io, uint16_t segment_size);
+unsigned shuso_io_datagram_split(const shuso_mmsghdr_t *msg, shuso_io_datagram_view_t *views, unsigned max_views);
+
 void shuso_io_suspend(shuso_io_t *io, void *);
 
+// Move up to len bytes from io's socket to dst's socket through a pipe, without copying them to userspace.
+// io->result is the number of bytes written to dst. If it's less than len for a non-partial splice, or 0 for
+// a partial one, io's socket was closed for reading -- shutting down dst for writing is up to the caller.
+void shuso_io_splice(shuso_io_t *io, shuso_io_t *dst, size_t len);
+void shuso_io_splice_partial(shuso_io_t *io, shuso_io_t *dst, size_t len);
+
+// Send up to len bytes from file_fd, starting at offset, to io's socket. io->result is the number of bytes sent,
+// which is less than len for a non-partial sendfile only if the file ended first.
+void shuso_io_sendfile(shuso_io_t *io, int file_fd, off_t offset, size_t len);
+void shuso_io_sendfile_partial(shuso_io_t *io, int file_fd, off_t offset, size_t len);
+
+shuso_io_pipe_t *shuso_io_splice_pipe_acquire(shuso_t *S);
+void shuso_io_splice_pipe_release(shuso_t *S, shuso_io_pipe_t *pipe, bool empty);
+void shuso_io_splice_pipes_free(shuso_t *S);
+
+// Zero-copy sends for large writes. Writes and sends of at least 'threshold' bytes are sent
+// without copying, and the coroutine is resumed only once the kernel is done with the buffer.
+// Returns false if zero-copy sends aren't supported for this socket.
+bool shuso_io_set_zerocopy(shuso_io_t *io, bool enabled, size_t threshold);
+
+// Give the io a deadline 'timeout' seconds from now, on the worker's timer wheel. When it goes off, the op
+// in progress fails with ETIMEDOUT, or if there isn't one, the next op does (except close). A timeout of 0
+// clears the deadline. Setting a new deadline replaces the old one.
+void shuso_io_set_deadline(shuso_io_t *io, ev_tstamp timeout);
+
+// Write coalescing, a sort of automatic TCP cork. Writes that fit in the 'threshold'-sized staging buffer
+// are copied there and complete right away; the staged bytes are written out together at the end of the
+// event loop iteration, or as soon as the buffer is full. Other writes, shutdown and close wait for the
+// staged bytes to be written first. An error from writing staged bytes is reported by the next op.
+// Returns false if the staging buffer couldn't be allocated.
+bool shuso_io_set_coalesce(shuso_io_t *io, bool enabled, size_t threshold);
+
+// Keep the io's watcher registered between ops instead of stopping it every time an op finishes.
+// Ops are always attempted right away, so this only saves watcher stops and restarts for ios that
+// go back to waiting often, like keepalive connections between requests. Whether that saves any
+// epoll_ctl calls is up to libev's backend; './test.sh strace' counts them. Going from waiting to
+// read to waiting to write still re-arms the watcher. Aborting the io turns this off. (libev only)
+void shuso_io_set_persistent_watch(shuso_io_t *io, bool enabled);
+
 void shuso_io_wait(shuso_io_t *io, int evflags);
 
 void shuso_io_close(shuso_io_t *io);
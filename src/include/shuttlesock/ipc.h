@@ -132,6 +132,8 @@ const shuso_ipc_handler_t *shuso_ipc_add_handler(shuso_t *S,  const char *name,
 
 
 bool shuso_ipc_send_fd(shuso_t *, shuso_process_t *, int fd, uintptr_t ref, void *pd);
+// same as shuso_ipc_send_fd, but the sender's copy of the fd is closed once it's been sent
+bool shuso_ipc_send_fd_and_close(shuso_t *, shuso_process_t *, int fd, uintptr_t ref, void *pd);
 
 //TODO: change to shuso_ipc_receive_fd_start with cleanup callback
 int shuso_ipc_receive_fd_start(shuso_t *S, const char *description, float timeout_sec, shuso_ipc_receive_fd_fn *callback, void *pd);
@@ -33,6 +33,8 @@ void shuso_system_initialize(void);
 
 int shuso_system_cores_online(void);
 bool shuso_system_thread_setname(const char *name);
+// pin the calling thread to one CPU
+bool shuso_system_thread_set_cpu(int cpu);
 
 const char *shuso_system_strsignal(int sig);
 const char *shuso_system_errnoname(int errno_);
@@ -0,0 +1,55 @@
+#ifndef SHUTTLESOCK_TIMER_WHEEL_H
+#define SHUTTLESOCK_TIMER_WHEEL_H
+
+#include <shuttlesock/common.h>
+#include <shuttlesock/watchers.h>
+#include <stdint.h>
+
+// A hierarchical timer wheel, for lots of coarse timers (connection timeouts and such) that are usually
+// cancelled before they expire. Starting and stopping a timer is O(1), and the whole wheel runs off one
+// ev_timer that ticks only while there are timers on the wheel.
+
+#define SHUSO_TIMER_WHEEL_LEVELS 4
+#define SHUSO_TIMER_WHEEL_SLOT_BITS 6
+#define SHUSO_TIMER_WHEEL_SLOTS (1 << SHUSO_TIMER_WHEEL_SLOT_BITS)
+#define SHUSO_TIMER_WHEEL_SLOT_MASK (SHUSO_TIMER_WHEEL_SLOTS - 1)
+//timers further out than this many ticks are parked in the last level until they get closer
+#define SHUSO_TIMER_WHEEL_MAX_TICKS (((uint64_t )1 << (SHUSO_TIMER_WHEEL_SLOT_BITS * SHUSO_TIMER_WHEEL_LEVELS)) - 1)
+
+#define SHUSO_TIMER_WHEEL_DEFAULT_RESOLUTION 0.1
+
+typedef struct shuso_timer_s shuso_timer_t;
+
+typedef void shuso_timer_fn(shuso_t *S, shuso_timer_t *timer, void *pd);
+
+typedef struct shuso_timer_s {
+  shuso_timer_t       *next;
+  shuso_timer_t      **pprev; //NULL when the timer isn't on the wheel
+  uint64_t             expires; //tick
+  shuso_timer_fn      *callback;
+  void                *pd;
+} shuso_timer_t;
+
+typedef struct {
+  shuso_t             *S;
+  shuso_ev_timer       tick;
+  ev_tstamp            resolution;
+  ev_tstamp            start; //loop time of tick 0
+  uint64_t             now; //last tick processed
+  size_t               count; //timers on the wheel
+  shuso_timer_t       *slot[SHUSO_TIMER_WHEEL_LEVELS][SHUSO_TIMER_WHEEL_SLOTS];
+} shuso_timer_wheel_t;
+
+void shuso_timer_wheel_init(shuso_t *S, shuso_timer_wheel_t *wheel, ev_tstamp resolution);
+// stops the tick and takes all remaining timers off the wheel, without running them
+void shuso_timer_wheel_shutdown(shuso_timer_wheel_t *wheel);
+
+void shuso_timer_init(shuso_timer_t *timer, shuso_timer_fn *callback, void *pd);
+// (re)start the timer to go off in 'after' seconds, rounded up to the wheel's resolution
+void shuso_timer_start(shuso_timer_wheel_t *wheel, shuso_timer_t *timer, ev_tstamp after);
+void shuso_timer_stop(shuso_timer_wheel_t *wheel, shuso_timer_t *timer);
+#define shuso_timer_active(timer) ((timer)->pprev != NULL)
+// seconds until the timer goes off, or -1 if it isn't active
+ev_tstamp shuso_timer_remaining(shuso_timer_wheel_t *wheel, shuso_timer_t *timer);
+
+#endif //SHUTTLESOCK_TIMER_WHEEL_H
@@ -0,0 +1,66 @@
+#ifndef SHUTTLESOCK_UPGRADE_H
+#define SHUTTLESOCK_UPGRADE_H
+
+#include <shuttlesock/common.h>
+#include <shuttlesock/watchers.h>
+
+// Live binary upgrades. The master re-executes the binary it was started from (which may have been replaced
+// since) with the same arguments, and passes the new master the fds it keeps -- the listening sockets -- over
+// SCM_RIGHTS. The new generation starts up with those instead of opening its own, and once it's running, the
+// old generation stops gracefully. The listening sockets stay open all along, so connections just wait in their
+// accept queues while the workers change over.
+
+//where the new master finds its channel to the old one, and its generation number
+#define SHUTTLESOCK_UPGRADE_FD_ENV "SHUTTLESOCK_UPGRADE_FD"
+#define SHUTTLESOCK_UPGRADE_GENERATION_ENV "SHUTTLESOCK_GENERATION"
+//the new generation has this long to start up, or it's killed and the old one keeps going
+#define SHUTTLESOCK_UPGRADE_TIMEOUT 60.0
+#define SHUTTLESOCK_UPGRADE_MAX_ID_LENGTH 255
+
+typedef struct {
+  char                 *id;
+  int                   fd;
+} shuso_upgrade_fd_t;
+
+typedef struct {
+  shuso_upgrade_fd_t   *array;
+  size_t                count;
+} shuso_upgrade_fds_t;
+
+//the generation number is in shuso_process_t
+typedef struct {
+  shuso_upgrade_fds_t   kept; //for the next generation
+  shuso_upgrade_fds_t   inherited; //from the previous generation, not yet taken
+  int                   previous_fd; //channel to the previous generation's master until this one's running, -1 if none
+  struct {
+    pid_t                 pid;
+    int                   fd;
+    shuso_ev_io           watcher;
+    shuso_ev_timer        timeout;
+  }                     next; //the next generation, while it's starting up
+} shuso_upgrade_t;
+
+// start the next generation. master only. the current one keeps running until the next one says it's ready.
+bool shuso_upgrade_start(shuso_t *S);
+
+// tell the previous generation that this one's running, so that it can stop. any fds it handed over that weren't
+// taken are closed. does nothing if this generation wasn't started by an upgrade.
+bool shuso_upgrade_finish(shuso_t *S);
+
+// hand an fd over to the next generation, when there is one. the master keeps it open until it exits.
+bool shuso_upgrade_keep_fd(shuso_t *S, const char *id, int fd);
+
+// take one of the fds the previous generation kept with this id. -1 if there's none (left).
+int shuso_upgrade_take_inherited_fd(shuso_t *S, const char *id);
+
+// the handover itself: send the kept fds, or receive them into the inherited ones. both block until they're done.
+bool shuso_upgrade_send_fds(shuso_t *S, int fd);
+bool shuso_upgrade_receive_fds(shuso_t *S, int fd);
+
+// pick up the previous generation's fds and generation number, if this process was started by an upgrade
+bool shuso_upgrade_inherit(shuso_t *S);
+
+// close all the kept and inherited fds, and give up on any upgrade in progress
+void shuso_upgrade_cleanup(shuso_t *S);
+
+#endif //SHUTTLESOCK_UPGRADE_H
@@ -1,5 +1,5 @@
 #include <shuttlesock/build_config.h>
-#ifdef SHUTTLESOCK_HAVE_ACCEPT4
+#if defined(SHUTTLESOCK_HAVE_ACCEPT4) || defined(SHUTTLESOCK_HAVE_SPLICE) || defined(SHUTTLESOCK_HAVE_MMSG)
 #ifndef _GNU_SOURCE
 #define _GNU_SOURCE
 #endif
@@ -7,6 +7,8 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <netinet/udp.h>
 
 #include <shuttlesock.h>
 #include <errno.h>
@@ -14,6 +16,8 @@
 #ifdef SHUTTLESOCK_HAVE_IO_URING
 #include <liburing.h>
 #endif
+#include <openssl/ssl.h>
+#include <openssl/err.h>
 
 #include "io_private.h"
 #include "io_libev.h"
@@ -43,11 +47,14 @@ static char *shuso_io_watch_type_str(shuso_io_watch_type_t watchtype) {
     case SHUSO_IO_WATCH_POLL_READ:  return "poll_read";
     case SHUSO_IO_WATCH_POLL_WRITE: return "poll_write";
     case SHUSO_IO_WATCH_POLL_READWRITE: return "poll_readwrite";
+    case SHUSO_IO_WATCH_OP_ZEROCOPY_FINISH: return "op_zerocopy_finish";
   }
   return "???";
 }
 */
 
+static void io_deadline_handler(shuso_t *S, shuso_timer_t *timer, void *pd);
+
 void __shuso_io_init_socket(shuso_t *S, shuso_io_t *io, shuso_socket_t *sock, int readwrite, shuso_io_fn *coro, void *privdata) {
   assert(readwrite == SHUSO_IO_READ || readwrite == SHUSO_IO_WRITE || readwrite == (SHUSO_IO_READ | SHUSO_IO_WRITE));
   *io = (shuso_io_t ){
@@ -64,10 +71,28 @@ void __shuso_io_init_socket(shuso_t *S, shuso_io_t *io, shuso_socket_t *sock, in
     .watch_type = SHUSO_IO_WATCH_NONE,
     .error = 0,
     .closed = 0,
-    .readwrite = readwrite
+    .readwrite = readwrite,
+    .zerocopy = {
+      .threshold = SHUSO_IO_ZEROCOPY_DEFAULT_THRESHOLD,
+      .sent = 0,
+      .completed = 0
+    },
+    .use_zerocopy = 0,
+    .persistent_watch = 0,
+    .deadline_expired = 0,
+    .counted_connection = 0
   };
+  shuso_timer_init(&io->deadline, io_deadline_handler, io);
   if(sock) {
     io->io_socket = *sock;
+    if(sock->tls) {
+      //OpenSSL may have to do the reading and writing, and it needs to say goodbye when the socket's closed
+      io->use_io_uring = 0;
+    }
+    if(sock->accepted && S->process && S->process->load) {
+      atomic_fetch_add(&S->process->load->connections, 1);
+      io->counted_connection = 1;
+    }
   }
   
   if(io->use_io_uring) {
@@ -99,6 +124,36 @@ static void shuso_io_watch_update(shuso_io_t *io) {
   }
 }
 
+static void io_deadline_handler(shuso_t *S, shuso_timer_t *timer, void *pd) {
+  shuso_io_t *io = pd;
+  if(io->watch_type == SHUSO_IO_WATCH_NONE || io->use_io_uring) {
+    //nothing's waiting on the socket (or it's an io_uring op that can't be cancelled yet). the next op gets the timeout
+    io->deadline_expired = 1;
+    return;
+  }
+  if(io->watch_type == SHUSO_IO_WATCH_OP_ZEROCOPY_FINISH) {
+    //the kernel still has the buffer, so the op can't be let go of yet. it times out once the completions are in
+    io->deadline_expired = 1;
+    return;
+  }
+  shuso_io_op_cleanup(io);
+  io->watch_type = SHUSO_IO_WATCH_NONE;
+  shuso_io_watch_update(io);
+  io->result = -1;
+  io->error = ETIMEDOUT;
+  shuso_io_run_handler(io);
+}
+
+void shuso_io_set_deadline(shuso_io_t *io, ev_tstamp timeout) {
+  io->deadline_expired = 0;
+  if(timeout > 0) {
+    shuso_timer_start(&io->S->timer_wheel, &io->deadline, timeout);
+  }
+  else {
+    shuso_timer_stop(&io->S->timer_wheel, &io->deadline);
+  }
+}
+
 void shuso_io_run_handler(shuso_io_t *io) {
   if(io->error_handler && io->result == -1) {
     io->handler_stage = 0;
@@ -132,69 +187,46 @@ void shuso_io_resume_data(shuso_io_t *io, void *data, int intdata) {
   shuso_io_run_handler(io);
 }
 
-/*
 static size_t iovec_size(const struct iovec *iov, size_t iovcnt) {
   size_t sz = 0;
   for(size_t i=0; i<iovcnt; i++) {
-    sz += iov->iov_len;
+    sz += iov[i].iov_len;
   }
   return sz;
 }
-*/
 
-static bool io_iovec_update_on_incomplete_op(shuso_io_t *io, struct iovec **iovptr, size_t *iovcnt_ptr, size_t iovcnt_offset, size_t iov_start_offset) {
-  if(iov_start_offset == 0) {
-    if(!io->incomplete_original_iovec) {
-      io->incomplete_original_iovec = *iovptr;
-    }
-    assert(*iovcnt_ptr > iovcnt_offset);
-    *iovptr = &(*iovptr)[iovcnt_offset];
-    *iovcnt_ptr -= iovcnt_offset;
+static void io_iovec_restore_trimmed(shuso_io_t *io) {
+  if(io->incomplete_iovec.iov) {
+    *io->incomplete_iovec.iov = io->incomplete_iovec.original;
+    io->incomplete_iovec.iov = NULL;
   }
-  else {
-    if(!io->incomplete_temporary_iovec) {
-      ssize_t iovcnt = *iovcnt_ptr;
-      ssize_t new_iovcnt = iovcnt - iovcnt_offset;
-      assert(iovcnt > 0);
-      assert(new_iovcnt > 0);
-      assert(iovcnt + iovcnt_offset > 0);
-      struct iovec *iov = *iovptr;
-      struct iovec *tmp_iov = malloc(sizeof(*tmp_iov) * (size_t)new_iovcnt);
-      if(tmp_iov == NULL) {
-        io->error = errno;
-        io->result = -1;
-        return false;
-      }
+}
 
-      for(unsigned i = 0; i < iovcnt + iovcnt_offset; i++) {
-        tmp_iov[i] = iov[i+iovcnt_offset];
-      }
-      assert(tmp_iov[0].iov_len > iov_start_offset);
-      tmp_iov[0].iov_len -= iov_start_offset;
-      tmp_iov[0].iov_base = &((char *)tmp_iov[0].iov_base)[iov_start_offset];
-      
-      io->incomplete_temporary_iovec = tmp_iov;
-      if(!io->incomplete_original_iovec) {
-        io->incomplete_original_iovec = *iovptr;
-      }
-      assert(*iovcnt_ptr > iovcnt_offset);
-      *iovcnt_ptr -= iovcnt_offset;
-      *iovptr = tmp_iov;
-    }
-    else {
-      assert(io->incomplete_original_iovec != NULL);
-      struct iovec *iov = *iovptr;
-      assert(iov[iovcnt_offset].iov_len > iov_start_offset);
-      assert(*iovcnt_ptr > iovcnt_offset);
-      *iovptr = &iov[iovcnt_offset];
-      *iovcnt_ptr -= iovcnt_offset;
+static void io_iovec_update_on_incomplete_op(shuso_io_t *io, struct iovec **iovptr, size_t *iovcnt_ptr, size_t iovcnt_offset, size_t iov_start_offset) {
+  //trims the caller's iovec in-place rather than copying the remainder somewhere, so that a partial op never allocates.
+  //the one trimmed iovec is saved in the io struct and put back when the op is done.
+  struct iovec *iov = &(*iovptr)[iovcnt_offset];
+  assert(*iovcnt_ptr > iovcnt_offset);
+  if(!io->incomplete_original_iovec) {
+    io->incomplete_original_iovec = *iovptr;
+  }
+  if(iov_start_offset > 0) {
+    if(io->incomplete_iovec.iov != iov) {
+      //any previously trimmed iovec has been completely written by now
+      io_iovec_restore_trimmed(io);
+      io->incomplete_iovec.iov = iov;
+      io->incomplete_iovec.original = *iov;
     }
+    assert(iov->iov_len > iov_start_offset);
+    iov->iov_base = &((char *)iov->iov_base)[iov_start_offset];
+    iov->iov_len -= iov_start_offset;
   }
-  return true;
+  *iovptr = iov;
+  *iovcnt_ptr -= iovcnt_offset;
 }
 
 static bool io_iovec_op_update_and_check_completion(shuso_io_t *io, struct iovec **iov_ptr, size_t *iovcnt_ptr, ssize_t written) {
-  //returns true if operation is complete (no more iovec to write, or there's an error)
+  //returns true if operation is complete (no more iovec to write)
   size_t         written_unaccounted_for = written;
   size_t         iovcnt = *iovcnt_ptr;
   size_t         i;
@@ -203,27 +235,103 @@ static bool io_iovec_op_update_and_check_completion(shuso_io_t *io, struct iovec
     size_t len = iov[i].iov_len;
     if(written_unaccounted_for < len) {
       //ended in the middle of an iovec
-      if(!io_iovec_update_on_incomplete_op(io, iov_ptr, iovcnt_ptr, i, written_unaccounted_for)) {
-        assert(io->error != 0);
-        return true; //finished with error
-      }
+      io_iovec_update_on_incomplete_op(io, iov_ptr, iovcnt_ptr, i, written_unaccounted_for);
       return false;
     }
     else {
       written_unaccounted_for -= len;
     }
   }
-  if(written_unaccounted_for > 0) {
+  while(i < iovcnt && iov[i].iov_len == 0) {
+    i++;
+  }
+  if(i < iovcnt) {
     //ended between iovecs
-    if(!io_iovec_update_on_incomplete_op(io, iov_ptr, iovcnt_ptr, i, 0)) {
-      assert(io->error != 0);
-      return true; //finished with error
-    }
+    io_iovec_update_on_incomplete_op(io, iov_ptr, iovcnt_ptr, i, 0);
     return false;
   }
   return true;
 }
 
+static void io_write_buffer_gather(shuso_io_t *io) {
+  shuso_buffer_t      *buf = io->write_buffer.buffer;
+  struct iovec        *iov = io->write_buffer.batch->iov;
+  size_t               n = 0;
+  size_t               skip;
+  shuso_buffer_link_t *link;
+  
+  for(link = buf->first; link != NULL && n < SHUSO_IO_IOVEC_BATCH_SIZE; link = link->next) {
+    if(link->data_type == SHUSO_BUF_CHARBUF) {
+      skip = link == buf->first ? io->write_buffer.link_offset : 0;
+      if(link->len > skip) {
+        iov[n++] = (struct iovec ) {.iov_base = &link->buf[skip], .iov_len = link->len - skip};
+      }
+    }
+    else if(link->data_type == SHUSO_BUF_IOVEC) {
+      for(int i = link == buf->first ? io->write_buffer.link_iov : 0; i < link->iovcnt && n < SHUSO_IO_IOVEC_BATCH_SIZE; i++) {
+        skip = (link == buf->first && i == io->write_buffer.link_iov) ? io->write_buffer.link_offset : 0;
+        if(link->iov[i].iov_len > skip) {
+          iov[n++] = (struct iovec ) {.iov_base = &((char *)link->iov[i].iov_base)[skip], .iov_len = link->iov[i].iov_len - skip};
+        }
+      }
+    }
+    else {
+      //msghdrs may carry ancillary data, and need a sendmsg of their own
+      break;
+    }
+  }
+  io->iov = iov;
+  io->iovcnt = n;
+}
+
+static void io_write_buffer_link_done(shuso_io_t *io) {
+  shuso_buffer_t      *buf = io->write_buffer.buffer;
+  shuso_buffer_link_t *link = shuso_buffer_dequeue(io->S, buf);
+  shuso_buffer_free(io->S, buf, link);
+  io->write_buffer.link_iov = 0;
+  io->write_buffer.link_offset = 0;
+}
+
+static bool io_write_buffer_update_and_check_completion(shuso_io_t *io, size_t written) {
+  //returns true if there's nothing left to write
+  shuso_buffer_t      *buf = io->write_buffer.buffer;
+  shuso_buffer_link_t *link;
+  size_t               remaining;
+  
+  while((link = buf->first) != NULL) {
+    if(link->data_type == SHUSO_BUF_CHARBUF) {
+      remaining = link->len - io->write_buffer.link_offset;
+      if(written < remaining) {
+        io->write_buffer.link_offset += written;
+        break;
+      }
+      written -= remaining;
+      io_write_buffer_link_done(io);
+    }
+    else if(link->data_type == SHUSO_BUF_IOVEC) {
+      while(io->write_buffer.link_iov < link->iovcnt) {
+        remaining = link->iov[io->write_buffer.link_iov].iov_len - io->write_buffer.link_offset;
+        if(written < remaining) {
+          break;
+        }
+        written -= remaining;
+        io->write_buffer.link_iov++;
+        io->write_buffer.link_offset = 0;
+      }
+      if(io->write_buffer.link_iov < link->iovcnt) {
+        io->write_buffer.link_offset += written;
+        break;
+      }
+      io_write_buffer_link_done(io);
+    }
+    else {
+      break;
+    }
+  }
+  io_write_buffer_gather(io);
+  return io->iovcnt == 0;
+}
+
 bool shuso_io_op_update_and_check_completion(shuso_io_t *io, ssize_t result_sz) {
   size_t  iovcnt;
   bool    ret;
@@ -246,13 +354,37 @@ bool shuso_io_op_update_and_check_completion(shuso_io_t *io, ssize_t result_sz)
       assert(io->len >= 0);
       return io->len == 0;
       
-    case SHUSO_IO_OP_READV:
     case SHUSO_IO_OP_WRITEV:
+      if(io->write_buffer.buffer) {
+        return io_write_buffer_update_and_check_completion(io, result_sz);
+      }
+      //fallthrough
+    case SHUSO_IO_OP_READV:
       iovcnt = io->iovcnt;
       ret = io_iovec_op_update_and_check_completion(io, &io->iov, &iovcnt, result_sz);
       io->iovcnt = iovcnt;
       return ret;
       
+    case SHUSO_IO_OP_SENDFILE:
+      //the file offset is advanced by sendfile() itself
+      io->len -= result_sz;
+      assert(io->len >= 0);
+      return io->len == 0;
+    
+    case SHUSO_IO_OP_SPLICE:
+      //the backends keep track of this one themselves
+      return true;
+    
+    case SHUSO_IO_OP_RECVMMSG:
+      //any number of datagrams is a complete receive
+      return true;
+    
+    case SHUSO_IO_OP_SENDMMSG:
+      io->mmsg = &io->mmsg[result_sz];
+      io->len -= result_sz;
+      assert(io->len >= 0);
+      return io->len == 0;
+      
     case SHUSO_IO_OP_RECVMSG:
     case SHUSO_IO_OP_SENDMSG:
       iovcnt = (size_t )io->msg->msg_iovlen;
@@ -280,9 +412,36 @@ socklen_t shuso_io_af_sockaddrlen(sa_family_t fam) {
   return 0;
 }
 
+void shuso_io_forget_connection(shuso_io_t *io) {
+  if(io->counted_connection) {
+    atomic_fetch_sub(&io->S->process->load->connections, 1);
+    io->counted_connection = 0;
+  }
+}
+
+void shuso_io_tls_free(shuso_socket_t *sock) {
+  if(!sock->tls) {
+    return;
+  }
+  //one try, no waiting around. the socket's about to be closed anyway
+  ERR_clear_error();
+  if(SSL_is_init_finished(sock->tls)) {
+    SSL_shutdown(sock->tls);
+  }
+  ERR_clear_error();
+  SSL_free(sock->tls);
+  sock->tls = NULL;
+  sock->tls_offload = 0;
+}
+
 void shuso_io_update_fd_closed_status_from_op_result(shuso_io_t *io, shuso_io_opcode_t op, int result) {
 //if we got a 0 from a read or write operation, mark this thing closed
   switch(op) {
+    case SHUSO_IO_OP_CLOSE:
+      if(result == 0) {
+        shuso_io_forget_connection(io);
+      }
+      break;
     case SHUSO_IO_OP_READ:
     case SHUSO_IO_OP_READV:
     case SHUSO_IO_OP_RECVFROM:
@@ -319,17 +478,390 @@ void shuso_io_op_cleanup(shuso_io_t *io) {
     case SHUSO_IO_OP_WRITEV:
     case SHUSO_IO_OP_SENDMSG:
     case SHUSO_IO_OP_RECVMSG:
-      if(io->incomplete_temporary_iovec) {
-        free(io->incomplete_temporary_iovec);
-        io->incomplete_temporary_iovec = NULL;
+      io_iovec_restore_trimmed(io);
+      if(io->write_buffer.buffer) {
+        shuso_io_iovec_batch_release(io->S, io->write_buffer.batch);
+        io->write_buffer.buffer = NULL;
+        io->write_buffer.batch = NULL;
+      }
+      if(io->read_buffer.buffer) {
+        shuso_buffer_read_commit(io->S, io->read_buffer.buffer, io->result);
+        io->read_buffer.buffer = NULL;
+      }
+      break;
+    case SHUSO_IO_OP_SPLICE:
+    case SHUSO_IO_OP_SENDFILE:
+      if(io->splice.pipe) {
+        shuso_io_splice_pipe_release(io->S, io->splice.pipe, io->splice.buffered == 0);
+        io->splice.pipe = NULL;
+        io->splice.buffered = 0;
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+void shuso_io_set_persistent_watch(shuso_io_t *io, bool enabled) {
+  io->persistent_watch = enabled;
+  if(!enabled) {
+    //stop the watcher if it was only left running because it was persistent
+    shuso_io_watch_update(io);
+  }
+}
+
+static bool io_op_use_zerocopy(shuso_io_t *io) {
+  if(!io->use_zerocopy) {
+    return false;
+  }
+  switch((shuso_io_opcode_t )io->opcode) {
+    case SHUSO_IO_OP_WRITE:
+    case SHUSO_IO_OP_SEND:
+      return (size_t )io->len >= io->zerocopy.threshold;
+    case SHUSO_IO_OP_WRITEV:
+      if(io->write_buffer.buffer) {
+        //written links are freed right away, before the kernel would be done with them
+        return false;
+      }
+      return iovec_size(io->iov, io->iovcnt) >= io->zerocopy.threshold;
+    case SHUSO_IO_OP_SENDMSG:
+      return iovec_size(io->msg->msg_iov, io->msg->msg_iovlen) >= io->zerocopy.threshold;
+    default:
+      return false;
+  }
+}
+
+bool shuso_io_set_zerocopy(shuso_io_t *io, bool enabled, size_t threshold) {
+  bool ok;
+  if(enabled && io->io_socket.tls && !(io->io_socket.tls_offload & SHUSO_IO_WRITE)) {
+    //OpenSSL encrypts into its own buffers
+    ok = false;
+  }
+  else if(io->use_io_uring) {
+    ok = shuso_io_uring_set_zerocopy(io, enabled);
+  }
+  else {
+    ok = shuso_io_ev_set_zerocopy(io, enabled);
+  }
+  if(!ok) {
+    io->use_zerocopy = 0;
+    return false;
+  }
+  io->use_zerocopy = enabled;
+  io->zerocopy.threshold = threshold > UINT32_MAX ? UINT32_MAX : threshold;
+  return true;
+}
+
+struct shuso_io_coalesce_s {
+  shuso_io_t                 *io;
+  struct shuso_io_coalesce_s *next; //in the worker's queue of stages to flush at the end of the loop iteration
+  shuso_ev_io                 watcher; //waits for the socket to be writable again after an incomplete flush
+  size_t                      threshold;
+  size_t                      start; //bytes already flushed from the front of buf
+  size_t                      len; //bytes staged, flushed or not
+  int                         error; //from a failed flush, reported by the next op
+  unsigned                    queued:1;
+  unsigned                    disabled:1;
+  struct io_coalesce_deferred_s {
+    unsigned                    pending:1;
+    unsigned                    partial:1;
+    unsigned                    registered:1;
+    uint8_t                     opcode;
+    void                       *ptr;
+    ssize_t                     len;
+  }                           deferred; //op waiting for the staged bytes to be flushed first
+  char                        buf[];
+};
+
+static void io_op_run_new(shuso_io_t *io, shuso_io_opcode_t opcode, void *init_ptr, ssize_t init_len, bool partial, bool registered);
+
+static bool io_coalesce_flush(shuso_io_coalesce_t *co) {
+  //returns true when there's nothing left to flush
+  ssize_t n;
+  while(co->start < co->len) {
+    n = write(co->io->io_socket.fd, &co->buf[co->start], co->len - co->start);
+    if(n == -1) {
+      if(errno == EINTR) {
+        continue;
+      }
+      if(errno == EAGAIN || errno == EWOULDBLOCK) {
+        return false;
       }
+      co->error = errno;
       break;
+    }
+    co->start += n;
+  }
+  co->start = 0;
+  co->len = 0;
+  return true;
+}
+
+static void io_coalesce_unqueue(shuso_t *S, shuso_io_coalesce_t *co) {
+  shuso_io_coalesce_t **cur;
+  if(!co->queued) {
+    return;
+  }
+  for(cur = &S->io.coalesce_queue; *cur != NULL; cur = &(*cur)->next) {
+    if(*cur == co) {
+      *cur = co->next;
+      break;
+    }
+  }
+  co->queued = 0;
+  co->next = NULL;
+}
+
+static void io_coalesce_free(shuso_io_t *io) {
+  shuso_io_coalesce_t *co = io->coalesce;
+  io_coalesce_unqueue(io->S, co);
+  if(shuso_ev_active(&co->watcher)) {
+    shuso_ev_stop(io->S, &co->watcher);
+  }
+  io->coalesce = NULL;
+  free(co);
+}
+
+static void io_coalesce_drained(shuso_io_coalesce_t *co) {
+  shuso_io_t *io = co->io;
+  struct io_coalesce_deferred_s deferred = co->deferred;
+  co->deferred.pending = 0;
+  if(co->disabled && co->error == 0) {
+    io_coalesce_free(io);
+  }
+  if(deferred.pending) {
+    //the replayed op picks up any flush error
+    io_op_run_new(io, deferred.opcode, deferred.ptr, deferred.len, deferred.partial, deferred.registered);
+  }
+}
+
+static void io_coalesce_watcher_handler(shuso_loop *loop, shuso_ev_io *w, int evflags) {
+  shuso_io_coalesce_t *co = shuso_ev_data(w);
+  if(io_coalesce_flush(co)) {
+    shuso_ev_stop(co->io->S, w);
+    io_coalesce_drained(co);
+  }
+}
+
+static void io_coalesce_wait(shuso_io_coalesce_t *co) {
+  if(!shuso_ev_active(&co->watcher)) {
+    //the socket may have been opened after coalescing was turned on
+    ev_io_set(&co->watcher.ev, co->io->io_socket.fd, EV_WRITE);
+    shuso_ev_start(co->io->S, &co->watcher);
+  }
+}
+
+static void io_coalesce_flush_or_wait(shuso_io_coalesce_t *co) {
+  if(io_coalesce_flush(co)) {
+    io_coalesce_drained(co);
+  }
+  else {
+    io_coalesce_wait(co);
+  }
+}
+
+static void io_coalesce_prepare_handler(struct ev_loop *loop, ev_prepare *w, int evflags) {
+  shuso_t             *S = w->data;
+  shuso_io_coalesce_t *co, *next;
+  //flushing may resume coroutines that stage more writes, so keep going until nothing's queued
+  while((co = S->io.coalesce_queue) != NULL) {
+    S->io.coalesce_queue = NULL;
+    for(; co != NULL; co = next) {
+      next = co->next;
+      co->next = NULL;
+      co->queued = 0;
+      io_coalesce_flush_or_wait(co);
+    }
+  }
+  ev_prepare_stop(loop, w);
+}
+
+static void io_coalesce_queue(shuso_io_coalesce_t *co) {
+  shuso_t *S = co->io->S;
+  if(co->queued) {
+    return;
+  }
+  co->queued = 1;
+  co->next = S->io.coalesce_queue;
+  S->io.coalesce_queue = co;
+  if(!ev_is_active(&S->io.coalesce_flush)) {
+    ev_prepare_init(&S->io.coalesce_flush, io_coalesce_prepare_handler);
+    S->io.coalesce_flush.data = S;
+    ev_prepare_start(S->ev.loop, &S->io.coalesce_flush);
+  }
+}
+
+static size_t io_coalesce_stageable_size(shuso_io_t *io, shuso_io_opcode_t opcode, void *init_ptr, ssize_t init_len) {
+  //returns 0 if the op's data can't be staged
+  switch(opcode) {
+    case SHUSO_IO_OP_WRITE:
+      return init_len;
+    case SHUSO_IO_OP_SEND:
+      return (io->flags & ~(MSG_NOSIGNAL | MSG_DONTWAIT | MSG_MORE)) == 0 ? (size_t )init_len : 0;
+    case SHUSO_IO_OP_WRITEV:
+      //buffer chain writes free links as they're written, so they don't get staged
+      return io->write_buffer.buffer ? 0 : iovec_size(init_ptr, init_len);
     default:
+      return 0;
+  }
+}
+
+static bool io_coalesce_op(shuso_io_t *io, shuso_io_opcode_t opcode, void *init_ptr, ssize_t init_len, bool partial, bool registered) {
+  //returns true if the op was taken care of here, false if it should proceed as usual
+  shuso_io_coalesce_t *co = io->coalesce;
+  size_t               size;
+  
+  if(co->error) {
+    io->opcode = opcode;
+    io->result = -1;
+    io->error = co->error;
+    co->error = 0;
+    if(co->disabled) {
+      io_coalesce_free(io);
+    }
+    //a buffer chain write has its iovec batch already, and its links stay queued
+    shuso_io_op_cleanup(io);
+    shuso_io_run_handler(io);
+    return true;
+  }
+  
+  switch(opcode) {
+    case SHUSO_IO_OP_WRITE:
+    case SHUSO_IO_OP_SEND:
+    case SHUSO_IO_OP_WRITEV:
+    case SHUSO_IO_OP_SENDTO:
+    case SHUSO_IO_OP_SENDMSG:
+    case SHUSO_IO_OP_SENDMMSG:
+    case SHUSO_IO_OP_SENDFILE:
+    case SHUSO_IO_OP_SHUTDOWN:
+    case SHUSO_IO_OP_CLOSE:
       break;
+    default:
+      //reads and such don't care about staged writes
+      return false;
+  }
+  
+  size = co->disabled ? 0 : io_coalesce_stageable_size(io, opcode, init_ptr, init_len);
+  if(size > 0 && size <= co->threshold && co->len + size > co->threshold) {
+    //doesn't fit with what's already staged. flush that first
+    if(!io_coalesce_flush(co)) {
+      goto defer;
+    }
   }
+  if(size > 0 && co->len + size <= co->threshold) {
+    if(opcode == SHUSO_IO_OP_WRITEV) {
+      struct iovec *iov = init_ptr;
+      for(ssize_t i = 0; i < init_len; i++) {
+        memcpy(&co->buf[co->len], iov[i].iov_base, iov[i].iov_len);
+        co->len += iov[i].iov_len;
+      }
+    }
+    else {
+      memcpy(&co->buf[co->len], init_ptr, size);
+      co->len += size;
+    }
+    io->opcode = opcode;
+    io->result = size;
+    io->error = 0;
+    if(co->len == co->threshold) {
+      io_coalesce_flush_or_wait(co);
+    }
+    else {
+      io_coalesce_queue(co);
+    }
+    shuso_io_run_handler(io);
+    return true;
+  }
+  
+  if(co->len > 0 && !io_coalesce_flush(co)) {
+    goto defer;
+  }
+  if(co->error) {
+    //report it with this op
+    return io_coalesce_op(io, opcode, init_ptr, init_len, partial, registered);
+  }
+  if(opcode == SHUSO_IO_OP_CLOSE) {
+    io_coalesce_free(io);
+  }
+  return false;
+  
+defer:
+  co->deferred.pending = 1;
+  co->deferred.opcode = opcode;
+  co->deferred.ptr = init_ptr;
+  co->deferred.len = init_len;
+  co->deferred.partial = partial;
+  co->deferred.registered = registered;
+  io->opcode = opcode;
+  io->watch_type = SHUSO_IO_WATCH_NONE;
+  shuso_io_watch_update(io);
+  io_coalesce_unqueue(io->S, co);
+  io_coalesce_wait(co);
+  return true;
+}
+
+bool shuso_io_set_coalesce(shuso_io_t *io, bool enabled, size_t threshold) {
+  shuso_io_coalesce_t *co = io->coalesce;
+  if(!enabled) {
+    if(co) {
+      co->disabled = 1;
+      if(co->len == 0 && !co->deferred.pending && co->error == 0) {
+        io_coalesce_free(io);
+      }
+      //otherwise, it's freed once the staged bytes are flushed
+    }
+    return true;
+  }
+  if(io->io_socket.tls && !(io->io_socket.tls_offload & SHUSO_IO_WRITE)) {
+    //staged writes are flushed straight to the socket
+    return false;
+  }
+  if(threshold == 0) {
+    threshold = SHUSO_IO_COALESCE_DEFAULT_THRESHOLD;
+  }
+  if(co && !co->disabled && co->threshold == threshold) {
+    return true;
+  }
+  if(co && (co->len > 0 || co->deferred.pending || co->error)) {
+    //can't resize while there's stuff staged
+    return false;
+  }
+  if(co) {
+    io_coalesce_free(io);
+  }
+  if((co = malloc(sizeof(*co) + threshold)) == NULL) {
+    return false;
+  }
+  *co = (shuso_io_coalesce_t ) {
+    .io = io,
+    .next = NULL,
+    .threshold = threshold,
+    .start = 0,
+    .len = 0,
+    .error = 0
+  };
+  shuso_ev_init(io->S, &co->watcher, io->io_socket.fd, EV_WRITE, io_coalesce_watcher_handler, co);
+  io->coalesce = co;
+  return true;
 }
 
 static void io_op_run_new(shuso_io_t *io, shuso_io_opcode_t opcode, void *init_ptr, ssize_t init_len, bool partial, bool registered) {
+  if(opcode == SHUSO_IO_OP_CLOSE) {
+    shuso_timer_stop(&io->S->timer_wheel, &io->deadline);
+  }
+  else if(io->deadline_expired) {
+    io->deadline_expired = 0;
+    io->opcode = opcode;
+    io->result = -1;
+    io->error = ETIMEDOUT;
+    //the op never started, but it may have been handed a buffer already. let go of it
+    shuso_io_op_cleanup(io);
+    shuso_io_run_handler(io);
+    return;
+  }
+  if(io->coalesce && io_coalesce_op(io, opcode, init_ptr, init_len, partial, registered)) {
+    return;
+  }
   io->result = 0;
   io->error = 0;
   io->op_again = 0;
@@ -340,20 +872,46 @@ static void io_op_run_new(shuso_io_t *io, shuso_io_opcode_t opcode, void *init_p
       io->iov = init_ptr;
       io->iovcnt = init_len;
       io->incomplete_original_iovec = NULL;
-      io->incomplete_temporary_iovec = NULL;
+      io->incomplete_iovec.iov = NULL;
       break;
     case SHUSO_IO_OP_SENDMSG:
     case SHUSO_IO_OP_RECVMSG:
       io->msg = init_ptr;
       io->len = init_len;
       io->incomplete_original_iovec = NULL;
-      io->incomplete_temporary_iovec = NULL;
+      io->incomplete_iovec.iov = NULL;
       break;
     case SHUSO_IO_OP_ACCEPT:
       io->sockaddr = init_ptr;
       io->len = init_len;
       assert(init_len == sizeof(*io->sockaddr));
       break;
+    case SHUSO_IO_OP_SPLICE:
+      io->splice.dst = init_ptr;
+      io->len = init_len;
+      io->splice.buffered = 0;
+      assert(init_len > 0);
+      if((io->splice.pipe = shuso_io_splice_pipe_acquire(io->S)) == NULL) {
+        io->result = -1;
+        io->error = errno;
+        shuso_io_run_handler(io);
+        return;
+      }
+      break;
+    case SHUSO_IO_OP_SENDFILE:
+      //io->sendfile is already set
+      io->len = init_len;
+      io->splice.buffered = 0;
+      io->splice.pipe = NULL;
+      assert(init_len > 0);
+      if(io->use_io_uring && (io->splice.pipe = shuso_io_splice_pipe_acquire(io->S)) == NULL) {
+        //io_uring has no sendfile, so it's spliced through a pipe
+        io->result = -1;
+        io->error = errno;
+        shuso_io_run_handler(io);
+        return;
+      }
+      break;
     default:
       io->buf = init_ptr;
       io->len = init_len;
@@ -361,6 +919,7 @@ static void io_op_run_new(shuso_io_t *io, shuso_io_opcode_t opcode, void *init_p
   }
   io->op_repeat_to_completion = !partial;
   io->op_registered_memory_buffer = registered;
+  io->op_zerocopy = io_op_use_zerocopy(io);
   if(io->use_io_uring) {
     shuso_io_uring_operation(io);
   }
@@ -378,6 +937,7 @@ void shuso_io_stop(shuso_io_t *io) {
     case SHUSO_IO_WATCH_POLL_READ:
     case SHUSO_IO_WATCH_POLL_WRITE:
     case SHUSO_IO_WATCH_POLL_READWRITE:
+    case SHUSO_IO_WATCH_OP_ZEROCOPY_FINISH:
       io->watch_type = SHUSO_IO_WATCH_NONE;
       io->result = -1;
       io->error = ECANCELED;
@@ -394,9 +954,16 @@ void shuso_io_abort(shuso_io_t *io) {
   else {
     shuso_io_op_cleanup(io);
   }
+  if(io->coalesce) {
+    //staged writes are dropped
+    io_coalesce_free(io);
+  }
+  shuso_timer_stop(&io->S->timer_wheel, &io->deadline);
   io->watch_type = SHUSO_IO_WATCH_NONE;
   io->error = ECANCELED;
   io->result = -1;
+  //the fd may be closed or handed off next, so don't leave a persistent watcher on it
+  io->persistent_watch = 0;
   shuso_io_watch_update(io);
   //stop it at once!
 }
@@ -450,17 +1017,55 @@ void shuso_io_accept(shuso_io_t *io, shuso_sockaddr_t *sockaddr_buffer, socklen_
 }
 
 void shuso_io_writev_partial(shuso_io_t *io, struct iovec *iov, int iovcnt) {
+  io->write_buffer.buffer = NULL;
   io_op_run_new(io, SHUSO_IO_OP_WRITEV, iov, iovcnt, true, false);
 }
 void shuso_io_writev(shuso_io_t *io, struct iovec *iov, int iovcnt) {
+  io->write_buffer.buffer = NULL;
   io_op_run_new(io, SHUSO_IO_OP_WRITEV, iov, iovcnt, false, false);
 }
+void shuso_io_write_buffer(shuso_io_t *io, shuso_buffer_t *buf) {
+  io->opcode = SHUSO_IO_OP_WRITEV;
+  io->result = 0;
+  io->error = 0;
+  if((io->write_buffer.batch = shuso_io_iovec_batch_acquire(io->S)) == NULL) {
+    io->write_buffer.buffer = NULL;
+    io->result = -1;
+    io->error = ENOMEM;
+    shuso_io_run_handler(io);
+    return;
+  }
+  io->write_buffer.buffer = buf;
+  io->write_buffer.link_iov = 0;
+  io->write_buffer.link_offset = 0;
+  if(io_write_buffer_update_and_check_completion(io, 0)) {
+    //nothing to write
+    shuso_io_op_cleanup(io);
+    shuso_io_run_handler(io);
+    return;
+  }
+  io_op_run_new(io, SHUSO_IO_OP_WRITEV, io->iov, io->iovcnt, false, false);
+}
 void shuso_io_readv_partial(shuso_io_t *io, struct iovec *iov, int iovcnt) {
+  io->read_buffer.buffer = NULL;
   io_op_run_new(io, SHUSO_IO_OP_READV, iov, iovcnt, true, false);
 }
 void shuso_io_readv(shuso_io_t *io, struct iovec *iov, int iovcnt) {
+  io->read_buffer.buffer = NULL;
   io_op_run_new(io, SHUSO_IO_OP_READV, iov, iovcnt, false, false);
 }
+void shuso_io_read_into_buffer(shuso_io_t *io, shuso_buffer_t *buf) {
+  int iovcnt = shuso_buffer_read_prepare(io->S, buf, io->read_buffer.iov);
+  if(iovcnt == 0) {
+    io->opcode = SHUSO_IO_OP_READV;
+    io->result = -1;
+    io->error = ENOMEM;
+    shuso_io_run_handler(io);
+    return;
+  }
+  io->read_buffer.buffer = buf;
+  io_op_run_new(io, SHUSO_IO_OP_READV, io->read_buffer.iov, iovcnt, true, false);
+}
 
 void shuso_io_sendto_partial(shuso_io_t *io, const void *buf, size_t len, shuso_sockaddr_t *to, int flags) {
   io->flags = flags;
@@ -513,6 +1118,295 @@ void shuso_io_read(shuso_io_t *io, void *buf, size_t len) {
   io_op_run_new(io, SHUSO_IO_OP_READ, buf, len, false, false);
 }
 
+void shuso_io_recvmmsg(shuso_io_t *io, shuso_mmsghdr_t *msgvec, unsigned int vlen, int flags) {
+  io->flags = flags;
+  io_op_run_new(io, SHUSO_IO_OP_RECVMMSG, msgvec, vlen, true, false);
+}
+void shuso_io_sendmmsg(shuso_io_t *io, shuso_mmsghdr_t *msgvec, unsigned int vlen, int flags) {
+  io->flags = flags;
+  io_op_run_new(io, SHUSO_IO_OP_SENDMMSG, msgvec, vlen, false, false);
+}
+void shuso_io_sendmmsg_partial(shuso_io_t *io, shuso_mmsghdr_t *msgvec, unsigned int vlen, int flags) {
+  io->flags = flags;
+  io_op_run_new(io, SHUSO_IO_OP_SENDMMSG, msgvec, vlen, true, false);
+}
+
+char *shuso_io_datagram_batch_slot(shuso_io_datagram_batch_t *batch, unsigned i) {
+  assert(i < SHUSO_IO_DATAGRAM_BATCH_SIZE);
+  return &batch->buf[batch->slot_size * i];
+}
+
+void shuso_io_datagram_batch_reset(shuso_io_datagram_batch_t *batch) {
+  for(unsigned i = 0; i < SHUSO_IO_DATAGRAM_BATCH_SIZE; i++) {
+    batch->iov[i] = (struct iovec ) {
+      .iov_base = shuso_io_datagram_batch_slot(batch, i),
+      .iov_len = batch->slot_size
+    };
+    batch->msg[i] = (shuso_mmsghdr_t ) {
+      .msg_hdr = {
+        .msg_name = &batch->addr[i],
+        .msg_namelen = sizeof(batch->addr[i]),
+        .msg_iov = &batch->iov[i],
+        .msg_iovlen = 1,
+        .msg_control = batch->control[i].buf,
+        .msg_controllen = sizeof(batch->control[i].buf)
+      },
+      .msg_len = 0
+    };
+  }
+}
+
+bool shuso_io_datagram_batch_prepare_send(shuso_io_datagram_batch_t *batch, unsigned i, size_t len, const shuso_sockaddr_t *to, uint16_t segment_size) {
+  struct msghdr *msg = &batch->msg[i].msg_hdr;
+  assert(i < SHUSO_IO_DATAGRAM_BATCH_SIZE);
+  assert(len <= batch->slot_size);
+  batch->iov[i].iov_base = shuso_io_datagram_batch_slot(batch, i);
+  batch->iov[i].iov_len = len;
+  msg->msg_iov = &batch->iov[i];
+  msg->msg_iovlen = 1;
+  if(to) {
+    batch->addr[i] = *to;
+    msg->msg_name = &batch->addr[i];
+    msg->msg_namelen = shuso_io_af_sockaddrlen(to->any.sa_family);
+  }
+  else {
+    msg->msg_name = NULL;
+    msg->msg_namelen = 0;
+  }
+  msg->msg_control = NULL;
+  msg->msg_controllen = 0;
+  msg->msg_flags = 0;
+  batch->msg[i].msg_len = 0;
+  if(segment_size == 0 || segment_size >= len) {
+    return true;
+  }
+#ifdef UDP_SEGMENT
+  msg->msg_control = batch->control[i].buf;
+  msg->msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg);
+  cmsg->cmsg_level = SOL_UDP;
+  cmsg->cmsg_type = UDP_SEGMENT;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+  memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(segment_size));
+  return true;
+#else
+  errno = ENOPROTOOPT;
+  return false;
+#endif
+}
+
+bool shuso_io_set_udp_gro(shuso_io_t *io, bool enabled) {
+#ifdef UDP_GRO
+  int val = enabled ? 1 : 0;
+  return setsockopt(io->io_socket.fd, SOL_UDP, UDP_GRO, &val, sizeof(val)) == 0;
+#else
+  errno = ENOPROTOOPT;
+  return !enabled;
+#endif
+}
+
+bool shuso_io_set_udp_segment_size(shuso_io_t *io, uint16_t segment_size) {
+#ifdef UDP_SEGMENT
+  int val = segment_size;
+  return setsockopt(io->io_socket.fd, SOL_UDP, UDP_SEGMENT, &val, sizeof(val)) == 0;
+#else
+  errno = ENOPROTOOPT;
+  return segment_size == 0;
+#endif
+}
+
+unsigned shuso_io_datagram_split(const shuso_mmsghdr_t *msg, shuso_io_datagram_view_t *views, unsigned max_views) {
+  const struct msghdr *hdr = &msg->msg_hdr;
+  size_t               len = msg->msg_len;
+  size_t               segment_size = 0;
+  char                *data;
+  unsigned             n = 0, total;
+  
+  if(hdr->msg_iovlen == 0) {
+    return 0;
+  }
+  data = hdr->msg_iov[0].iov_base;
+  
+#ifdef UDP_GRO
+  if(hdr->msg_control && hdr->msg_controllen >= sizeof(struct cmsghdr)) {
+    for(struct cmsghdr *cmsg = CMSG_FIRSTHDR((struct msghdr *)hdr); cmsg != NULL; cmsg = CMSG_NXTHDR((struct msghdr *)hdr, cmsg)) {
+      if(cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+        int gso_size;
+        memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(gso_size));
+        segment_size = gso_size > 0 ? (size_t )gso_size : 0;
+        break;
+      }
+    }
+  }
+#endif
+  if(segment_size == 0 || segment_size >= len) {
+    //just the one datagram
+    if(max_views > 0) {
+      views[0] = (shuso_io_datagram_view_t ) {.data = data, .len = len};
+    }
+    return 1;
+  }
+  
+  //every segment but the last one is exactly segment_size bytes long
+  total = (len + segment_size - 1) / segment_size;
+  while(len > 0 && n < max_views) {
+    size_t seglen = len < segment_size ? len : segment_size;
+    views[n++] = (shuso_io_datagram_view_t ) {.data = data, .len = seglen};
+    data += seglen;
+    len -= seglen;
+  }
+  return total;
+}
+
+shuso_io_datagram_batch_t *shuso_io_datagram_batch_acquire(shuso_t *S, size_t slot_size) {
+  shuso_io_datagram_batch_t *batch, *prev = NULL;
+  for(batch = S->io.free_datagram_batches; batch != NULL; prev = batch, batch = batch->next) {
+    if(batch->slot_size == slot_size) {
+      break;
+    }
+  }
+  if(batch) {
+    if(prev) {
+      prev->next = batch->next;
+    }
+    else {
+      S->io.free_datagram_batches = batch->next;
+    }
+    S->io.free_datagram_batches_count--;
+  }
+  else {
+    if((batch = malloc(sizeof(*batch) + slot_size * SHUSO_IO_DATAGRAM_BATCH_SIZE)) == NULL) {
+      return NULL;
+    }
+    batch->slot_size = slot_size;
+  }
+  batch->next = NULL;
+  shuso_io_datagram_batch_reset(batch);
+  return batch;
+}
+
+void shuso_io_datagram_batch_release(shuso_t *S, shuso_io_datagram_batch_t *batch) {
+  if(S->io.free_datagram_batches_count >= SHUSO_IO_DATAGRAM_MAX_FREE_BATCHES) {
+    free(batch);
+    return;
+  }
+  batch->next = S->io.free_datagram_batches;
+  S->io.free_datagram_batches = batch;
+  S->io.free_datagram_batches_count++;
+}
+
+void shuso_io_datagram_batches_free(shuso_t *S) {
+  shuso_io_datagram_batch_t *batch, *next;
+  for(batch = S->io.free_datagram_batches; batch != NULL; batch = next) {
+    next = batch->next;
+    free(batch);
+  }
+  S->io.free_datagram_batches = NULL;
+  S->io.free_datagram_batches_count = 0;
+}
+
+shuso_io_iovec_batch_t *shuso_io_iovec_batch_acquire(shuso_t *S) {
+  shuso_io_iovec_batch_t *batch = S->io.free_iovec_batches;
+  if(batch) {
+    S->io.free_iovec_batches = batch->next;
+    S->io.free_iovec_batches_count--;
+  }
+  else if((batch = malloc(sizeof(*batch))) == NULL) {
+    return NULL;
+  }
+  batch->next = NULL;
+  return batch;
+}
+
+void shuso_io_iovec_batch_release(shuso_t *S, shuso_io_iovec_batch_t *batch) {
+  if(S->io.free_iovec_batches_count >= SHUSO_IO_IOVEC_MAX_FREE_BATCHES) {
+    free(batch);
+    return;
+  }
+  batch->next = S->io.free_iovec_batches;
+  S->io.free_iovec_batches = batch;
+  S->io.free_iovec_batches_count++;
+}
+
+void shuso_io_iovec_batches_free(shuso_t *S) {
+  shuso_io_iovec_batch_t *batch, *next;
+  for(batch = S->io.free_iovec_batches; batch != NULL; batch = next) {
+    next = batch->next;
+    free(batch);
+  }
+  S->io.free_iovec_batches = NULL;
+  S->io.free_iovec_batches_count = 0;
+}
+
+void shuso_io_splice(shuso_io_t *io, shuso_io_t *dst, size_t len) {
+  io_op_run_new(io, SHUSO_IO_OP_SPLICE, dst, len, false, false);
+}
+void shuso_io_splice_partial(shuso_io_t *io, shuso_io_t *dst, size_t len) {
+  io_op_run_new(io, SHUSO_IO_OP_SPLICE, dst, len, true, false);
+}
+
+void shuso_io_sendfile(shuso_io_t *io, int file_fd, off_t offset, size_t len) {
+  io->sendfile.fd = file_fd;
+  io->sendfile.offset = offset;
+  io_op_run_new(io, SHUSO_IO_OP_SENDFILE, NULL, len, false, false);
+}
+void shuso_io_sendfile_partial(shuso_io_t *io, int file_fd, off_t offset, size_t len) {
+  io->sendfile.fd = file_fd;
+  io->sendfile.offset = offset;
+  io_op_run_new(io, SHUSO_IO_OP_SENDFILE, NULL, len, true, false);
+}
+
+shuso_io_pipe_t *shuso_io_splice_pipe_acquire(shuso_t *S) {
+#ifdef SHUTTLESOCK_HAVE_SPLICE
+  shuso_io_pipe_t *pipe = S->io.free_pipes;
+  if(pipe) {
+    S->io.free_pipes = pipe->next;
+    S->io.free_pipes_count--;
+    pipe->next = NULL;
+    return pipe;
+  }
+  if((pipe = malloc(sizeof(*pipe))) == NULL) {
+    return NULL;
+  }
+  if(pipe2(pipe->fd, O_NONBLOCK | O_CLOEXEC) == -1) {
+    int err = errno;
+    free(pipe);
+    errno = err;
+    return NULL;
+  }
+  pipe->next = NULL;
+  return pipe;
+#else
+  errno = ENOSYS;
+  return NULL;
+#endif
+}
+
+void shuso_io_splice_pipe_release(shuso_t *S, shuso_io_pipe_t *pipe, bool empty) {
+  if(empty && S->io.free_pipes_count < SHUSO_IO_SPLICE_MAX_FREE_PIPES) {
+    pipe->next = S->io.free_pipes;
+    S->io.free_pipes = pipe;
+    S->io.free_pipes_count++;
+    return;
+  }
+  //a pipe with leftover data in it is no good to anyone else
+  close(pipe->fd[0]);
+  close(pipe->fd[1]);
+  free(pipe);
+}
+
+void shuso_io_splice_pipes_free(shuso_t *S) {
+  shuso_io_pipe_t *pipe, *next;
+  for(pipe = S->io.free_pipes; pipe != NULL; pipe = next) {
+    next = pipe->next;
+    close(pipe->fd[0]);
+    close(pipe->fd[1]);
+    free(pipe);
+  }
+  S->io.free_pipes = NULL;
+  S->io.free_pipes_count = 0;
+}
+
 void shuso_io_sendmsg(shuso_io_t *io, struct msghdr *msg, int flags) {
   io->flags = flags;
   io_op_run_new(io, SHUSO_IO_OP_SENDMSG, msg, 0, false, false);
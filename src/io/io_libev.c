@@ -1,5 +1,5 @@
 #include <shuttlesock/build_config.h>
-#ifdef SHUTTLESOCK_HAVE_ACCEPT4
+#if defined(SHUTTLESOCK_HAVE_ACCEPT4) || defined(SHUTTLESOCK_HAVE_SPLICE) || defined(SHUTTLESOCK_HAVE_MMSG)
 #ifndef _GNU_SOURCE
 #define _GNU_SOURCE
 #endif
@@ -7,16 +7,44 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
+#include <fcntl.h>
+#ifdef SHUTTLESOCK_HAVE_SENDFILE
+#include <sys/sendfile.h>
+#endif
 
 #include <shuttlesock.h>
 #include <errno.h>
+#include <limits.h>
 #include <sys/uio.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#ifdef SHUTTLESOCK_HAVE_MSG_ZEROCOPY
+#include <linux/errqueue.h>
+#endif
 
 #include "io_private.h"
 #include "io_libev.h"
 
 static int shuso_io_ev_connect(shuso_io_t *io);
 static void shuso_io_ev_watcher_handler(shuso_loop *loop, shuso_ev_io *ev, int evflags);
+static void shuso_io_ev_operation_finish(shuso_io_t *io);
+static void shuso_io_ev_splice(shuso_io_t *io);
+
+#ifdef SHUTTLESOCK_HAVE_MMSG
+_Static_assert(sizeof(shuso_mmsghdr_t) == sizeof(struct mmsghdr), "shuso_mmsghdr_t must match struct mmsghdr");
+_Static_assert(offsetof(shuso_mmsghdr_t, msg_len) == offsetof(struct mmsghdr, msg_len), "shuso_mmsghdr_t must match struct mmsghdr");
+#endif
+
+static void ev_watcher_start(shuso_io_t *io) {
+  io->S->io.watcher_starts++;
+  shuso_ev_start(io->S, &io->watcher);
+}
+
+static void ev_watcher_stop(shuso_io_t *io) {
+  io->S->io.watcher_stops++;
+  shuso_ev_stop(io->S, &io->watcher);
+}
 
 static bool ev_opcode_finish_match_event_type(shuso_io_opcode_t opcode, int evflags) {
   switch(opcode) {
@@ -34,6 +62,10 @@ static bool ev_opcode_finish_match_event_type(shuso_io_opcode_t opcode, int evfl
     case SHUSO_IO_OP_ACCEPT:
     case SHUSO_IO_OP_CLOSE:
     case SHUSO_IO_OP_SHUTDOWN:
+    case SHUSO_IO_OP_SPLICE:
+    case SHUSO_IO_OP_SENDFILE:
+    case SHUSO_IO_OP_RECVMMSG:
+    case SHUSO_IO_OP_SENDMMSG:
       //should not happen
       raise(SIGABRT);
       return false;
@@ -43,7 +75,7 @@ static bool ev_opcode_finish_match_event_type(shuso_io_opcode_t opcode, int evfl
   return false;
 }
 
-static bool ev_opcode_retry_match_event_type(shuso_io_opcode_t opcode, int evflags) {
+static bool ev_opcode_retry_match_event_type(shuso_io_opcode_t opcode, size_t io_splice_buffered, int evflags) {
   switch(opcode) {
     case SHUSO_IO_OP_NONE:
       //should not happen
@@ -55,6 +87,7 @@ static bool ev_opcode_retry_match_event_type(shuso_io_opcode_t opcode, int evfla
     case SHUSO_IO_OP_RECVFROM:
     case SHUSO_IO_OP_RECVMSG:
     case SHUSO_IO_OP_RECV:
+    case SHUSO_IO_OP_RECVMMSG:
       return evflags & EV_READ;
     
     case SHUSO_IO_OP_WRITEV:
@@ -62,6 +95,8 @@ static bool ev_opcode_retry_match_event_type(shuso_io_opcode_t opcode, int evfla
     case SHUSO_IO_OP_SENDTO:
     case SHUSO_IO_OP_SENDMSG:
     case SHUSO_IO_OP_SEND:
+    case SHUSO_IO_OP_SENDFILE:
+    case SHUSO_IO_OP_SENDMMSG:
       return evflags & EV_WRITE;
       
     case SHUSO_IO_OP_ACCEPT:
@@ -69,10 +104,90 @@ static bool ev_opcode_retry_match_event_type(shuso_io_opcode_t opcode, int evfla
     case SHUSO_IO_OP_CLOSE:
     case SHUSO_IO_OP_SHUTDOWN:
       return true;
+    
+    case SHUSO_IO_OP_SPLICE:
+      //waiting to write to the destination if there's something in the pipe, otherwise to read from the source
+      return evflags & (io_splice_buffered ? EV_WRITE : EV_READ);
   }
   return false;
 }
 
+//small iovecs are gathered into one TLS record instead of a record each
+#define EV_TLS_WRITE_GATHER_SIZE 16384
+
+static bool ev_tls_op(shuso_io_t *io, int direction) {
+  //true if OpenSSL has to do this op, rather than a plain syscall
+  return io->io_socket.tls && !(io->io_socket.tls_offload & direction);
+}
+
+static ssize_t ev_tls_op_error(shuso_io_t *io, int rc, bool reading) {
+  //make a failed SSL_read or SSL_write look like the plain syscall had failed
+  int err = SSL_get_error(io->io_socket.tls, rc);
+  int sys_errno = errno;
+  ERR_clear_error();
+  if(err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+    io->op_tls_events = err == SSL_ERROR_WANT_READ ? EV_READ : EV_WRITE;
+    errno = EAGAIN;
+    return -1;
+  }
+  if(err == SSL_ERROR_ZERO_RETURN || (err == SSL_ERROR_SYSCALL && sys_errno == 0)) {
+    //close_notify, or the peer just went away
+    if(reading) {
+      return 0;
+    }
+    errno = EPIPE;
+    return -1;
+  }
+  errno = err == SSL_ERROR_SYSCALL ? sys_errno : EPROTO;
+  return -1;
+}
+
+static ssize_t ev_tls_read(shuso_io_t *io, void *buf, size_t len) {
+  int rc;
+  ERR_clear_error();
+  errno = 0;
+  rc = SSL_read(io->io_socket.tls, buf, len > INT_MAX ? INT_MAX : (int )len);
+  return rc > 0 ? rc : ev_tls_op_error(io, rc, true);
+}
+
+static ssize_t ev_tls_readv(shuso_io_t *io, struct iovec *iov, size_t iovcnt) {
+  for(size_t i = 0; i < iovcnt; i++) {
+    if(iov[i].iov_len > 0) {
+      return ev_tls_read(io, iov[i].iov_base, iov[i].iov_len);
+    }
+  }
+  return 0;
+}
+
+static ssize_t ev_tls_write(shuso_io_t *io, const void *buf, size_t len) {
+  int rc;
+  ERR_clear_error();
+  errno = 0;
+  rc = SSL_write(io->io_socket.tls, buf, len > INT_MAX ? INT_MAX : (int )len);
+  return rc > 0 ? rc : ev_tls_op_error(io, rc, false);
+}
+
+static ssize_t ev_tls_writev(shuso_io_t *io, struct iovec *iov, size_t iovcnt) {
+  //a retried SSL_write must be given the same data again. gathering from the same iovecs does that
+  char    buf[EV_TLS_WRITE_GATHER_SIZE];
+  size_t  len = 0, i = 0;
+  while(i < iovcnt && iov[i].iov_len == 0) {
+    i++;
+  }
+  if(i == iovcnt) {
+    return 0;
+  }
+  if(i + 1 == iovcnt || iov[i].iov_len >= sizeof(buf)) {
+    return ev_tls_write(io, iov[i].iov_base, iov[i].iov_len);
+  }
+  for(; i < iovcnt && len < sizeof(buf); i++) {
+    size_t chunk = iov[i].iov_len < sizeof(buf) - len ? iov[i].iov_len : sizeof(buf) - len;
+    memcpy(&buf[len], iov[i].iov_base, chunk);
+    len += chunk;
+  }
+  return ev_tls_write(io, buf, len);
+}
+
 static bool ev_watch_poll_match_event_type(shuso_io_watch_type_t watchtype, int evflags) {
   if(evflags & EV_READ) {
     return watchtype == SHUSO_IO_WATCH_POLL_READ || watchtype == SHUSO_IO_WATCH_POLL_READWRITE;
@@ -83,12 +198,189 @@ static bool ev_watch_poll_match_event_type(shuso_io_watch_type_t watchtype, int
   return false;
 }
 
+#ifdef SHUTTLESOCK_HAVE_MSG_ZEROCOPY
+static bool ev_zerocopy_receive_completions(shuso_io_t *io) {
+  //returns true if the kernel is done with all the zero-copy buffers we gave it
+  union {
+    char                    buf[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(shuso_sockaddr_t))];
+    struct cmsghdr          align;
+  }                       control;
+  struct msghdr           msg;
+  struct cmsghdr         *cmsg;
+  struct sock_extended_err *serr;
+  
+  while(io->zerocopy.completed != io->zerocopy.sent) {
+    msg = (struct msghdr ) {
+      .msg_control = control.buf,
+      .msg_controllen = sizeof(control.buf)
+    };
+    if(recvmsg(io->io_socket.fd, &msg, MSG_ERRQUEUE) == -1) {
+      if(errno == EINTR) {
+        continue;
+      }
+      //EAGAIN means no more notifications for now
+      break;
+    }
+    for(cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if(!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+#ifdef SHUTTLESOCK_HAVE_IPV6
+       && !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)
+#endif
+      ) {
+        continue;
+      }
+      serr = (struct sock_extended_err *)CMSG_DATA(cmsg);
+      if(serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+        continue;
+      }
+      //[ee_info, ee_data] is the inclusive range of completed sends. Ranges may be coalesced, and may arrive out of order
+      io->zerocopy.completed += serr->ee_data - serr->ee_info + 1;
+    }
+  }
+  return io->zerocopy.completed == io->zerocopy.sent;
+}
+
+static void ev_zerocopy_poll_handler(struct ev_loop *loop, ev_timer *w, int evflags) {
+  shuso_t      *S = w->data;
+  shuso_io_t  **cur;
+  shuso_io_t   *io;
+  
+  cur = &S->io.zerocopy_polled;
+  while((io = *cur) != NULL) {
+    if(!ev_zerocopy_receive_completions(io)) {
+      cur = &io->zerocopy.next_polled;
+      continue;
+    }
+    *cur = io->zerocopy.next_polled;
+    io->zerocopy.next_polled = NULL;
+    io->op_zerocopy_polled = 0;
+    io->watch_type = SHUSO_IO_WATCH_NONE;
+    shuso_io_ev_operation_finish(io);
+    //the handler may have started another op that's now polled too, or aborted other ios in the list
+    cur = &S->io.zerocopy_polled;
+  }
+  if(S->io.zerocopy_polled == NULL) {
+    ev_timer_stop(loop, w);
+  }
+}
+
+static void ev_zerocopy_poll_start(shuso_io_t *io) {
+  shuso_t *S = io->S;
+  if(io->op_zerocopy_polled) {
+    return;
+  }
+  io->zerocopy.next_polled = S->io.zerocopy_polled;
+  S->io.zerocopy_polled = io;
+  io->op_zerocopy_polled = 1;
+  if(!ev_is_active(&S->io.zerocopy_poll)) {
+    ev_timer_init(&S->io.zerocopy_poll, ev_zerocopy_poll_handler, SHUSO_IO_ZEROCOPY_POLL_INTERVAL, SHUSO_IO_ZEROCOPY_POLL_INTERVAL);
+    S->io.zerocopy_poll.data = S;
+    ev_timer_start(S->ev.loop, &S->io.zerocopy_poll);
+  }
+}
+
+static void ev_zerocopy_poll_stop(shuso_io_t *io) {
+  shuso_t     *S = io->S;
+  shuso_io_t **cur;
+  if(!io->op_zerocopy_polled) {
+    return;
+  }
+  for(cur = &S->io.zerocopy_polled; *cur != NULL; cur = &(*cur)->zerocopy.next_polled) {
+    if(*cur == io) {
+      *cur = io->zerocopy.next_polled;
+      break;
+    }
+  }
+  io->zerocopy.next_polled = NULL;
+  io->op_zerocopy_polled = 0;
+  if(S->io.zerocopy_polled == NULL && ev_is_active(&S->io.zerocopy_poll)) {
+    ev_timer_stop(S->ev.loop, &S->io.zerocopy_poll);
+  }
+}
+#endif
+
+static bool ev_zerocopy_fallback(shuso_io_t *io) {
+  if(errno != ENOBUFS) {
+    return false;
+  }
+  //over the socket's pinned-page limit. copy instead for the rest of this op
+  io->op_zerocopy = 0;
+  return true;
+}
+
+static int ev_opcode_events(shuso_io_t *io) {
+  if(io->op_tls_events) {
+    return io->op_tls_events;
+  }
+  switch((shuso_io_opcode_t )io->opcode) {
+    case SHUSO_IO_OP_READV:
+    case SHUSO_IO_OP_READ:
+    case SHUSO_IO_OP_RECVFROM:
+    case SHUSO_IO_OP_RECVMSG:
+    case SHUSO_IO_OP_RECV:
+    case SHUSO_IO_OP_RECVMMSG:
+    case SHUSO_IO_OP_ACCEPT:
+      return EV_READ;
+    
+    case SHUSO_IO_OP_WRITEV:
+    case SHUSO_IO_OP_WRITE:
+    case SHUSO_IO_OP_SENDTO:
+    case SHUSO_IO_OP_SENDMSG:
+    case SHUSO_IO_OP_SEND:
+    case SHUSO_IO_OP_SENDFILE:
+    case SHUSO_IO_OP_SENDMMSG:
+    case SHUSO_IO_OP_CONNECT:
+      return EV_WRITE;
+    
+    case SHUSO_IO_OP_SPLICE:
+      return io->splice.buffered ? EV_WRITE : EV_READ;
+    
+    default:
+      return io->readwrite;
+  }
+}
+
+static int ev_watch_fd(shuso_io_t *io) {
+  if(io->opcode == SHUSO_IO_OP_SPLICE && io->watch_type == SHUSO_IO_WATCH_OP_RETRY && io->splice.buffered) {
+    //the destination is who we're waiting on. it may have its own op going, so borrow its fd rather than its watcher
+    return io->splice.dst->io_socket.fd;
+  }
+  return io->io_socket.fd;
+}
+
+static int ev_watch_events(shuso_io_t *io) {
+  //only wait for the events the op needs. a read-write io waiting to read would otherwise wake up on every loop
+  //iteration because the socket is writable.
+  switch((shuso_io_watch_type_t )io->watch_type) {
+    case SHUSO_IO_WATCH_NONE:
+      return io->watcher.ev.events & (EV_READ | EV_WRITE);
+    case SHUSO_IO_WATCH_OP_FINISH:
+    case SHUSO_IO_WATCH_OP_RETRY:
+      return ev_opcode_events(io);
+    case SHUSO_IO_WATCH_POLL_READ:
+      return EV_READ;
+    case SHUSO_IO_WATCH_POLL_WRITE:
+      return EV_WRITE;
+    case SHUSO_IO_WATCH_POLL_READWRITE:
+      return EV_READ | EV_WRITE;
+    case SHUSO_IO_WATCH_OP_ZEROCOPY_FINISH:
+      //never watched, see shuso_io_ev_watch_update
+      return 0;
+  }
+  return io->readwrite;
+}
+
 static void shuso_io_ev_watcher_handler(shuso_loop *loop, shuso_ev_io *ev, int evflags) {
   shuso_io_t *io = shuso_ev_data(ev);
   switch((shuso_io_watch_type_t )io->watch_type) {    
     case SHUSO_IO_WATCH_NONE:
-      //should never happer
-      raise(SIGABRT);
+      if(!io->persistent_watch) {
+        //should never happen. only persistent watchers are left running with nothing to wait for
+        raise(SIGABRT);
+      }
+      //a persistent watcher fired while nobody's waiting on it. disarm it now, or level-triggered readiness will
+      //keep waking us up
+      ev_watcher_stop(io);
       break;
     
     case SHUSO_IO_WATCH_OP_FINISH:
@@ -98,7 +390,7 @@ static void shuso_io_ev_watcher_handler(shuso_loop *loop, shuso_ev_io *ev, int e
       break;
       
     case SHUSO_IO_WATCH_OP_RETRY:
-      if(ev_opcode_retry_match_event_type(io->opcode, evflags)) {
+      if(io->op_tls_events ? (evflags & io->op_tls_events) : ev_opcode_retry_match_event_type(io->opcode, io->splice.buffered, evflags)) {
         io->watch_type = SHUSO_IO_WATCH_NONE;
         assert(io->opcode != SHUSO_IO_OP_NONE);
         shuso_io_ev_operation(io);
@@ -113,20 +405,66 @@ static void shuso_io_ev_watcher_handler(shuso_loop *loop, shuso_ev_io *ev, int e
         shuso_io_run_handler(io);
       }
       break;
+    
+    case SHUSO_IO_WATCH_OP_ZEROCOPY_FINISH:
+      //should never happen. completions are polled for, not watched
+      raise(SIGABRT);
+      break;
   }
 }
 
 void shuso_io_ev_watch_update(shuso_io_t *io) {
   assert(!io->use_io_uring);
   bool ev_watcher_active = shuso_ev_active(&io->watcher);
-  if(io->watch_type == SHUSO_IO_WATCH_NONE && ev_watcher_active) {
-    //watcher needs to be stopped
-    shuso_ev_stop(io->S, &io->watcher);
+#ifdef SHUTTLESOCK_HAVE_MSG_ZEROCOPY
+  if(io->watch_type == SHUSO_IO_WATCH_OP_ZEROCOPY_FINISH) {
+    //completions land on the error queue, and a level-triggered watcher would report the still-readable (or
+    //-writable) socket on every loop iteration until they arrive. check the error queue on a short timer instead.
+    if(ev_watcher_active) {
+      ev_watcher_stop(io);
+    }
+    ev_zerocopy_poll_start(io);
+    return;
+  }
+  ev_zerocopy_poll_stop(io);
+#endif
+  if(io->watch_type == SHUSO_IO_WATCH_NONE) {
+    if(ev_watcher_active && !io->persistent_watch) {
+      //watcher needs to be stopped
+      ev_watcher_stop(io);
+    }
+    //persistent watchers stay armed between ops, so that an op that hits EAGAIN right after the last one finished
+    //doesn't need to touch the epoll set.
+    return;
+  }
+  
+  int events = ev_watch_events(io);
+  int fd = ev_watch_fd(io);
+  if((io->watcher.ev.events & (EV_READ | EV_WRITE)) != events || io->watcher.ev.fd != fd) {
+    //watching for different events now. libev has to be stopped to change them, but it only tells epoll once per
+    //loop iteration, so this is at most one epoll_ctl(EPOLL_CTL_MOD)
+    if(ev_watcher_active) {
+      ev_watcher_stop(io);
+      ev_watcher_active = false;
+    }
+    ev_io_set(&io->watcher.ev, fd, events);
   }
-  else if(io->watch_type != SHUSO_IO_WATCH_NONE && !ev_watcher_active) {
+  if(!ev_watcher_active) {
     //watcher needs to be started
-    shuso_ev_start(io->S, &io->watcher);
+    ev_watcher_start(io);
+  }
+}
+
+bool shuso_io_ev_set_zerocopy(shuso_io_t *io, bool enabled) {
+#ifdef SHUTTLESOCK_HAVE_MSG_ZEROCOPY
+  int val = enabled ? 1 : 0;
+  if(io->io_socket.fd == -1) {
+    return false;
   }
+  return setsockopt(io->io_socket.fd, SOL_SOCKET, SO_ZEROCOPY, &val, sizeof(val)) == 0;
+#else
+  return !enabled;
+#endif
 }
 
 void shuso_io_ev_init_socket(shuso_t *S, shuso_io_t *io, shuso_socket_t *sock, int readwrite, shuso_io_fn *coro, void *privdata) {
@@ -190,8 +528,20 @@ void shuso_io_ev_operation(shuso_io_t *io) {
   ssize_t result;
   shuso_io_opcode_t   op = io->opcode;
   int                 fd = io->io_socket.fd;
+  int                 zerocopy_flag;
+  
+  if(op == SHUSO_IO_OP_SPLICE && !ev_tls_op(io, SHUSO_IO_READ) && !ev_tls_op(io->splice.dst, SHUSO_IO_WRITE)) {
+    shuso_io_ev_splice(io);
+    return;
+  }
+  io->op_tls_events = 0;
   
   do {
+#ifdef SHUTTLESOCK_HAVE_MSG_ZEROCOPY
+    zerocopy_flag = io->op_zerocopy ? MSG_ZEROCOPY : 0;
+#else
+    zerocopy_flag = 0;
+#endif
     switch(op) {
       case SHUSO_IO_OP_NONE:
         //should never happen
@@ -199,22 +549,62 @@ void shuso_io_ev_operation(shuso_io_t *io) {
         break;
       
       case SHUSO_IO_OP_READ:
-        result = read(fd, io->buf, io->len);
+        if(ev_tls_op(io, SHUSO_IO_READ)) {
+          result = ev_tls_read(io, io->buf, io->len);
+        }
+        else {
+          result = read(fd, io->buf, io->len);
+        }
         break;
       case SHUSO_IO_OP_WRITE:
         assert(io->len > 0);
-        result = write(fd, io->buf, io->len);
+        if(ev_tls_op(io, SHUSO_IO_WRITE)) {
+          result = ev_tls_write(io, io->buf, io->len);
+        }
+        else if(zerocopy_flag) {
+          result = send(fd, io->buf, io->len, zerocopy_flag);
+        }
+        else {
+          result = write(fd, io->buf, io->len);
+        }
         break;
       case SHUSO_IO_OP_READV:
-        result = readv(fd, io->iov, io->iovcnt);
+        if(ev_tls_op(io, SHUSO_IO_READ)) {
+          result = ev_tls_readv(io, io->iov, io->iovcnt);
+        }
+        else {
+          result = readv(fd, io->iov, io->iovcnt);
+        }
         break;
       case SHUSO_IO_OP_WRITEV:
-        result = writev(fd, io->iov, io->iovcnt);
+        if(ev_tls_op(io, SHUSO_IO_WRITE)) {
+          result = ev_tls_writev(io, io->iov, io->iovcnt);
+        }
+        else if(zerocopy_flag) {
+          struct msghdr msg = {
+            .msg_iov = io->iov,
+            .msg_iovlen = io->iovcnt
+          };
+          result = sendmsg(fd, &msg, zerocopy_flag);
+        }
+        else {
+          result = writev(fd, io->iov, io->iovcnt);
+        }
         break;
       case SHUSO_IO_OP_SENDMSG:
-        result = sendmsg(fd, io->msg, io->flags);
+        if(ev_tls_op(io, SHUSO_IO_WRITE)) {
+          errno = EOPNOTSUPP;
+          result = -1;
+          break;
+        }
+        result = sendmsg(fd, io->msg, io->flags | zerocopy_flag);
         break;
       case SHUSO_IO_OP_RECVMSG:
+        if(ev_tls_op(io, SHUSO_IO_READ)) {
+          errno = EOPNOTSUPP;
+          result = -1;
+          break;
+        }
         result = recvmsg(fd, io->msg, io->flags);
         break;
       case SHUSO_IO_OP_RECVFROM: {
@@ -224,14 +614,24 @@ void shuso_io_ev_operation(shuso_io_t *io) {
         break;
       }
       case SHUSO_IO_OP_RECV:
-        result = recv(fd, io->buf, io->len, io->flags);
+        if(ev_tls_op(io, SHUSO_IO_READ)) {
+          result = ev_tls_read(io, io->buf, io->len);
+        }
+        else {
+          result = recv(fd, io->buf, io->len, io->flags);
+        }
         break;
       case SHUSO_IO_OP_SENDTO: 
         assert(io->sockaddr);
         result = sendto(fd, io->buf, io->len, io->flags, &io->sockaddr->any, shuso_io_af_sockaddrlen(io->sockaddr->any.sa_family));
         break;
       case SHUSO_IO_OP_SEND:
-        result = send(fd, io->buf, io->len, io->flags);
+        if(ev_tls_op(io, SHUSO_IO_WRITE)) {
+          result = ev_tls_write(io, io->buf, io->len);
+        }
+        else {
+          result = send(fd, io->buf, io->len, io->flags | zerocopy_flag);
+        }
         break;
       case SHUSO_IO_OP_CONNECT:
         result = shuso_io_ev_connect(io);
@@ -252,13 +652,62 @@ void shuso_io_ev_operation(shuso_io_t *io) {
         break;
       }
       case SHUSO_IO_OP_CLOSE:
+        if(shuso_ev_active(&io->watcher)) {
+          //a persistent watcher may still be registered for this fd
+          ev_watcher_stop(io);
+        }
+        shuso_io_tls_free(&io->io_socket);
         result = close(fd);
         break;
       case SHUSO_IO_OP_SHUTDOWN:
         result = shutdown(fd, io->flags);
         break;
+      case SHUSO_IO_OP_SENDFILE:
+        if(ev_tls_op(io, SHUSO_IO_WRITE)) {
+          //the file would go out unencrypted
+          errno = EOPNOTSUPP;
+          result = -1;
+          break;
+        }
+#ifdef SHUTTLESOCK_HAVE_SENDFILE
+        result = sendfile(fd, io->sendfile.fd, &io->sendfile.offset, io->len);
+#else
+        errno = ENOSYS;
+        result = -1;
+#endif
+        break;
+      case SHUSO_IO_OP_RECVMMSG:
+#ifdef SHUTTLESOCK_HAVE_MMSG
+        result = recvmmsg(fd, (struct mmsghdr *)io->mmsg, io->len, io->flags, NULL);
+#else
+        //one at a time, then
+        if((result = recvmsg(fd, &io->mmsg[0].msg_hdr, io->flags)) != -1) {
+          io->mmsg[0].msg_len = result;
+          result = 1;
+        }
+#endif
+        break;
+      case SHUSO_IO_OP_SENDMMSG:
+#ifdef SHUTTLESOCK_HAVE_MMSG
+        result = sendmmsg(fd, (struct mmsghdr *)io->mmsg, io->len, io->flags);
+#else
+        if((result = sendmsg(fd, &io->mmsg[0].msg_hdr, io->flags)) != -1) {
+          io->mmsg[0].msg_len = result;
+          result = 1;
+        }
+#endif
+        break;
+      case SHUSO_IO_OP_SPLICE:
+        //handled separately, unless the data would have to go through OpenSSL on either end
+        errno = EOPNOTSUPP;
+        result = -1;
+        break;
     }
-  } while(result == -1 && errno == EINTR);
+  } while(result == -1 && (errno == EINTR || (zerocopy_flag && ev_zerocopy_fallback(io))));
+  
+  if(zerocopy_flag && result != -1) {
+    io->zerocopy.sent++;
+  }
   
   shuso_io_update_fd_closed_status_from_op_result(io, op, result);
   
@@ -278,8 +727,7 @@ void shuso_io_ev_operation(shuso_io_t *io) {
       //legit error happened
       io->result = -1;
       io->error = errno;
-      shuso_io_op_cleanup(io);
-      shuso_io_run_handler(io);
+      shuso_io_ev_operation_finish(io);
       return;
     }
   }
@@ -289,10 +737,90 @@ void shuso_io_ev_operation(shuso_io_t *io) {
     shuso_io_ev_watch_update(io);
     return;
   }
-  shuso_io_op_cleanup(io);
   io->result += result;
-  shuso_io_run_handler(io);
+  shuso_io_ev_operation_finish(io);
   return;
 }
 
+static void shuso_io_ev_splice(shuso_io_t *io) {
+#ifdef SHUTTLESOCK_HAVE_SPLICE
+  int                 src_fd = io->io_socket.fd;
+  int                 dst_fd = io->splice.dst->io_socket.fd;
+  shuso_io_pipe_t    *pipe = io->splice.pipe;
+  ssize_t             n;
+  
+  while(1) {
+    if(io->splice.buffered > 0) {
+      //pipe -> destination
+      n = splice(pipe->fd[0], NULL, dst_fd, NULL, io->splice.buffered, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if(n == -1) {
+        if(errno == EINTR) {
+          continue;
+        }
+        if(errno == EAGAIN || errno == EWOULDBLOCK) {
+          io->watch_type = SHUSO_IO_WATCH_OP_RETRY;
+          shuso_io_ev_watch_update(io);
+          return;
+        }
+        break;
+      }
+      io->splice.buffered -= n;
+      io->result += n;
+      io->len -= n;
+      if(io->splice.buffered == 0 && (io->len == 0 || !io->op_repeat_to_completion)) {
+        shuso_io_ev_operation_finish(io);
+        return;
+      }
+      continue;
+    }
+    
+    //source -> pipe
+    n = splice(src_fd, NULL, pipe->fd[1], NULL, io->len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if(n == -1) {
+      if(errno == EINTR) {
+        continue;
+      }
+      if(errno == EAGAIN || errno == EWOULDBLOCK) {
+        io->watch_type = SHUSO_IO_WATCH_OP_RETRY;
+        shuso_io_ev_watch_update(io);
+        return;
+      }
+      break;
+    }
+    shuso_io_update_fd_closed_status_from_op_result(io, SHUSO_IO_OP_READ, n);
+    if(n == 0) {
+      //source closed. whatever we've moved so far is the result
+      shuso_io_ev_operation_finish(io);
+      return;
+    }
+    io->splice.buffered = n;
+  }
+#else
+  errno = ENOSYS;
+#endif
+  //legit error happened
+  io->result = -1;
+  io->error = errno;
+  shuso_io_ev_operation_finish(io);
+}
+
+static void shuso_io_ev_operation_finish(shuso_io_t *io) {
+#ifdef SHUTTLESOCK_HAVE_MSG_ZEROCOPY
+  if(io->zerocopy.completed != io->zerocopy.sent && !ev_zerocopy_receive_completions(io)) {
+    //the kernel still has the buffer. don't resume the coroutine until it lets go.
+    io->watch_type = SHUSO_IO_WATCH_OP_ZEROCOPY_FINISH;
+    shuso_io_ev_watch_update(io);
+    return;
+  }
+  if(io->deadline_expired) {
+    //the deadline went off while the completions were pending
+    io->deadline_expired = 0;
+    io->result = -1;
+    io->error = ETIMEDOUT;
+  }
+#endif
+  shuso_io_op_cleanup(io);
+  shuso_io_run_handler(io);
+}
+
 
@@ -5,5 +5,7 @@ void shuso_io_ev_operation(shuso_io_t *io);
 
 void shuso_io_ev_watch_update(shuso_io_t *io);
 
+bool shuso_io_ev_set_zerocopy(shuso_io_t *io, bool enabled);
+
 void shuso_io_ev_init_socket(shuso_t *S, shuso_io_t *io, shuso_socket_t *sock, int readwrite, shuso_io_fn *coro, void *privdata);
 #endif
@@ -1,9 +1,16 @@
+#include <shuttlesock/build_config.h>
+#ifdef SHUTTLESOCK_HAVE_SPLICE
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#endif
 #include <shuttlesock.h>
 #include "io_private.h"
 #ifdef SHUTTLESOCK_HAVE_IO_URING
 
 #include <liburing.h>
 #include <poll.h>
+#include <fcntl.h>
 
 static void io_uring_cqe_op_handler(shuso_t *S, int32_t ret, uint32_t flags, shuso_io_uring_handle_t *handle, void *pd);
 static void io_uring_cqe_timeout_handler(shuso_t *S, int32_t ret, uint32_t flags, shuso_io_uring_handle_t *handle, void *pd);
@@ -13,6 +20,29 @@ void shuso_io_uring_init_socket(shuso_t *S, shuso_io_t *io, shuso_socket_t *sock
   //TODO: register socket maybe? for now, nothing.
 }
 
+bool shuso_io_uring_set_zerocopy(shuso_io_t *io, bool enabled) {
+#ifdef IORING_CQE_F_NOTIF
+  shuso_t *S = io->S;
+  if(!enabled) {
+    return true;
+  }
+  if(S->io_uring.zerocopy_supported == SHUSO_MAYBE) {
+    //liburing may know about the zero-copy ops while the kernel doesn't. ask the ring, once.
+    struct io_uring_probe *probe = io_uring_get_probe_ring(&S->io_uring.ring);
+    if(probe && io_uring_opcode_supported(probe, IORING_OP_SEND_ZC) && io_uring_opcode_supported(probe, IORING_OP_SENDMSG_ZC)) {
+      S->io_uring.zerocopy_supported = SHUSO_YES;
+    }
+    else {
+      S->io_uring.zerocopy_supported = SHUSO_NO;
+    }
+    free(probe);
+  }
+  return S->io_uring.zerocopy_supported == SHUSO_YES;
+#else
+  return !enabled;
+#endif
+}
+
 void shuso_io_uring_operation(shuso_io_t *io) {
   shuso_io_opcode_t       op = io->opcode;
   int                     fd = io->io_socket.fd;
@@ -44,30 +74,71 @@ void shuso_io_uring_operation(shuso_io_t *io) {
       io_uring_prep_read(sqe, fd, io->buf, io->len, 0);
       break;
     case SHUSO_IO_OP_WRITE:
+#ifdef IORING_CQE_F_NOTIF
+      if(io->op_zerocopy) {
+        io_uring_prep_send_zc(sqe, fd, io->buf, io->len, 0, 0);
+        break;
+      }
+#endif
       io_uring_prep_write(sqe, fd, io->buf, io->len, 0);
       break;
     case SHUSO_IO_OP_READV:
       io_uring_prep_readv(sqe, fd, io->iov, io->iovcnt, 0);
       break;
     case SHUSO_IO_OP_WRITEV:
+      //there's no zero-copy writev. we'd need a msghdr that outlives this call to use sendmsg_zc, so just copy.
+      io->op_zerocopy = 0;
       io_uring_prep_writev(sqe, fd, io->iov, io->iovcnt, 0);
       break;
     case SHUSO_IO_OP_SENDMSG:
+#ifdef IORING_CQE_F_NOTIF
+      if(io->op_zerocopy) {
+        io_uring_prep_sendmsg_zc(sqe, fd, io->msg, io->flags);
+        break;
+      }
+#endif
       io_uring_prep_sendmsg(sqe, fd, io->msg, io->flags);
       break;
     case SHUSO_IO_OP_RECVMSG:
       io_uring_prep_recvmsg(sqe, fd, io->msg, io->flags);
       break;
     case SHUSO_IO_OP_RECVFROM:
-      //TODO: implement via recvmsg
+      iors->iov = (struct iovec ) {.iov_base = io->buf, .iov_len = io->len};
+      iors->msg = (struct msghdr ) {
+        .msg_name = io->sockaddr,
+        .msg_namelen = io->sockaddr ? sizeof(*io->sockaddr) : 0,
+        .msg_iov = &iors->iov,
+        .msg_iovlen = 1
+      };
+      io_uring_prep_recvmsg(sqe, fd, &iors->msg, io->flags);
       break;
     case SHUSO_IO_OP_RECV:
       io_uring_prep_recv(sqe, fd, io->buf, io->len, io->flags);
       break;
-    case SHUSO_IO_OP_SENDTO: 
-      //TODO: implement via sendmsg
+    case SHUSO_IO_OP_SENDTO:
+      iors->iov = (struct iovec ) {.iov_base = io->buf, .iov_len = io->len};
+      iors->msg = (struct msghdr ) {
+        .msg_name = io->sockaddr,
+        .msg_namelen = io->sockaddr ? shuso_io_af_sockaddrlen(io->sockaddr->any.sa_family) : 0,
+        .msg_iov = &iors->iov,
+        .msg_iovlen = 1
+      };
+      io_uring_prep_sendmsg(sqe, fd, &iors->msg, io->flags);
+      break;
+    case SHUSO_IO_OP_RECVMMSG:
+      //there's no batched recvmsg in io_uring. one datagram per completion
+      io_uring_prep_recvmsg(sqe, fd, &io->mmsg[0].msg_hdr, io->flags);
+      break;
+    case SHUSO_IO_OP_SENDMMSG:
+      io_uring_prep_sendmsg(sqe, fd, &io->mmsg[0].msg_hdr, io->flags);
       break;
     case SHUSO_IO_OP_SEND:
+#ifdef IORING_CQE_F_NOTIF
+      if(io->op_zerocopy) {
+        io_uring_prep_send_zc(sqe, fd, io->buf, io->len, io->flags, 0);
+        break;
+      }
+#endif
       io_uring_prep_send(sqe, fd, io->buf, io->len, io->flags);
       break;
     case SHUSO_IO_OP_CONNECT: {
@@ -96,6 +167,23 @@ void shuso_io_uring_operation(shuso_io_t *io) {
     case SHUSO_IO_OP_SHUTDOWN:
       //TODO: uuh... how do I implement this?...
       break;
+    case SHUSO_IO_OP_SPLICE:
+      if(io->splice.buffered > 0) {
+        io_uring_prep_splice(sqe, io->splice.pipe->fd[0], -1, io->splice.dst->io_socket.fd, -1, io->splice.buffered, SPLICE_F_MOVE);
+      }
+      else {
+        io_uring_prep_splice(sqe, fd, -1, io->splice.pipe->fd[1], -1, io->len, SPLICE_F_MOVE);
+      }
+      break;
+    case SHUSO_IO_OP_SENDFILE:
+      //no sendfile in io_uring. splice file -> pipe -> socket instead
+      if(io->splice.buffered > 0) {
+        io_uring_prep_splice(sqe, io->splice.pipe->fd[0], -1, fd, -1, io->splice.buffered, SPLICE_F_MOVE);
+      }
+      else {
+        io_uring_prep_splice(sqe, io->sendfile.fd, io->sendfile.offset, io->splice.pipe->fd[1], -1, io->len, SPLICE_F_MOVE);
+      }
+      break;
   }
   iors->sqe_opcode = sqe->opcode;
   iors->sqe_flags = sqe->flags;
@@ -108,6 +196,11 @@ static short io_uring_poll_mask(shuso_io_t *io) {
   switch(io->watch_type) {
     case SHUSO_IO_WATCH_NONE:
       return 0;
+    
+    case SHUSO_IO_WATCH_OP_ZEROCOPY_FINISH:
+      //io_uring posts a notification CQE for these, there's nothing to poll for
+      raise(SIGABRT);
+      return 0;
       
     case SHUSO_IO_WATCH_POLL_READ:
       return POLLIN;
@@ -131,6 +224,7 @@ static short io_uring_poll_mask(shuso_io_t *io) {
         case SHUSO_IO_OP_RECVFROM:
         case SHUSO_IO_OP_RECVMSG:
         case SHUSO_IO_OP_RECV:
+        case SHUSO_IO_OP_RECVMMSG:
           return POLLIN;
         
         case SHUSO_IO_OP_WRITEV:
@@ -138,12 +232,15 @@ static short io_uring_poll_mask(shuso_io_t *io) {
         case SHUSO_IO_OP_SENDTO:
         case SHUSO_IO_OP_SENDMSG:
         case SHUSO_IO_OP_SEND:
+        case SHUSO_IO_OP_SENDMMSG:
           return POLLOUT;
           
         case SHUSO_IO_OP_ACCEPT:
         case SHUSO_IO_OP_CONNECT:
         case SHUSO_IO_OP_CLOSE:
         case SHUSO_IO_OP_SHUTDOWN:
+        case SHUSO_IO_OP_SPLICE:
+        case SHUSO_IO_OP_SENDFILE:
           //not supposed to happen, as io_uring performs these to completion... right?...
           raise(SIGABRT);
           return 0;
@@ -248,9 +345,74 @@ static const char *shuso_io_uring_strerror(int error, uint8_t sqe_opcode, uint8_
 }
 
 
+static void io_uring_splice_step(shuso_io_t *io, int32_t ret) {
+  if(io->splice.buffered == 0) {
+    //source -> pipe finished
+    if(io->opcode == SHUSO_IO_OP_SENDFILE) {
+      io->sendfile.offset += ret;
+    }
+    else {
+      shuso_io_update_fd_closed_status_from_op_result(io, SHUSO_IO_OP_READ, ret);
+    }
+    if(ret == 0) {
+      //source closed or file ended. whatever we've moved so far is the result
+      shuso_io_op_cleanup(io);
+      shuso_io_run_handler(io);
+      return;
+    }
+    io->splice.buffered = ret;
+  }
+  else {
+    //pipe -> destination finished
+    if(ret == 0) {
+      io->result = -1;
+      io->error = EPIPE;
+      shuso_io_op_cleanup(io);
+      shuso_io_run_handler(io);
+      return;
+    }
+    io->splice.buffered -= ret;
+    io->result += ret;
+    io->len -= ret;
+    if(io->splice.buffered == 0 && (io->len == 0 || !io->op_repeat_to_completion)) {
+      shuso_io_op_cleanup(io);
+      shuso_io_run_handler(io);
+      return;
+    }
+  }
+  shuso_io_uring_operation(io);
+}
+
+static void io_uring_op_finish(shuso_io_t *io) {
+  if(io->zerocopy.completed != io->zerocopy.sent) {
+    //don't resume until the kernel lets go of the buffer, even if the op failed. the result (or error) waits with it,
+    //and the io has to stay around for the notifications anyway
+    io->uring.zerocopy_finish_pending = 1;
+    return;
+  }
+  shuso_io_op_cleanup(io);
+  shuso_io_run_handler(io);
+}
+
 static void io_uring_cqe_op_handler(shuso_t *S, int32_t ret, uint32_t flags, shuso_io_uring_handle_t *handle, void *pd) {
   shuso_io_t             *io = pd;
   shuso_io_opcode_t       op = io->opcode;
+#ifdef IORING_CQE_F_NOTIF
+  if(flags & IORING_CQE_F_NOTIF) {
+    //the kernel is done with a zero-copy send buffer
+    io->zerocopy.completed++;
+    if(io->uring.zerocopy_finish_pending && io->zerocopy.completed == io->zerocopy.sent) {
+      io->uring.zerocopy_finish_pending = 0;
+      shuso_io_op_cleanup(io);
+      shuso_io_run_handler(io);
+    }
+    return;
+  }
+  if(flags & IORING_CQE_F_MORE) {
+    //a notification CQE will follow once the buffer is released
+    io->zerocopy.sent++;
+  }
+#endif
   assert(io->uring.active);
   io->uring.active = false;
   assert(S == io->S);
@@ -259,18 +421,31 @@ static void io_uring_cqe_op_handler(shuso_t *S, int32_t ret, uint32_t flags, shu
     io->result = -1;
     io->error = -ret;
     io->strerror = shuso_io_uring_strerror(io->error, io->uring.sqe_opcode, io->uring.sqe_flags);
+    io_uring_op_finish(io);
+    return;
+  }
+  else if(op == SHUSO_IO_OP_SPLICE || op == SHUSO_IO_OP_SENDFILE) {
+    io_uring_splice_step(io, ret);
     return;
   }
+  else if(op == SHUSO_IO_OP_RECVMMSG || op == SHUSO_IO_OP_SENDMMSG) {
+    //one datagram at a time
+    io->mmsg[0].msg_len = ret;
+    if(op == SHUSO_IO_OP_SENDMMSG && io->op_repeat_to_completion && !shuso_io_op_update_and_check_completion(io, 1)) {
+      io->result += 1;
+      shuso_io_uring_operation(io);
+      return;
+    }
+    ret = 1;
+  }
   else if(ret != 0 && io->op_repeat_to_completion && !shuso_io_op_update_and_check_completion(io, ret)) {
     io->watch_type = SHUSO_IO_WATCH_OP_RETRY;
     io->result += ret;
     shuso_io_uring_watch_update(io);
     return;
   }
-  shuso_io_op_cleanup(io);
   io->result += ret;
-  shuso_io_run_handler(io);
-  return;
+  io_uring_op_finish(io);
 }
 
 static void io_uring_cqe_cancel_handler(shuso_t *S, int32_t ret, uint32_t flags, shuso_io_uring_handle_t *handle, void *pd) {
@@ -7,10 +7,12 @@
 void shuso_io_uring_watch_update(shuso_io_t *io);
 void shuso_io_uring_init_socket(shuso_t *S, shuso_io_t *io, shuso_socket_t *sock, int readwrite, shuso_io_fn *coro, void *privdata);
 void shuso_io_uring_operation(shuso_io_t *io);
+bool shuso_io_uring_set_zerocopy(shuso_io_t *io, bool enabled);
 #else
 #define shuso_io_uring_watch_update(...)
 #define shuso_io_uring_init_socket(...)
 #define shuso_io_uring_operation(...)
+#define shuso_io_uring_set_zerocopy(...) false
 #endif
 
 #endif //SHUTTLESOCK_IO_LIBURING_H
@@ -635,6 +635,25 @@ bool shuso_ipc_send_fd(shuso_t *S, shuso_process_t *dst_proc, int fd, uintptr_t
   return true;
 }
 
+static void ipc_send_fd_close_cleanup(shuso_t *S, shuso_buffer_t *buf, shuso_buffer_link_t *link, void *pd) {
+  close((int )(intptr_t )pd);
+}
+
+bool shuso_ipc_send_fd_and_close(shuso_t *S, shuso_process_t *dst_proc, int fd, uintptr_t ref, void *pd) {
+  uintptr_t buf[2] = {ref, (uintptr_t )pd};
+  
+  shuso_io_send_t  *send = &S->ipc.io.send[dst_proc->procnum];
+  char             *iov_bufspace = shuso_buffer_add_msg_fd_with_cleanup(S, &send->fd_msg_buf, fd, sizeof(buf), ipc_send_fd_close_cleanup, (void *)(intptr_t )fd);
+  if(!iov_bufspace) {
+    return shuso_set_error(S, "failed to send fd: no space for fd buffer link");
+  }
+  memcpy(iov_bufspace, buf, sizeof(buf));
+  
+  shuso_io_resume(&send->fd);
+  
+  return true;
+}
+
 int shuso_ipc_receive_fd_start(shuso_t *S, const char *description, float timeout_sec, shuso_ipc_receive_fd_fn *callback, void *pd) {
   
   union {
@@ -22,6 +22,9 @@ static void signal_handle(shuso_t *S, const uint8_t code, void *ptr) {
     case SIGQUIT:
       shuso_ipc_send(S, &S->common->process.manager, SHUTTLESOCK_IPC_CMD_SHUTDOWN, NULL); 
       break;
+    case SIGUSR2:
+      shuso_upgrade_start(S);
+      break;
     default:
       //ignore
       break;
@@ -216,6 +216,25 @@ static bool core_module_initialize_config(shuso_t *S, shuso_module_t *module, sh
     return shuso_config_value_error(S, workers, 0);
   }
   
+  shuso_setting_t  *cpu_affinity = shuso_setting(S, block, "worker_cpu_affinity");
+  bool              cpu_affinity_val;
+  if(!shuso_setting_boolean(S, cpu_affinity, 0, &cpu_affinity_val)) {
+    return shuso_config_value_error(S, cpu_affinity, 0);
+  }
+#ifndef SHUTTLESOCK_HAVE_CPU_AFFINITY
+  if(cpu_affinity_val) {
+    return shuso_config_error(S, cpu_affinity, "CPU affinity is not supported in this build of Shuttlesock");
+  }
+#endif
+  S->common->config.worker_cpu_affinity = cpu_affinity_val;
+  
+  shuso_setting_t  *timer_resolution = shuso_setting(S, block, "timer_resolution");
+  double            resolution_sec;
+  if(!shuso_setting_time_sec(S, timer_resolution, 0, &resolution_sec) || resolution_sec <= 0) {
+    return shuso_config_value_error(S, timer_resolution, 0);
+  }
+  S->common->config.timer_resolution = resolution_sec;
+  
   shuso_setting_t  *io_uring_setting = shuso_setting(S, block, "io_uring");
   bool              io_uring_setting_val;
   if(shuso_setting_string_matches(S, io_uring_setting, 0, "^auto$")) {
@@ -314,6 +333,22 @@ shuso_module_t shuso_core_module = {
       .nargs = "1"
     },
     
+    {
+      .name = "worker_cpu_affinity",
+      .path = "/",
+      .description = "Pin each worker to its own CPU core. Worker n runs on CPU n, wrapping around if there are more workers than cores.",
+      .default_value = "off",
+      .nargs = "1"
+    },
+    
+    {
+      .name = "timer_resolution",
+      .path = "/",
+      .description = "Granularity of connection timeouts and other coarse timers. Finer resolution means more frequent wakeups while such timers are pending.",
+      .default_value = "100ms",
+      .nargs = "1"
+    },
+    
     {
       .name = "io_uring",
       .path = "/",
@@ -111,6 +111,7 @@ bool shuso_core_io_uring_setup(shuso_t *S) {
   //initial state: assi,e io_uring has not bee set up
   S->io_uring.on = false;
   S->io_uring.eventfd = -1;
+  S->io_uring.zerocopy_supported = SHUSO_MAYBE;
   
   if(enabled == SHUSO_NO) {
     return true;
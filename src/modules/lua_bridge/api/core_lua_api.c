@@ -17,12 +17,17 @@ typedef enum {
   LUA_EV_WATCHER_IO =       0,
   LUA_EV_WATCHER_TIMER =    1,
   LUA_EV_WATCHER_CHILD =    2,
-  LUA_EV_WATCHER_SIGNAL =   3
+  LUA_EV_WATCHER_SIGNAL =   3,
+  LUA_EV_WATCHER_TIMEOUT =  4  //one-shot timer on the worker's timer wheel
 } shuso_lua_ev_watcher_type_t;
 
 
 typedef struct shuso_lua_ev_watcher_s {
   shuso_ev_any      watcher;
+  struct {
+    shuso_timer_t     timer;
+    double            after;
+  }                 timeout;
   struct {
     int               self;
     int               handler;
@@ -346,11 +351,28 @@ static const char *watchertype_str(shuso_lua_ev_watcher_type_t type) {
       return "child";
     case LUA_EV_WATCHER_SIGNAL:
       return "signal";
+    case LUA_EV_WATCHER_TIMEOUT:
+      return "timeout";
     default:
       return "???";
   }
 }
 
+static bool lua_watcher_active(shuso_lua_ev_watcher_t *w) {
+  if(w->type == LUA_EV_WATCHER_TIMEOUT) {
+    return shuso_timer_active(&w->timeout.timer);
+  }
+  return ev_is_active(&w->watcher.watcher);
+}
+
+static bool lua_watcher_pending(shuso_lua_ev_watcher_t *w) {
+  if(w->type == LUA_EV_WATCHER_TIMEOUT) {
+    //timer wheel callbacks are run right away, they're never pending
+    return false;
+  }
+  return ev_is_pending(&w->watcher.watcher);
+}
+
 static int Lua_watcher_gc(lua_State *L) {
   shuso_lua_ev_watcher_t *w = luaL_checkudata(L, 1, "shuttlesock.watcher");
   if(w->ref.self != LUA_NOREF) {
@@ -361,10 +383,7 @@ static int Lua_watcher_gc(lua_State *L) {
   lua_watcher_unref(L, w);
   return 0;
 }
-static void watcher_callback(struct ev_loop *loop, ev_watcher *watcher, int events) {
-  shuso_t                *S = shuso_state(loop, watcher);
-
-  shuso_lua_ev_watcher_t *w = watcher->data;
+static void lua_watcher_run(shuso_t *S, shuso_lua_ev_watcher_t *w) {
   lua_State              *L = S->lua.state;
   lua_State              *coro = NULL;
   bool                    handler_is_coroutine;
@@ -393,6 +412,7 @@ static void watcher_callback(struct ev_loop *loop, ev_watcher *watcher, int even
   
   if((handler_is_coroutine && rc == LUA_OK) /* coroutine is finished */
    ||(w->type == LUA_EV_WATCHER_TIMER && w->watcher.timer.ev.repeat == 0.0) /* timer is finished */
+   ||(w->type == LUA_EV_WATCHER_TIMEOUT && !shuso_timer_active(&w->timeout.timer)) /* timeout is finished, and wasn't restarted */
   ) {
     lua_pushcfunction(L, Lua_watcher_stop);
     lua_rawgeti(L, LUA_REGISTRYINDEX, w->ref.self);
@@ -405,12 +425,21 @@ static void watcher_callback(struct ev_loop *loop, ev_watcher *watcher, int even
   }
 }
 
+static void watcher_callback(struct ev_loop *loop, ev_watcher *watcher, int events) {
+  shuso_t                *S = shuso_state(loop, watcher);
+  lua_watcher_run(S, watcher->data);
+}
+
+static void timeout_watcher_callback(shuso_t *S, shuso_timer_t *timer, void *pd) {
+  lua_watcher_run(S, pd);
+}
+
 static int Lua_watcher_set(lua_State *L) {
   shuso_t                *S = shuso_state(L);
   int                     nargs = lua_gettop(L);
   shuso_lua_ev_watcher_t *w = luaL_checkudata(L, 1, "shuttlesock.watcher");
   
-  if(ev_is_active(&w->watcher.watcher) || ev_is_pending(&w->watcher.watcher)) {
+  if(lua_watcher_active(w) || lua_watcher_pending(w)) {
     return luaL_error(L, "cannot call %s watcher:set(), the event is already active", watchertype_str(w->type));
   }
   
@@ -452,6 +481,14 @@ static int Lua_watcher_set(lua_State *L) {
       shuso_ev_timer_init(S, &w->watcher.timer, after, repeat, (shuso_ev_timer_fn *)watcher_callback, w);
     } break;
     
+    case LUA_EV_WATCHER_TIMEOUT: {
+      if(nargs-1 < 1 || nargs-1 > 2) {
+        return luaL_error(L, "timeout watcher:set() expects 1-2 arguments");
+      }
+      w->timeout.after = luaL_checknumber(L, 2);
+      shuso_timer_init(&w->timeout.timer, timeout_watcher_callback, w);
+    } break;
+    
     case LUA_EV_WATCHER_SIGNAL: {
       if(nargs-1 < 1 || nargs-1>2) {
         return luaL_error(L, "signal watcher:set() expects 1-2 arguments");
@@ -535,7 +572,7 @@ static void lua_watcher_unref(lua_State *L, shuso_lua_ev_watcher_t *w) {
 static int Lua_watcher_start(lua_State *L) {
   shuso_t                *S = shuso_state(L);
   shuso_lua_ev_watcher_t *w = luaL_checkudata(L, 1, "shuttlesock.watcher");
-  if(ev_is_active(&w->watcher.watcher)) {
+  if(lua_watcher_active(w)) {
     return luaL_error(L, "shuttlesock.watcher already active");
   }
   if(w->ref.handler == LUA_NOREF) {
@@ -554,6 +591,9 @@ static int Lua_watcher_start(lua_State *L) {
     case LUA_EV_WATCHER_CHILD:
       shuso_ev_child_start(S, &w->watcher.child);
       break;
+    case LUA_EV_WATCHER_TIMEOUT:
+      shuso_timer_start(&S->timer_wheel, &w->timeout.timer, w->timeout.after);
+      break;
   }
   lua_watcher_ref(L, w, 1);
   lua_pushvalue(L, 1);
@@ -576,6 +616,9 @@ static int Lua_watcher_stop(lua_State *L) {
     case LUA_EV_WATCHER_CHILD:
       shuso_ev_child_stop(S, &w->watcher.child);
       break;
+    case LUA_EV_WATCHER_TIMEOUT:
+      shuso_timer_stop(&S->timer_wheel, &w->timeout.timer);
+      break;
   }
   lua_watcher_unref(L, w);
   lua_pushvalue(L, 1);
@@ -642,6 +685,12 @@ static int Lua_watcher_newindex(lua_State *L) {
       w->watcher.timer.ev.repeat = luaL_checknumber(L, 3);
     }
   }
+  else if(w->type == LUA_EV_WATCHER_TIMEOUT) {
+    //watcher.after=(float), takes effect the next time it's started
+    if(luaS_streq_literal(L, 2, "after")) {
+      w->timeout.after = luaL_checknumber(L, 3);
+    }
+  }
   else {
     return luaL_error(L, "don't know how to set shuttlesock %s watcher field \"%s\"", watchertype_str(w->type), lua_tostring(L, 2));
   }
@@ -667,11 +716,11 @@ static int Lua_watcher_index(lua_State *L) {
     return 1;
   }
   else if(luaS_streq_literal(L, 2, "active")) {
-    lua_pushboolean(L, ev_is_active(&w->watcher.watcher) || ev_is_pending(&w->watcher.watcher));
+    lua_pushboolean(L, lua_watcher_active(w) || lua_watcher_pending(w));
     return 1;
   }
   else if(luaS_streq_literal(L, 2, "pending")) {
-    lua_pushboolean(L, ev_is_pending(&w->watcher.watcher));
+    lua_pushboolean(L, lua_watcher_pending(w));
     return 1;
   }
   else if(luaS_streq_literal(L, 2, "handler")) {
@@ -720,6 +769,16 @@ static int Lua_watcher_index(lua_State *L) {
     return 1;
   }
   
+  else if(w->type == LUA_EV_WATCHER_TIMEOUT) {
+    if(luaS_streq_literal(L, 2, "after")) {
+      lua_pushnumber(L, w->timeout.after);
+    }
+    else if(luaS_streq_literal(L, 2, "remaining")) {
+      lua_pushnumber(L, shuso_timer_remaining(&shuso_state(L)->timer_wheel, &w->timeout.timer));
+    }
+    return 1;
+  }
+  
   else if(w->type == LUA_EV_WATCHER_SIGNAL) {
     if(luaS_streq_literal(L, 2, "signum")) {
       lua_pushinteger(L, w->watcher.signal.ev.signum);
@@ -759,6 +818,9 @@ int Lua_shuso_new_watcher(lua_State *L) {
   else if(luaS_streq_literal(L, 1, "signal")) {
     wtype = LUA_EV_WATCHER_SIGNAL;
   }
+  else if(luaS_streq_literal(L, 1, "timeout")) {
+    wtype = LUA_EV_WATCHER_TIMEOUT;
+  }
   else {
     return luaL_error(L, "invalid watcher type \"%s\"", lua_tostring(L, 1));
   }
@@ -769,6 +831,8 @@ int Lua_shuso_new_watcher(lua_State *L) {
   }
   
   memset(&watcher->watcher, 0, sizeof(watcher->watcher));
+  shuso_timer_init(&watcher->timeout.timer, timeout_watcher_callback, watcher);
+  watcher->timeout.after = 0;
   watcher->type = wtype;
   watcher->ref.handler = LUA_NOREF;
   watcher->ref.self = LUA_NOREF;
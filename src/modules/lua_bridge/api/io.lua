@@ -96,7 +96,7 @@ local io_mt = {
 }
 
 function IO.wrap(init, io_handler)
-  local fd, hostname, family, path, name, port, address, address_binary, socktype, sockopts, readwrite
+  local fd, hostname, family, path, name, port, address, address_binary, socktype, sockopts, readwrite, accepted, tls, tls_offload
   
   if type(init) == "integer" then
     fd = init
@@ -127,6 +127,9 @@ function IO.wrap(init, io_handler)
     socktype = init.type or init.socktype
     sockopts = init.sockopts
     readwrite = init.readwrite or init.rw or "rw"
+    accepted = init.accepted
+    tls = init.tls
+    tls_offload = init.tls_offload
     
     if not name then
       if path then
@@ -204,7 +207,10 @@ function IO.wrap(init, io_handler)
       port = port,
       type = socktype,
       sockopts = sockopts,
-      readwrite = readwrite
+      readwrite = readwrite,
+      accepted = accepted,
+      tls = tls,
+      tls_offload = tls_offload
     }
     
     if not fd or fd == -1 then
@@ -270,6 +270,7 @@ static int Lua_shuso_io_gc(lua_State *L) {
   shuso_io_t            *io = luaL_checkudata(L, 1, "shuttlesock.core.io");
   shuso_lua_io_data_t   *d = io->privdata;
   shuso_io_abort(io);
+  shuso_io_forget_connection(io);
   if(io->io_socket.fd != -1) {
     close(io->io_socket.fd);
     io->io_socket.fd = -1;
@@ -363,6 +364,18 @@ int Lua_shuso_io_create(lua_State *L) {
   socket.fd = lua_tointeger(L, -1);
   lua_pop(L, 1);
   
+  lua_getfield(L, 1, "accepted");
+  socket.accepted = lua_toboolean(L, -1);
+  lua_pop(L, 1);
+  
+  lua_getfield(L, 1, "tls");
+  socket.tls = lua_islightuserdata(L, -1) ? (void *)lua_topointer(L, -1) : NULL;
+  lua_pop(L, 1);
+  
+  lua_getfield(L, 1, "tls_offload");
+  socket.tls_offload = lua_tointeger(L, -1);
+  lua_pop(L, 1);
+  
   
   socket.host.type = SOCK_STREAM; //assume stream by default
   luaS_getfield_any(L, 1, 2, "udp", "UDP");
@@ -9,6 +9,11 @@ function Watcher.timer(after_sec, handler)
   return Core.new_watcher("timer", after_sec, handler)
 end
 
+function Watcher.timeout(after_sec, handler)
+  -- coarse one-shot timer on the worker's timer wheel. cheap to start and stop, for lots of timeouts
+  return Core.new_watcher("timeout", after_sec, handler)
+end
+
 function Watcher.child(signum, trace, handler)
   return Core.new_watcher("child", signum, trace, handler)
 end
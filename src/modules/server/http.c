@@ -0,0 +1,602 @@
+#include <shuttlesock.h>
+#include "http.h"
+#include "http2.h"
+#include <picohttpparser.h>
+#include <strings.h>
+#include <errno.h>
+#include <stdio.h>
+
+struct shuso_http_connection_s {
+  shuso_connection_t         *connection; //its pool is the request pool, and this is allocated from it
+  shuso_event_t              *request_event;
+  shuso_http_request_t        request;
+  int                         pool_level;
+  char                       *buf; //the connection's, kept in sync with it
+  size_t                      size;
+  size_t                      len; //bytes in buf. the current request always starts at buf[0]
+  size_t                      parsed_len; //bytes the header parser has already seen
+  size_t                      header_len; //of the current request, once it's been parsed
+  size_t                      body_len; //Content-Length, or bytes dechunked so far
+  struct phr_chunked_decoder  chunked;
+  struct phr_header           phr_headers[SHUSO_HTTP_MAX_HEADERS];
+  struct iovec                response[2];
+  int                         response_iovcnt;
+  int                         error_status; //status of an error response the connection closes after
+  unsigned                    waiting:1; //for a response to the current request
+  unsigned                    chunked_body:1;
+  unsigned                    expect_continue:1;
+  unsigned                    first_request:1; //the only one that can start with the HTTP/2 preface
+};
+
+//http_parse_headers() result for an HTTP/2 connection preface
+#define HTTP_PARSE_HTTP2 -3
+
+static const char http_continue_response[] = "HTTP/1.1 100 Continue\r\n\r\n";
+
+static const char *http_status_reason(int status) {
+  switch(status) {
+    case 100: return "Continue";
+    case 200: return "OK";
+    case 201: return "Created";
+    case 202: return "Accepted";
+    case 204: return "No Content";
+    case 206: return "Partial Content";
+    case 301: return "Moved Permanently";
+    case 302: return "Found";
+    case 303: return "See Other";
+    case 304: return "Not Modified";
+    case 307: return "Temporary Redirect";
+    case 308: return "Permanent Redirect";
+    case 400: return "Bad Request";
+    case 401: return "Unauthorized";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 408: return "Request Timeout";
+    case 409: return "Conflict";
+    case 411: return "Length Required";
+    case 413: return "Payload Too Large";
+    case 414: return "URI Too Long";
+    case 429: return "Too Many Requests";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    case 502: return "Bad Gateway";
+    case 503: return "Service Unavailable";
+    case 504: return "Gateway Timeout";
+    default:  return "Unknown";
+  }
+}
+
+static bool http_header_is(const shuso_http_header_t *h, const char *name) {
+  size_t len = strlen(name);
+  return h->name_len == len && strncasecmp(h->name, name, len) == 0;
+}
+
+static bool http_header_value_next_token(const shuso_http_header_t *h, const char **cur, const char **tok, size_t *tok_len) {
+  //comma-separated. *cur starts out NULL
+  const char *end = h->value + h->value_len;
+  const char *c = *cur ? *cur : h->value;
+  while(c < end && (*c == ' ' || *c == '\t' || *c == ',')) {
+    c++;
+  }
+  if(c == end) {
+    *cur = c;
+    return false;
+  }
+  *tok = c;
+  while(c < end && *c != ',') {
+    c++;
+  }
+  *cur = c;
+  while(c > *tok && (c[-1] == ' ' || c[-1] == '\t')) {
+    c--;
+  }
+  *tok_len = c - *tok;
+  return true;
+}
+
+static bool http_token_is(const char *tok, size_t tok_len, const char *token) {
+  size_t len = strlen(token);
+  return tok_len == len && strncasecmp(tok, token, len) == 0;
+}
+
+static bool http_header_value_has_token(const shuso_http_header_t *h, const char *token) {
+  //case-insensitive
+  const char *cur = NULL, *tok;
+  size_t      tok_len;
+  while(http_header_value_next_token(h, &cur, &tok, &tok_len)) {
+    if(http_token_is(tok, tok_len, token)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+const shuso_http_header_t *shuso_http_request_header(const shuso_http_request_t *r, const char *name) {
+  for(size_t i = 0; i < r->header_count; i++) {
+    if(http_header_is(&r->headers[i], name)) {
+      return &r->headers[i];
+    }
+  }
+  return NULL;
+}
+
+static bool http_buffer_reserve(shuso_http_connection_t *c, size_t want) {
+  //make room for at least 'want' more bytes. the parsed request's strings point into the buffer, so they're moved along with it
+  shuso_http_request_t *r = &c->request;
+  uintptr_t             old = (uintptr_t )c->buf;
+  size_t                size = c->size;
+  char                 *buf;
+  if(c->len + want <= c->size) {
+    return true;
+  }
+  while(size < c->len + want) {
+    size *= 2;
+  }
+  if((buf = realloc(c->buf, size)) == NULL) {
+    return false;
+  }
+  c->buf = c->connection->buf = buf;
+  c->size = c->connection->size = size;
+  if((uintptr_t )buf != old && c->header_len > 0) {
+#define http_rebase(ptr) (ptr) = (const char *)((uintptr_t )(ptr) - old + (uintptr_t )buf)
+    http_rebase(r->method);
+    http_rebase(r->path);
+    for(size_t i = 0; i < r->header_count; i++) {
+      http_rebase(r->headers[i].name);
+      http_rebase(r->headers[i].value);
+    }
+#undef http_rebase
+  }
+  return true;
+}
+
+static size_t http_read_size(shuso_http_connection_t *c) {
+  if(c->header_len == 0 && c->size > SHUSO_HTTP_MAX_HEADER_SIZE) {
+    //don't read more than the biggest allowed header block while waiting for one
+    return c->len < SHUSO_HTTP_MAX_HEADER_SIZE ? SHUSO_HTTP_MAX_HEADER_SIZE - c->len : 0;
+  }
+  return c->size - c->len;
+}
+
+static int http_parse_transfer_encoding(const shuso_http_header_t *h) {
+  //0 for a chunked body, -1 if the body's length can't be told, or 501 for codings we can't decode
+  const char *cur = NULL, *tok;
+  size_t      tok_len;
+  unsigned    codings = 0, chunked = 0;
+  bool        last_chunked = false;
+  while(http_header_value_next_token(h, &cur, &tok, &tok_len)) {
+    codings++;
+    last_chunked = http_token_is(tok, tok_len, "chunked");
+    if(last_chunked) {
+      chunked++;
+    }
+  }
+  if(!last_chunked || chunked > 1) {
+    //chunked has to be the last coding applied, and only applied once. anything else doesn't say where the body ends
+    return -1;
+  }
+  return codings > 1 ? 501 : 0;
+}
+
+static int http_parse_headers(shuso_http_connection_t *c) {
+  //returns 0 when done, -1 for a bad request, -2 if incomplete, HTTP_PARSE_HTTP2, or the status of an error response
+  shuso_http_request_t  *r = &c->request;
+  size_t                 count = SHUSO_HTTP_MAX_HEADERS;
+  const shuso_http_header_t *h;
+  const shuso_http_header_t *transfer_encoding = NULL, *content_length = NULL;
+  int                    rc;
+
+  if(c->len == 0) {
+    return -2;
+  }
+  if(c->first_request) {
+    size_t len = c->len < SHUSO_HTTP2_PREFACE_LEN ? c->len : SHUSO_HTTP2_PREFACE_LEN;
+    if(memcmp(c->buf, SHUSO_HTTP2_PREFACE, len) == 0) {
+      return len == SHUSO_HTTP2_PREFACE_LEN ? HTTP_PARSE_HTTP2 : -2;
+    }
+  }
+  rc = phr_parse_request(c->buf, c->len, &r->method, &r->method_len, &r->path, &r->path_len, &r->minor_version, c->phr_headers, &count, c->parsed_len);
+  c->parsed_len = c->len;
+  if(rc == -2) {
+    return c->len >= SHUSO_HTTP_MAX_HEADER_SIZE ? 431 : -2;
+  }
+  if(rc == -1) {
+    //picohttpparser doesn't tell "too many headers" apart from other errors
+    return count == SHUSO_HTTP_MAX_HEADERS ? 431 : -1;
+  }
+
+  r->header_count = count;
+  if(count > 0) {
+    if((r->headers = shuso_palloc(r->pool, sizeof(*r->headers) * count)) == NULL) {
+      return 500;
+    }
+    //same layout, but it's not ours to rely on
+    for(size_t i = 0; i < count; i++) {
+      r->headers[i] = (shuso_http_header_t ) {
+        .name = c->phr_headers[i].name,
+        .name_len = c->phr_headers[i].name_len,
+        .value = c->phr_headers[i].value,
+        .value_len = c->phr_headers[i].value_len
+      };
+    }
+  }
+  c->header_len = rc;
+
+  r->major_version = 1;
+  r->keepalive = r->minor_version >= 1;
+  if((h = shuso_http_request_header(r, "connection")) != NULL) {
+    if(http_header_value_has_token(h, "close")) {
+      r->keepalive = false;
+    }
+    else if(http_header_value_has_token(h, "keep-alive")) {
+      r->keepalive = true;
+    }
+  }
+
+  //request smuggling territory: every framing header counts, not just the first one of each
+  for(size_t i = 0; i < r->header_count; i++) {
+    h = &r->headers[i];
+    if(http_header_is(h, "transfer-encoding")) {
+      if(transfer_encoding) {
+        return -1;
+      }
+      transfer_encoding = h;
+    }
+    else if(http_header_is(h, "content-length")) {
+      if(content_length && (h->value_len != content_length->value_len || memcmp(h->value, content_length->value, h->value_len) != 0)) {
+        return -1;
+      }
+      content_length = h;
+    }
+  }
+  if(transfer_encoding && content_length) {
+    return -1;
+  }
+
+  c->body_len = 0;
+  c->chunked_body = 0;
+  if((h = transfer_encoding) != NULL) {
+    if((rc = http_parse_transfer_encoding(h)) != 0) {
+      return rc;
+    }
+    c->chunked_body = 1;
+    memset(&c->chunked, 0, sizeof(c->chunked));
+    c->chunked.consume_trailer = 1;
+  }
+  else if((h = content_length) != NULL) {
+    size_t len = 0;
+    if(h->value_len == 0) {
+      return -1;
+    }
+    for(size_t i = 0; i < h->value_len; i++) {
+      if(h->value[i] < '0' || h->value[i] > '9') {
+        return -1;
+      }
+      len = len * 10 + (h->value[i] - '0');
+      if(len > SHUSO_HTTP_MAX_BODY_SIZE) {
+        return 413;
+      }
+    }
+    c->body_len = len;
+  }
+
+  c->expect_continue = 0;
+  if(r->minor_version >= 1 && (h = shuso_http_request_header(r, "expect")) != NULL && http_header_value_has_token(h, "100-continue")) {
+    c->expect_continue = 1;
+  }
+  return 0;
+}
+
+static int http_decode_chunked(shuso_http_connection_t *c) {
+  //dechunks in place, right behind the headers. returns 0 when done, -1 for a bad body, -2 if incomplete, or 413
+  size_t  decoded_end = c->header_len + c->body_len;
+  size_t  len = c->len - decoded_end;
+  ssize_t rc;
+  if(len == 0) {
+    return -2;
+  }
+  rc = phr_decode_chunked(&c->chunked, &c->buf[decoded_end], &len);
+  if(rc == -1) {
+    return -1;
+  }
+  c->body_len += len;
+  //whatever's left after the body (the next pipelined request) was moved up to right after the dechunked data
+  c->len = c->header_len + c->body_len + (rc >= 0 ? rc : 0);
+  if(c->body_len > SHUSO_HTTP_MAX_BODY_SIZE) {
+    return 413;
+  }
+  return rc >= 0 ? 0 : -2;
+}
+
+static bool http_response_prepare(shuso_http_request_t *r, int status, const shuso_http_header_t *headers, size_t header_count, const char *body, size_t body_len) {
+  shuso_http_connection_t *c = r->connection;
+  const char  *reason = http_status_reason(status);
+  const char  *connection_header = NULL;
+  size_t       head_size;
+  char        *head, *cur;
+  char        *body_copy = NULL;
+  bool         head_only = r->method && r->method_len == 4 && memcmp(r->method, "HEAD", 4) == 0;
+
+  if(!r->keepalive) {
+    connection_header = "Connection: close\r\n";
+  }
+  else if(r->minor_version == 0) {
+    connection_header = "Connection: keep-alive\r\n";
+  }
+
+  //"HTTP/1.1 NNN reason\r\n" + "Content-Length: N\r\n" + headers + "\r\n"
+  head_size = sizeof("HTTP/1.1 000 \r\n") + strlen(reason) + sizeof("Content-Length: 18446744073709551615\r\n") + 2;
+  if(connection_header) {
+    head_size += strlen(connection_header);
+  }
+  for(size_t i = 0; i < header_count; i++) {
+    head_size += headers[i].name_len + 2 + headers[i].value_len + 2;
+  }
+  if((head = shuso_palloc(r->pool, head_size)) == NULL) {
+    return false;
+  }
+  if(body_len > 0 && !head_only && (body_copy = shuso_palloc(r->pool, body_len)) == NULL) {
+    return false;
+  }
+
+  cur = head;
+  cur += sprintf(cur, "HTTP/1.1 %03d %s\r\nContent-Length: %zu\r\n", status, reason, body_len);
+  for(size_t i = 0; i < header_count; i++) {
+    memcpy(cur, headers[i].name, headers[i].name_len);
+    cur += headers[i].name_len;
+    *cur++ = ':';
+    *cur++ = ' ';
+    memcpy(cur, headers[i].value, headers[i].value_len);
+    cur += headers[i].value_len;
+    *cur++ = '\r';
+    *cur++ = '\n';
+  }
+  if(connection_header) {
+    memcpy(cur, connection_header, strlen(connection_header));
+    cur += strlen(connection_header);
+  }
+  *cur++ = '\r';
+  *cur++ = '\n';
+
+  c->response[0].iov_base = head;
+  c->response[0].iov_len = cur - head;
+  c->response_iovcnt = 1;
+  if(body_copy) {
+    memcpy(body_copy, body, body_len);
+    c->response[1].iov_base = body_copy;
+    c->response[1].iov_len = body_len;
+    c->response_iovcnt = 2;
+  }
+  r->responded = true;
+  return true;
+}
+
+bool shuso_http_respond(shuso_http_request_t *r, int status, const shuso_http_header_t *headers, size_t header_count, const char *body, size_t body_len) {
+  shuso_http_connection_t *c = r->connection;
+  shuso_t                 *S;
+  if(r->stream) {
+    return shuso_http2_respond(r, status, headers, header_count, body, body_len);
+  }
+  S = c->connection->S;
+  if(r->responded) {
+    return shuso_set_error(S, "request has already been responded to");
+  }
+  if(status < 100 || status > 999) {
+    return shuso_set_error(S, "invalid HTTP status %d", status);
+  }
+  for(size_t i = 0; i < header_count; i++) {
+    if(http_header_is(&headers[i], "content-length") || http_header_is(&headers[i], "connection") || http_header_is(&headers[i], "transfer-encoding")) {
+      return shuso_set_error(S, "HTTP header \"%.*s\" is set automatically", (int )headers[i].name_len, headers[i].name);
+    }
+  }
+  if(!http_response_prepare(r, status, headers, header_count, body, body_len)) {
+    return shuso_set_error(S, "failed to allocate HTTP response");
+  }
+  if(c->waiting) {
+    c->waiting = 0;
+    c->connection->io.result = 0;
+    shuso_io_resume(&c->connection->io);
+  }
+  return true;
+}
+
+static void http_request_reset(shuso_http_connection_t *c) {
+  shuso_http_request_t *r = &c->request;
+  if(r->finish) {
+    r->finish(r, r->finish_pd);
+  }
+  shuso_pool_drain_to_level(r->pool, c->pool_level);
+  c->pool_level = shuso_pool_mark_level(r->pool);
+  r->method = NULL;
+  r->method_len = 0;
+  r->path = NULL;
+  r->path_len = 0;
+  r->major_version = 0;
+  r->minor_version = 0;
+  r->headers = NULL;
+  r->header_count = 0;
+  r->body.data = NULL;
+  r->body.len = 0;
+  r->keepalive = false;
+  r->responded = false;
+  r->finish = NULL;
+  r->finish_pd = NULL;
+}
+
+static void http_request_done(shuso_http_connection_t *c) {
+  //move any pipelined data up to the front for the next request
+  size_t next = c->header_len + c->body_len;
+  http_request_reset(c);
+  if(next < c->len) {
+    memmove(c->buf, &c->buf[next], c->len - next);
+  }
+  c->len -= next;
+  c->first_request = 0;
+  c->parsed_len = 0;
+  c->header_len = 0;
+  c->body_len = 0;
+}
+
+static void http_connection_free(shuso_http_connection_t *c) {
+  http_request_reset(c);
+  //c goes along with the connection's pool, at the end of the loop iteration. not from inside its own coroutine
+  shuso_connection_release(c->connection);
+}
+
+static void http_connection_error(shuso_t *S, shuso_io_t *io) {
+  shuso_http_connection_t *c = io->privdata;
+  if(io->error != ECONNRESET && io->error != EPIPE && io->error != ETIMEDOUT) {
+    shuso_log_info(S, "HTTP connection error: %s", strerror(io->error));
+  }
+  shuso_io_abort(io);
+  shuso_io_forget_connection(io);
+  shuso_io_tls_free(&io->io_socket);
+  close(io->io_socket.fd);
+  http_connection_free(c);
+}
+
+static void http_connection_coro(shuso_t *S, shuso_io_t *io) {
+  shuso_http_connection_t *c = io->privdata;
+  int                      rc;
+
+  SHUSO_IO_CORO_BEGIN(io, http_connection_error);
+  while(1) {
+    shuso_io_set_deadline(io, SHUSO_HTTP_KEEPALIVE_TIMEOUT);
+
+    //request line and headers
+    while((rc = http_parse_headers(c)) == -2) {
+      if(!http_buffer_reserve(c, 1)) {
+        c->error_status = 500;
+        goto error_response;
+      }
+      SHUSO_IO_CORO_YIELD(read_partial, &c->buf[c->len], http_read_size(c));
+      if(io->result == 0) {
+        goto close;
+      }
+      c->len += io->result;
+    }
+    if(rc == HTTP_PARSE_HTTP2) {
+      goto http2;
+    }
+    if(rc != 0) {
+      c->error_status = rc == -1 ? 400 : rc;
+      goto error_response;
+    }
+
+    //body
+    if(c->expect_continue && c->len == c->header_len && (c->chunked_body || c->body_len > 0)) {
+      SHUSO_IO_CORO_YIELD(write, http_continue_response, sizeof(http_continue_response) - 1);
+    }
+    if(c->chunked_body) {
+      while((rc = http_decode_chunked(c)) == -2) {
+        if(!http_buffer_reserve(c, 1)) {
+          c->error_status = 500;
+          goto error_response;
+        }
+        SHUSO_IO_CORO_YIELD(read_partial, &c->buf[c->len], c->size - c->len);
+        if(io->result == 0) {
+          goto close;
+        }
+        c->len += io->result;
+      }
+      if(rc != 0) {
+        c->error_status = rc == -1 ? 400 : rc;
+        goto error_response;
+      }
+    }
+    else if(c->len < c->header_len + c->body_len) {
+      if(!http_buffer_reserve(c, c->header_len + c->body_len - c->len)) {
+        c->error_status = 500;
+        goto error_response;
+      }
+      while(c->len < c->header_len + c->body_len) {
+        SHUSO_IO_CORO_YIELD(read_partial, &c->buf[c->len], c->size - c->len);
+        if(io->result == 0) {
+          goto close;
+        }
+        c->len += io->result;
+      }
+    }
+    c->request.body.data = c->body_len > 0 ? &c->buf[c->header_len] : NULL;
+    c->request.body.len = c->body_len;
+
+    //the request's handlers can take as long as they like
+    shuso_io_set_deadline(io, 0);
+    shuso_event_publish(S, c->request_event, SHUSO_OK, &c->request);
+    if(!c->request.responded) {
+      c->waiting = 1;
+      SHUSO_IO_CORO_YIELD(suspend, NULL);
+    }
+
+  respond:
+    shuso_io_set_deadline(io, SHUSO_HTTP_KEEPALIVE_TIMEOUT);
+    SHUSO_IO_CORO_YIELD(writev, c->response, c->response_iovcnt);
+    if(!c->request.keepalive) {
+      goto close;
+    }
+    http_request_done(c);
+    //the next request is likely to be read right after the next response is written. keep the watcher armed
+    //across the wait for the response
+    shuso_io_set_persistent_watch(io, true);
+  }
+
+error_response:
+  //the request (if there even is one) isn't going anywhere. respond and hang up
+  http_request_reset(c);
+  c->request.keepalive = false;
+  c->request.major_version = 1;
+  c->request.minor_version = 1;
+  if(!http_response_prepare(&c->request, c->error_status, NULL, 0, NULL, 0)) {
+    goto close;
+  }
+  goto respond;
+
+http2:
+  //prior knowledge. the rest of the connection belongs to the HTTP/2 session, socket and all
+  shuso_io_set_deadline(io, 0);
+  shuso_io_set_persistent_watch(io, false);
+  shuso_io_forget_connection(io);
+  if(!shuso_http2_connection_start(S, &io->io_socket, c->request.binding, c->request_event, c->buf, c->len)) {
+    shuso_log_warning(S, "failed to start HTTP/2 connection: %s", shuso_last_error(S));
+    goto close;
+  }
+  http_connection_free(c);
+  return;
+
+close:
+  shuso_io_set_deadline(io, 0);
+  SHUSO_IO_CORO_YIELD(close);
+  http_connection_free(c);
+  SHUSO_IO_CORO_END(io);
+}
+
+bool shuso_http_connection_start(shuso_t *S, shuso_connection_t *connection, shuso_server_binding_t *binding, shuso_event_t *request_event, const char *preread, size_t preread_len) {
+  shuso_http_connection_t *c = shuso_palloc(&connection->pool, sizeof(*c));
+  size_t                   want = preread_len + 1 > SHUSO_HTTP_READ_BUFFER_SIZE ? preread_len + 1 : SHUSO_HTTP_READ_BUFFER_SIZE;
+  if(!c || !shuso_connection_buffer_reserve(connection, 0, want)) {
+    return shuso_set_error(S, "failed to allocate HTTP connection");
+  }
+  memset(c, 0, sizeof(*c));
+  c->connection = connection;
+  c->buf = connection->buf;
+  c->size = connection->size;
+  if(preread_len > 0) {
+    memcpy(c->buf, preread, preread_len);
+    c->len = preread_len;
+  }
+  //requests' allocations are drained back to here
+  c->pool_level = shuso_pool_mark_level(&connection->pool);
+  c->request_event = request_event;
+  c->request.connection = c;
+  c->request.pool = &connection->pool;
+  c->request.binding = binding;
+  c->first_request = 1;
+
+  connection->claimed = true;
+  connection->data = c;
+  shuso_io_init(S, &connection->io, &connection->socket, SHUSO_IO_READ | SHUSO_IO_WRITE, http_connection_coro, c);
+  shuso_io_start(&connection->io);
+  return true;
+}
@@ -0,0 +1,68 @@
+#ifndef SHUTTLESOCK_SERVER_HTTP_H
+#define SHUTTLESOCK_SERVER_HTTP_H
+
+#include <shuttlesock/common.h>
+#include <shuttlesock/pool.h>
+#include "server.h"
+
+//most headers a request may have
+#define SHUSO_HTTP_MAX_HEADERS 64
+//initial connection read buffer size. it grows as needed for headers and bodies
+#define SHUSO_HTTP_READ_BUFFER_SIZE 4096
+//requests with a larger header block get a 431
+#define SHUSO_HTTP_MAX_HEADER_SIZE 16384
+//requests with a larger body get a 413
+#define SHUSO_HTTP_MAX_BODY_SIZE (1024 * 1024)
+//idle time allowed between keepalive requests, and for reading a request once it's started
+#define SHUSO_HTTP_KEEPALIVE_TIMEOUT 75.0
+#define SHUSO_HTTP_REQUEST_POOL_PAGE_SIZE 4096
+
+typedef struct {
+  const char             *name;
+  size_t                  name_len;
+  const char             *value;
+  size_t                  value_len;
+} shuso_http_header_t;
+
+typedef struct shuso_http_connection_s shuso_http_connection_t;
+typedef struct shuso_http_request_s shuso_http_request_t;
+typedef struct shuso_http2_stream_s shuso_http2_stream_t;
+
+//called when the request is done with, responded to or not
+typedef void shuso_http_request_finish_fn(shuso_http_request_t *r, void *pd);
+
+struct shuso_http_request_s {
+  shuso_http_connection_t *connection; //HTTP/1.x requests
+  shuso_http2_stream_t   *stream; //HTTP/2 requests
+  shuso_server_binding_t *binding;
+  shuso_pool_t           *pool; //request-scoped. emptied once the response has been written
+  const char             *method;
+  size_t                  method_len;
+  const char             *path;
+  size_t                  path_len;
+  int                     major_version;
+  int                     minor_version;
+  shuso_http_header_t    *headers;
+  size_t                  header_count;
+  struct {
+    const char             *data; //the whole body, already read (and dechunked)
+    size_t                  len;
+  }                       body;
+  bool                    keepalive;
+  bool                    responded;
+  shuso_http_request_finish_fn *finish;
+  void                   *finish_pd;
+};
+
+// serve HTTP/1.x on an accepted connection, which is claimed and released when it closes. each parsed request is published as request_event, one at a time;
+// pipelined requests wait their turn. preread is data already read from the socket, if any.
+bool shuso_http_connection_start(shuso_t *S, shuso_connection_t *connection, shuso_server_binding_t *binding, shuso_event_t *request_event, const char *preread, size_t preread_len);
+
+// case-insensitive header lookup. NULL if there's no such header
+const shuso_http_header_t *shuso_http_request_header(const shuso_http_request_t *r, const char *name);
+
+// respond to the request, right away or later on. the headers and body are copied, and
+// Content-Length and Connection headers are added. a request can only be responded to once.
+bool shuso_http_respond(shuso_http_request_t *r, int status, const shuso_http_header_t *headers, size_t header_count, const char *body, size_t body_len);
+
+#endif //SHUTTLESOCK_SERVER_HTTP_H
@@ -0,0 +1,571 @@
+#include <shuttlesock.h>
+#include "http2.h"
+#include <nghttp2/nghttp2.h>
+#include <errno.h>
+#include <stdio.h>
+
+struct shuso_http2_stream_s {
+  shuso_http_request_t        request;
+  shuso_pool_t                pool; //the request's
+  shuso_http2_connection_t   *connection;
+  int32_t                     id;
+  size_t                      headers_size; //allocated
+  char                       *body; //malloc'd, so it can grow
+  size_t                      body_size;
+  struct {
+    const char                 *data; //in the request pool
+    size_t                      len;
+    size_t                      queued; //handed to nghttp2
+    size_t                      sent; //given to the writer
+  }                           response;
+  shuso_http2_stream_t       *next;
+  unsigned                    published:1;
+  unsigned                    rejected:1;
+  unsigned                    closed:1;
+};
+
+struct shuso_http2_connection_s {
+  shuso_io_t                  reader;
+  shuso_io_t                  writer; //same socket. responses can be written while the reader waits for more requests
+  nghttp2_session            *session;
+  shuso_event_t              *request_event;
+  shuso_server_binding_t     *binding;
+  shuso_http2_stream_t       *streams;
+  size_t                      open_streams;
+  char                       *inbuf;
+  size_t                      inbuf_size;
+  size_t                      preread_len;
+  shuso_ev_timer              release;
+  unsigned                    in_recv:1; //nghttp2 can't be asked to send from inside its receive callbacks
+  unsigned                    writer_idle:1;
+  unsigned                    reading_done:1;
+  unsigned                    closed:1;
+  struct {
+    size_t                      len; //bytes in buf
+    int                         count; //segments
+    struct {
+      const char                 *data; //NULL for bytes in buf
+      size_t                      offset; //into buf
+      size_t                      len;
+    }                           seg[SHUSO_HTTP2_WRITE_BATCH_IOVECS];
+    struct iovec                iov[SHUSO_HTTP2_WRITE_BATCH_IOVECS];
+    char                        buf[SHUSO_HTTP2_WRITE_BATCH_SIZE]; //copied frame headers and control frames
+  }                           out;
+};
+
+static void http2_connection_close(shuso_http2_connection_t *c);
+
+static void http2_stream_free(shuso_http2_stream_t *st) {
+  if(st->request.finish) {
+    st->request.finish(&st->request, st->request.finish_pd);
+  }
+  shuso_pool_empty(&st->pool);
+  free(st->body);
+  free(st);
+}
+
+static void http2_free_closed_streams(shuso_http2_connection_t *c) {
+  //only when nothing's being written. DATA frames are written straight from the stream's response
+  shuso_http2_stream_t **cur = &c->streams, *st;
+  while((st = *cur) != NULL) {
+    if(st->closed) {
+      *cur = st->next;
+      http2_stream_free(st);
+    }
+    else {
+      cur = &st->next;
+    }
+  }
+}
+
+static void http2_output_copy(shuso_http2_connection_t *c, const void *data, size_t len) {
+  int last = c->out.count - 1;
+  if(last < 0 || c->out.seg[last].data != NULL || c->out.seg[last].offset + c->out.seg[last].len != c->out.len) {
+    last = c->out.count++;
+    c->out.seg[last].data = NULL;
+    c->out.seg[last].offset = c->out.len;
+    c->out.seg[last].len = 0;
+  }
+  memcpy(&c->out.buf[c->out.len], data, len);
+  c->out.len += len;
+  c->out.seg[last].len += len;
+}
+
+static bool http2_output_can_copy(shuso_http2_connection_t *c, size_t len) {
+  int last = c->out.count - 1;
+  if(c->out.len + len > SHUSO_HTTP2_WRITE_BATCH_SIZE) {
+    return false;
+  }
+  return c->out.count < SHUSO_HTTP2_WRITE_BATCH_IOVECS || (last >= 0 && c->out.seg[last].data == NULL);
+}
+
+static void http2_output_iovecs(shuso_http2_connection_t *c) {
+  for(int i = 0; i < c->out.count; i++) {
+    c->out.iov[i].iov_base = c->out.seg[i].data ? (void *)c->out.seg[i].data : &c->out.buf[c->out.seg[i].offset];
+    c->out.iov[i].iov_len = c->out.seg[i].len;
+  }
+}
+
+static void http2_output_reset(shuso_http2_connection_t *c) {
+  c->out.len = 0;
+  c->out.count = 0;
+}
+
+static ssize_t http2_send_callback(nghttp2_session *session, const uint8_t *data, size_t length, int flags, void *user_data) {
+  shuso_http2_connection_t *c = user_data;
+  size_t                    space = SHUSO_HTTP2_WRITE_BATCH_SIZE - c->out.len;
+  size_t                    len = length < space ? length : space;
+  if(len == 0 || !http2_output_can_copy(c, len)) {
+    //write out what's been gathered first
+    return NGHTTP2_ERR_WOULDBLOCK;
+  }
+  http2_output_copy(c, data, len);
+  return len;
+}
+
+static int http2_send_data_callback(nghttp2_session *session, nghttp2_frame *frame, const uint8_t *framehd, size_t length, nghttp2_data_source *source, void *user_data) {
+  //DATA frame payloads aren't copied, just pointed to
+  shuso_http2_connection_t *c = user_data;
+  shuso_http2_stream_t     *st = source->ptr;
+  assert(frame->data.padlen == 0);
+  if(!http2_output_can_copy(c, 9) || c->out.count + 2 > SHUSO_HTTP2_WRITE_BATCH_IOVECS) {
+    return NGHTTP2_ERR_WOULDBLOCK;
+  }
+  http2_output_copy(c, framehd, 9);
+  if(length > 0) {
+    c->out.seg[c->out.count].data = &st->response.data[st->response.sent];
+    c->out.seg[c->out.count].len = length;
+    c->out.count++;
+    st->response.sent += length;
+  }
+  return 0;
+}
+
+static ssize_t http2_response_body_read_callback(nghttp2_session *session, int32_t stream_id, uint8_t *buf, size_t length, uint32_t *data_flags, nghttp2_data_source *source, void *user_data) {
+  shuso_http2_stream_t *st = source->ptr;
+  size_t                left = st->response.len - st->response.queued;
+  size_t                len = left < length ? left : length;
+  st->response.queued += len;
+  *data_flags |= NGHTTP2_DATA_FLAG_NO_COPY;
+  if(st->response.queued == st->response.len) {
+    *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+  }
+  return len;
+}
+
+static int http2_on_begin_headers_callback(nghttp2_session *session, const nghttp2_frame *frame, void *user_data) {
+  shuso_http2_connection_t *c = user_data;
+  shuso_http2_stream_t     *st;
+  if(frame->hd.type != NGHTTP2_HEADERS || frame->headers.cat != NGHTTP2_HCAT_REQUEST) {
+    return 0;
+  }
+  if((st = calloc(1, sizeof(*st))) == NULL) {
+    return NGHTTP2_ERR_CALLBACK_FAILURE;
+  }
+  if(!shuso_pool_init(&st->pool, SHUSO_HTTP_REQUEST_POOL_PAGE_SIZE)) {
+    free(st);
+    return NGHTTP2_ERR_CALLBACK_FAILURE;
+  }
+  st->request.pool = &st->pool;
+  st->connection = c;
+  st->id = frame->hd.stream_id;
+  st->request.stream = st;
+  st->request.binding = c->binding;
+  st->request.major_version = 2;
+  st->request.minor_version = 0;
+  st->request.keepalive = true;
+  st->next = c->streams;
+  c->streams = st;
+  c->open_streams++;
+  nghttp2_session_set_stream_user_data(session, st->id, st);
+  return 0;
+}
+
+static const char *http2_pool_strdup(shuso_pool_t *pool, const uint8_t *str, size_t len) {
+  char *cpy = shuso_palloc(pool, len + 1);
+  if(cpy) {
+    memcpy(cpy, str, len);
+    cpy[len] = '\0';
+  }
+  return cpy;
+}
+
+static int http2_on_header_callback(nghttp2_session *session, const nghttp2_frame *frame, const uint8_t *name, size_t namelen, const uint8_t *value, size_t valuelen, uint8_t flags, void *user_data) {
+  shuso_http2_stream_t *st = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+  shuso_http_request_t *r;
+  const char           *str;
+  if(!st || frame->hd.type != NGHTTP2_HEADERS || frame->headers.cat != NGHTTP2_HCAT_REQUEST) {
+    return 0;
+  }
+  r = &st->request;
+  if(namelen > 0 && name[0] == ':') {
+    //nghttp2 has already made sure the pseudo-headers make sense
+    if(namelen == 7 && memcmp(name, ":method", 7) == 0) {
+      if((str = http2_pool_strdup(r->pool, value, valuelen)) == NULL) {
+        return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+      }
+      r->method = str;
+      r->method_len = valuelen;
+      return 0;
+    }
+    if(namelen == 5 && memcmp(name, ":path", 5) == 0) {
+      if((str = http2_pool_strdup(r->pool, value, valuelen)) == NULL) {
+        return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+      }
+      r->path = str;
+      r->path_len = valuelen;
+      return 0;
+    }
+    if(namelen == 10 && memcmp(name, ":authority", 10) == 0) {
+      //same as Host in HTTP/1.x, so it goes with the headers
+      name = (const uint8_t *)"host";
+      namelen = 4;
+    }
+    else {
+      return 0;
+    }
+  }
+
+  if(r->header_count == st->headers_size) {
+    shuso_http_header_t *headers;
+    size_t               size = st->headers_size > 0 ? st->headers_size * 2 : 8;
+    if(r->header_count >= SHUSO_HTTP_MAX_HEADERS) {
+      return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+    }
+    if(size > SHUSO_HTTP_MAX_HEADERS) {
+      size = SHUSO_HTTP_MAX_HEADERS;
+    }
+    if((headers = shuso_palloc(r->pool, sizeof(*headers) * size)) == NULL) {
+      return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+    }
+    if(r->header_count > 0) {
+      memcpy(headers, r->headers, sizeof(*headers) * r->header_count);
+    }
+    r->headers = headers;
+    st->headers_size = size;
+  }
+  r->headers[r->header_count] = (shuso_http_header_t ) {
+    .name = http2_pool_strdup(r->pool, name, namelen),
+    .name_len = namelen,
+    .value = http2_pool_strdup(r->pool, value, valuelen),
+    .value_len = valuelen
+  };
+  if(!r->headers[r->header_count].name || !r->headers[r->header_count].value) {
+    return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+  }
+  r->header_count++;
+  return 0;
+}
+
+static int http2_on_data_chunk_recv_callback(nghttp2_session *session, uint8_t flags, int32_t stream_id, const uint8_t *data, size_t len, void *user_data) {
+  shuso_http2_stream_t *st = nghttp2_session_get_stream_user_data(session, stream_id);
+  if(!st || st->rejected) {
+    return 0;
+  }
+  if(st->request.body.len + len > SHUSO_HTTP_MAX_BODY_SIZE) {
+    st->rejected = 1;
+    nghttp2_submit_rst_stream(session, NGHTTP2_FLAG_NONE, stream_id, NGHTTP2_CANCEL);
+    return 0;
+  }
+  if(st->request.body.len + len > st->body_size) {
+    size_t  size = st->body_size > 0 ? st->body_size : 1024;
+    char   *body;
+    while(size < st->request.body.len + len) {
+      size *= 2;
+    }
+    if((body = realloc(st->body, size)) == NULL) {
+      st->rejected = 1;
+      nghttp2_submit_rst_stream(session, NGHTTP2_FLAG_NONE, stream_id, NGHTTP2_INTERNAL_ERROR);
+      return 0;
+    }
+    st->body = body;
+    st->body_size = size;
+  }
+  memcpy(&st->body[st->request.body.len], data, len);
+  st->request.body.len += len;
+  return 0;
+}
+
+static int http2_on_frame_recv_callback(nghttp2_session *session, const nghttp2_frame *frame, void *user_data) {
+  shuso_http2_connection_t *c = user_data;
+  shuso_http2_stream_t     *st;
+  if((frame->hd.type != NGHTTP2_HEADERS && frame->hd.type != NGHTTP2_DATA) || !(frame->hd.flags & NGHTTP2_FLAG_END_STREAM)) {
+    return 0;
+  }
+  st = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+  if(!st || st->published || st->rejected || st->closed) {
+    return 0;
+  }
+  //the whole request is here
+  st->published = 1;
+  st->request.body.data = st->request.body.len > 0 ? st->body : NULL;
+  shuso_event_publish(c->reader.S, c->request_event, SHUSO_OK, &st->request);
+  return 0;
+}
+
+static int http2_on_stream_close_callback(nghttp2_session *session, int32_t stream_id, uint32_t error_code, void *user_data) {
+  shuso_http2_connection_t *c = user_data;
+  shuso_http2_stream_t     *st = nghttp2_session_get_stream_user_data(session, stream_id);
+  if(!st) {
+    return 0;
+  }
+  //freed once the writer's done with its response
+  st->closed = 1;
+  c->open_streams--;
+  return 0;
+}
+
+static void http2_kick(shuso_http2_connection_t *c) {
+  //there may be something to write
+  if(c->in_recv || c->closed) {
+    //the reader will kick it once it's done receiving
+    return;
+  }
+  if(c->writer_idle) {
+    c->writer_idle = 0;
+    c->writer.result = 0;
+    shuso_io_resume(&c->writer);
+  }
+}
+
+bool shuso_http2_respond(shuso_http_request_t *r, int status, const shuso_http_header_t *headers, size_t header_count, const char *body, size_t body_len) {
+  shuso_http2_stream_t     *st = r->stream;
+  shuso_http2_connection_t *c = st->connection;
+  shuso_t                  *S = c->reader.S;
+  nghttp2_nv               *nv;
+  nghttp2_data_provider     data_provider;
+  char                     *status_str, *length_str, *name;
+  size_t                    nvlen = 0;
+  bool                      head_only = r->method_len == 4 && memcmp(r->method, "HEAD", 4) == 0;
+  int                       rv;
+
+  if(r->responded) {
+    return shuso_set_error(S, "request has already been responded to");
+  }
+  if(st->closed || c->closed) {
+    return shuso_set_error(S, "HTTP/2 stream is already closed");
+  }
+  if(status < 100 || status > 999) {
+    return shuso_set_error(S, "invalid HTTP status %d", status);
+  }
+
+  nv = shuso_palloc(r->pool, sizeof(*nv) * (header_count + 2));
+  status_str = shuso_palloc(r->pool, 4);
+  length_str = shuso_palloc(r->pool, 24);
+  if(!nv || !status_str || !length_str) {
+    return shuso_set_error(S, "failed to allocate HTTP/2 response");
+  }
+  sprintf(status_str, "%03d", status);
+  nv[nvlen++] = (nghttp2_nv ) {(uint8_t *)":status", (uint8_t *)status_str, 7, 3, NGHTTP2_NV_FLAG_NO_COPY_NAME | NGHTTP2_NV_FLAG_NO_COPY_VALUE};
+  for(size_t i = 0; i < header_count; i++) {
+    //HTTP/2 header names are lowercase, and connection-specific headers aren't allowed
+    static const char *not_allowed[] = {"content-length", "connection", "transfer-encoding", "keep-alive", "upgrade", "proxy-connection", NULL};
+    if((name = shuso_palloc(r->pool, headers[i].name_len + 1)) == NULL) {
+      return shuso_set_error(S, "failed to allocate HTTP/2 response");
+    }
+    for(size_t j = 0; j < headers[i].name_len; j++) {
+      name[j] = (headers[i].name[j] >= 'A' && headers[i].name[j] <= 'Z') ? headers[i].name[j] - 'A' + 'a' : headers[i].name[j];
+    }
+    name[headers[i].name_len] = '\0';
+    for(const char **na = not_allowed; *na; na++) {
+      if(strcmp(name, *na) == 0) {
+        return shuso_set_error(S, "HTTP header \"%.*s\" is set automatically", (int )headers[i].name_len, headers[i].name);
+      }
+    }
+    nv[nvlen++] = (nghttp2_nv ) {(uint8_t *)name, (uint8_t *)headers[i].value, headers[i].name_len, headers[i].value_len, NGHTTP2_NV_FLAG_NONE};
+  }
+  sprintf(length_str, "%zu", body_len);
+  nv[nvlen++] = (nghttp2_nv ) {(uint8_t *)"content-length", (uint8_t *)length_str, 14, strlen(length_str), NGHTTP2_NV_FLAG_NO_COPY_NAME | NGHTTP2_NV_FLAG_NO_COPY_VALUE};
+
+  if(body_len > 0 && !head_only) {
+    char *body_copy = shuso_palloc(r->pool, body_len);
+    if(!body_copy) {
+      return shuso_set_error(S, "failed to allocate HTTP/2 response");
+    }
+    memcpy(body_copy, body, body_len);
+    st->response.data = body_copy;
+    st->response.len = body_len;
+    data_provider.source.ptr = st;
+    data_provider.read_callback = http2_response_body_read_callback;
+    rv = nghttp2_submit_response(c->session, st->id, nv, nvlen, &data_provider);
+  }
+  else {
+    rv = nghttp2_submit_response(c->session, st->id, nv, nvlen, NULL);
+  }
+  if(rv != 0) {
+    return shuso_set_error(S, "failed to submit HTTP/2 response: %s", nghttp2_strerror(rv));
+  }
+  r->responded = true;
+  http2_kick(c);
+  return true;
+}
+
+static void http2_connection_free(shuso_http2_connection_t *c) {
+  shuso_http2_stream_t *st;
+  nghttp2_session_del(c->session);
+  while((st = c->streams) != NULL) {
+    c->streams = st->next;
+    http2_stream_free(st);
+  }
+  free(c->inbuf);
+  free(c);
+}
+
+static void http2_connection_release(shuso_loop *loop, shuso_ev_timer *w, int events) {
+  http2_connection_free(shuso_ev_data(w));
+}
+
+static void http2_connection_close(shuso_http2_connection_t *c) {
+  shuso_t *S = c->reader.S;
+  if(c->closed) {
+    return;
+  }
+  c->closed = 1;
+  shuso_io_abort(&c->reader);
+  shuso_io_abort(&c->writer);
+  shuso_io_forget_connection(&c->reader);
+  shuso_io_tls_free(&c->reader.io_socket);
+  close(c->reader.io_socket.fd);
+  //either coroutine may be the one closing it, so it can't be freed just yet
+  shuso_ev_timer_init(S, &c->release, 0, 0, http2_connection_release, c);
+  shuso_ev_timer_start(S, &c->release);
+}
+
+static void http2_io_error(shuso_t *S, shuso_io_t *io) {
+  shuso_http2_connection_t *c = io->privdata;
+  if(io->error != ECONNRESET && io->error != EPIPE && io->error != ETIMEDOUT && io->error != ECANCELED) {
+    shuso_log_info(S, "HTTP/2 connection error: %s", strerror(io->error));
+  }
+  http2_connection_close(c);
+}
+
+static bool http2_receive(shuso_http2_connection_t *c, size_t len) {
+  ssize_t rv;
+  c->in_recv = 1;
+  rv = nghttp2_session_mem_recv(c->session, (const uint8_t *)c->inbuf, len);
+  c->in_recv = 0;
+  //a GOAWAY may be queued even if there was an error
+  http2_kick(c);
+  if(rv < 0) {
+    shuso_log_debug(c->reader.S, "HTTP/2 session error: %s", nghttp2_strerror(rv));
+    return false;
+  }
+  return true;
+}
+
+static void http2_reader_coro(shuso_t *S, shuso_io_t *io) {
+  shuso_http2_connection_t *c = io->privdata;
+
+  SHUSO_IO_CORO_BEGIN(io, http2_io_error);
+  if(c->preread_len > 0 && !http2_receive(c, c->preread_len)) {
+    goto done;
+  }
+  while(!c->closed && nghttp2_session_want_read(c->session)) {
+    shuso_io_set_deadline(io, c->open_streams == 0 ? SHUSO_HTTP_KEEPALIVE_TIMEOUT : 0);
+    SHUSO_IO_CORO_YIELD(read_partial, c->inbuf, c->inbuf_size);
+    if(io->result == 0 || !http2_receive(c, io->result)) {
+      break;
+    }
+  }
+done:
+  c->reading_done = 1;
+  if(!c->closed) {
+    shuso_io_set_deadline(io, 0);
+    if(c->writer_idle) {
+      http2_connection_close(c);
+    }
+  }
+  SHUSO_IO_CORO_END(io);
+}
+
+static void http2_writer_coro(shuso_t *S, shuso_io_t *io) {
+  shuso_http2_connection_t *c = io->privdata;
+  int                       rv;
+
+  SHUSO_IO_CORO_BEGIN(io, http2_io_error);
+  while(!c->closed) {
+    if((rv = nghttp2_session_send(c->session)) != 0) {
+      shuso_log_info(S, "HTTP/2 session error: %s", nghttp2_strerror(rv));
+      http2_connection_close(c);
+      break;
+    }
+    if(c->out.count > 0) {
+      //everything nghttp2 had to send, or as much of it as fit in a batch, in one go
+      http2_output_iovecs(c);
+      SHUSO_IO_CORO_YIELD(writev, c->out.iov, c->out.count);
+      http2_output_reset(c);
+      continue;
+    }
+    http2_free_closed_streams(c);
+    if(c->reading_done || !nghttp2_session_want_read(c->session)) {
+      http2_connection_close(c);
+      break;
+    }
+    c->writer_idle = 1;
+    SHUSO_IO_CORO_YIELD(suspend, NULL);
+  }
+  SHUSO_IO_CORO_END(io);
+}
+
+bool shuso_http2_connection_start(shuso_t *S, shuso_socket_t *socket, shuso_server_binding_t *binding, shuso_event_t *request_event, const char *preread, size_t preread_len) {
+  shuso_http2_connection_t  *c;
+  nghttp2_session_callbacks *callbacks;
+  shuso_socket_t             writer_socket;
+  nghttp2_settings_entry     settings[] = {
+    {NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, SHUSO_HTTP2_MAX_CONCURRENT_STREAMS}
+  };
+  int                        rv;
+
+  if((c = calloc(1, sizeof(*c))) == NULL) {
+    return shuso_set_error(S, "failed to allocate HTTP/2 connection");
+  }
+  c->inbuf_size = preread_len > SHUSO_HTTP2_READ_BUFFER_SIZE ? preread_len : SHUSO_HTTP2_READ_BUFFER_SIZE;
+  if((c->inbuf = malloc(c->inbuf_size)) == NULL) {
+    free(c);
+    return shuso_set_error(S, "failed to allocate HTTP/2 connection");
+  }
+  if(preread_len > 0) {
+    memcpy(c->inbuf, preread, preread_len);
+    c->preread_len = preread_len;
+  }
+  c->request_event = request_event;
+  c->binding = binding;
+
+  if(nghttp2_session_callbacks_new(&callbacks) != 0) {
+    free(c->inbuf);
+    free(c);
+    return shuso_set_error(S, "failed to allocate HTTP/2 session callbacks");
+  }
+  nghttp2_session_callbacks_set_send_callback(callbacks, http2_send_callback);
+  nghttp2_session_callbacks_set_send_data_callback(callbacks, http2_send_data_callback);
+  nghttp2_session_callbacks_set_on_begin_headers_callback(callbacks, http2_on_begin_headers_callback);
+  nghttp2_session_callbacks_set_on_header_callback(callbacks, http2_on_header_callback);
+  nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks, http2_on_data_chunk_recv_callback);
+  nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, http2_on_frame_recv_callback);
+  nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, http2_on_stream_close_callback);
+  rv = nghttp2_session_server_new(&c->session, callbacks, c);
+  nghttp2_session_callbacks_del(callbacks);
+  if(rv != 0) {
+    free(c->inbuf);
+    free(c);
+    return shuso_set_error(S, "failed to create HTTP/2 session: %s", nghttp2_strerror(rv));
+  }
+  if((rv = nghttp2_submit_settings(c->session, NGHTTP2_FLAG_NONE, settings, sizeof(settings)/sizeof(settings[0]))) != 0) {
+    nghttp2_session_del(c->session);
+    free(c->inbuf);
+    free(c);
+    return shuso_set_error(S, "failed to submit HTTP/2 settings: %s", nghttp2_strerror(rv));
+  }
+
+  shuso_io_init(S, &c->reader, socket, SHUSO_IO_READ, http2_reader_coro, c);
+  //the connection's counted once, by the reader. TLS state is shared
+  writer_socket = *socket;
+  writer_socket.accepted = false;
+  shuso_io_init(S, &c->writer, &writer_socket, SHUSO_IO_WRITE, http2_writer_coro, c);
+  //the writer goes first, with the server's SETTINGS
+  shuso_io_start(&c->writer);
+  if(!c->closed) {
+    shuso_io_start(&c->reader);
+  }
+  return true;
+}
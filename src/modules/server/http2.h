@@ -0,0 +1,25 @@
+#ifndef SHUTTLESOCK_SERVER_HTTP2_H
+#define SHUTTLESOCK_SERVER_HTTP2_H
+
+#include "http.h"
+
+#define SHUSO_HTTP2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define SHUSO_HTTP2_PREFACE_LEN (sizeof(SHUSO_HTTP2_PREFACE) - 1)
+
+#define SHUSO_HTTP2_MAX_CONCURRENT_STREAMS 128
+#define SHUSO_HTTP2_READ_BUFFER_SIZE 16384
+//frames are gathered until there's this much to write, then written out with one writev
+#define SHUSO_HTTP2_WRITE_BATCH_SIZE 65536
+//iovecs per writev. response bodies are written straight from the response, each DATA frame takes two
+#define SHUSO_HTTP2_WRITE_BATCH_IOVECS 64
+
+typedef struct shuso_http2_connection_s shuso_http2_connection_t;
+
+// serve HTTP/2 on an accepted socket, starting with the connection preface (h2c with prior knowledge, or h2 after ALPN).
+// each stream's request is published as request_event, same as HTTP/1.x requests. preread is data already read from the socket.
+bool shuso_http2_connection_start(shuso_t *S, shuso_socket_t *socket, shuso_server_binding_t *binding, shuso_event_t *request_event, const char *preread, size_t preread_len);
+
+// shuso_http_respond() for HTTP/2 requests
+bool shuso_http2_respond(shuso_http_request_t *r, int status, const shuso_http_header_t *headers, size_t header_count, const char *body, size_t body_len);
+
+#endif //SHUTTLESOCK_SERVER_HTTP2_H
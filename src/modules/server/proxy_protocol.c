@@ -0,0 +1,269 @@
+#include <shuttlesock.h>
+#include "proxy_protocol.h"
+#include <arpa/inet.h>
+#include <errno.h>
+
+typedef struct {
+  shuso_io_t              io;
+  shuso_server_binding_t *binding;
+  shuso_sockaddr_t        sockaddr;
+  shuso_proxy_protocol_fn *done;
+  void                   *pd;
+  size_t                  len; //header bytes taken out of the socket so far
+  ssize_t                 header_len; //0 until it's been parsed, -1 if it couldn't be
+  shuso_ev_timer          release;
+  char                    buf[SHUSO_PROXY_PROTOCOL_READ_SIZE];
+} proxy_protocol_read_t;
+
+static const char proxy_protocol_v1_sig[] = "PROXY ";
+static const char proxy_protocol_v2_sig[] = "\r\n\r\n\0\r\nQUIT\n";
+
+static bool proxy_protocol_v1_port(const char *str, in_port_t *port) {
+  char *end;
+  long  num = strtol(str, &end, 10);
+  if(*str == '\0' || *end != '\0' || num < 0 || num > 65535) {
+    return false;
+  }
+  *port = htons(num);
+  return true;
+}
+
+static ssize_t proxy_protocol_parse_v1(const char *buf, size_t len, shuso_sockaddr_t *sockaddr) {
+  // PROXY TCP4 192.0.2.1 192.0.2.2 56324 443\r\n
+  char              line[SHUSO_PROXY_PROTOCOL_V1_MAX_HEADER];
+  char             *field[6], *saveptr = NULL, *tok;
+  const char       *end;
+  size_t            header_len;
+  int               n = 0;
+  shuso_sockaddr_t  addr;
+  if(memcmp(buf, proxy_protocol_v1_sig, len < sizeof(proxy_protocol_v1_sig) - 1 ? len : sizeof(proxy_protocol_v1_sig) - 1) != 0) {
+    return -1;
+  }
+  if((end = memchr(buf, '\n', len < sizeof(line) ? len : sizeof(line))) == NULL) {
+    return len < sizeof(line) ? 0 : -1;
+  }
+  if(end == buf || end[-1] != '\r') {
+    return -1;
+  }
+  header_len = end - buf + 1;
+  memcpy(line, buf, header_len - 2);
+  line[header_len - 2] = '\0';
+
+  for(tok = strtok_r(line, " ", &saveptr); tok != NULL; tok = strtok_r(NULL, " ", &saveptr)) {
+    if(n == 6) {
+      return -1;
+    }
+    field[n++] = tok;
+  }
+  if(n >= 2 && strcmp(field[1], "UNKNOWN") == 0) {
+    //the proxy doesn't know either. whatever follows is to be ignored
+    return header_len;
+  }
+  if(n != 6) {
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  if(strcmp(field[1], "TCP4") == 0) {
+    addr.in.sin_family = AF_INET;
+    if(inet_pton(AF_INET, field[2], &addr.in.sin_addr) != 1 || !proxy_protocol_v1_port(field[4], &addr.in.sin_port)) {
+      return -1;
+    }
+  }
+#ifdef SHUTTLESOCK_HAVE_IPV6
+  else if(strcmp(field[1], "TCP6") == 0) {
+    addr.in6.sin6_family = AF_INET6;
+    if(inet_pton(AF_INET6, field[2], &addr.in6.sin6_addr) != 1 || !proxy_protocol_v1_port(field[4], &addr.in6.sin6_port)) {
+      return -1;
+    }
+  }
+#endif
+  else {
+    return -1;
+  }
+  *sockaddr = addr;
+  return header_len;
+}
+
+static ssize_t proxy_protocol_parse_v2(const unsigned char *buf, size_t len, shuso_sockaddr_t *sockaddr) {
+  //12-byte signature, version and command, family and protocol, 16-bit length of what follows. then the addresses
+  size_t            sig_len = sizeof(proxy_protocol_v2_sig) - 1;
+  size_t            addr_len;
+  shuso_sockaddr_t  addr;
+  if(memcmp(buf, proxy_protocol_v2_sig, len < sig_len ? len : sig_len) != 0) {
+    return -1;
+  }
+  if(len < 16) {
+    return 0;
+  }
+  if((buf[12] & 0xF0) != 0x20) {
+    return -1;
+  }
+  addr_len = (buf[14] << 8) | buf[15];
+  switch(buf[12] & 0x0F) {
+    case 0x0:
+      //LOCAL. the proxy's own connection, for health checks and such
+      return 16 + addr_len;
+    case 0x1:
+      //PROXY
+      break;
+    default:
+      return -1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  switch(buf[13] >> 4) {
+    case 0x1:
+      //source address, destination address, source port, destination port
+      if(addr_len < 12) {
+        return -1;
+      }
+      if(len < 16 + 12) {
+        return 0;
+      }
+      addr.in.sin_family = AF_INET;
+      memcpy(&addr.in.sin_addr, &buf[16], 4);
+      memcpy(&addr.in.sin_port, &buf[24], 2);
+      break;
+#ifdef SHUTTLESOCK_HAVE_IPV6
+    case 0x2:
+      if(addr_len < 36) {
+        return -1;
+      }
+      if(len < 16 + 36) {
+        return 0;
+      }
+      addr.in6.sin6_family = AF_INET6;
+      memcpy(&addr.in6.sin6_addr, &buf[16], 16);
+      memcpy(&addr.in6.sin6_port, &buf[48], 2);
+      break;
+#endif
+    default:
+      //unspecified or unix socket addresses. the connection's own address will have to do
+      return 16 + addr_len;
+  }
+  *sockaddr = addr;
+  return 16 + addr_len;
+}
+
+ssize_t shuso_proxy_protocol_parse(const char *buf, size_t len, shuso_sockaddr_t *sockaddr) {
+  if(len == 0) {
+    return 0;
+  }
+  switch(buf[0]) {
+    case 'P':
+      return proxy_protocol_parse_v1(buf, len, sockaddr);
+    case '\r':
+      return proxy_protocol_parse_v2((const unsigned char *)buf, len, sockaddr);
+    default:
+      return -1;
+  }
+}
+
+static void proxy_protocol_release(shuso_loop *loop, shuso_ev_timer *w, int events) {
+  free(shuso_ev_data(w));
+}
+
+static void proxy_protocol_finish(proxy_protocol_read_t *pp, bool ok) {
+  shuso_t    *S = pp->io.S;
+  shuso_io_t *io = &pp->io;
+  shuso_io_set_deadline(io, 0);
+  shuso_io_abort(io);
+  if(ok) {
+    pp->done(S, io->io_socket.fd, &pp->sockaddr, pp->binding, pp->pd);
+  }
+  else {
+    close(io->io_socket.fd);
+  }
+  //might be in the reading coroutine
+  shuso_ev_timer_init(S, &pp->release, 0, 0, proxy_protocol_release, pp);
+  shuso_ev_timer_start(S, &pp->release);
+}
+
+static void proxy_protocol_error(shuso_t *S, shuso_io_t *io) {
+  if(io->error != ETIMEDOUT && io->error != ECONNRESET) {
+    shuso_log_debug(S, "failed to read PROXY protocol header: %s", strerror(io->error));
+  }
+  proxy_protocol_finish(io->privdata, false);
+}
+
+static ssize_t proxy_protocol_recv(int fd, void *buf, size_t len, int flags) {
+  ssize_t n;
+  do {
+    n = recv(fd, buf, len, flags);
+  } while(n == -1 && errno == EINTR);
+  return n;
+}
+
+static void proxy_protocol_coro(shuso_t *S, shuso_io_t *io) {
+  proxy_protocol_read_t *pp = io->privdata;
+  char                   skipped[SHUSO_PROXY_PROTOCOL_READ_SIZE];
+  ssize_t                n;
+
+  SHUSO_IO_CORO_BEGIN(io, proxy_protocol_error);
+  shuso_io_set_deadline(io, SHUSO_PROXY_PROTOCOL_TIMEOUT);
+  while(pp->header_len == 0) {
+    //peek, so that nothing past the header is taken out of the socket. it usually all arrives at once
+    n = proxy_protocol_recv(io->io_socket.fd, &pp->buf[pp->len], sizeof(pp->buf) - pp->len, MSG_PEEK);
+    if(n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      SHUSO_IO_CORO_YIELD(wait, SHUSO_IO_READ);
+      continue;
+    }
+    if(n <= 0) {
+      pp->header_len = -1;
+      break;
+    }
+    if((pp->header_len = shuso_proxy_protocol_parse(pp->buf, pp->len + n, &pp->sockaddr)) != 0) {
+      if(pp->header_len < 0) {
+        shuso_log_warning(S, "dropped connection with an invalid PROXY protocol header");
+      }
+      break;
+    }
+    //it's all header so far. take it out of the socket, or it'll stay readable while the rest is on its way
+    if(pp->len + n == sizeof(pp->buf) || proxy_protocol_recv(io->io_socket.fd, &pp->buf[pp->len], n, 0) != n) {
+      pp->header_len = -1;
+      break;
+    }
+    pp->len += n;
+  }
+  while(pp->header_len > 0 && pp->len < (size_t )pp->header_len) {
+    //the rest of the header, and nothing more
+    n = (size_t )pp->header_len - pp->len < sizeof(skipped) ? (size_t )pp->header_len - pp->len : sizeof(skipped);
+    n = proxy_protocol_recv(io->io_socket.fd, skipped, n, 0);
+    if(n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      SHUSO_IO_CORO_YIELD(wait, SHUSO_IO_READ);
+      continue;
+    }
+    if(n <= 0) {
+      pp->header_len = -1;
+      break;
+    }
+    pp->len += n;
+  }
+  proxy_protocol_finish(pp, pp->header_len > 0);
+  SHUSO_IO_CORO_END(io);
+}
+
+bool shuso_proxy_protocol_read_start(shuso_t *S, shuso_server_binding_t *binding, int fd, const shuso_sockaddr_t *sockaddr, shuso_proxy_protocol_fn *done, void *pd) {
+  proxy_protocol_read_t *pp;
+  shuso_socket_t         sock = {
+    .fd = fd,
+    .host = binding->host
+  };
+  if((pp = malloc(sizeof(*pp))) == NULL) {
+    return shuso_set_error(S, "failed to allocate PROXY protocol header reader");
+  }
+  pp->binding = binding;
+  pp->done = done;
+  pp->pd = pd;
+  pp->len = 0;
+  pp->header_len = 0;
+  //the listener reuses its sockaddr for the next connection
+  pp->sockaddr = *sockaddr;
+  sock.host.name = NULL;
+  sock.host.sockaddr = &pp->sockaddr;
+  //not counted as a connection until someone picks it up
+  sock.accepted = false;
+  shuso_io_init(S, &pp->io, &sock, SHUSO_IO_READ, proxy_protocol_coro, pp);
+  shuso_io_start(&pp->io);
+  return true;
+}
@@ -0,0 +1,24 @@
+#ifndef SHUTTLESOCK_SERVER_PROXY_PROTOCOL_H
+#define SHUTTLESOCK_SERVER_PROXY_PROTOCOL_H
+
+#include "server.h"
+
+#define SHUSO_PROXY_PROTOCOL_TIMEOUT 30.0
+//the longest v1 header there can be
+#define SHUSO_PROXY_PROTOCOL_V1_MAX_HEADER 107
+//v2 headers are read this far -- past the addresses of any family. TLVs beyond it are skipped unread
+#define SHUSO_PROXY_PROTOCOL_READ_SIZE 256
+
+// called with the client's address from the header, once it's been read out of the socket. for 'LOCAL' and
+// 'UNKNOWN' headers, that's the address the connection came from. whatever the client sent after the header is
+// still in the socket. the socket is closed and this isn't called if there's no valid header.
+typedef void shuso_proxy_protocol_fn(shuso_t *S, int fd, shuso_sockaddr_t *sockaddr, shuso_server_binding_t *binding, void *pd);
+
+// read the PROXY protocol (v1 or v2) header off an accepted connection
+bool shuso_proxy_protocol_read_start(shuso_t *S, shuso_server_binding_t *binding, int fd, const shuso_sockaddr_t *sockaddr, shuso_proxy_protocol_fn *done, void *pd);
+
+// parse a PROXY protocol header at the start of buf, and set sockaddr to the address it has, if any. returns
+// the header's length (which, for v2, may be longer than len), 0 if more of it is needed, or -1 if it's invalid.
+ssize_t shuso_proxy_protocol_parse(const char *buf, size_t len, shuso_sockaddr_t *sockaddr);
+
+#endif //SHUTTLESOCK_SERVER_PROXY_PROTOCOL_H
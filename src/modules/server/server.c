@@ -1,12 +1,28 @@
+#include <shuttlesock/build_config.h>
+#ifdef SHUTTLESOCK_HAVE_ACCEPT4
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#endif
 #include <shuttlesock.h>
 #include <lualib.h>
 #include <lauxlib.h>
 #include "server.h"
+#include "http.h"
+#include "http2.h"
+#include "tls.h"
+#include "stream_proxy.h"
+#include "proxy_protocol.h"
 
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <ctype.h>
+#ifdef SHUTTLESOCK_HAVE_REUSEPORT_CBPF
+#include <linux/filter.h>
+#endif
 #include <shuttlesock/modules/config/private.h>
 
 static int luaS_create_binding_data(lua_State *L) {
@@ -57,6 +73,80 @@ static int luaS_create_binding_data(lua_State *L) {
   
   binding->host.family = binding->host.sockaddr->any.sa_family;
   
+  lua_getfield(L, 1, "backlog");
+  binding->backlog = lua_isinteger(L, -1) ? lua_tointeger(L, -1) : SHUSO_SERVER_DEFAULT_BACKLOG;
+  lua_pop(L, 1);
+  
+  lua_getfield(L, 1, "accept_batch");
+  binding->accept_batch = lua_isinteger(L, -1) ? lua_tointeger(L, -1) : SHUSO_SERVER_DEFAULT_ACCEPT_BATCH;
+  lua_pop(L, 1);
+  
+  lua_getfield(L, 1, "rebalance");
+  binding->rebalance = lua_toboolean(L, -1);
+  lua_pop(L, 1);
+  
+  lua_getfield(L, 1, "proxy_protocol");
+  binding->proxy_protocol = lua_toboolean(L, -1);
+  lua_pop(L, 1);
+  
+  lua_getfield(L, 1, "max_connections");
+  binding->max_connections = lua_isinteger(L, -1) ? lua_tointeger(L, -1) : 0;
+  lua_pop(L, 1);
+  
+  lua_getfield(L, 1, "max_lag_usec");
+  binding->max_loop_lag_usec = lua_isinteger(L, -1) ? lua_tointeger(L, -1) : 0;
+  lua_pop(L, 1);
+  
+  binding->tls = NULL;
+  lua_getfield(L, 1, "ssl");
+  if(lua_toboolean(L, -1)) {
+    lua_getfield(L, 1, "ssl_certificate");
+    lua_getfield(L, 1, "ssl_certificate_key");
+    binding->tls = shuso_tls_ctx_create(S, luaL_checkstring(L, -2), luaL_checkstring(L, -1), strcmp(binding->server_type, "http") == 0);
+    if(!binding->tls) {
+      return luaL_error(L, "%s", shuso_last_error(S));
+    }
+    lua_pop(L, 2);
+  }
+  lua_pop(L, 1);
+  
+  binding->proxy = NULL;
+  lua_getfield(L, 1, "proxy_pass");
+  if(lua_istable(L, -1)) {
+    unsigned          count = luaL_len(L, -1);
+    shuso_hostinfo_t *upstreams = count > 0 ? shuso_palloc(&S->pool, sizeof(*upstreams) * count) : NULL;
+    shuso_sockaddr_t *sockaddrs = count > 0 ? shuso_palloc(&S->pool, sizeof(*sockaddrs) * count) : NULL;
+    if(count > 0 && (!upstreams || !sockaddrs)) {
+      return luaL_error(L, "failed to allocate memory for proxy upstreams");
+    }
+    for(unsigned i = 0; i < count; i++) {
+      lua_geti(L, -1, i+1);
+      lua_getfield(L, -1, "name");
+      upstreams[i].name = lua_tostring(L, -1);
+      lua_pop(L, 1);
+      upstreams[i].type = SOCK_STREAM;
+      upstreams[i].sockaddr = &sockaddrs[i];
+      lua_pushcfunction(L, luaS_sockaddr_lua_to_c);
+      lua_pushvalue(L, -2);
+      lua_pushlightuserdata(L, &sockaddrs[i]);
+      luaS_call(L, 2, 2);
+      if(lua_isnil(L, -2)) {
+        return luaL_error(L, "%s", lua_tostring(L, -1));
+      }
+      lua_pop(L, 2);
+      upstreams[i].family = sockaddrs[i].any.sa_family;
+      lua_pop(L, 1); //pop proxy_pass[i]
+    }
+    lua_getfield(L, 1, "proxy_idle_connections");
+    //the names are still on the Lua stack, in the proxy_pass table
+    binding->proxy = shuso_stream_proxy_create(S, &S->pool, upstreams, count, lua_isinteger(L, -1) ? lua_tointeger(L, -1) : 0);
+    lua_pop(L, 1);
+    if(!binding->proxy) {
+      return luaL_error(L, "%s", shuso_last_error(S));
+    }
+  }
+  lua_pop(L, 1);
+  
   lua_getfield(L, 1, "common_parent_block");
   assert(lua_istable(L, -1));
   lua_getfield(L, -1, "ptr");
@@ -111,6 +201,9 @@ static int luaS_create_binding_table_from_ptr(lua_State *L) {
     lua_setfield(L, -2, "name");
   }
   
+  lua_pushboolean(L, binding->tls != NULL);
+  lua_setfield(L, -2, "ssl");
+  
   lua_pushcfunction(L, luaS_sockaddr_c_to_lua);
   lua_pushlightuserdata(L, binding->host.sockaddr);
   luaS_call(L, 1, 2);
@@ -153,26 +246,287 @@ static int luaS_create_binding_table_from_ptr(lua_State *L) {
   return 1;
 }
 
-typedef struct {
+typedef struct shuso_listener_io_data_s shuso_listener_io_data_t;
+struct shuso_listener_io_data_s {
   shuso_io_t                io;
   shuso_event_t            *maybe_accept_event;
   shuso_event_t            *accept_event;
+  shuso_event_t            *datagram_event; //for UDP listeners
+  shuso_io_datagram_batch_t *batch; //what UDP listeners receive into
+  shuso_event_t            *pause_event;
+  shuso_event_t            *resume_event;
+  shuso_ev_timer            throttle; //checks if a paused listener can resume
+  shuso_ev_timer            backoff; //resumes a listener that ran out of fds or memory
+  ev_tstamp                 backoff_logged; //when that was last logged
+  unsigned                  backoff_unlogged; //and how many times it happened since
+  bool                      paused;
+  bool                      suspended; //paused, and not accepting at all until listener_throttle_check() resumes it
+  bool                      backing_off;
   shuso_server_binding_t   *binding;
   shuso_sockaddr_t          sockaddr;
   socklen_t                 sockaddr_len;
-} shuso_listener_io_data_t;
+  shuso_listener_io_data_t *next;
+};
+
+//this worker's end of connection handoffs from other workers
+typedef struct {
+  shuso_listener_io_data_t *listeners;
+  int                       fd_ref;
+} server_handoff_receiver_t;
+
+//sent along with a handed-off connection's fd
+typedef struct {
+  shuso_server_binding_t   *binding;
+  shuso_sockaddr_t          sockaddr;
+  size_t                    preread_len;
+  char                      preread[];
+} server_handoff_t;
+
+static uint32_t process_load_score(shuso_process_load_t *load) {
+  return atomic_load(&load->connections) + atomic_load(&load->pending_handoffs) + atomic_load(&load->loop_lag_usec) / SHUSO_SERVER_HANDOFF_LAG_USEC_PER_CONNECTION;
+}
+
+shuso_process_t *shuso_server_handoff_target(shuso_t *S) {
+  shuso_process_t *target = NULL;
+  uint32_t         least = UINT32_MAX;
+  uint32_t         mine, score;
+  if(!S->process->load) {
+    return NULL;
+  }
+  mine = process_load_score(S->process->load);
+  if(mine <= SHUSO_SERVER_HANDOFF_LOAD_SLACK) {
+    return NULL;
+  }
+  SHUSO_EACH_WORKER(S, worker) {
+    if(worker == S->process || !worker->load || atomic_load(&worker->load->handoff_fd_ref) == 0 || *worker->state != SHUSO_STATE_RUNNING) {
+      continue;
+    }
+    score = process_load_score(worker->load);
+    if(score < least) {
+      least = score;
+      target = worker;
+    }
+  }
+  if(!target || mine <= (uint64_t )least * SHUSO_SERVER_HANDOFF_LOAD_RATIO + SHUSO_SERVER_HANDOFF_LOAD_SLACK) {
+    return NULL;
+  }
+  return target;
+}
+
+bool shuso_server_handoff_connection(shuso_t *S, shuso_process_t *dst, shuso_server_binding_t *binding, int fd, const shuso_sockaddr_t *sockaddr, const char *preread, size_t preread_len) {
+  int               ref = atomic_load(&dst->load->handoff_fd_ref);
+  server_handoff_t *handoff;
+  if(ref == 0) {
+    return shuso_set_error(S, "worker %d isn't accepting connection handoffs", dst->procnum);
+  }
+  //workers share an address space, but SCM_RIGHTS still gives the receiver its own fd to own and close
+  handoff = malloc(sizeof(*handoff) + preread_len);
+  if(!handoff) {
+    return shuso_set_error(S, "failed to allocate connection handoff");
+  }
+  handoff->binding = binding;
+  handoff->sockaddr = *sockaddr;
+  handoff->preread_len = preread_len;
+  if(preread_len > 0) {
+    memcpy(handoff->preread, preread, preread_len);
+  }
+  atomic_fetch_add(&dst->load->pending_handoffs, 1);
+  if(!shuso_ipc_send_fd_and_close(S, dst, fd, ref, handoff)) {
+    atomic_fetch_sub(&dst->load->pending_handoffs, 1);
+    free(handoff);
+    return false;
+  }
+  return true;
+}
+
+static void receive_handoff_connection(shuso_t *S, bool ok, uintptr_t ref, int fd, void *receiver_pd, void *pd) {
+  server_handoff_receiver_t            *receiver = receiver_pd;
+  server_handoff_t                     *handoff = pd;
+  shuso_listener_io_data_t             *listener;
+  shuso_server_tentative_accept_data_t  maybe_accept_data;
+  if(!ok) {
+    //receiver stopped
+    if(receiver && receiver->fd_ref == (int )ref) {
+      receiver->fd_ref = 0;
+      atomic_store(&S->process->load->handoff_fd_ref, 0);
+    }
+    return;
+  }
+  atomic_fetch_sub(&S->process->load->pending_handoffs, 1);
+  for(listener = receiver->listeners; listener != NULL; listener = listener->next) {
+    if(listener->binding == handoff->binding) {
+      break;
+    }
+  }
+  if(!listener) {
+    shuso_log_warning(S, "dropped handed-off connection on %s: not listening there", handoff->binding->host.name ? handoff->binding->host.name : "(?)");
+    close(fd);
+    free(handoff);
+    return;
+  }
+  
+  //pick it up right where the other worker's listener left off
+  maybe_accept_data = (shuso_server_tentative_accept_data_t ) {
+    .sockaddr = &handoff->sockaddr,
+    .fd = fd,
+    .binding = listener->binding,
+    .accept_event = listener->accept_event,
+    .preread = handoff->preread_len > 0 ? handoff->preread : NULL,
+    .preread_len = handoff->preread_len
+  };
+  shuso_event_publish(S, listener->maybe_accept_event, SHUSO_OK, &maybe_accept_data);
+  free(handoff);
+}
 
 static void listener_accept_coro_error(shuso_t *S, shuso_io_t *io) {
   shuso_log(S, "socket accept listener error");
 }
 
+static int listener_accept_nowait(shuso_listener_io_data_t *d, int fd) {
+  socklen_t socklen = sizeof(d->sockaddr);
+  int       accepted_fd;
+#ifdef SHUTTLESOCK_HAVE_ACCEPT4
+  accepted_fd = accept4(fd, &d->sockaddr.any, &socklen, SOCK_NONBLOCK);
+#else
+  accepted_fd = accept(fd, &d->sockaddr.any, &socklen);
+  if(accepted_fd != -1) {
+    fcntl(accepted_fd, F_SETFL, O_NONBLOCK);
+  }
+#endif
+  d->sockaddr_len = socklen;
+  return accepted_fd;
+}
+
+static bool listener_overloaded(shuso_t *S, shuso_listener_io_data_t *d) {
+  shuso_server_binding_t *binding = d->binding;
+  uint64_t                max_connections = binding->max_connections;
+  uint64_t                max_lag = binding->max_loop_lag_usec;
+  if(!S->process->load || (max_connections == 0 && max_lag == 0)) {
+    return false;
+  }
+  if(d->paused) {
+    //stay paused until well under the limits, so that the listener doesn't flap around them
+    max_connections = max_connections * SHUSO_SERVER_THROTTLE_RESUME_CONNECTIONS_PERCENT / 100;
+    max_lag = max_lag * SHUSO_SERVER_THROTTLE_RESUME_LAG_PERCENT / 100;
+    return (binding->max_connections > 0 && atomic_load(&S->process->load->connections) > max_connections)
+        || (binding->max_loop_lag_usec > 0 && atomic_load(&S->process->load->loop_lag_usec) > max_lag);
+  }
+  return (max_connections > 0 && atomic_load(&S->process->load->connections) >= max_connections)
+      || (max_lag > 0 && atomic_load(&S->process->load->loop_lag_usec) >= max_lag);
+}
+
+static void listener_throttle_publish(shuso_t *S, shuso_listener_io_data_t *d) {
+  shuso_server_listener_throttle_t data = {
+    .binding = d->binding,
+    .paused = d->paused,
+    .connections = atomic_load(&S->process->load->connections),
+    .loop_lag_usec = atomic_load(&S->process->load->loop_lag_usec)
+  };
+  const char *name = d->binding->host.name ? d->binding->host.name : "(?)";
+  if(d->paused) {
+    shuso_log_warning(S, "stopped accepting connections on %s: %u open, %.1fms loop lag", name, (unsigned )data.connections, data.loop_lag_usec / 1000.0);
+  }
+  else {
+    shuso_log_notice(S, "resumed accepting connections on %s: %u open, %.1fms loop lag", name, (unsigned )data.connections, data.loop_lag_usec / 1000.0);
+  }
+  shuso_event_publish(S, d->paused ? d->pause_event : d->resume_event, SHUSO_OK, &data);
+}
+
+static bool listener_hands_off(shuso_t *S, shuso_listener_io_data_t *d) {
+  //a paused 'rebalance' listener keeps accepting as long as there's a less busy worker to pass the connections to
+  return d->binding->rebalance && shuso_server_handoff_target(S) != NULL;
+}
+
+static void listener_throttle_check(shuso_loop *loop, shuso_ev_timer *w, int revents) {
+  shuso_listener_io_data_t *d = shuso_ev_data(w);
+  shuso_t                  *S = d->io.S;
+  if(listener_overloaded(S, d)) {
+    if(d->suspended && listener_hands_off(S, d)) {
+      //still paused, but some other worker can take the connections now
+      d->suspended = false;
+      shuso_io_resume(&d->io);
+    }
+    return;
+  }
+  shuso_ev_timer_stop(S, &d->throttle);
+  d->paused = false;
+  listener_throttle_publish(S, d);
+  if(d->suspended) {
+    d->suspended = false;
+    shuso_io_resume(&d->io);
+  }
+}
+
+static void listener_pause(shuso_t *S, shuso_listener_io_data_t *d) {
+  //the kernel keeps queueing connections on this worker's socket -- SO_REUSEPORT hashing (or CPU steering) doesn't
+  //know it's paused. 'rebalance' listeners keep accepting them to hand off to other workers. the rest just wait
+  //in the listen queue until the worker catches up, or until it overflows
+  d->paused = true;
+  shuso_ev_timer_init(S, &d->throttle, SHUSO_SERVER_THROTTLE_CHECK_INTERVAL, SHUSO_SERVER_THROTTLE_CHECK_INTERVAL, listener_throttle_check, d);
+  shuso_ev_timer_start(S, &d->throttle);
+  listener_throttle_publish(S, d);
+}
+
+static void listener_backoff_done(shuso_loop *loop, shuso_ev_timer *w, int revents) {
+  shuso_listener_io_data_t *d = shuso_ev_data(w);
+  shuso_ev_timer_stop(d->io.S, &d->backoff);
+  d->backing_off = false;
+  shuso_io_resume(&d->io);
+}
+
+static void listener_backoff(shuso_t *S, shuso_listener_io_data_t *d, int err) {
+  //the connection's still in the accept queue, so the (level-triggered) listener would be woken right back up to
+  //fail again. stop watching it for a bit instead, and hope some fds or memory get freed up in the meantime
+  const char *name = d->binding->host.name ? d->binding->host.name : "(?)";
+  ev_tstamp   now = ev_now(S->ev.loop);
+  if(d->backoff_logged == 0 || now - d->backoff_logged >= SHUSO_SERVER_ACCEPT_BACKOFF_LOG_INTERVAL) {
+    if(d->backoff_unlogged > 0) {
+      shuso_log_warning(S, "failed to accept connection on %s: %s (and %u more times since the last warning)", name, strerror(err), d->backoff_unlogged);
+    }
+    else {
+      shuso_log_warning(S, "failed to accept connection on %s: %s", name, strerror(err));
+    }
+    d->backoff_logged = now;
+    d->backoff_unlogged = 0;
+  }
+  else {
+    d->backoff_unlogged++;
+  }
+  d->backing_off = true;
+  shuso_ev_timer_init(S, &d->backoff, SHUSO_SERVER_ACCEPT_BACKOFF_INTERVAL, 0.0, listener_backoff_done, d);
+  shuso_ev_timer_start(S, &d->backoff);
+}
+
+static void listener_connection_accepted(shuso_t *S, shuso_listener_io_data_t *d, int fd, shuso_sockaddr_t *sockaddr) {
+  shuso_server_tentative_accept_data_t  maybe_accept_data;
+  shuso_process_t                      *handoff_target;
+  if(d->binding->rebalance && (handoff_target = shuso_server_handoff_target(S)) != NULL) {
+    if(shuso_server_handoff_connection(S, handoff_target, d->binding, fd, sockaddr, NULL, 0)) {
+      return;
+    }
+  }
+  maybe_accept_data.sockaddr = sockaddr;
+  maybe_accept_data.fd = fd;
+  maybe_accept_data.binding = d->binding;
+  maybe_accept_data.accept_event = d->accept_event;
+  maybe_accept_data.preread = NULL;
+  maybe_accept_data.preread_len = 0;
+  
+  shuso_event_publish(S, d->maybe_accept_event, SHUSO_OK, &maybe_accept_data);
+}
+
+static void proxy_protocol_header_read(shuso_t *S, int fd, shuso_sockaddr_t *sockaddr, shuso_server_binding_t *binding, void *pd) {
+  listener_connection_accepted(S, pd, fd, sockaddr);
+}
+
 static void listener_accept_coro(shuso_t *S, shuso_io_t *io) {
   
   shuso_listener_io_data_t   *d = io->privdata;
-  shuso_server_tentative_accept_data_t  maybe_accept_data;
   int rc = 0;
+  int fd;
+  int accept_errno;
   SHUSO_IO_CORO_BEGIN(io, listener_accept_coro_error);
-  rc = listen(io->io_socket.fd, 100);
+  rc = listen(io->io_socket.fd, d->binding->backlog);
   if(rc < 0) {
     raise(SIGABRT);
     shuso_set_error_errno(S, "failed to listen on %s: %s", d->binding->host.name ? d->binding->host.name : "(?)", strerror(errno));
@@ -181,21 +535,111 @@ static void listener_accept_coro(shuso_t *S, shuso_io_t *io) {
     shuso_log_info(S, "Listening on %s", d->binding->host.name ? d->binding->host.name : "(?)");
   }
   while(rc == 0) {
+    if(listener_overloaded(S, d)) {
+      if(!d->paused) {
+        listener_pause(S, d);
+      }
+      if(!listener_hands_off(S, d)) {
+        //until listener_throttle_check() says otherwise
+        d->suspended = true;
+        SHUSO_IO_CORO_YIELD(suspend, NULL);
+        continue;
+      }
+      //listener_connection_accepted() hands everything off
+    }
     SHUSO_IO_CORO_YIELD(wait, SHUSO_IO_READ);
-    SHUSO_IO_CORO_YIELD(accept, &d->sockaddr, sizeof(d->sockaddr));
-    maybe_accept_data.sockaddr = &d->sockaddr;
-    maybe_accept_data.fd = io->result_fd;
-    maybe_accept_data.binding = d->binding;
-    maybe_accept_data.accept_event = d->accept_event;
-    
-    shuso_event_publish(S, d->maybe_accept_event, SHUSO_OK, &maybe_accept_data);
+    if(io->result < 0) {
+      //stopped
+      break;
+    }
+    accept_errno = 0;
+    //drain the accept queue (up to a limit, so other work isn't starved) instead of going back to the loop for every connection
+    for(unsigned i = 0; i < d->binding->accept_batch; i++) {
+      if(i > 0 && listener_overloaded(S, d) && !listener_hands_off(S, d)) {
+        break;
+      }
+      if((fd = listener_accept_nowait(d, io->io_socket.fd)) == -1) {
+        if(errno == EINTR || errno == ECONNABORTED) {
+          continue;
+        }
+        if(errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+          accept_errno = errno;
+        }
+        else if(errno != EAGAIN && errno != EWOULDBLOCK) {
+          shuso_log_warning(S, "failed to accept connection on %s: %s", d->binding->host.name ? d->binding->host.name : "(?)", strerror(errno));
+        }
+        break;
+      }
+      if(d->binding->proxy_protocol) {
+        //everything else waits for the header, and the client address in it
+        if(!shuso_proxy_protocol_read_start(S, d->binding, fd, &d->sockaddr, proxy_protocol_header_read, d)) {
+          shuso_log_warning(S, "dropped connection: %s", shuso_last_error(S));
+          close(fd);
+        }
+        continue;
+      }
+      listener_connection_accepted(S, d, fd, &d->sockaddr);
+    }
+    if(accept_errno != 0) {
+      //until listener_backoff_done()
+      listener_backoff(S, d, accept_errno);
+      SHUSO_IO_CORO_YIELD(suspend, NULL);
+    }
   }
   SHUSO_IO_CORO_END(io);
 }
 
+static void listener_datagram_coro_error(shuso_t *S, shuso_io_t *io) {
+  shuso_listener_io_data_t   *d = io->privdata;
+  shuso_log_warning(S, "stopped receiving datagrams on %s: %s", d->binding->host.name ? d->binding->host.name : "(?)", strerror(io->error));
+}
+
+static void listener_datagram_coro(shuso_t *S, shuso_io_t *io) {
+  shuso_listener_io_data_t   *d = io->privdata;
+  shuso_server_datagram_t     datagram;
+  shuso_mmsghdr_t            *msg;
+  SHUSO_IO_CORO_BEGIN(io, listener_datagram_coro_error);
+  shuso_log_info(S, "Receiving datagrams on %s", d->binding->host.name ? d->binding->host.name : "(?)");
+  while(1) {
+    shuso_io_datagram_batch_reset(d->batch);
+    //as many as have arrived, up to a batch, in one call
+    SHUSO_IO_CORO_YIELD(recvmmsg, d->batch->msg, SHUSO_IO_DATAGRAM_BATCH_SIZE, 0);
+    if(io->result < 0) {
+      //stopped
+      break;
+    }
+    for(int i = 0; i < io->result; i++) {
+      msg = &d->batch->msg[i];
+      datagram = (shuso_server_datagram_t ) {
+        .binding = d->binding,
+        .fd = io->io_socket.fd,
+        .peer = &d->batch->addr[i],
+        .peer_len = msg->msg_hdr.msg_namelen,
+        .data = msg->msg_hdr.msg_iov[0].iov_base,
+        .len = msg->msg_len,
+        .truncated = msg->msg_hdr.msg_flags & MSG_TRUNC
+      };
+      shuso_event_publish(S, d->datagram_event, SHUSO_OK, &datagram);
+    }
+  }
+  SHUSO_IO_CORO_END(io);
+}
+
+bool shuso_server_datagram_reply(shuso_t *S, const shuso_server_datagram_t *datagram, const char *data, size_t len) {
+  ssize_t sent;
+  do {
+    sent = sendto(datagram->fd, data, len, 0, &datagram->peer->any, datagram->peer_len);
+  } while(sent == -1 && errno == EINTR);
+  if(sent == -1) {
+    return shuso_set_error_errno(S, "failed to send datagram on %s: %s", datagram->binding->host.name ? datagram->binding->host.name : "(?)", strerror(errno));
+  }
+  return true;
+}
+
 static int luaS_start_worker_io_listener_coroutine(lua_State *L) {
   shuso_t *S = shuso_state(L);
   shuso_listener_io_data_t  *data;
+  server_handoff_receiver_t *receiver;
   int                        fd = lua_tointeger(L, 2);
   shuso_server_binding_t    *binding = (void *)lua_topointer(L, 3);
   assert(binding);
@@ -205,7 +649,54 @@ static int luaS_start_worker_io_listener_coroutine(lua_State *L) {
     return luaL_error(L, "failed to allocate shuso_io data for listener socket");
   }
   
+  lua_getfield(L, 1, "handoff_receiver");
+  receiver = (void *)lua_topointer(L, -1);
+  lua_pop(L, 1);
+  if(!receiver) {
+    if((receiver = shuso_palloc(&S->pool, sizeof(*receiver))) == NULL) {
+      return luaL_error(L, "failed to allocate connection handoff receiver");
+    }
+    *receiver = (server_handoff_receiver_t ) {.listeners = NULL, .fd_ref = 0};
+    lua_pushlightuserdata(L, receiver);
+    lua_setfield(L, 1, "handoff_receiver");
+  }
+  
   data->binding = binding;
+  data->batch = NULL;
+  data->datagram_event = NULL;
+  data->pause_event = NULL;
+  data->resume_event = NULL;
+  data->paused = false;
+  data->suspended = false;
+  data->backing_off = false;
+  data->backoff_logged = 0;
+  data->backoff_unlogged = 0;
+  data->next = receiver->listeners;
+  receiver->listeners = data;
+  
+  shuso_socket_t      sock = {
+    .fd = fd,
+    .host = binding->host
+  };
+  
+  if(binding->host.type == SOCK_DGRAM) {
+    //nothing to listen() or accept() here. every worker receives on its own SO_REUSEPORT socket
+    lua_getfield(L, 1, "event_pointer");
+    lua_pushvalue(L, 1);
+    lua_pushfstring(L, "%s.datagram", binding->server_type);
+    luaS_call(L, 2, 1);
+    data->datagram_event = (void *)lua_topointer(L, -1);
+    assert(data->datagram_event);
+    lua_pop(L, 1);
+    if((data->batch = shuso_io_datagram_batch_acquire(S, SHUSO_IO_DATAGRAM_SLOT_SIZE)) == NULL) {
+      return luaL_error(L, "failed to allocate datagram batch for listener socket");
+    }
+    shuso_io_init(S, &data->io, &sock, SHUSO_IO_READ, listener_datagram_coro, data);
+    shuso_io_start(&data->io);
+    lua_pushlightuserdata(L, &data->io);
+    return 1;
+  }
+  
   lua_getfield(L, 1, "event_pointer");
   lua_pushvalue(L, 1);
   lua_pushliteral(L, "maybe_accept");
@@ -222,26 +713,76 @@ static int luaS_start_worker_io_listener_coroutine(lua_State *L) {
   assert(data->accept_event);
   lua_pop(L, 1);
   
-  shuso_socket_t      sock = {
-    .fd = fd,
-    .host = binding->host
-  };
+  if(binding->max_connections > 0 || binding->max_loop_lag_usec > 0) {
+    lua_getfield(L, 1, "event_pointer");
+    lua_pushvalue(L, 1);
+    lua_pushliteral(L, "listener_pause");
+    luaS_call(L, 2, 1);
+    data->pause_event = (void *)lua_topointer(L, -1);
+    assert(data->pause_event);
+    lua_pop(L, 1);
+    
+    lua_getfield(L, 1, "event_pointer");
+    lua_pushvalue(L, 1);
+    lua_pushliteral(L, "listener_resume");
+    luaS_call(L, 2, 1);
+    data->resume_event = (void *)lua_topointer(L, -1);
+    assert(data->resume_event);
+    lua_pop(L, 1);
+  }
   
   shuso_io_init(S, &data->io, &sock, SHUSO_IO_READ, listener_accept_coro, data);
   shuso_io_start(&data->io);
   
+  if(binding->rebalance && receiver->fd_ref == 0 && S->process->load) {
+    receiver->fd_ref = shuso_ipc_receive_fd_start(S, "server connection handoff", 0, receive_handoff_connection, receiver);
+    atomic_store(&S->process->load->handoff_fd_ref, receiver->fd_ref);
+  }
+  
   lua_pushlightuserdata(L, &data->io);
   return 1;
 }
 
 static int luaS_stop_worker_io_listener_coroutine(lua_State *L) {
-  shuso_io_t *io = (void *)lua_topointer(L, 1);
+  shuso_io_t               *io = (void *)lua_topointer(L, 1);
+  shuso_listener_io_data_t *d = io->privdata;
+  if(d->paused) {
+    shuso_ev_timer_stop(io->S, &d->throttle);
+    d->paused = false;
+    d->suspended = false;
+  }
+  if(d->backing_off) {
+    shuso_ev_timer_stop(io->S, &d->backoff);
+    d->backing_off = false;
+  }
   shuso_io_stop(io);
   close(io->io_socket.fd);
+  if(d->batch) {
+    shuso_io_datagram_batch_release(io->S, d->batch);
+    d->batch = NULL;
+  }
   lua_pushboolean(L, 1);
   return 1;
 }
 
+static int luaS_stop_worker_connection_handoff(lua_State *L) {
+  shuso_t                   *S = shuso_state(L);
+  server_handoff_receiver_t *receiver;
+  lua_getfield(L, 1, "handoff_receiver");
+  receiver = (void *)lua_topointer(L, -1);
+  lua_pop(L, 1);
+  if(receiver && receiver->fd_ref != 0) {
+    //stop taking connections from other workers before the listeners go away
+    atomic_store(&S->process->load->handoff_fd_ref, 0);
+    shuso_ipc_receive_fd_finish(S, receiver->fd_ref);
+    receiver->fd_ref = 0;
+  }
+  if(receiver) {
+    receiver->listeners = NULL;
+  }
+  return 0;
+}
+
 static void free_shared_host_data(shuso_t *S, shuso_hostinfo_t *h) {
   if(h) {
     if(h->sockaddr) {
@@ -353,6 +894,40 @@ static int luaS_handle_fd_request(lua_State *L) {
   return 1;
 }
 
+static int luaS_attach_reuseport_cpu_steering(lua_State *L) {
+  shuso_t          *S = shuso_state(L);
+  int               fd = luaL_checkinteger(L, 1);
+  int               count = luaL_checkinteger(L, 2);
+  assert(count > 0);
+#ifdef SHUTTLESOCK_HAVE_REUSEPORT_CBPF
+  //hand the connection to the socket at index (receiving CPU % number of sockets). sockets are indexed in the order they were bound,
+  //and worker n gets socket n, so with worker_cpu_affinity on, the connection stays on the CPU that took the interrupt
+  struct sock_filter code[] = {
+    { BPF_LD  | BPF_W   | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+    { BPF_ALU | BPF_MOD | BPF_K,   0, 0, (uint32_t )count },
+    { BPF_RET | BPF_A,             0, 0, 0 }
+  };
+  struct sock_fprog prog = {
+    .len = sizeof(code)/sizeof(*code),
+    .filter = code
+  };
+  if(!S->common->config.worker_cpu_affinity) {
+    shuso_log_notice(S, "CPU steering is enabled for a listener, but worker_cpu_affinity is off. Connections will be steered to workers that may be on any CPU");
+  }
+  if(setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == -1) {
+    lua_pushnil(L);
+    lua_pushfstring(L, "failed to attach CPU steering program to listener socket: %s", strerror(errno));
+    return 2;
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+#else
+  lua_pushnil(L);
+  lua_pushliteral(L, "CPU steering for listener sockets is not supported on this system");
+  return 2;
+#endif
+}
+
 static int luaS_free_shared_host_data(lua_State *L) {
   shuso_hostinfo_t *shared_host = (void *)lua_topointer(L, 1);
   free_shared_host_data(shuso_state(L), shared_host);
@@ -360,6 +935,39 @@ static int luaS_free_shared_host_data(lua_State *L) {
   return 1;
 }
 
+static int luaS_take_inherited_listener_fd(lua_State *L) {
+  shuso_t          *S = shuso_state(L);
+  int               fd = shuso_upgrade_take_inherited_fd(S, luaL_checkstring(L, 1));
+  if(fd == -1) {
+    lua_pushnil(L);
+    return 1;
+  }
+  lua_pushinteger(L, fd);
+  return 1;
+}
+
+static int luaS_keep_listener_fd(lua_State *L) {
+  shuso_t          *S = shuso_state(L);
+  if(!shuso_upgrade_keep_fd(S, luaL_checkstring(L, 1), luaL_checkinteger(L, 2))) {
+    lua_pushnil(L);
+    lua_pushstring(L, shuso_last_error(S));
+    return 2;
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+static int luaS_finish_upgrade(lua_State *L) {
+  shuso_t          *S = shuso_state(L);
+  if(!shuso_upgrade_finish(S)) {
+    lua_pushnil(L);
+    lua_pushstring(L, shuso_last_error(S));
+    return 2;
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
 static bool binding_data_lua_wrap(lua_State *L, const char *type, void *data) {
   assert(strcmp(type, "server_binding") == 0);
   shuso_server_binding_t *binding = data;
@@ -380,29 +988,68 @@ static lua_reference_t binding_data_lua_unwrap(lua_State *L, const char *type, i
   return LUA_NOREF;
 }
 
+static void accept_event_publish(shuso_t *S, shuso_event_t *accept_event, shuso_socket_t *socket, shuso_server_binding_t *binding, const char *preread, size_t preread_len, const unsigned char *alpn, unsigned alpn_len) {
+  shuso_connection_t         *c;
+  shuso_server_accept_data_t  accept_data;
+  if((c = shuso_connection_create(S, socket)) == NULL) {
+    shuso_log_warning(S, "dropped connection: %s", shuso_last_error(S));
+    shuso_io_tls_free(socket);
+    close(socket->fd);
+    return;
+  }
+  accept_data = (shuso_server_accept_data_t ) {
+    .socket = &c->socket,
+    .connection = c,
+    .binding = binding,
+    .preread = preread,
+    .preread_len = preread_len,
+    .alpn = alpn,
+    .alpn_len = alpn_len
+  };
+  shuso_event_publish(S, accept_event, SHUSO_OK, &accept_data);
+  if(!c->claimed) {
+    //whoever took the socket copied what they needed
+    shuso_connection_recycle(c);
+  }
+}
+
+static void tls_handshake_done(shuso_t *S, shuso_socket_t *socket, shuso_server_binding_t *binding, const unsigned char *alpn, unsigned alpn_len, void *pd) {
+  accept_event_publish(S, pd, socket, binding, NULL, 0, alpn, alpn_len);
+}
+
 static void maybe_accept_event_confirm_accept(shuso_t *S, shuso_event_state_t *evs, intptr_t code,  void *d, void *pd) {
   shuso_server_tentative_accept_data_t *data = d;
-  shuso_server_accept_data_t            accept_data;
-  shuso_socket_t                        socket;
+  shuso_socket_t                        socket = {0};
   
   socket.fd = data->fd;
   socket.host.name = NULL;
+  socket.accepted = true;
 
-  assert(data->sockaddr->any.sa_family == data->binding->host.family);
   socket.host.sockaddr = data->sockaddr;
-  socket.host.family = data->binding->host.family;
+  //not necessarily the binding's, if it came from a PROXY protocol header
+  socket.host.family = data->sockaddr->any.sa_family;
   socket.host.type = data->binding->host.type;
   
-  accept_data = (shuso_server_accept_data_t ) {
-    .socket = &socket,
-    .binding = data->binding
-  };
+  if(data->binding->tls) {
+    //the accept event gets the connection once the handshake's done
+    if(data->preread_len > 0) {
+      //handed off too late to be decrypted here
+      shuso_log_warning(S, "dropped TLS connection with data already read from it");
+      close(socket.fd);
+    }
+    else if(!shuso_tls_handshake_start(S, data->binding, &socket, tls_handshake_done, data->accept_event)) {
+      shuso_log_warning(S, "%s", shuso_last_error(S));
+      close(socket.fd);
+    }
+    return;
+  }
   
-  shuso_event_publish(S, data->accept_event, SHUSO_OK, &accept_data);
+  accept_event_publish(S, data->accept_event, &socket, data->binding, data->preread, data->preread_len, NULL, 0);
 }
 
 static void no_accept_handler_found(shuso_t *S, shuso_event_state_t *evs, intptr_t code,  void *d, void *pd) {
   shuso_server_accept_data_t *data = d;
+  shuso_io_tls_free(data->socket);
   close(data->socket->fd);
   //TODO: from where?
   shuso_log_info(S, "No handler accepted incoming connection [FROM WHERE?]");
@@ -417,6 +1064,78 @@ static int luaS_accept_event_init(lua_State *L) {
   return 0;
 }
 
+static void http_accept_handler(shuso_t *S, shuso_event_state_t *evs, intptr_t code,  void *d, void *pd) {
+  shuso_server_accept_data_t *data = d;
+  shuso_event_t              *request_event = pd;
+  if(request_event->listeners == NULL || request_event->listeners[0].fn == NULL) {
+    //nobody wants parsed requests. whoever handles http.accept gets the raw socket
+    return;
+  }
+  if(data->alpn_len == 2 && memcmp(data->alpn, "h2", 2) == 0) {
+    if(!shuso_http2_connection_start(S, data->socket, data->binding, request_event, data->preread, data->preread_len)) {
+      shuso_log_warning(S, "failed to start HTTP/2 connection: %s", shuso_last_error(S));
+      shuso_io_tls_free(data->socket);
+      close(data->socket->fd);
+    }
+    return;
+  }
+  if(!shuso_http_connection_start(S, data->connection, data->binding, request_event, data->preread, data->preread_len)) {
+    shuso_log_warning(S, "failed to start HTTP connection: %s", shuso_last_error(S));
+    shuso_io_tls_free(data->socket);
+    close(data->socket->fd);
+  }
+}
+
+static int luaS_http_accept_event_init(lua_State *L) {
+  shuso_t *S = shuso_state(L);
+  
+  shuso_event_t *accept_event = (void *)lua_topointer(L, 1);
+  shuso_event_t *request_event = (void *)lua_topointer(L, 2);
+  shuso_event_listen_with_priority(S, accept_event, http_accept_handler, request_event, SHUTTLESOCK_LAST_PRIORITY);
+  
+  return 0;
+}
+
+static void stream_accept_handler(shuso_t *S, shuso_event_state_t *evs, intptr_t code,  void *d, void *pd) {
+  shuso_server_accept_data_t *data = d;
+  if(!data->binding->proxy) {
+    //whoever handles stream.accept gets the raw socket
+    return;
+  }
+  if(!shuso_stream_proxy_start(S, data->binding->proxy, data->socket, data->preread, data->preread_len)) {
+    shuso_log_warning(S, "failed to proxy connection: %s", shuso_last_error(S));
+    shuso_io_tls_free(data->socket);
+    close(data->socket->fd);
+  }
+}
+
+static int luaS_stream_accept_event_init(lua_State *L) {
+  shuso_t *S = shuso_state(L);
+  
+  shuso_event_t *accept_event = (void *)lua_topointer(L, 1);
+  shuso_event_listen_with_priority(S, accept_event, stream_accept_handler, NULL, SHUTTLESOCK_LAST_PRIORITY);
+  
+  return 0;
+}
+
+static int luaS_stop_worker_stream_proxy(lua_State *L) {
+  shuso_server_binding_t *binding = (void *)lua_topointer(L, 1);
+  if(binding && binding->proxy) {
+    shuso_stream_proxy_worker_stop(shuso_state(L), binding->proxy);
+  }
+  return 0;
+}
+
+static int luaS_free_binding_tls(lua_State *L) {
+  shuso_t                *S = shuso_state(L);
+  shuso_server_binding_t *binding = (void *)lua_topointer(L, 1);
+  if(binding && binding->tls) {
+    shuso_tls_ctx_free(S, binding->tls);
+    binding->tls = NULL;
+  }
+  return 0;
+}
+
 static int luaS_maybe_accept_event_init(lua_State *L) {
   shuso_t *S = shuso_state(L);
   
@@ -440,6 +1159,19 @@ static bool lua_event_data_socket_wrap(lua_State *L, const char *type, void *dat
   lua_pushinteger(L, sock->fd);
   lua_setfield(L, tindex, "fd");
   
+  if(sock->accepted) {
+    lua_pushboolean(L, 1);
+    lua_setfield(L, tindex, "accepted");
+  }
+  
+  if(sock->tls) {
+    //TLS state goes along with the fd. IO.wrap() picks it up
+    lua_pushlightuserdata(L, sock->tls);
+    lua_setfield(L, tindex, "tls");
+    lua_pushinteger(L, sock->tls_offload);
+    lua_setfield(L, tindex, "tls_offload");
+  }
+  
   if(sock->host.name) {
     lua_pushstring(L, sock->host.name);
     lua_setfield(L, tindex, "name");
@@ -483,6 +1215,18 @@ static lua_reference_t lua_event_data_socket_unwrap(lua_State *L, const char *ty
   sock->fd = lua_isinteger(L, -1) ? lua_tointeger(L, -1) : -1;
   lua_pop(L, 1);
   
+  lua_getfield(L, idx, "accepted");
+  sock->accepted = lua_toboolean(L, -1);
+  lua_pop(L, 1);
+  
+  lua_getfield(L, idx, "tls");
+  sock->tls = lua_islightuserdata(L, -1) ? (void *)lua_topointer(L, -1) : NULL;
+  lua_pop(L, 1);
+  
+  lua_getfield(L, idx, "tls_offload");
+  sock->tls_offload = lua_tointeger(L, -1);
+  lua_pop(L, 1);
+  
   lua_getfield(L, idx, "name");
   sock->host.name = lua_isstring(L, -1) ? lua_tostring(L, -1) : NULL;
   lua_pop(L, 1);
@@ -509,109 +1253,481 @@ static bool lua_event_data_socket_unwrap_cleanup(lua_State *L, const char *type,
 }
 
 
+//pushes the sockaddr's family, address, address_binary, port or path. false (and nothing pushed) if it doesn't have that one
+static bool lua_push_sockaddr_field(lua_State *L, const shuso_sockaddr_t *sockaddr, const char *field) {
+  switch(sockaddr->any.sa_family) {
+    case AF_INET:
+      if(strcmp(field, "family") == 0) {
+        lua_pushliteral(L, "IPv4");
+      }
+      else if(strcmp(field, "address_binary") == 0) {
+        lua_pushlstring(L, (char *)&sockaddr->in.sin_addr, sizeof(sockaddr->in.sin_addr));
+      }
+      else if(strcmp(field, "address") == 0) {
+        char  address_str[INET_ADDRSTRLEN];
+        if(!inet_ntop(AF_INET, (char *)&sockaddr->in.sin_addr, address_str, INET_ADDRSTRLEN)) {
+          return false;
+        }
+        lua_pushstring(L, address_str);
+      }
+      else if(strcmp(field, "port") == 0) {
+        lua_pushinteger(L, ntohs(sockaddr->in.sin_port));
+      }
+      else {
+        return false;
+      }
+      return true;
+#ifdef SHUTTLESOCK_HAVE_IPV6
+    case AF_INET6:
+      if(strcmp(field, "family") == 0) {
+        lua_pushliteral(L, "IPv6");
+      }
+      else if(strcmp(field, "address_binary") == 0) {
+        lua_pushlstring(L, (char *)&sockaddr->in6.sin6_addr, sizeof(sockaddr->in6.sin6_addr));
+      }
+      else if(strcmp(field, "address") == 0) {
+        char address_str[INET6_ADDRSTRLEN];
+        if(!inet_ntop(AF_INET6, (char *)&sockaddr->in6.sin6_addr, address_str, INET6_ADDRSTRLEN)) {
+          return false;
+        }
+        lua_pushstring(L, address_str);
+      }
+      else if(strcmp(field, "port") == 0) {
+        lua_pushinteger(L, ntohs(sockaddr->in6.sin6_port));
+      }
+      else {
+        return false;
+      }
+      return true;
+#endif
+    case AF_UNIX:
+      if(strcmp(field, "family") == 0) {
+        lua_pushliteral(L, "unix");
+      }
+      else if(strcmp(field, "path") == 0) {
+        lua_pushstring(L, sockaddr->un.sun_path);
+      }
+      else {
+        return false;
+      }
+      return true;
+  }
+  return false;
+}
+
+//family, address, address_binary and port, or path, of the table on top of the stack
+static void lua_set_sockaddr_fields(lua_State *L, const shuso_sockaddr_t *sockaddr) {
+  static const char *fields[] = {"family", "address", "address_binary", "port", "path", NULL};
+  for(const char **field = fields; *field != NULL; field++) {
+    if(lua_push_sockaddr_field(L, sockaddr, *field)) {
+      lua_setfield(L, -2, *field);
+    }
+  }
+}
+
+static void lua_push_binding(lua_State *L, shuso_server_binding_t *binding) {
+  luaS_push_lua_module_field(L, "shuttlesock.modules.core.server", "get_binding");
+  lua_pushlightuserdata(L, binding);
+  luaS_call(L, 1, 1);
+  assert(lua_istable(L, -1));
+}
+
+//accept event data, as Lua sees it. connections come in too fast to build a table for each one that's mostly
+//never looked at, so Lua gets this instead, and its fields are looked up when they're indexed. they're only good
+//while the event is being handled, and raise an error if they're indexed after that.
+typedef struct {
+  void                   *data; //NULL once the event's been handled
+  bool                    maybe; //shuso_server_tentative_accept_data_t, or else shuso_server_accept_data_t
+} accept_data_lua_proxy_t;
+
+static int luaS_accept_data_proxy_index(lua_State *L) {
+  accept_data_lua_proxy_t *proxy = luaL_checkudata(L, 1, "shuttlesock.server.accept_data");
+  const char              *field = luaL_checkstring(L, 2);
+  
+  if(!proxy->data) {
+    return luaL_error(L, "accept event data is only valid while the event is being handled");
+  }
+  
+  if(proxy->maybe) {
+    shuso_server_tentative_accept_data_t *data = proxy->data;
+    if(strcmp(field, "fd") == 0) {
+      lua_pushinteger(L, data->fd);
+    }
+    else if(strcmp(field, "binding") == 0) {
+      lua_push_binding(L, data->binding);
+    }
+    else if(strcmp(field, "preread") == 0 && data->preread) {
+      lua_pushlstring(L, data->preread, data->preread_len);
+    }
+    else if(strcmp(field, "accept_event_name") == 0 && data->accept_event) {
+      lua_pushstring(L, data->accept_event->name);
+    }
+    else if(strcmp(field, "accept_event_ptr") == 0 && data->accept_event) {
+      lua_pushlightuserdata(L, data->accept_event);
+    }
+    else if(!lua_push_sockaddr_field(L, data->sockaddr, field)) {
+      lua_pushnil(L);
+    }
+  }
+  else {
+    shuso_server_accept_data_t *data = proxy->data;
+    if(strcmp(field, "socket") == 0) {
+      lua_event_data_socket_wrap(L, "shuso_socket", data->socket);
+    }
+    else if(strcmp(field, "binding") == 0) {
+      lua_push_binding(L, data->binding);
+    }
+    else if(strcmp(field, "preread") == 0 && data->preread) {
+      lua_pushlstring(L, data->preread, data->preread_len);
+    }
+    else if(strcmp(field, "alpn") == 0 && data->alpn) {
+      lua_pushlstring(L, (const char *)data->alpn, data->alpn_len);
+    }
+    else {
+      lua_pushnil(L);
+    }
+  }
+  return 1;
+}
+
+//the proxies are kept in a registry table, one for each accept event being handled at once. usually just the one,
+//unless a handler publishes another accept event. each event gets a new one: a handler may have held on to the
+//last one, and that has to stay invalid rather than start pointing at the next event's data
+static void lua_push_accept_data_proxy(lua_State *L, void *data, bool maybe) {
+  accept_data_lua_proxy_t *proxy;
+  lua_Integer              depth;
+  if(lua_getfield(L, LUA_REGISTRYINDEX, "shuttlesock.server.accept_data_proxies") != LUA_TTABLE) {
+    lua_pop(L, 1);
+    lua_newtable(L);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, LUA_REGISTRYINDEX, "shuttlesock.server.accept_data_proxies");
+  }
+  lua_getfield(L, -1, "depth");
+  depth = lua_tointeger(L, -1) + 1;
+  lua_pop(L, 1);
+  lua_pushinteger(L, depth);
+  lua_setfield(L, -2, "depth");
+  
+  proxy = lua_newuserdata(L, sizeof(*proxy));
+  if(luaL_newmetatable(L, "shuttlesock.server.accept_data")) {
+    lua_pushcfunction(L, luaS_accept_data_proxy_index);
+    lua_setfield(L, -2, "__index");
+  }
+  lua_setmetatable(L, -2);
+  lua_pushvalue(L, -1);
+  lua_rawseti(L, -3, depth);
+  proxy->data = data;
+  proxy->maybe = maybe;
+  lua_remove(L, -2);
+}
+
+static void accept_data_proxy_release(lua_State *L, void *data) {
+  accept_data_lua_proxy_t *proxy;
+  lua_Integer              depth;
+  lua_getfield(L, LUA_REGISTRYINDEX, "shuttlesock.server.accept_data_proxies");
+  lua_getfield(L, -1, "depth");
+  depth = lua_tointeger(L, -1);
+  lua_pop(L, 1);
+  assert(depth > 0);
+  lua_rawgeti(L, -1, depth);
+  proxy = lua_touserdata(L, -1);
+  assert(proxy && proxy->data == data);
+  proxy->data = NULL;
+  lua_pop(L, 1);
+  //never reused, so any reference to it that's left over keeps raising errors
+  lua_pushnil(L);
+  lua_rawseti(L, -2, depth);
+  lua_pushinteger(L, depth - 1);
+  lua_setfield(L, -2, "depth");
+  lua_pop(L, 1);
+}
+
 static bool lua_event_accept_data_wrap(lua_State *L, const char *type, void *data) {
-  shuso_server_accept_data_t *accept = data;
-  int top = lua_gettop(L);
   lua_checkstack(L, 3);
+  lua_push_accept_data_proxy(L, data, false);
+  return true;
+}
+
+static bool lua_event_accept_data_wrap_cleanup(lua_State *L, const char *type, void *data) {
+  accept_data_proxy_release(L, data);
+  return true;
+}
+
+static bool lua_event_maybe_accept_data_wrap(lua_State *L, const char *type, void *data) {
+  lua_checkstack(L, 3);
+  lua_push_accept_data_proxy(L, data, true);
+  return true;
+}
+
+static bool lua_event_maybe_accept_data_wrap_cleanup(lua_State *L, const char *type, void *data) {
+  accept_data_proxy_release(L, data);
+  return true;
+}
+
+//enough to reply with, after the event's done and the received datagram is gone
+typedef struct {
+  shuso_server_binding_t *binding;
+  int                     fd;
+  socklen_t               peer_len;
+  shuso_sockaddr_t        peer;
+} datagram_lua_handle_t;
+
+static int luaS_datagram_reply(lua_State *L) {
+  shuso_t                 *S = shuso_state(L);
+  datagram_lua_handle_t   *handle;
+  shuso_server_datagram_t  datagram;
+  const char              *data;
+  size_t                   len;
+  
+  luaL_checktype(L, 1, LUA_TTABLE);
+  data = luaL_checklstring(L, 2, &len);
+  lua_getfield(L, 1, "handle");
+  handle = luaL_checkudata(L, -1, "shuttlesock.server.datagram_handle");
+  lua_pop(L, 1);
+  
+  datagram = (shuso_server_datagram_t ) {
+    .binding = handle->binding,
+    .fd = handle->fd,
+    .peer = &handle->peer,
+    .peer_len = handle->peer_len
+  };
+  if(!shuso_server_datagram_reply(S, &datagram, data, len)) {
+    lua_pushnil(L);
+    lua_pushstring(L, shuso_last_error(S));
+    return 2;
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+static bool lua_event_datagram_wrap(lua_State *L, const char *type, void *evdata) {
+  shuso_server_datagram_t *datagram = evdata;
+  datagram_lua_handle_t   *handle;
+  int top = lua_gettop(L);
+  lua_checkstack(L, 4);
   
   lua_newtable(L);
-  lua_event_data_socket_wrap(L, "shuso_socket", accept->socket);
-  lua_setfield(L, -2, "socket");
   
-  luaS_push_lua_module_field(L, "shuttlesock.modules.core.server", "get_binding");
-  lua_pushlightuserdata(L, accept->binding);
-  luaS_call(L, 1, 1);
-  assert(lua_istable(L, -1));
+  //Lua gets its own copy. the batch it came in is reused for the next datagrams
+  lua_pushlstring(L, datagram->data, datagram->len);
+  lua_setfield(L, -2, "data");
   
+  if(datagram->truncated) {
+    lua_pushboolean(L, 1);
+    lua_setfield(L, -2, "truncated");
+  }
+  
+  lua_newtable(L);
+  lua_set_sockaddr_fields(L, datagram->peer);
+  lua_setfield(L, -2, "peer");
+  
+  handle = lua_newuserdata(L, sizeof(*handle));
+  handle->binding = datagram->binding;
+  handle->fd = datagram->fd;
+  handle->peer_len = datagram->peer_len;
+  memcpy(&handle->peer, datagram->peer, datagram->peer_len);
+  luaL_newmetatable(L, "shuttlesock.server.datagram_handle");
+  lua_setmetatable(L, -2);
+  lua_setfield(L, -2, "handle");
+  
+  lua_push_binding(L, datagram->binding);
   lua_setfield(L, -2, "binding");
   
+  if(luaL_newmetatable(L, "shuttlesock.server.datagram")) {
+    lua_newtable(L);
+    lua_pushcfunction(L, luaS_datagram_reply);
+    lua_setfield(L, -2, "reply");
+    lua_setfield(L, -2, "__index");
+  }
+  lua_setmetatable(L, -2);
+  
   assert(lua_gettop(L) == top+1);
-  //TODO: shuso_server_binding_t
   return true;
 }
 
-static bool lua_event_accept_data_wrap_cleanup(lua_State *L, const char *type, void *data) {
+static bool lua_event_datagram_wrap_cleanup(lua_State *L, const char *type, void *data) {
   return true;
 }
 
-static bool lua_event_maybe_accept_data_wrap(lua_State *L, const char *type, void *evdata) {
-  shuso_server_tentative_accept_data_t *data = evdata;
-  int top = lua_gettop(L);
+static bool lua_event_listener_throttle_wrap(lua_State *L, const char *type, void *evdata) {
+  shuso_server_listener_throttle_t *throttle = evdata;
   lua_checkstack(L, 3);
-  
   lua_newtable(L);
+  lua_pushboolean(L, throttle->paused);
+  lua_setfield(L, -2, "paused");
+  lua_pushinteger(L, throttle->connections);
+  lua_setfield(L, -2, "connections");
+  lua_pushnumber(L, (double )throttle->loop_lag_usec / 1000000.0);
+  lua_setfield(L, -2, "loop_lag");
+  lua_push_binding(L, throttle->binding);
+  lua_setfield(L, -2, "binding");
+  return true;
+}
+
+static bool lua_event_listener_throttle_wrap_cleanup(lua_State *L, const char *type, void *data) {
+  return true;
+}
+
+typedef struct {
+  shuso_http_request_t   *request; //NULL once the request is finished
+  shuso_t                *S;
+  lua_reference_t         ref;
+} http_request_lua_handle_t;
+
+static void http_request_lua_handle_finish(shuso_http_request_t *r, void *pd) {
+  http_request_lua_handle_t *handle = pd;
+  handle->request = NULL;
+  luaL_unref(handle->S->lua.state, LUA_REGISTRYINDEX, handle->ref);
+  handle->ref = LUA_NOREF;
+}
+
+static int luaS_http_request_respond(lua_State *L) {
+  shuso_t                   *S = shuso_state(L);
+  http_request_lua_handle_t *handle;
+  shuso_http_request_t      *r;
+  shuso_http_header_t       *headers = NULL;
+  size_t                     header_count = 0;
+  const char                *body = NULL;
+  size_t                     body_len = 0;
+  int                        status;
+  
+  luaL_checktype(L, 1, LUA_TTABLE);
+  status = luaL_checkinteger(L, 2);
+  if(!lua_isnoneornil(L, 3)) {
+    luaL_checktype(L, 3, LUA_TTABLE);
+  }
+  if(!lua_isnoneornil(L, 4)) {
+    body = luaL_checklstring(L, 4, &body_len);
+  }
   
-  lua_pushinteger(L, data->fd);
-  lua_setfield(L, -2, "fd");
+  lua_getfield(L, 1, "handle");
+  handle = lua_touserdata(L, -1);
+  lua_pop(L, 1);
+  if(!handle || !handle->request) {
+    lua_pushnil(L);
+    lua_pushliteral(L, "request is already finished");
+    return 2;
+  }
+  r = handle->request;
   
-  if(data->accept_event) {
-    lua_pushstring(L, data->accept_event->name);
-    lua_setfield(L, -2, "accept_event_name");
-    
-    lua_pushlightuserdata(L, data->accept_event);
-    lua_setfield(L, -2, "accept_event_ptr");
-  }
-  
-  switch(data->sockaddr->any.sa_family) {
-    case AF_INET: {
-      lua_pushliteral(L, "IPv4");
-      lua_setfield(L, -2, "family");
-      
-      lua_pushlstring(L, (char *)&data->sockaddr->in.sin_addr, sizeof(data->sockaddr->in.sin_addr));
-      lua_setfield(L, -2, "address_binary");
-      
-      char  address_str[INET_ADDRSTRLEN];
-      if(inet_ntop(AF_INET, (char *)&data->sockaddr->in.sin_addr, address_str, INET_ADDRSTRLEN)) {
-        lua_pushstring(L, address_str);
-        lua_setfield(L, -2, "address");
-      }
-      
-      lua_pushinteger(L, ntohs(data->sockaddr->in.sin_port));
-      lua_setfield(L, -2, "port");
-      
-      break;
+  if(lua_istable(L, 3)) {
+    lua_pushnil(L);
+    while(lua_next(L, 3)) {
+      header_count++;
+      lua_pop(L, 1);
     }
-#ifdef SHUTTLESOCK_HAVE_IPV6
-    case AF_INET6: {
-      lua_pushliteral(L, "IPv6");
-      lua_setfield(L, -2, "family");
-      
-      lua_pushlstring(L, (char *)&data->sockaddr->in6.sin6_addr, sizeof(data->sockaddr->in6.sin6_addr));
-      lua_setfield(L, -2, "address_binary");
-      char address_str[INET6_ADDRSTRLEN];
-      if(inet_ntop(AF_INET6, (char *)&data->sockaddr->in6.sin6_addr, address_str, INET6_ADDRSTRLEN)) {
-        lua_pushstring(L, address_str);
-        lua_setfield(L, -2, "address");
+    if(header_count > 0 && (headers = shuso_palloc(r->pool, sizeof(*headers) * header_count)) == NULL) {
+      return luaL_error(L, "failed to allocate response headers");
+    }
+    header_count = 0;
+    lua_pushnil(L);
+    while(lua_next(L, 3)) {
+      if(lua_type(L, -2) != LUA_TSTRING || !lua_isstring(L, -1)) {
+        return luaL_error(L, "response headers must be a table of string names and string values");
       }
-      
-      lua_pushinteger(L, ntohs(data->sockaddr->in6.sin6_port));
-      lua_setfield(L, -2, "port");
-      
-      break;
+      headers[header_count].name = lua_tolstring(L, -2, &headers[header_count].name_len);
+      //the value may be a number, and converting it in place would confuse lua_next. convert a copy
+      lua_pushvalue(L, -1);
+      headers[header_count].value = lua_tolstring(L, -1, &headers[header_count].value_len);
+      header_count++;
+      //the strings are in the headers table, so they'll stick around until the response is prepared
+      lua_pop(L, 2);
     }
-#endif
-    case AF_UNIX:
-      lua_pushliteral(L, "unix");
-      lua_setfield(L, -2, "family");
-      
-      lua_pushstring(L, data->sockaddr->un.sun_path);
-      lua_setfield(L, -2, "path");
-      break;
   }
   
+  if(!shuso_http_respond(r, status, headers, header_count, body, body_len)) {
+    lua_pushnil(L);
+    lua_pushstring(L, shuso_last_error(S));
+    return 2;
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+static bool lua_event_http_request_wrap(lua_State *L, const char *type, void *data) {
+  shuso_http_request_t      *r = data;
+  http_request_lua_handle_t *handle;
+  luaL_Buffer                buf;
+  int top = lua_gettop(L);
+  lua_checkstack(L, 6);
+  
+  lua_newtable(L);
+  
+  lua_pushlstring(L, r->method, r->method_len);
+  lua_setfield(L, -2, "method");
+  
+  lua_pushlstring(L, r->path, r->path_len);
+  lua_setfield(L, -2, "path");
+  
+  if(r->major_version == 2) {
+    lua_pushliteral(L, "2");
+  }
+  else {
+    lua_pushfstring(L, "1.%d", r->minor_version);
+  }
+  lua_setfield(L, -2, "version");
+  
+  lua_createtable(L, 0, r->header_count);
+  for(size_t i = 0; i < r->header_count; i++) {
+    //header names are lowercased, and repeated headers are joined with commas
+    char *name = luaL_buffinitsize(L, &buf, r->headers[i].name_len);
+    for(size_t j = 0; j < r->headers[i].name_len; j++) {
+      name[j] = tolower((unsigned char )r->headers[i].name[j]);
+    }
+    luaL_pushresultsize(&buf, r->headers[i].name_len);
+    lua_pushvalue(L, -1);
+    if(lua_rawget(L, -3) == LUA_TNIL) {
+      lua_pop(L, 1);
+      lua_pushlstring(L, r->headers[i].value, r->headers[i].value_len);
+    }
+    else {
+      lua_pushliteral(L, ", ");
+      lua_pushlstring(L, r->headers[i].value, r->headers[i].value_len);
+      lua_concat(L, 3);
+    }
+    lua_rawset(L, -3);
+  }
+  lua_setfield(L, -2, "headers");
+  
+  if(r->body.len > 0) {
+    lua_pushlstring(L, r->body.data, r->body.len);
+    lua_setfield(L, -2, "body");
+  }
+  
+  if(r->finish == http_request_lua_handle_finish) {
+    handle = r->finish_pd;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, handle->ref);
+  }
+  else {
+    assert(r->finish == NULL);
+    handle = lua_newuserdata(L, sizeof(*handle));
+    handle->request = r;
+    handle->S = shuso_state(L);
+    lua_pushvalue(L, -1);
+    handle->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    r->finish = http_request_lua_handle_finish;
+    r->finish_pd = handle;
+  }
+  lua_setfield(L, -2, "handle");
+  
   luaS_push_lua_module_field(L, "shuttlesock.modules.core.server", "get_binding");
-  lua_pushlightuserdata(L, data->binding);
+  lua_pushlightuserdata(L, r->binding);
   luaS_call(L, 1, 1);
-  assert(lua_istable(L, -1));
-  
   lua_setfield(L, -2, "binding");
   
+  if(luaL_newmetatable(L, "shuttlesock.server.http_request")) {
+    lua_newtable(L);
+    lua_pushcfunction(L, luaS_http_request_respond);
+    lua_setfield(L, -2, "respond");
+    lua_setfield(L, -2, "__index");
+  }
+  lua_setmetatable(L, -2);
+  
   assert(lua_gettop(L) == top+1);
-  //TODO: shuso_server_binding_t
   return true;
 }
 
-static bool lua_event_maybe_accept_data_wrap_cleanup(lua_State *L, const char *type, void *data) {
+static bool lua_event_http_request_wrap_cleanup(lua_State *L, const char *type, void *data) {
   return true;
 }
 
@@ -639,6 +1755,21 @@ static int register_event_data_types(lua_State *L) {
     .wrap =           lua_event_maybe_accept_data_wrap,
     .wrap_cleanup =   lua_event_maybe_accept_data_wrap_cleanup,
   });
+  
+  ok = ok && shuso_lua_event_register_data_wrapper(S, "server_datagram", &(shuso_lua_event_data_wrapper_t ){
+    .wrap =           lua_event_datagram_wrap,
+    .wrap_cleanup =   lua_event_datagram_wrap_cleanup,
+  });
+  
+  ok = ok && shuso_lua_event_register_data_wrapper(S, "server_listener_throttle", &(shuso_lua_event_data_wrapper_t ){
+    .wrap =           lua_event_listener_throttle_wrap,
+    .wrap_cleanup =   lua_event_listener_throttle_wrap_cleanup,
+  });
+  
+  ok = ok && shuso_lua_event_register_data_wrapper(S, "http_request", &(shuso_lua_event_data_wrapper_t ){
+    .wrap =           lua_event_http_request_wrap,
+    .wrap_cleanup =   lua_event_http_request_wrap_cleanup,
+  });
     
   lua_pushboolean(L, ok);
   return 1;
@@ -651,11 +1782,20 @@ void shuttlesock_server_module_prepare(shuso_t *S, void *pd) {
     {"create_binding_table_from_ptr", luaS_create_binding_table_from_ptr},
     {"start_worker_io_listener_coro", luaS_start_worker_io_listener_coroutine},
     {"stop_worker_io_listener_coro", luaS_stop_worker_io_listener_coroutine},
+    {"stop_worker_connection_handoff", luaS_stop_worker_connection_handoff},
     {"maybe_accept_event_init", luaS_maybe_accept_event_init},
     {"accept_event_init", luaS_accept_event_init},
+    {"http_accept_event_init", luaS_http_accept_event_init},
+    {"stream_accept_event_init", luaS_stream_accept_event_init},
+    {"stop_worker_stream_proxy", luaS_stop_worker_stream_proxy},
+    {"free_binding_tls", luaS_free_binding_tls},
     {"create_shared_host_data", luaS_create_shared_host_data},
     {"handle_fd_request", luaS_handle_fd_request},
+    {"attach_reuseport_cpu_steering", luaS_attach_reuseport_cpu_steering},
     {"free_shared_host_data", luaS_free_shared_host_data},
+    {"take_inherited_listener_fd", luaS_take_inherited_listener_fd},
+    {"keep_listener_fd", luaS_keep_listener_fd},
+    {"finish_upgrade", luaS_finish_upgrade},
 
     {NULL, NULL}
   };
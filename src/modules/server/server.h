@@ -5,10 +5,43 @@
 
 void shuttlesock_server_module_prepare(shuso_t *S, void *pd);
 
+#define SHUSO_SERVER_DEFAULT_BACKLOG 511
+//connections accepted per listener readiness event before yielding back to the loop
+#define SHUSO_SERVER_DEFAULT_ACCEPT_BATCH 64
+
+//a worker is overloaded when its load is more than this many times the least loaded worker's...
+#define SHUSO_SERVER_HANDOFF_LOAD_RATIO 2
+//...plus this much. keeps lightly-loaded workers from passing connections back and forth
+#define SHUSO_SERVER_HANDOFF_LOAD_SLACK 32
+//this much event loop lag weighs as much as one open connection
+#define SHUSO_SERVER_HANDOFF_LAG_USEC_PER_CONNECTION 1000
+
+//a listener paused for max_connections resumes when the worker's connections are down to this percentage of it...
+#define SHUSO_SERVER_THROTTLE_RESUME_CONNECTIONS_PERCENT 75
+//...and one paused for max_lag when the loop lag is down to this percentage of that
+#define SHUSO_SERVER_THROTTLE_RESUME_LAG_PERCENT 50
+//how often a paused listener checks if it can resume
+#define SHUSO_SERVER_THROTTLE_CHECK_INTERVAL 0.05
+//how long a listener stops accepting after running out of fds or memory
+#define SHUSO_SERVER_ACCEPT_BACKOFF_INTERVAL 0.1
+//and how often it says so
+#define SHUSO_SERVER_ACCEPT_BACKOFF_LOG_INTERVAL 5.0
+
+typedef struct shuso_tls_ctx_s shuso_tls_ctx_t;
+typedef struct shuso_stream_proxy_s shuso_stream_proxy_t;
+
 typedef struct {
   int                 lua_hostnum;
   const char         *server_type;
   shuso_hostinfo_t    host;
+  int                 backlog;
+  unsigned            accept_batch;
+  bool                rebalance;
+  unsigned            max_connections; //pause accepting when the worker has this many connections open. 0 for no limit
+  uint32_t            max_loop_lag_usec; //...or when its event loop lags this much
+  shuso_tls_ctx_t    *tls; //for 'ssl' listeners
+  shuso_stream_proxy_t *proxy; //for stream servers with proxy_pass
+  bool                proxy_protocol; //connections start with a PROXY protocol header
   struct {
     size_t              count;
     struct {
@@ -21,7 +54,12 @@ typedef struct {
 
 typedef struct {
   shuso_socket_t         *socket;
+  shuso_connection_t     *connection; //pooled. to keep it past the event, set its 'claimed' and shuso_connection_release() it when done
   shuso_server_binding_t *binding;
+  const char             *preread; //data already read from the socket, if it was handed off by another worker
+  size_t                  preread_len;
+  const unsigned char    *alpn; //protocol negotiated during the TLS handshake, if any
+  unsigned                alpn_len;
 } shuso_server_accept_data_t;
 
 typedef struct {
@@ -29,8 +67,29 @@ typedef struct {
   int                     fd;
   shuso_event_t          *accept_event;
   shuso_server_binding_t *binding;
+  const char             *preread;
+  size_t                  preread_len;
 } shuso_server_tentative_accept_data_t;
 
+//a received datagram. data points into the worker's receive batch, and is only valid while the event is handled
+typedef struct {
+  shuso_server_binding_t *binding;
+  int                     fd; //the listener socket it came in on
+  const shuso_sockaddr_t *peer;
+  socklen_t               peer_len;
+  const char             *data;
+  size_t                  len;
+  bool                    truncated; //longer than SHUSO_IO_DATAGRAM_SLOT_SIZE, and cut off there
+} shuso_server_datagram_t;
+
+//published when a listener stops accepting because its worker is overloaded, and when it starts again
+typedef struct {
+  shuso_server_binding_t *binding;
+  bool                    paused;
+  uint32_t                connections; //the worker's open connections
+  uint32_t                loop_lag_usec; //the worker's smoothed event loop lag
+} shuso_server_listener_throttle_t;
+
 typedef struct {
   struct {
     size_t                  count;
@@ -38,4 +97,15 @@ typedef struct {
   } binding;
 } shuso_server_ctx_t;
 
+// the least loaded worker, if this one is overloaded enough to hand connections off to it. NULL otherwise.
+shuso_process_t *shuso_server_handoff_target(shuso_t *S);
+// hand an accepted connection and any data already read from it to another worker, which picks it up as if
+// it had accepted it itself. the fd is closed here once it's been sent. returns false if it couldn't be handed off,
+// in which case the fd is left open.
+bool shuso_server_handoff_connection(shuso_t *S, shuso_process_t *dst, shuso_server_binding_t *binding, int fd, const shuso_sockaddr_t *sockaddr, const char *preread, size_t preread_len);
+
+// send a datagram back to the peer a datagram came from, out of the same socket. doesn't wait for the socket
+// to be writable: if the send buffer is full, the reply is dropped and false is returned, as it would be by the network.
+bool shuso_server_datagram_reply(shuso_t *S, const shuso_server_datagram_t *datagram, const char *data, size_t len);
+
 #endif //SHUTTLESOCK_SERVER_MODULE_H
@@ -19,9 +19,21 @@ local Server = Module.new {
     ["http.accept"] = {
       data_type = "server_accept"
     },
+    ["http.request"] = {
+      data_type = "http_request"
+    },
     ["stream.accept"] = {
       data_type = "server_accept"
     },
+    ["stream.datagram"] = {
+      data_type = "server_datagram"
+    },
+    ["listener_pause"] = {
+      data_type = "server_listener_throttle"
+    },
+    ["listener_resume"] = {
+      data_type = "server_listener_throttle"
+    },
     "start",
     "master.start",
     "manager.start",
@@ -82,15 +94,41 @@ Server.settings = {
   {
     name = "listen",
     path = "server/",
-    description = "Sets the address and port for the socket on which the server will accept connections. It is possible to specify just the port. The address can also be a hostname.",
+    description = "Sets the address and port for the socket on which the server will accept connections. It is possible to specify just the port. The address can also be a hostname. Optional parameters: 'udp' or 'tcp' (UDP listeners, in stream servers only, publish a 'stream.datagram' event for every datagram received), 'backlog=N' for the listen queue length, 'accept_batch=N' for the most connections accepted per wakeup, 'cpu_steering' to hand each connection to the worker on the CPU that received it, 'rebalance' to let overloaded workers pass new connections to less busy ones (and keep accepting them to pass on while paused), 'max_connections=N' and 'max_lag=MS' to have a worker stop accepting connections while it has N connections open or its event loop lags by MS milliseconds, 'ssl' to accept TLS connections, and 'proxy_protocol' for connections from a load balancer that starts them with a PROXY protocol (v1 or v2) header, to take the client's address from it. A paused listener publishes 'server:listener_pause', and 'server:listener_resume' once the worker has caught up.",
     default_value = "$default_listen_host:$default_listen_port",
     nargs = "1-32",
+  },
+  {
+    name = "proxy_pass",
+    path = "stream/**",
+    description = "Proxy connections to these upstream servers, given as host:port or unix:path. Each connection goes to the upstream with the fewest connections.",
+    nargs = "1-64"
+  },
+  {
+    name = "proxy_idle_connections",
+    path = "stream/**",
+    description = "Connections to each proxy_pass upstream that every worker keeps open and unused, so that proxied connections don't have to wait to connect. Servers that expect to speak first, or that hang up on quiet clients, may not like this.",
+    nargs = 1
+  },
+  {
+    name = "ssl_certificate",
+    path = "(http|stream)/**",
+    description = "PEM file with the certificate (and any intermediate certificates) for 'ssl' listeners.",
+    nargs = 1
+  },
+  {
+    name = "ssl_certificate_key",
+    path = "(http|stream)/**",
+    description = "PEM file with the private key for 'ssl_certificate'.",
+    nargs = 1
   }
 }
 
 function Server:initialize()
   CFuncs.register_event_data_types()
   CFuncs.maybe_accept_event_init(self:event_pointer("maybe_accept"))
+  CFuncs.http_accept_event_init(self:event_pointer("http.accept"), self:event_pointer("http.request"))
+  CFuncs.stream_accept_event_init(self:event_pointer("stream.accept"))
   self.shared = Atomics.new("done_count", "failed_count", "aborted")
   self.shared.aborted = false
   self.shared.done_count = 0
@@ -114,10 +152,85 @@ function Server:initialize_config(block)
   
   host.socket_type = "TCP"
   for _, val in listen:each_value(2, "string") do
+    local opt, optval = val:match("^([%w_]+)=(.*)$")
     if val == "udp" or val == "UDP" then
       host.socket_type = "UDP"
     elseif val == "tcp" or val == "TCP" then
       host.socket_type = "TCP"
+    elseif val == "cpu_steering" then
+      host.cpu_steering = true
+    elseif val == "rebalance" then
+      host.rebalance = true
+    elseif val == "ssl" then
+      host.ssl = true
+    elseif val == "proxy_protocol" then
+      host.proxy_protocol = true
+    elseif opt == "backlog" or opt == "accept_batch" then
+      local num = tonumber(optval)
+      if not num or num < 1 or math.floor(num) ~= num then
+        return listen:error(("invalid %s value \"%s\""):format(opt, optval))
+      end
+      host[opt] = math.tointeger(num)
+    elseif opt == "max_connections" then
+      local num = tonumber(optval)
+      if not num or num < 1 or math.floor(num) ~= num then
+        return listen:error(("invalid %s value \"%s\""):format(opt, optval))
+      end
+      host.max_connections = math.tointeger(num)
+    elseif opt == "max_lag" then
+      local num = tonumber(optval)
+      if not num or num <= 0 then
+        return listen:error(("invalid %s value \"%s\""):format(opt, optval))
+      end
+      host.max_lag_usec = math.max(1, math.floor(num * 1000))
+    end
+  end
+  
+  if host.socket_type == "UDP" then
+    if not block:match_path("/stream/server/") then
+      return listen:error("'udp' listeners can only be used in stream servers")
+    elseif host.ssl then
+      return listen:error("'udp' and 'ssl' can't be used together")
+    elseif block:setting("proxy_pass") then
+      return block:setting("proxy_pass"):error("can't proxy from a 'udp' listener")
+    elseif host.proxy_protocol then
+      return listen:error("'udp' and 'proxy_protocol' can't be used together")
+    elseif host.max_connections or host.max_lag_usec then
+      return listen:error("'udp' listeners don't accept connections, so they can't be throttled")
+    end
+  end
+  
+  if host.ssl then
+    for _, name in ipairs{"ssl_certificate", "ssl_certificate_key"} do
+      local setting = block:setting(name)
+      local path = setting and setting:value(1, "string")
+      if not path then
+        return listen:error(('"%s" setting missing for "ssl" listener'):format(name))
+      end
+      host[name] = path
+    end
+  end
+  
+  local proxy_pass = block:setting("proxy_pass")
+  if proxy_pass then
+    host.proxy_pass = {}
+    for _, val in proxy_pass:each_value("string") do
+      local upstream, uerr = Core.parse_host(val)
+      if not upstream then
+        return proxy_pass:error(uerr)
+      elseif not upstream.port and not upstream.path then
+        return proxy_pass:error(("upstream \"%s\" port missing"):format(val))
+      end
+      upstream.setting = proxy_pass
+      table.insert(host.proxy_pass, upstream)
+    end
+    local idle = block:setting("proxy_idle_connections")
+    if idle then
+      local num = idle:value(1, "integer")
+      if not num or num < 0 then
+        return idle:error("invalid proxy_idle_connections value")
+      end
+      host.proxy_idle_connections = num
     end
   end
   
@@ -190,6 +303,44 @@ local function ipc_try_send(dst, name, data)
   return true
 end
 
+--send each worker all of its listener sockets in one message, to all the workers at once
+local function transfer_listener_sockets(transfers)
+  local waiting = coroutine.running()
+  local pending = 0
+  local yielded = false
+  local failed
+  for worker, listeners in pairs(transfers) do
+    pending = pending + 1
+    coroutine.resume(coroutine.create(function()
+      local ok, err = pcall(function()
+        if #listeners > 0 then
+          local receiver = IPC.Receiver.start("server:listener_socket_transfer", worker)
+          ipc_try_send(worker, "server:listener_socket_transfer", listeners)
+          local resp = receiver:yield()
+          receiver:stop()
+          assert(resp == "ok", resp)
+        end
+        ipc_try_send(worker, "server:listener_socket_transfer", "done")
+      end)
+      if not ok then
+        failed = failed or err
+      end
+      pending = pending - 1
+      if pending == 0 and yielded then
+        coroutine.resume(waiting)
+      end
+    end))
+  end
+  if pending > 0 then
+    yielded = true
+    coroutine.yield()
+  end
+  if failed then
+    error(failed, 0)
+  end
+  return true
+end
+
 local function finish_server_startup(func)
   local ok, err = pcall(func)
   if not ok then
@@ -201,36 +352,67 @@ local function finish_server_startup(func)
   return ok
 end
 
+local function host_addresses(host)
+  local addrs, err
+  if host.addrinfo then
+    addrs = host.addrinfo
+  elseif host.hostname then
+    --TODO: per-block resolver
+    local resolved
+    resolved, err = Core.resolve(host.hostname)
+    if resolved then
+      addrs = resolved.addresses
+      --host.aliases = resolved.aliases
+      --host.name = resolved.name
+    end
+  elseif host.path then
+    addrs = {
+      {
+        family = "unix",
+        path=host.path
+      }
+    }
+  end
+  if not addrs or err then
+    return nil, err or "failed to process host"
+  end
+  return addrs
+end
+
 Server:subscribe("core:manager.workers_started", function()
 
   local coro = coroutine.create(function()
     for _, host in ipairs(Server.raw_hosts) do
-      local addrs, err
-      if host.addrinfo then
-        addrs = host.addrinfo
-      elseif host.hostname then
-        --TODO: per-block resolver
-        local resolved
-        resolved, err = Core.resolve(host.hostname)
-        if resolved then
-          addrs = resolved.addresses
-          --host.aliases = resolved.aliases
-          --host.name = resolved.name
-        end
-      elseif host.path then
-        addrs = {
-          {
-            family = "unix",
-            path=host.path
-          }
-        }
+      local addrs, err = host_addresses(host)
+      if not addrs then
+        return nil, host.setting:error(err)
       end
       for _, addr in ipairs(addrs) do
         addr.type = host.socket_type
       end
       host.addresses = addrs
-      if not addrs or err then
-        return nil, host.setting:error(err or "failed to process host")
+      
+      if host.proxy_pass then
+        --every address an upstream resolves to is an upstream of its own
+        host.proxy_addresses = {}
+        for _, upstream in ipairs(host.proxy_pass) do
+          local upstream_addrs, uerr = host_addresses(upstream)
+          if not upstream_addrs then
+            return nil, upstream.setting:error(uerr)
+          end
+          for _, addr in ipairs(upstream_addrs) do
+            addr.type = "TCP"
+            addr.port = upstream.port
+            if addr.path then
+              addr.name = "unix:" .. addr.path
+            elseif addr.address:match(":") then
+              addr.name = ("[%s]:%d"):format(addr.address, upstream.port)
+            else
+              addr.name = ("%s:%d"):format(addr.address, upstream.port)
+            end
+            table.insert(host.proxy_addresses, addr)
+          end
+        end
       end
     end
     local unique_bindings = {}
@@ -249,7 +431,42 @@ Server:subscribe("core:manager.workers_started", function()
         else
           return nil, host.setting:error("can't figure out internal id")
         end
-        unique_bindings[id]=unique_bindings[id] or {address = addr, listen = {}}
+        unique_bindings[id]=unique_bindings[id] or {id = id, address = addr, listen = {}}
+        local binding = unique_bindings[id]
+        --several listen settings may share a socket. the largest ones win
+        for _, opt in ipairs{"backlog", "accept_batch"} do
+          if host[opt] and (not binding[opt] or binding[opt] < host[opt]) then
+            binding[opt] = host[opt]
+          end
+        end
+        --...and the lowest limits
+        for _, opt in ipairs{"max_connections", "max_lag_usec"} do
+          if host[opt] and (not binding[opt] or binding[opt] > host[opt]) then
+            binding[opt] = host[opt]
+          end
+        end
+        binding.cpu_steering = binding.cpu_steering or host.cpu_steering
+        binding.rebalance = binding.rebalance or host.rebalance
+        if binding.ssl == nil then
+          binding.ssl = host.ssl or false
+          binding.ssl_certificate = host.ssl_certificate
+          binding.ssl_certificate_key = host.ssl_certificate_key
+        elseif binding.ssl ~= (host.ssl or false) then
+          return nil, host.setting:error("can't listen both with and without 'ssl' on " .. name)
+        end
+        if binding.proxy_protocol == nil then
+          binding.proxy_protocol = host.proxy_protocol or false
+        elseif binding.proxy_protocol ~= (host.proxy_protocol or false) then
+          return nil, host.setting:error("can't listen both with and without 'proxy_protocol' on " .. name)
+        end
+        if host.proxy_addresses then
+          if binding.proxy_pass and binding.proxy_block ~= host.block then
+            return nil, host.setting:error("can't proxy from more than one server on " .. name)
+          end
+          binding.proxy_pass = host.proxy_addresses
+          binding.proxy_idle_connections = host.proxy_idle_connections
+          binding.proxy_block = host.block
+        end
         table.insert(unique_bindings[id].listen, {
           name = name,
           block = host.block,
@@ -299,9 +516,11 @@ Server:subscribe("core:manager.workers_started", function()
           local shared_ptr = CFuncs.create_shared_host_data(binding.ptr)
           
           local msg = {
+            id = binding.id,
             count = #worker_procnums,
             shared_ptr = shared_ptr,
-            fd_ref = rcvfd.id
+            fd_ref = rcvfd.id,
+            cpu_steering = binding.cpu_steering
           }
           
           ipc_try_send("master", "server:create_listener_sockets", msg)
@@ -320,19 +539,17 @@ Server:subscribe("core:manager.workers_started", function()
           CFuncs.free_shared_host_data(shared_ptr)
         end
       end
-      for _, worker in ipairs(worker_procnums) do
-        if #Server.bindings > 0 then
-          local receiver = IPC.Receiver.start("server:listener_socket_transfer", worker)
-          for _, binding in ipairs(Server.bindings) do
-            local fd = assert(table.remove(binding.sockets), "not enough listener sockets opened. weird")
-            ipc_try_send(worker, "server:listener_socket_transfer", {name = binding.name, fd = fd, address = binding.address, binding_ptr = binding.ptr})
-            local resp = receiver:yield()
-            assert(resp == "ok", resp)
-          end
-          receiver:stop()
+      local transfers = {}
+      for i, worker in ipairs(worker_procnums) do
+        local listeners = {}
+        for _, binding in ipairs(Server.bindings) do
+          --worker i gets the i-th socket bound. CPU steering depends on it
+          local fd = assert(binding.sockets[i], "not enough listener sockets opened. weird")
+          table.insert(listeners, {name = binding.name, fd = fd, address = binding.address, binding_ptr = binding.ptr})
         end
-        ipc_try_send(worker, "server:listener_socket_transfer", "done")
+        transfers[worker] = listeners
       end
+      transfer_listener_sockets(transfers)
       ipc_try_send("master", "server:create_listener_sockets", "done")
     end)
   end)
@@ -350,6 +567,7 @@ end)
 
 Server:subscribe("core:worker.start", function()
   Server.listener_io_c_coroutines = {}
+  Server.listener_binding_ptrs = {}
   local coro = coroutine.create(function()
     finish_server_startup(function()
       local receiver = IPC.Receiver.start("server:listener_socket_transfer", "manager")
@@ -358,13 +576,15 @@ Server:subscribe("core:worker.start", function()
         if data == "done" then
           break
         elseif type(data) == "table" then
-          local c_io_coro = CFuncs.start_worker_io_listener_coro(Server, data.fd, data.binding_ptr)
-          local resp
-          if c_io_coro then
-            table.insert(Server.listener_io_c_coroutines, c_io_coro)
-            resp = "ok"
-          else
-            resp = "not ok"
+          local resp = "ok"
+          for _, listener in ipairs(data) do
+            local c_io_coro = CFuncs.start_worker_io_listener_coro(Server, listener.fd, listener.binding_ptr)
+            if c_io_coro then
+              table.insert(Server.listener_io_c_coroutines, c_io_coro)
+              table.insert(Server.listener_binding_ptrs, listener.binding_ptr)
+            else
+              resp = "failed to start listener on " .. tostring(listener.name)
+            end
           end
           ipc_try_send("manager", "server:listener_socket_transfer", resp)
         else
@@ -395,7 +615,11 @@ Server:subscribe("core:master.start", function()
           local fds = {}
           local errors = {}
           while #fds < req.count - #errors do
-            local fd, err = CFuncs.handle_fd_request(req.shared_ptr)
+            --the previous generation's sockets first, if this one took over from it. they've been listening all along
+            local fd, err = CFuncs.take_inherited_listener_fd(req.id)
+            if not fd then
+              fd, err = CFuncs.handle_fd_request(req.shared_ptr)
+            end
             if fd then
               table.insert(fds, fd)
             else
@@ -403,6 +627,13 @@ Server:subscribe("core:master.start", function()
             end
           end
           
+          if req.cpu_steering and #fds > 0 then
+            local ok, err = CFuncs.attach_reuseport_cpu_steering(fds[1], #fds)
+            if not ok then
+              Log.warning("%s. Falling back to hash-based connection distribution", err)
+            end
+          end
+          
           local resp = {
             fd_count = #fds,
             errors = errors
@@ -414,7 +645,12 @@ Server:subscribe("core:master.start", function()
           resp = rcv:yield()
           assert(resp == "ok")
           for _, fd in ipairs(fds) do
-            assert(Core.fd_close(fd))
+            --kept open for the next generation, should there be one
+            local ok, err = CFuncs.keep_listener_fd(req.id, fd)
+            if not ok then
+              Log.warning("%s", err)
+              assert(Core.fd_close(fd))
+            end
           end
         end
       until not req or req == "done"
@@ -422,14 +658,22 @@ Server:subscribe("core:master.start", function()
     end)
     
   end)
-  IPC.receive("server:start", "manager", publish_server_started_event)
+  IPC.receive("server:start", "manager", function(ok)
+    publish_server_started_event(ok)
+    --every worker is listening. the previous generation, if there is one, can stop now
+    CFuncs.finish_upgrade()
+  end)
   coroutine.resume(coro)
 end)
 
 Server:subscribe("core:worker.stop", function()
+  CFuncs.stop_worker_connection_handoff(Server)
   for _, io_coro in ipairs(Server.listener_io_c_coroutines) do
     CFuncs.stop_worker_io_listener_coro(io_coro)
   end
+  for _, binding_ptr in ipairs(Server.listener_binding_ptrs) do
+    CFuncs.stop_worker_stream_proxy(binding_ptr)
+  end
 end)
 
 local function delay_stopping(self, evstate)
@@ -438,6 +682,15 @@ local function delay_stopping(self, evstate)
   end
 end
 
+Server:subscribe("core:manager.stop", function()
+  --the workers are done with their TLS contexts by now
+  for _, binding in ipairs(Server.bindings) do
+    if binding.ptr then
+      CFuncs.free_binding_tls(binding.ptr)
+    end
+  end
+end)
+
 Server:subscribe("core:master.stop", delay_stopping)
 Server:subscribe("core:manager.stop", delay_stopping)
 Server:subscribe("core:worker.stop", delay_stopping)
@@ -0,0 +1,431 @@
+#include <shuttlesock.h>
+#include "stream_proxy.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <errno.h>
+#include <fcntl.h>
+
+struct shuso_stream_proxy_idle_s {
+  shuso_io_t                      io;
+  shuso_stream_proxy_upstream_t  *upstream;
+  ev_tstamp                       since; //when it connected
+  shuso_stream_proxy_idle_t      *next;
+  unsigned                        connected:1;
+};
+
+typedef struct stream_proxy_session_s stream_proxy_session_t;
+
+typedef struct {
+  shuso_io_t                  reader; //this side's socket
+  shuso_io_t                  writer; //the other side's socket. spliced into, or written to from buf
+  stream_proxy_session_t     *session;
+  char                       *buf; //only when copying
+  size_t                      len; //bytes in buf the writer hasn't written yet
+  unsigned                    splice:1;
+  unsigned                    writer_idle:1;
+  unsigned                    reader_waiting:1; //for the writer to finish with buf
+  unsigned                    done:1;
+} stream_proxy_direction_t;
+
+struct stream_proxy_session_s {
+  stream_proxy_direction_t        up; //client to upstream. its writer connects the upstream socket first
+  stream_proxy_direction_t        down; //upstream to client
+  shuso_stream_proxy_t           *proxy;
+  shuso_stream_proxy_upstream_t  *upstream; //set once the upstream socket's ios are set up
+  uint64_t                        tried; //upstreams that failed to connect
+  char                           *preread;
+  size_t                          preread_len;
+  shuso_ev_timer                  reconnect;
+  shuso_ev_timer                  release;
+  unsigned                        connected:1;
+  unsigned                        closed:1;
+};
+
+shuso_stream_proxy_t *shuso_stream_proxy_create(shuso_t *S, shuso_pool_t *pool, const shuso_hostinfo_t *upstreams, unsigned count, unsigned idle_connections) {
+  shuso_stream_proxy_t *proxy;
+  if(count == 0 || count > SHUSO_STREAM_PROXY_MAX_UPSTREAMS) {
+    shuso_set_error(S, "can't proxy to %u upstreams, it has to be between 1 and %d", count, SHUSO_STREAM_PROXY_MAX_UPSTREAMS);
+    return NULL;
+  }
+  if((proxy = shuso_palloc(pool, sizeof(*proxy))) == NULL || (proxy->upstreams = shuso_palloc(pool, sizeof(*proxy->upstreams) * count)) == NULL) {
+    shuso_set_error(S, "failed to allocate stream proxy");
+    return NULL;
+  }
+  memset(proxy->next, 0, sizeof(proxy->next));
+  memset(proxy->upstreams, 0, sizeof(*proxy->upstreams) * count);
+  proxy->count = count;
+  proxy->idle_connections = idle_connections;
+  for(unsigned i = 0; i < count; i++) {
+    shuso_stream_proxy_upstream_t *upstream = &proxy->upstreams[i];
+    upstream->host = upstreams[i];
+    upstream->host.sockaddr = shuso_palloc(pool, sizeof(*upstream->host.sockaddr));
+    upstream->host.name = upstreams[i].name ? shuso_palloc(pool, strlen(upstreams[i].name) + 1) : NULL;
+    if(!upstream->host.sockaddr || (upstreams[i].name && !upstream->host.name)) {
+      shuso_set_error(S, "failed to allocate stream proxy upstream");
+      return NULL;
+    }
+    *upstream->host.sockaddr = *upstreams[i].sockaddr;
+    if(upstream->host.name) {
+      strcpy((char *)upstream->host.name, upstreams[i].name);
+    }
+    atomic_init(&upstream->connections, 0);
+  }
+  return proxy;
+}
+
+static const char *upstream_name(shuso_stream_proxy_upstream_t *upstream) {
+  return upstream->host.name ? upstream->host.name : "(?)";
+}
+
+static int stream_proxy_socket(shuso_stream_proxy_upstream_t *upstream) {
+  int fd = socket(upstream->host.family, SOCK_STREAM, 0);
+  int one = 1;
+  if(fd == -1) {
+    return -1;
+  }
+  shuso_set_nonblocking(fd);
+  if(upstream->host.family != AF_UNIX) {
+    //whatever the client sent goes out right away
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+  return fd;
+}
+
+static shuso_stream_proxy_upstream_t *stream_proxy_pick_upstream(shuso_t *S, shuso_stream_proxy_t *proxy, uint64_t exclude) {
+  //least connections, counting every worker's
+  shuso_stream_proxy_upstream_t *best = NULL;
+  uint32_t                       least = UINT32_MAX, n;
+  unsigned                       start = proxy->next[S->procnum]++, i;
+  for(unsigned j = 0; j < proxy->count; j++) {
+    i = (start + j) % proxy->count;
+    if(exclude & ((uint64_t )1 << i)) {
+      continue;
+    }
+    n = atomic_load(&proxy->upstreams[i].connections);
+    if(n < least) {
+      least = n;
+      best = &proxy->upstreams[i];
+    }
+  }
+  return best;
+}
+
+static void stream_proxy_idle_unlink(shuso_t *S, shuso_stream_proxy_idle_t *idle) {
+  shuso_stream_proxy_idle_t **cur;
+  for(cur = &idle->upstream->worker[S->procnum].idle; *cur != NULL; cur = &(*cur)->next) {
+    if(*cur == idle) {
+      *cur = idle->next;
+      idle->upstream->worker[S->procnum].idle_count--;
+      return;
+    }
+  }
+}
+
+static void stream_proxy_idle_error(shuso_t *S, shuso_io_t *io) {
+  shuso_stream_proxy_idle_t *idle = io->privdata;
+  shuso_log_info(S, "failed to connect to upstream %s: %s", upstream_name(idle->upstream), strerror(io->error));
+  shuso_io_abort(io);
+  stream_proxy_idle_unlink(S, idle);
+  close(io->io_socket.fd);
+  free(idle);
+}
+
+static void stream_proxy_idle_connect_coro(shuso_t *S, shuso_io_t *io) {
+  shuso_stream_proxy_idle_t *idle = io->privdata;
+  SHUSO_IO_CORO_BEGIN(io, stream_proxy_idle_error);
+  shuso_io_set_deadline(io, SHUSO_STREAM_PROXY_CONNECT_TIMEOUT);
+  SHUSO_IO_CORO_YIELD(connect);
+  shuso_io_set_deadline(io, 0);
+  idle->connected = 1;
+  idle->since = ev_now(S->ev.loop);
+  SHUSO_IO_CORO_END(io);
+}
+
+static void stream_proxy_pool_fill(shuso_t *S, shuso_stream_proxy_t *proxy, shuso_stream_proxy_upstream_t *upstream) {
+  shuso_stream_proxy_idle_t *idle;
+  shuso_socket_t             sock;
+  //one try per missing connection. a connect can fail right away, and this shouldn't spin on a dead upstream
+  for(unsigned i = upstream->worker[S->procnum].idle_count; i < proxy->idle_connections && !upstream->worker[S->procnum].stopped; i++) {
+    if((idle = calloc(1, sizeof(*idle))) == NULL) {
+      return;
+    }
+    sock = (shuso_socket_t ) {.fd = stream_proxy_socket(upstream), .host = upstream->host};
+    if(sock.fd == -1) {
+      free(idle);
+      return;
+    }
+    idle->upstream = upstream;
+    idle->next = upstream->worker[S->procnum].idle;
+    upstream->worker[S->procnum].idle = idle;
+    upstream->worker[S->procnum].idle_count++;
+    shuso_io_init(S, &idle->io, &sock, SHUSO_IO_WRITE, stream_proxy_idle_connect_coro, idle);
+    shuso_io_start(&idle->io);
+  }
+}
+
+static int stream_proxy_idle_take(shuso_t *S, shuso_stream_proxy_upstream_t *upstream) {
+  shuso_stream_proxy_idle_t **cur = &upstream->worker[S->procnum].idle, *idle;
+  ev_tstamp                   now = ev_now(S->ev.loop);
+  bool                        fresh;
+  ssize_t                     n;
+  char                        c;
+  int                         fd;
+  while((idle = *cur) != NULL) {
+    if(!idle->connected) {
+      cur = &idle->next;
+      continue;
+    }
+    *cur = idle->next;
+    upstream->worker[S->procnum].idle_count--;
+    fd = idle->io.io_socket.fd;
+    fresh = now - idle->since < SHUSO_STREAM_PROXY_IDLE_TIMEOUT;
+    free(idle);
+    //a connection the upstream closed reads as EOF. one it's already said hello on is fine
+    n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if(fresh && (n > 0 || (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)))) {
+      return fd;
+    }
+    close(fd);
+  }
+  return -1;
+}
+
+void shuso_stream_proxy_worker_stop(shuso_t *S, shuso_stream_proxy_t *proxy) {
+  shuso_stream_proxy_idle_t *idle;
+  for(unsigned i = 0; i < proxy->count; i++) {
+    shuso_stream_proxy_upstream_t *upstream = &proxy->upstreams[i];
+    upstream->worker[S->procnum].stopped = true;
+    while((idle = upstream->worker[S->procnum].idle) != NULL) {
+      upstream->worker[S->procnum].idle = idle->next;
+      if(!idle->connected) {
+        shuso_io_abort(&idle->io);
+      }
+      close(idle->io.io_socket.fd);
+      free(idle);
+    }
+    upstream->worker[S->procnum].idle_count = 0;
+  }
+}
+
+static void stream_proxy_session_free(stream_proxy_session_t *p) {
+  free(p->up.buf);
+  free(p->down.buf);
+  free(p->preread);
+  free(p);
+}
+
+static void stream_proxy_session_release(shuso_loop *loop, shuso_ev_timer *w, int events) {
+  stream_proxy_session_free(shuso_ev_data(w));
+}
+
+static void stream_proxy_session_close(stream_proxy_session_t *p) {
+  shuso_t *S = p->up.reader.S;
+  if(p->closed) {
+    return;
+  }
+  p->closed = 1;
+  shuso_io_abort(&p->up.reader);
+  shuso_io_abort(&p->down.writer);
+  if(p->upstream) {
+    shuso_io_abort(&p->up.writer);
+    shuso_io_abort(&p->down.reader);
+    close(p->up.writer.io_socket.fd);
+    atomic_fetch_sub(&p->upstream->connections, 1);
+  }
+  shuso_io_forget_connection(&p->up.reader);
+  shuso_io_tls_free(&p->up.reader.io_socket);
+  close(p->up.reader.io_socket.fd);
+  //any of the coroutines may be the one closing it, so it can't be freed just yet
+  shuso_ev_timer_init(S, &p->release, 0, 0, stream_proxy_session_release, p);
+  shuso_ev_timer_start(S, &p->release);
+}
+
+static void stream_proxy_reader_coro(shuso_t *S, shuso_io_t *io);
+static void stream_proxy_writer_coro(shuso_t *S, shuso_io_t *io);
+
+static bool stream_proxy_connect(shuso_t *S, stream_proxy_session_t *p) {
+  shuso_stream_proxy_upstream_t *upstream;
+  shuso_socket_t                 sock;
+  if((upstream = stream_proxy_pick_upstream(S, p->proxy, p->tried)) == NULL) {
+    return shuso_set_error(S, "no upstream left to try");
+  }
+  sock = (shuso_socket_t ) {.fd = stream_proxy_idle_take(S, upstream), .host = upstream->host};
+  p->connected = sock.fd != -1;
+  if(!p->connected && (sock.fd = stream_proxy_socket(upstream)) == -1) {
+    return shuso_set_error_errno(S, "failed to create socket for upstream %s: %s", upstream_name(upstream), strerror(errno));
+  }
+  //replace the one that was just taken, or start keeping some
+  stream_proxy_pool_fill(S, p->proxy, upstream);
+
+  p->upstream = upstream;
+  atomic_fetch_add(&upstream->connections, 1);
+  shuso_io_init(S, &p->up.writer, &sock, SHUSO_IO_WRITE, stream_proxy_writer_coro, &p->up);
+  shuso_io_init(S, &p->down.reader, &sock, SHUSO_IO_READ, stream_proxy_reader_coro, &p->down);
+  shuso_io_start(&p->up.writer);
+  return true;
+}
+
+static void stream_proxy_session_reconnect(shuso_loop *loop, shuso_ev_timer *w, int events) {
+  stream_proxy_session_t *p = shuso_ev_data(w);
+  shuso_t                *S = p->up.reader.S;
+  //that upstream's out
+  p->tried |= (uint64_t )1 << (p->upstream - p->proxy->upstreams);
+  close(p->up.writer.io_socket.fd);
+  atomic_fetch_sub(&p->upstream->connections, 1);
+  p->upstream = NULL;
+  if(!stream_proxy_connect(S, p)) {
+    shuso_log_warning(S, "failed to proxy connection: %s", shuso_last_error(S));
+    stream_proxy_session_close(p);
+  }
+}
+
+static void stream_proxy_io_error(shuso_t *S, shuso_io_t *io) {
+  stream_proxy_direction_t *d = io->privdata;
+  stream_proxy_session_t   *p = d->session;
+  if(io == &p->up.writer && !p->connected) {
+    shuso_log_info(S, "failed to connect to upstream %s: %s", upstream_name(p->upstream), strerror(io->error));
+    shuso_io_abort(io);
+    //try the next one, from outside this coroutine
+    shuso_ev_timer_init(S, &p->reconnect, 0, 0, stream_proxy_session_reconnect, p);
+    shuso_ev_timer_start(S, &p->reconnect);
+    return;
+  }
+  if(io->error != ECONNRESET && io->error != EPIPE && io->error != ETIMEDOUT && io->error != ECANCELED) {
+    shuso_log_info(S, "stream proxy connection error: %s", strerror(io->error));
+  }
+  stream_proxy_session_close(p);
+}
+
+static void stream_proxy_direction_done(stream_proxy_session_t *p, stream_proxy_direction_t *d) {
+  shuso_socket_t *dst = &d->writer.io_socket;
+  d->done = 1;
+  if((p->up.done && p->down.done) || dst->tls) {
+    //a TLS client gets a close_notify rather than a half-close
+    stream_proxy_session_close(p);
+    return;
+  }
+  //pass the half-close along. the other way may still have plenty to say
+  shutdown(dst->fd, SHUT_WR);
+}
+
+static void stream_proxy_forward(stream_proxy_session_t *p) {
+  //upstream's connected. both ways now
+  if(!p->down.splice) {
+    shuso_io_start(&p->down.writer);
+  }
+  shuso_io_start(&p->down.reader);
+  if(!p->closed) {
+    shuso_io_start(&p->up.reader);
+  }
+}
+
+static void stream_proxy_reader_coro(shuso_t *S, shuso_io_t *io) {
+  stream_proxy_direction_t *d = io->privdata;
+  stream_proxy_session_t   *p = d->session;
+
+  SHUSO_IO_CORO_BEGIN(io, stream_proxy_io_error);
+  while(!p->closed) {
+    if(d->splice) {
+      SHUSO_IO_CORO_YIELD(splice_partial, &d->writer, SHUSO_STREAM_PROXY_SPLICE_SIZE);
+      if(io->result == 0) {
+        break;
+      }
+      continue;
+    }
+    //buf is all ours: the writer's done with it
+    SHUSO_IO_CORO_YIELD(read_partial, d->buf, SHUSO_STREAM_PROXY_BUFFER_SIZE);
+    if(io->result == 0) {
+      break;
+    }
+    d->len = io->result;
+    if(d->writer_idle) {
+      d->writer_idle = 0;
+      d->writer.result = 0;
+      shuso_io_resume(&d->writer);
+    }
+    if(d->len > 0 && !p->closed) {
+      //the writer resumes this once it's written it all
+      d->reader_waiting = 1;
+      SHUSO_IO_CORO_YIELD(suspend, NULL);
+    }
+  }
+  if(!p->closed) {
+    stream_proxy_direction_done(p, d);
+  }
+  SHUSO_IO_CORO_END(io);
+}
+
+static void stream_proxy_writer_coro(shuso_t *S, shuso_io_t *io) {
+  stream_proxy_direction_t *d = io->privdata;
+  stream_proxy_session_t   *p = d->session;
+
+  SHUSO_IO_CORO_BEGIN(io, stream_proxy_io_error);
+  if(d == &p->up) {
+    //the upstream socket's writer gets it ready first
+    if(!p->connected) {
+      shuso_io_set_deadline(io, SHUSO_STREAM_PROXY_CONNECT_TIMEOUT);
+      SHUSO_IO_CORO_YIELD(connect);
+      shuso_io_set_deadline(io, 0);
+      p->connected = 1;
+    }
+    if(p->preread_len > 0) {
+      SHUSO_IO_CORO_YIELD(write, p->preread, p->preread_len);
+    }
+    stream_proxy_forward(p);
+  }
+  //only resumed by the reader when it's idle, and only resumes the reader when it's waiting. neither re-enters the other
+  while(!p->closed && !d->splice) {
+    while(d->len == 0) {
+      d->writer_idle = 1;
+      SHUSO_IO_CORO_YIELD(suspend, NULL);
+    }
+    SHUSO_IO_CORO_YIELD(write, d->buf, d->len);
+    d->len = 0;
+    if(d->reader_waiting) {
+      d->reader_waiting = 0;
+      d->reader.result = 0;
+      shuso_io_resume(&d->reader);
+    }
+  }
+  SHUSO_IO_CORO_END(io);
+}
+
+bool shuso_stream_proxy_start(shuso_t *S, shuso_stream_proxy_t *proxy, shuso_socket_t *socket, const char *preread, size_t preread_len) {
+  stream_proxy_session_t *p = calloc(1, sizeof(*p));
+  shuso_socket_t          writer_socket;
+  if(!p) {
+    return shuso_set_error(S, "failed to allocate stream proxy connection");
+  }
+  p->proxy = proxy;
+  p->up.session = p;
+  p->down.session = p;
+#ifdef SHUTTLESOCK_HAVE_SPLICE
+  //spliced bytes never pass through OpenSSL, so a TLS client can only be spliced the ways the kernel does its records
+  p->up.splice = !socket->tls || (socket->tls_offload & SHUSO_IO_READ);
+  p->down.splice = !socket->tls || (socket->tls_offload & SHUSO_IO_WRITE);
+#endif
+  if((!p->up.splice && (p->up.buf = malloc(SHUSO_STREAM_PROXY_BUFFER_SIZE)) == NULL)
+   || (!p->down.splice && (p->down.buf = malloc(SHUSO_STREAM_PROXY_BUFFER_SIZE)) == NULL)
+   || (preread_len > 0 && (p->preread = malloc(preread_len)) == NULL)) {
+    stream_proxy_session_free(p);
+    return shuso_set_error(S, "failed to allocate stream proxy connection");
+  }
+  if(preread_len > 0) {
+    memcpy(p->preread, preread, preread_len);
+    p->preread_len = preread_len;
+  }
+
+  shuso_io_init(S, &p->up.reader, socket, SHUSO_IO_READ, stream_proxy_reader_coro, &p->up);
+  //the connection's counted once, by the reader. TLS state is shared
+  writer_socket = *socket;
+  writer_socket.accepted = false;
+  shuso_io_init(S, &p->down.writer, &writer_socket, SHUSO_IO_WRITE, stream_proxy_writer_coro, &p->down);
+
+  if(!stream_proxy_connect(S, p)) {
+    shuso_io_forget_connection(&p->up.reader);
+    stream_proxy_session_free(p);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,44 @@
+#ifndef SHUTTLESOCK_SERVER_STREAM_PROXY_H
+#define SHUTTLESOCK_SERVER_STREAM_PROXY_H
+
+#include "server.h"
+
+//at most this many upstreams per proxy_pass
+#define SHUSO_STREAM_PROXY_MAX_UPSTREAMS 64
+#define SHUSO_STREAM_PROXY_CONNECT_TIMEOUT 10.0
+//idle upstream connections older than this are closed instead of used. servers tend to hang up on clients that say nothing
+#define SHUSO_STREAM_PROXY_IDLE_TIMEOUT 5.0
+//bytes moved per splice, or read per copy when the client's TLS isn't offloaded to the kernel
+#define SHUSO_STREAM_PROXY_SPLICE_SIZE 65536
+#define SHUSO_STREAM_PROXY_BUFFER_SIZE 16384
+
+typedef struct shuso_stream_proxy_idle_s shuso_stream_proxy_idle_t;
+
+typedef struct {
+  shuso_hostinfo_t            host;
+  _Atomic(uint32_t)           connections; //proxied through it right now, by all the workers
+  struct {
+    shuso_stream_proxy_idle_t  *idle; //connected or connecting, not yet used
+    unsigned                    idle_count;
+    bool                        stopped; //the worker's stopping, so it's not keeping any
+  }                           worker[SHUTTLESOCK_MAX_WORKERS]; //only ever touched by their own worker
+} shuso_stream_proxy_upstream_t;
+
+struct shuso_stream_proxy_s {
+  unsigned                        count;
+  unsigned                        idle_connections; //per upstream per worker
+  shuso_stream_proxy_upstream_t  *upstreams;
+  unsigned                        next[SHUTTLESOCK_MAX_WORKERS]; //where each worker starts looking, so ties don't all go to the first upstream
+};
+
+// a proxy to 'count' upstreams, allocated from the pool along with copies of the hostinfos
+shuso_stream_proxy_t *shuso_stream_proxy_create(shuso_t *S, shuso_pool_t *pool, const shuso_hostinfo_t *upstreams, unsigned count, unsigned idle_connections);
+
+// proxy an accepted connection to the upstream with the fewest connections, using an idle upstream connection
+// if this worker has one. preread is data already read from the socket, and goes upstream first.
+bool shuso_stream_proxy_start(shuso_t *S, shuso_stream_proxy_t *proxy, shuso_socket_t *socket, const char *preread, size_t preread_len);
+
+// close this worker's idle upstream connections. proxied connections carry on until they're done
+void shuso_stream_proxy_worker_stop(shuso_t *S, shuso_stream_proxy_t *proxy);
+
+#endif //SHUTTLESOCK_SERVER_STREAM_PROXY_H
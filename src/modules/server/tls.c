@@ -0,0 +1,440 @@
+#include <shuttlesock.h>
+#include "tls.h"
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/rand.h>
+#include <openssl/evp.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#else
+#include <openssl/hmac.h>
+#endif
+#include <errno.h>
+#include <time.h>
+
+typedef struct tls_session_s tls_session_t;
+struct tls_session_s {
+  tls_session_t          *bucket_next;
+  tls_session_t          *older;
+  tls_session_t          *newer;
+  time_t                  expires;
+  unsigned                id_len;
+  unsigned char           id[SSL_MAX_SSL_SESSION_ID_LENGTH];
+  size_t                  len;
+  unsigned char           data[]; //serialized
+};
+
+typedef struct {
+  //in shared memory, so every worker resumes every other worker's sessions
+  struct {
+    unsigned char           name[16];
+    unsigned char           aes_key[32];
+    unsigned char           hmac_key[32];
+  }                       ticket_key;
+  tls_session_t          *oldest;
+  tls_session_t          *newest;
+  size_t                  count;
+  tls_session_t          *buckets[SHUSO_TLS_SESSION_CACHE_BUCKETS];
+} tls_shared_t;
+
+struct shuso_tls_ctx_s {
+  SSL_CTX                *ssl_ctx;
+  shuso_shared_slab_t    *shm;
+  tls_shared_t           *shared;
+};
+
+typedef struct {
+  shuso_io_t              io;
+  shuso_server_binding_t *binding;
+  shuso_sockaddr_t        sockaddr;
+  shuso_tls_handshake_fn *done;
+  void                   *pd;
+  shuso_ev_timer          release;
+} tls_handshake_t;
+
+static const unsigned char tls_http_alpn[] = "\x02h2\x08http/1.1";
+
+static const char *tls_error_string(void) {
+  const char *err = ERR_reason_error_string(ERR_peek_last_error());
+  return err ? err : "unknown error";
+}
+
+static unsigned tls_session_bucket(const unsigned char *id, unsigned id_len) {
+  uint32_t hash = 2166136261u;
+  for(unsigned i = 0; i < id_len; i++) {
+    hash = (hash ^ id[i]) * 16777619u;
+  }
+  return hash % SHUSO_TLS_SESSION_CACHE_BUCKETS;
+}
+
+static tls_session_t **tls_session_find_locked(tls_shared_t *shared, const unsigned char *id, unsigned id_len) {
+  tls_session_t **cur = &shared->buckets[tls_session_bucket(id, id_len)];
+  for(; *cur != NULL; cur = &(*cur)->bucket_next) {
+    if((*cur)->id_len == id_len && memcmp((*cur)->id, id, id_len) == 0) {
+      return cur;
+    }
+  }
+  return NULL;
+}
+
+static void tls_session_remove_locked(shuso_tls_ctx_t *ctx, tls_session_t *session) {
+  tls_shared_t   *shared = ctx->shared;
+  tls_session_t **ref = tls_session_find_locked(shared, session->id, session->id_len);
+  assert(ref && *ref == session);
+  *ref = session->bucket_next;
+  if(session->older) {
+    session->older->newer = session->newer;
+  }
+  else {
+    shared->oldest = session->newer;
+  }
+  if(session->newer) {
+    session->newer->older = session->older;
+  }
+  else {
+    shared->newest = session->older;
+  }
+  shared->count--;
+  shuso_shared_slab_free_locked(ctx->shm, session);
+}
+
+static int tls_session_new(SSL *ssl, SSL_SESSION *sess) {
+  shuso_tls_ctx_t *ctx = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+  tls_shared_t    *shared = ctx->shared;
+  tls_session_t   *session, **existing;
+  unsigned char    buf[SHUSO_TLS_SESSION_MAX_SIZE], *cur = buf;
+  unsigned         id_len;
+  const unsigned char *id = SSL_SESSION_get_id(sess, &id_len);
+  int              len = i2d_SSL_SESSION(sess, NULL);
+  time_t           now = time(NULL);
+
+  if(len <= 0 || len > SHUSO_TLS_SESSION_MAX_SIZE || id_len == 0 || id_len > SSL_MAX_SSL_SESSION_ID_LENGTH) {
+    return 0;
+  }
+  i2d_SSL_SESSION(sess, &cur);
+
+  shuso_shared_slab_lock(ctx->shm);
+  if((existing = tls_session_find_locked(shared, id, id_len)) != NULL) {
+    tls_session_remove_locked(ctx, *existing);
+  }
+  //expired sessions are at the old end
+  while(shared->oldest && (shared->oldest->expires <= now || shared->count >= SHUSO_TLS_SESSION_CACHE_SIZE)) {
+    tls_session_remove_locked(ctx, shared->oldest);
+  }
+  while((session = shuso_shared_slab_alloc_locked(ctx->shm, sizeof(*session) + len)) == NULL && shared->oldest) {
+    //out of shared memory. make room
+    tls_session_remove_locked(ctx, shared->oldest);
+  }
+  if(session) {
+    session->expires = now + SSL_SESSION_get_timeout(sess);
+    session->id_len = id_len;
+    memcpy(session->id, id, id_len);
+    session->len = len;
+    memcpy(session->data, buf, len);
+    session->bucket_next = shared->buckets[tls_session_bucket(id, id_len)];
+    shared->buckets[tls_session_bucket(id, id_len)] = session;
+    session->newer = NULL;
+    session->older = shared->newest;
+    if(shared->newest) {
+      shared->newest->newer = session;
+    }
+    else {
+      shared->oldest = session;
+    }
+    shared->newest = session;
+    shared->count++;
+  }
+  shuso_shared_slab_unlock(ctx->shm);
+  //the cache keeps a serialized copy, not the session itself
+  return 0;
+}
+
+static SSL_SESSION *tls_session_get(SSL *ssl, const unsigned char *id, int id_len, int *copy) {
+  shuso_tls_ctx_t *ctx = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+  tls_session_t  **ref;
+  unsigned char    buf[SHUSO_TLS_SESSION_MAX_SIZE];
+  const unsigned char *cur = buf;
+  size_t           len = 0;
+
+  *copy = 0;
+  if(id_len <= 0 || id_len > SSL_MAX_SSL_SESSION_ID_LENGTH) {
+    return NULL;
+  }
+  shuso_shared_slab_lock(ctx->shm);
+  if((ref = tls_session_find_locked(ctx->shared, id, id_len)) != NULL) {
+    if((*ref)->expires <= time(NULL)) {
+      tls_session_remove_locked(ctx, *ref);
+    }
+    else {
+      len = (*ref)->len;
+      memcpy(buf, (*ref)->data, len);
+    }
+  }
+  shuso_shared_slab_unlock(ctx->shm);
+  return len > 0 ? d2i_SSL_SESSION(NULL, &cur, len) : NULL;
+}
+
+static void tls_session_remove(SSL_CTX *ssl_ctx, SSL_SESSION *sess) {
+  shuso_tls_ctx_t *ctx = SSL_CTX_get_app_data(ssl_ctx);
+  tls_session_t  **ref;
+  unsigned         id_len;
+  const unsigned char *id = SSL_SESSION_get_id(sess, &id_len);
+  shuso_shared_slab_lock(ctx->shm);
+  if((ref = tls_session_find_locked(ctx->shared, id, id_len)) != NULL) {
+    tls_session_remove_locked(ctx, *ref);
+  }
+  shuso_shared_slab_unlock(ctx->shm);
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static int tls_ticket_key(SSL *ssl, unsigned char *name, unsigned char *iv, EVP_CIPHER_CTX *cipher_ctx, EVP_MAC_CTX *mac_ctx, int enc) {
+#else
+static int tls_ticket_key(SSL *ssl, unsigned char *name, unsigned char *iv, EVP_CIPHER_CTX *cipher_ctx, HMAC_CTX *mac_ctx, int enc) {
+#endif
+  shuso_tls_ctx_t *ctx = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+  tls_shared_t    *shared = ctx->shared;
+  if(enc) {
+    memcpy(name, shared->ticket_key.name, sizeof(shared->ticket_key.name));
+    if(RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1 || EVP_EncryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), NULL, shared->ticket_key.aes_key, iv) != 1) {
+      return -1;
+    }
+  }
+  else {
+    if(memcmp(name, shared->ticket_key.name, sizeof(shared->ticket_key.name)) != 0) {
+      //not one of ours. full handshake, then
+      return 0;
+    }
+    if(EVP_DecryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), NULL, shared->ticket_key.aes_key, iv) != 1) {
+      return -1;
+    }
+  }
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  char       digest[] = "sha256";
+  OSSL_PARAM params[] = {
+    OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, shared->ticket_key.hmac_key, sizeof(shared->ticket_key.hmac_key)),
+    OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+    OSSL_PARAM_construct_end()
+  };
+  if(EVP_MAC_CTX_set_params(mac_ctx, params) != 1) {
+    return -1;
+  }
+#else
+  if(HMAC_Init_ex(mac_ctx, shared->ticket_key.hmac_key, sizeof(shared->ticket_key.hmac_key), EVP_sha256(), NULL) != 1) {
+    return -1;
+  }
+#endif
+  return 1;
+}
+
+static int tls_alpn_select(SSL *ssl, const unsigned char **out, unsigned char *outlen, const unsigned char *in, unsigned int inlen, void *arg) {
+  //our preference, h2 first
+  if(SSL_select_next_proto((unsigned char **)out, outlen, tls_http_alpn, sizeof(tls_http_alpn) - 1, in, inlen) != OPENSSL_NPN_NEGOTIATED) {
+    return SSL_TLSEXT_ERR_NOACK;
+  }
+  return SSL_TLSEXT_ERR_OK;
+}
+
+shuso_tls_ctx_t *shuso_tls_ctx_create(shuso_t *S, const char *certificate, const char *key, bool http) {
+  shuso_tls_ctx_t *ctx;
+  SSL_CTX         *ssl_ctx;
+  long             options = SSL_OP_NO_COMPRESSION | SSL_OP_CIPHER_SERVER_PREFERENCE;
+#ifdef SSL_OP_NO_RENEGOTIATION
+  options |= SSL_OP_NO_RENEGOTIATION;
+#endif
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+  options |= SSL_OP_IGNORE_UNEXPECTED_EOF;
+#endif
+#ifdef SSL_OP_ENABLE_KTLS
+  //the kernel takes over the record layer after the handshake, where it can
+  options |= SSL_OP_ENABLE_KTLS;
+#endif
+
+  if((ctx = calloc(1, sizeof(*ctx))) == NULL) {
+    shuso_set_error(S, "failed to allocate TLS context");
+    return NULL;
+  }
+  ERR_clear_error();
+  if((ssl_ctx = SSL_CTX_new(TLS_server_method())) == NULL) {
+    shuso_set_error(S, "failed to create TLS context: %s", tls_error_string());
+    free(ctx);
+    return NULL;
+  }
+  ctx->ssl_ctx = ssl_ctx;
+  SSL_CTX_set_app_data(ssl_ctx, ctx);
+  SSL_CTX_set_options(ssl_ctx, options);
+  SSL_CTX_set_min_proto_version(ssl_ctx, TLS1_2_VERSION);
+  //writes are retried by the io with the same data, but not necessarily from the same place
+  SSL_CTX_set_mode(ssl_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+
+  if(SSL_CTX_use_certificate_chain_file(ssl_ctx, certificate) != 1) {
+    shuso_set_error(S, "failed to load TLS certificate \"%s\": %s", certificate, tls_error_string());
+    goto fail;
+  }
+  if(SSL_CTX_use_PrivateKey_file(ssl_ctx, key, SSL_FILETYPE_PEM) != 1) {
+    shuso_set_error(S, "failed to load TLS certificate key \"%s\": %s", key, tls_error_string());
+    goto fail;
+  }
+  if(SSL_CTX_check_private_key(ssl_ctx) != 1) {
+    shuso_set_error(S, "TLS certificate key \"%s\" doesn't match certificate \"%s\": %s", key, certificate, tls_error_string());
+    goto fail;
+  }
+
+  ctx->shm = &S->common->shm;
+  if((ctx->shared = shuso_shared_slab_calloc(ctx->shm, sizeof(*ctx->shared))) == NULL) {
+    shuso_set_error(S, "failed to allocate shared TLS session cache");
+    goto fail;
+  }
+  if(RAND_bytes(ctx->shared->ticket_key.name, sizeof(ctx->shared->ticket_key.name)) != 1
+   || RAND_bytes(ctx->shared->ticket_key.aes_key, sizeof(ctx->shared->ticket_key.aes_key)) != 1
+   || RAND_bytes(ctx->shared->ticket_key.hmac_key, sizeof(ctx->shared->ticket_key.hmac_key)) != 1) {
+    shuso_set_error(S, "failed to generate TLS session ticket keys: %s", tls_error_string());
+    goto fail;
+  }
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  SSL_CTX_set_tlsext_ticket_key_evp_cb(ssl_ctx, tls_ticket_key);
+#else
+  SSL_CTX_set_tlsext_ticket_key_cb(ssl_ctx, tls_ticket_key);
+#endif
+  SSL_CTX_set_session_id_context(ssl_ctx, (const unsigned char *)"shuttlesock", sizeof("shuttlesock") - 1);
+  SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+  SSL_CTX_set_timeout(ssl_ctx, SHUSO_TLS_SESSION_TIMEOUT);
+  SSL_CTX_sess_set_new_cb(ssl_ctx, tls_session_new);
+  SSL_CTX_sess_set_get_cb(ssl_ctx, tls_session_get);
+  SSL_CTX_sess_set_remove_cb(ssl_ctx, tls_session_remove);
+
+  if(http) {
+    SSL_CTX_set_alpn_select_cb(ssl_ctx, tls_alpn_select, NULL);
+  }
+  return ctx;
+
+fail:
+  ERR_clear_error();
+  shuso_tls_ctx_free(S, ctx);
+  return NULL;
+}
+
+void shuso_tls_ctx_free(shuso_t *S, shuso_tls_ctx_t *ctx) {
+  //connections still open hold their own reference to the SSL_CTX, but not to the cache
+  if(ctx->ssl_ctx) {
+    SSL_CTX_sess_set_new_cb(ctx->ssl_ctx, NULL);
+    SSL_CTX_sess_set_remove_cb(ctx->ssl_ctx, NULL);
+    SSL_CTX_free(ctx->ssl_ctx);
+  }
+  if(ctx->shared) {
+    shuso_shared_slab_lock(ctx->shm);
+    while(ctx->shared->oldest) {
+      tls_session_remove_locked(ctx, ctx->shared->oldest);
+    }
+    shuso_shared_slab_free_locked(ctx->shm, ctx->shared);
+    shuso_shared_slab_unlock(ctx->shm);
+  }
+  free(ctx);
+}
+
+static void tls_handshake_release(shuso_loop *loop, shuso_ev_timer *w, int events) {
+  free(shuso_ev_data(w));
+}
+
+static void tls_handshake_finish(tls_handshake_t *hs, bool ok) {
+  shuso_t    *S = hs->io.S;
+  shuso_io_t *io = &hs->io;
+  shuso_io_set_deadline(io, 0);
+  shuso_io_abort(io);
+  if(ok) {
+    const unsigned char *alpn = NULL;
+    unsigned             alpn_len = 0;
+#ifdef BIO_get_ktls_send
+    if(BIO_get_ktls_send(SSL_get_wbio(io->io_socket.tls))) {
+      io->io_socket.tls_offload |= SHUSO_IO_WRITE;
+    }
+    if(BIO_get_ktls_recv(SSL_get_rbio(io->io_socket.tls))) {
+      io->io_socket.tls_offload |= SHUSO_IO_READ;
+    }
+#endif
+    SSL_get0_alpn_selected(io->io_socket.tls, &alpn, &alpn_len);
+    //whoever picks up the socket counts it
+    shuso_io_forget_connection(io);
+    hs->done(S, &io->io_socket, hs->binding, alpn_len > 0 ? alpn : NULL, alpn_len, hs->pd);
+  }
+  else {
+    shuso_io_tls_free(&io->io_socket);
+    shuso_io_forget_connection(io);
+    close(io->io_socket.fd);
+  }
+  //might be in the handshake coroutine
+  shuso_ev_timer_init(S, &hs->release, 0, 0, tls_handshake_release, hs);
+  shuso_ev_timer_start(S, &hs->release);
+}
+
+static void tls_handshake_error(shuso_t *S, shuso_io_t *io) {
+  if(io->error != ETIMEDOUT && io->error != ECONNRESET) {
+    shuso_log_debug(S, "TLS handshake failed: %s", strerror(io->error));
+  }
+  tls_handshake_finish(io->privdata, false);
+}
+
+static int tls_handshake_step(shuso_io_t *io) {
+  //0 when done, -1 if it failed, or the readiness to wait for
+  int rc, err;
+  ERR_clear_error();
+  if((rc = SSL_do_handshake(io->io_socket.tls)) == 1) {
+    return 0;
+  }
+  err = SSL_get_error(io->io_socket.tls, rc);
+  if(err == SSL_ERROR_WANT_READ) {
+    return SHUSO_IO_READ;
+  }
+  if(err == SSL_ERROR_WANT_WRITE) {
+    return SHUSO_IO_WRITE;
+  }
+  shuso_log_debug(io->S, "TLS handshake failed: %s", err == SSL_ERROR_SYSCALL ? strerror(errno) : tls_error_string());
+  ERR_clear_error();
+  return -1;
+}
+
+static void tls_handshake_coro(shuso_t *S, shuso_io_t *io) {
+  tls_handshake_t *hs = io->privdata;
+  int              rc;
+
+  SHUSO_IO_CORO_BEGIN(io, tls_handshake_error);
+  shuso_io_set_deadline(io, SHUSO_TLS_HANDSHAKE_TIMEOUT);
+  while((rc = tls_handshake_step(io)) > 0) {
+    SHUSO_IO_CORO_YIELD(wait, rc);
+  }
+  tls_handshake_finish(hs, rc == 0);
+  SHUSO_IO_CORO_END(io);
+}
+
+bool shuso_tls_handshake_start(shuso_t *S, shuso_server_binding_t *binding, shuso_socket_t *socket, shuso_tls_handshake_fn *done, void *pd) {
+  tls_handshake_t *hs;
+  shuso_socket_t   sock = *socket;
+  SSL             *ssl;
+
+  if((hs = malloc(sizeof(*hs))) == NULL) {
+    return shuso_set_error(S, "failed to allocate TLS handshake");
+  }
+  ERR_clear_error();
+  if((ssl = SSL_new(binding->tls->ssl_ctx)) == NULL || SSL_set_fd(ssl, socket->fd) != 1) {
+    shuso_set_error(S, "failed to start TLS handshake: %s", tls_error_string());
+    ERR_clear_error();
+    if(ssl) {
+      SSL_free(ssl);
+    }
+    free(hs);
+    return false;
+  }
+  SSL_set_accept_state(ssl);
+  hs->binding = binding;
+  hs->done = done;
+  hs->pd = pd;
+  if(socket->host.sockaddr) {
+    //the listener reuses its sockaddr for the next connection
+    hs->sockaddr = *socket->host.sockaddr;
+    sock.host.sockaddr = &hs->sockaddr;
+  }
+  sock.tls = ssl;
+  sock.tls_offload = 0;
+  shuso_io_init(S, &hs->io, &sock, SHUSO_IO_READ | SHUSO_IO_WRITE, tls_handshake_coro, hs);
+  shuso_io_start(&hs->io);
+  return true;
+}
@@ -0,0 +1,26 @@
+#ifndef SHUTTLESOCK_SERVER_TLS_H
+#define SHUTTLESOCK_SERVER_TLS_H
+
+#include "server.h"
+
+//sessions kept for resumption, for all workers together
+#define SHUSO_TLS_SESSION_CACHE_SIZE 20480
+#define SHUSO_TLS_SESSION_CACHE_BUCKETS 4096
+//larger serialized sessions aren't cached
+#define SHUSO_TLS_SESSION_MAX_SIZE 4096
+#define SHUSO_TLS_SESSION_TIMEOUT 300
+#define SHUSO_TLS_HANDSHAKE_TIMEOUT 60.0
+
+// called once the handshake is done. the socket's TLS state is set, and it's offloaded to the kernel if possible.
+// the socket is closed and this isn't called if the handshake fails.
+typedef void shuso_tls_handshake_fn(shuso_t *S, shuso_socket_t *socket, shuso_server_binding_t *binding, const unsigned char *alpn, unsigned alpn_len, void *pd);
+
+// a server-side TLS context for a binding, used by all the workers. the session cache and ticket keys are in
+// shared memory. ALPN offers h2 and http/1.1 for http bindings.
+shuso_tls_ctx_t *shuso_tls_ctx_create(shuso_t *S, const char *certificate, const char *key, bool http);
+void shuso_tls_ctx_free(shuso_t *S, shuso_tls_ctx_t *ctx);
+
+// do the TLS handshake on an accepted connection, on the binding's TLS context.
+bool shuso_tls_handshake_start(shuso_t *S, shuso_server_binding_t *binding, shuso_socket_t *socket, shuso_tls_handshake_fn *done, void *pd);
+
+#endif //SHUTTLESOCK_SERVER_TLS_H
@@ -288,6 +288,8 @@ bool shuso_pool_drain_to_level(shuso_pool_t *pool, unsigned levelnum) {
     return true;
   }
   level = pool->levels.array[levelnum - 1];
+  //the level itself was allocated from the pool, and it's about to be rolled back over
+  pool->levels.count = levelnum - 1;
   shuso_pool_allocd_t *allocd = level->allocd;
   if(allocd) {
     while(pool->allocd.last != allocd) {
@@ -92,6 +92,8 @@ shuso_t *shuso_create_with_lua(lua_State *lua, const char **err) {
   }
   
   common_ctx->master_has_root = getuid() == 0;
+  common_ctx->upgrade.previous_fd = -1;
+  common_ctx->upgrade.next.fd = -1;
   
   common_ctx->process.master.procnum = SHUTTLESOCK_MASTER;
   common_ctx->process.manager.procnum = SHUTTLESOCK_MANAGER;
@@ -212,6 +214,8 @@ bool shuso_configure_finish(shuso_t *S) {
   
   set_default_config(S, ipc.send_retry_delay, SHUTTLESOCK_CONFIG_DEFAULT_IPC_SEND_RETRY_DELAY);
   set_default_config(S, ipc.send_timeout, SHUTTLESOCK_CONFIG_DEFAULT_IPC_SEND_TIMEOUT);
+  set_default_config(S, timer_resolution, SHUSO_TIMER_WHEEL_DEFAULT_RESOLUTION);
+  shuso_timer_wheel_init(S, &S->timer_wheel, S->common->config.timer_resolution);
   assert(S->common->config.workers != 0);
   
   shm_slab_created = shuso_shared_slab_create(S, &S->common->shm, S->common->config.shared_slab_size, "main shuttlesock slab");
@@ -238,6 +242,16 @@ bool shuso_configure_finish(shuso_t *S) {
   for(int i=0; i < SHUTTLESOCK_MAX_WORKERS; i++) {
     S->common->process.worker[i].state = &states[i+2];
   }
+  shuso_process_load_t *loads = shuso_shared_slab_calloc(&S->common->shm, sizeof(*loads) * (SHUTTLESOCK_MAX_WORKERS + 2));
+  if(!loads) {
+    errmsg = "failed to allocate shared memory for process load stats";
+    goto fail;
+  }
+  S->common->process.master.load = &loads[0];
+  S->common->process.manager.load = &loads[1];
+  for(int i=0; i < SHUTTLESOCK_MAX_WORKERS; i++) {
+    S->common->process.worker[i].load = &loads[i+2];
+  }
   S->common->process.workers_start = shuso_shared_slab_alloc(&S->common->shm, sizeof(*S->common->process.workers_start));
   S->common->process.workers_end = shuso_shared_slab_alloc(&S->common->shm, sizeof(*S->common->process.workers_end));
   if(!S->common->process.workers_start || !S->common->process.workers_end) {
@@ -329,6 +343,8 @@ static bool shuso_fork_manager(shuso_t *S) {
   S->procnum = SHUTTLESOCK_MANAGER;
   S->process = &S->common->process.manager;
   S->process->pid = getpid();
+  //the master's, for handing over to the next generation
+  shuso_upgrade_cleanup(S);
   *S->process->state = SHUSO_STATE_STARTING;
   shuso_log_debug(S, "starting %s...", shuso_process_as_string(S->procnum));
   shuso_ipc_channel_shared_start(S, &S->common->process.manager);
@@ -397,6 +413,11 @@ bool shuso_run(shuso_t *S) {
   
   shuso_log_debug(S, "starting %s...", shuso_process_as_string(S->procnum));
   
+  if(!shuso_upgrade_inherit(S)) {
+    err = "failed to take over from the previous generation";
+    goto fail;
+  }
+  
   if(!(master_ipc_created = shuso_ipc_channel_shared_create(S, &S->common->process.master))) {
     err = "failed to create shared IPC channel for master";
     goto fail;
@@ -453,12 +474,17 @@ bool shuso_run(shuso_t *S) {
   ev_run(S->ev.loop, 0);
   if(shuso_is_master(S)) {
     shuso_core_event_publish(S, "master.exit", SHUSO_OK, NULL);
+    shuso_upgrade_cleanup(S);
   }
   else if(shuso_is_manager(S)) {
     shuso_core_event_publish(S, "manager.exit", SHUSO_OK, NULL);
   }
   shuso_core_io_uring_teardown(S);
   shuso_cleanup_loop(S);
+  shuso_io_splice_pipes_free(S);
+  shuso_io_datagram_batches_free(S);
+  shuso_io_iovec_batches_free(S);
+  shuso_connections_free(S);
   shuso_resolver_cleanup(&S->resolver);
   *S->process->state = SHUSO_STATE_STOPPED;
   shuso_pool_empty(&S->pool);
@@ -469,6 +495,7 @@ fail:
   if(master_ipc_created) shuso_ipc_channel_shared_destroy(S, &S->common->process.master);
   if(manager_ipc_created) shuso_ipc_channel_shared_destroy(S, &S->common->process.manager);
   if(shuso_resolver_initialized) shuso_resolver_cleanup(&S->resolver);
+  shuso_upgrade_cleanup(S);
   *S->process->state = SHUSO_STATE_DEAD;
   shuso_set_error(S, err);
   return false;
@@ -505,12 +532,29 @@ void shuso_worker_shutdown(shuso_t *S) {
   S->ev.loop = NULL;
   shuso_lua_destroy(S);
   shuso_log_notice(S, "stopped worker %i", S->procnum);
+  shuso_io_splice_pipes_free(S);
+  shuso_io_datagram_batches_free(S);
+  shuso_io_iovec_batches_free(S);
+  shuso_connections_free(S);
   shuso_resolver_cleanup(&S->resolver);
   shuso_pool_empty(&S->pool);
   free(S);
   *worker_state = SHUSO_STATE_STOPPED;
 }
 
+static void worker_loop_lag_sample(shuso_loop *loop, shuso_ev_timer *w, int revents) {
+  shuso_t   *S = shuso_ev_data(w);
+  ev_tstamp  now = ev_now(loop);
+  ev_tstamp  lag = now - S->load.sampled_at - SHUTTLESOCK_LOOP_LAG_SAMPLE_INTERVAL;
+  uint32_t   prev = atomic_load(&S->process->load->loop_lag_usec);
+  S->load.sampled_at = now;
+  if(lag < 0) {
+    lag = 0;
+  }
+  //smooth it out so that one slow iteration doesn't look like an overloaded worker
+  atomic_store(&S->process->load->loop_lag_usec, (prev * 3 + (uint32_t )(lag * 1000000)) / 4);
+}
+
  static void *shuso_run_worker(void *arg) {
   shuso_t   *S = arg;
   assert(S);
@@ -520,6 +564,13 @@ void shuso_worker_shutdown(shuso_t *S) {
   snprintf(threadname, 16, "worker %i", S->procnum);
   shuso_system_thread_setname(threadname);
   
+  if(S->common->config.worker_cpu_affinity) {
+    int cpu = (S->procnum - SHUTTLESOCK_WORKER) % shuso_system_cores_online();
+    if(!shuso_system_thread_set_cpu(cpu)) {
+      shuso_log_warning(S, "failed to pin worker %i to CPU %i", S->procnum, cpu);
+    }
+  }
+  
   S->ev.loop = ev_loop_new(S->ev.flags);
   ev_set_userdata(S->ev.loop, S);
 #endif
@@ -529,6 +580,10 @@ void shuso_worker_shutdown(shuso_t *S) {
   shuso_ipc_channel_local_start(S);
 
   
+  S->load.sampled_at = ev_now(S->ev.loop);
+  shuso_ev_timer_init(S, &S->load.lag_sample, SHUTTLESOCK_LOOP_LAG_SAMPLE_INTERVAL, SHUTTLESOCK_LOOP_LAG_SAMPLE_INTERVAL, worker_loop_lag_sample, S);
+  shuso_ev_timer_start(S, &S->load.lag_sample);
+  
   //S->common->phase_handlers.start_worker(S, S->common->phase_handlers.privdata);
   *S->process->state = SHUSO_STATE_RUNNING;
   shuso_core_event_publish(S, "worker.start", SHUSO_OK, NULL);
@@ -589,6 +644,8 @@ int               procnum = shuso_process_to_procnum(S, proc);
     goto fail;
   }
   
+  shuso_timer_wheel_init(wS, &wS->timer_wheel, wS->common->config.timer_resolution);
+  
   if(!shuso_lua_create(wS)) {
     err = "failed to create Lua state";
     goto fail;
@@ -853,6 +910,10 @@ int shuso_process_to_procnum(shuso_t *S, shuso_process_t *proc) {
   } \
   llist_init(S->base_watchers.watcher_type)
 static void shuso_cleanup_loop(shuso_t *S) {
+  shuso_timer_wheel_shutdown(&S->timer_wheel);
+  if(shuso_ev_active(&S->load.lag_sample)) {
+    shuso_ev_timer_stop(S, &S->load.lag_sample);
+  }
   shuso_ipc_channel_local_stop(S);
   shuso_ipc_channel_shared_stop(S, S->process);
   
@@ -924,6 +985,9 @@ static void signal_watcher_cb(shuso_loop *loop, shuso_ev_signal *w, int revents)
       case SIGTERM:
         shuso_stop(S, SHUSO_STOP_ASK);
         break;
+      case SIGUSR2:
+        shuso_upgrade_start(S);
+        break;
       default:
         shuso_log_debug(S, "ignore signal %d", signum);
     }
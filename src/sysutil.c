@@ -1,5 +1,5 @@
 #include <shuttlesock/build_config.h>
-#ifdef SHUTTLESOCK_PTHREAD_SETNAME_STYLE_LINUX
+#if defined(SHUTTLESOCK_PTHREAD_SETNAME_STYLE_LINUX) || defined(SHUTTLESOCK_HAVE_CPU_AFFINITY)
 #define _GNU_SOURCE
 #define __UNDEF_GNU_SOURCE
 #endif
@@ -273,6 +273,17 @@ bool shuso_system_thread_setname(const char *name) {
 #endif
 }
 
+bool shuso_system_thread_set_cpu(int cpu) {
+#ifdef SHUTTLESOCK_HAVE_CPU_AFFINITY
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+#else
+  return false;
+#endif
+}
+
 static size_t shuso_system_cacheline_size(void) {
   size_t sz = 0;
 #ifdef _SC_LEVEL1_DCACHE_LINESIZE
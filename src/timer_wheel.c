@@ -0,0 +1,178 @@
+#include <shuttlesock.h>
+#include <shuttlesock/timer_wheel.h>
+#include <math.h>
+
+static uint64_t timer_wheel_current_tick(shuso_timer_wheel_t *w) {
+  ev_tstamp elapsed = ev_now(w->S->ev.loop) - w->start;
+  return elapsed > 0 ? (uint64_t )(elapsed / w->resolution) : 0;
+}
+
+static void timer_wheel_link(shuso_timer_t **head, shuso_timer_t *timer) {
+  timer->next = *head;
+  if(timer->next) {
+    timer->next->pprev = &timer->next;
+  }
+  timer->pprev = head;
+  *head = timer;
+}
+
+static void timer_wheel_unlink(shuso_timer_t *timer) {
+  *timer->pprev = timer->next;
+  if(timer->next) {
+    timer->next->pprev = timer->pprev;
+  }
+  timer->next = NULL;
+  timer->pprev = NULL;
+}
+
+static void timer_wheel_place(shuso_timer_wheel_t *w, shuso_timer_t *timer) {
+  uint64_t expires = timer->expires;
+  uint64_t delta;
+  int      level;
+  if(expires <= w->now) {
+    //overdue. it goes in the very next slot
+    expires = w->now + 1;
+  }
+  delta = expires - w->now;
+  if(delta > SHUSO_TIMER_WHEEL_MAX_TICKS) {
+    //too far out. park it as far as it'll go, and it'll be placed again when that slot is cascaded
+    expires = w->now + SHUSO_TIMER_WHEEL_MAX_TICKS;
+    delta = SHUSO_TIMER_WHEEL_MAX_TICKS;
+  }
+  for(level = 0; level < SHUSO_TIMER_WHEEL_LEVELS - 1; level++) {
+    if(delta < ((uint64_t )1 << (SHUSO_TIMER_WHEEL_SLOT_BITS * (level + 1)))) {
+      break;
+    }
+  }
+  timer_wheel_link(&w->slot[level][(expires >> (SHUSO_TIMER_WHEEL_SLOT_BITS * level)) & SHUSO_TIMER_WHEEL_SLOT_MASK], timer);
+}
+
+static void timer_wheel_cascade(shuso_timer_wheel_t *w, int level) {
+  //move the timers in this level's current slot down to where they belong now
+  unsigned       idx = (w->now >> (SHUSO_TIMER_WHEEL_SLOT_BITS * level)) & SHUSO_TIMER_WHEEL_SLOT_MASK;
+  shuso_timer_t *timer;
+
+  if(idx == 0 && level + 1 < SHUSO_TIMER_WHEEL_LEVELS) {
+    timer_wheel_cascade(w, level + 1);
+  }
+  while((timer = w->slot[level][idx]) != NULL) {
+    timer_wheel_unlink(timer);
+    timer_wheel_place(w, timer);
+  }
+}
+
+static void timer_wheel_advance(shuso_timer_wheel_t *w) {
+  shuso_timer_t *timer;
+  shuso_timer_t *expired;
+  unsigned       idx;
+
+  w->now++;
+  idx = w->now & SHUSO_TIMER_WHEEL_SLOT_MASK;
+  if(idx == 0) {
+    timer_wheel_cascade(w, 1);
+  }
+  //take the slot off the wheel first. callbacks may start and stop other timers, including ones in this slot
+  expired = w->slot[0][idx];
+  w->slot[0][idx] = NULL;
+  if(expired) {
+    expired->pprev = &expired;
+  }
+  while((timer = expired) != NULL) {
+    timer_wheel_unlink(timer);
+    if(timer->expires > w->now) {
+      timer_wheel_place(w, timer);
+      continue;
+    }
+    w->count--;
+    timer->callback(w->S, timer, timer->pd);
+  }
+}
+
+static void timer_wheel_tick(shuso_loop *loop, shuso_ev_timer *watcher, int events) {
+  shuso_timer_wheel_t *w = shuso_ev_data(watcher);
+  uint64_t             target = timer_wheel_current_tick(w);
+  while(w->now < target && w->count > 0) {
+    timer_wheel_advance(w);
+  }
+  if(w->count == 0) {
+    shuso_ev_timer_stop(w->S, &w->tick);
+  }
+}
+
+void shuso_timer_wheel_init(shuso_t *S, shuso_timer_wheel_t *w, ev_tstamp resolution) {
+  if(resolution <= 0) {
+    resolution = SHUSO_TIMER_WHEEL_DEFAULT_RESOLUTION;
+  }
+  *w = (shuso_timer_wheel_t ) {
+    .S = S,
+    .resolution = resolution,
+    .start = -1,
+    .now = 0,
+    .count = 0
+  };
+  shuso_ev_timer_init(S, &w->tick, resolution, resolution, timer_wheel_tick, w);
+}
+
+void shuso_timer_wheel_shutdown(shuso_timer_wheel_t *w) {
+  shuso_timer_t *timer;
+  if(w->S && w->S->ev.loop && shuso_ev_active(&w->tick)) {
+    shuso_ev_timer_stop(w->S, &w->tick);
+  }
+  for(int level = 0; level < SHUSO_TIMER_WHEEL_LEVELS; level++) {
+    for(int i = 0; i < SHUSO_TIMER_WHEEL_SLOTS; i++) {
+      while((timer = w->slot[level][i]) != NULL) {
+        timer_wheel_unlink(timer);
+      }
+    }
+  }
+  w->count = 0;
+}
+
+void shuso_timer_init(shuso_timer_t *timer, shuso_timer_fn *callback, void *pd) {
+  *timer = (shuso_timer_t ) {
+    .next = NULL,
+    .pprev = NULL,
+    .expires = 0,
+    .callback = callback,
+    .pd = pd
+  };
+}
+
+void shuso_timer_start(shuso_timer_wheel_t *w, shuso_timer_t *timer, ev_tstamp after) {
+  uint64_t ticks;
+  if(shuso_timer_active(timer)) {
+    shuso_timer_stop(w, timer);
+  }
+  if(w->count == 0) {
+    //the wheel was idle, so it's caught up to the present without turning through empty slots
+    if(w->start < 0) {
+      w->start = ev_now(w->S->ev.loop);
+    }
+    w->now = timer_wheel_current_tick(w);
+    shuso_ev_timer_start(w->S, &w->tick);
+  }
+  ticks = after > 0 ? (uint64_t )ceil(after / w->resolution) : 1;
+  //count from the present, even if the tick is running late
+  timer->expires = timer_wheel_current_tick(w) + (ticks > 0 ? ticks : 1);
+  timer_wheel_place(w, timer);
+  w->count++;
+}
+
+void shuso_timer_stop(shuso_timer_wheel_t *w, shuso_timer_t *timer) {
+  if(!shuso_timer_active(timer)) {
+    return;
+  }
+  timer_wheel_unlink(timer);
+  w->count--;
+  if(w->count == 0) {
+    shuso_ev_timer_stop(w->S, &w->tick);
+  }
+}
+
+ev_tstamp shuso_timer_remaining(shuso_timer_wheel_t *w, shuso_timer_t *timer) {
+  if(!shuso_timer_active(timer)) {
+    return -1;
+  }
+  ev_tstamp remaining = w->start + timer->expires * w->resolution - ev_now(w->S->ev.loop);
+  return remaining > 0 ? remaining : 0;
+}
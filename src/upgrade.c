@@ -0,0 +1,452 @@
+#include <shuttlesock.h>
+#include <shuttlesock/upgrade.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+extern char **environ;
+
+//messages between generations. the channel is a SOCK_SEQPACKET socket, so every one of these arrives whole
+#define UPGRADE_MSG_FD    'F' //followed by the fd's id, with the fd attached
+#define UPGRADE_MSG_END   'E' //that's all the fds
+#define UPGRADE_MSG_READY 'R' //from the next generation, once it's running
+
+static bool upgrade_fds_add(shuso_t *S, shuso_upgrade_fds_t *fds, const char *id, int fd) {
+  shuso_upgrade_fd_t *array;
+  char               *idcopy;
+  if(strlen(id) > SHUTTLESOCK_UPGRADE_MAX_ID_LENGTH) {
+    return shuso_set_error(S, "upgrade fd id '%s' is too long", id);
+  }
+  if((idcopy = strdup(id)) == NULL) {
+    return shuso_set_error(S, "failed to allocate upgrade fd id");
+  }
+  if((array = realloc(fds->array, sizeof(*array) * (fds->count + 1))) == NULL) {
+    free(idcopy);
+    return shuso_set_error(S, "failed to allocate upgrade fds");
+  }
+  array[fds->count++] = (shuso_upgrade_fd_t ){.id = idcopy, .fd = fd};
+  fds->array = array;
+  return true;
+}
+
+static void upgrade_fds_close(shuso_upgrade_fds_t *fds) {
+  for(size_t i = 0; i < fds->count; i++) {
+    close(fds->array[i].fd);
+    free(fds->array[i].id);
+  }
+  free(fds->array);
+  fds->array = NULL;
+  fds->count = 0;
+}
+
+bool shuso_upgrade_keep_fd(shuso_t *S, const char *id, int fd) {
+  if(S->procnum != SHUTTLESOCK_MASTER) {
+    return shuso_set_error(S, "only the master can keep fds for the next generation");
+  }
+  return upgrade_fds_add(S, &S->common->upgrade.kept, id, fd);
+}
+
+int shuso_upgrade_take_inherited_fd(shuso_t *S, const char *id) {
+  shuso_upgrade_fds_t *inherited = &S->common->upgrade.inherited;
+  for(size_t i = 0; i < inherited->count; i++) {
+    if(strcmp(inherited->array[i].id, id) == 0) {
+      int fd = inherited->array[i].fd;
+      free(inherited->array[i].id);
+      //keep the rest in order. SO_REUSEPORT sockets are picked by their position in the group
+      memmove(&inherited->array[i], &inherited->array[i+1], sizeof(*inherited->array) * (inherited->count - i - 1));
+      inherited->count--;
+      return fd;
+    }
+  }
+  return -1;
+}
+
+static bool upgrade_send(shuso_t *S, int fd, char type, const char *id, int sendfd) {
+  char              buf[1 + SHUTTLESOCK_UPGRADE_MAX_ID_LENGTH];
+  size_t            len = 1;
+  union {
+    struct cmsghdr    cmsg;
+    char              buf[CMSG_SPACE(sizeof(int))];
+  }                 control;
+  struct iovec      iov;
+  struct msghdr     msg;
+  struct cmsghdr   *cmsg;
+  ssize_t           rc;
+
+  buf[0] = type;
+  if(id) {
+    memcpy(&buf[1], id, strlen(id));
+    len += strlen(id);
+  }
+  iov = (struct iovec ){.iov_base = buf, .iov_len = len};
+  msg = (struct msghdr ){.msg_iov = &iov, .msg_iovlen = 1};
+  if(sendfd != -1) {
+    memset(&control, 0, sizeof(control));
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &sendfd, sizeof(int));
+  }
+  do {
+    rc = sendmsg(fd, &msg, MSG_NOSIGNAL);
+  } while(rc == -1 && errno == EINTR);
+  if(rc == -1) {
+    return shuso_set_error_errno(S, "failed to send to the next generation: %s", strerror(errno));
+  }
+  return true;
+}
+
+bool shuso_upgrade_send_fds(shuso_t *S, int fd) {
+  shuso_upgrade_fds_t *kept = &S->common->upgrade.kept;
+  for(size_t i = 0; i < kept->count; i++) {
+    if(!upgrade_send(S, fd, UPGRADE_MSG_FD, kept->array[i].id, kept->array[i].fd)) {
+      return false;
+    }
+  }
+  return upgrade_send(S, fd, UPGRADE_MSG_END, NULL, -1);
+}
+
+bool shuso_upgrade_receive_fds(shuso_t *S, int fd) {
+  char              buf[1 + SHUTTLESOCK_UPGRADE_MAX_ID_LENGTH + 1];
+  union {
+    struct cmsghdr    cmsg;
+    char              buf[CMSG_SPACE(sizeof(int))];
+  }                 control;
+  struct iovec      iov;
+  struct msghdr     msg;
+  struct cmsghdr   *cmsg;
+  ssize_t           rc;
+  int               recvfd;
+
+  while(1) {
+    iov = (struct iovec ){.iov_base = buf, .iov_len = sizeof(buf) - 1};
+    msg = (struct msghdr ){.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf, .msg_controllen = sizeof(control.buf)};
+    do {
+      rc = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    } while(rc == -1 && errno == EINTR);
+    if(rc == -1) {
+      return shuso_set_error_errno(S, "failed to receive from the previous generation: %s", strerror(errno));
+    }
+    if(rc == 0) {
+      return shuso_set_error(S, "the previous generation hung up before it was done handing over");
+    }
+    recvfd = -1;
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if(cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+      memcpy(&recvfd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    buf[rc] = '\0';
+    if(buf[0] == UPGRADE_MSG_END && recvfd == -1) {
+      return true;
+    }
+    if(buf[0] != UPGRADE_MSG_FD || recvfd == -1 || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+      if(recvfd != -1) {
+        close(recvfd);
+      }
+      return shuso_set_error(S, "got a bad message from the previous generation");
+    }
+    if(!upgrade_fds_add(S, &S->common->upgrade.inherited, &buf[1], recvfd)) {
+      close(recvfd);
+      return false;
+    }
+  }
+}
+
+static void upgrade_set_timeout(int fd) {
+  struct timeval tv = {.tv_sec = (time_t )SHUTTLESOCK_UPGRADE_TIMEOUT};
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+bool shuso_upgrade_inherit(shuso_t *S) {
+  shuso_upgrade_t *up = &S->common->upgrade;
+  const char      *str;
+  char            *end;
+  long             generation = 0, fd = -1;
+
+  if((str = getenv(SHUTTLESOCK_UPGRADE_GENERATION_ENV)) != NULL) {
+    generation = strtol(str, &end, 10);
+    if(*str == '\0' || *end != '\0' || generation < 0 || generation > UINT16_MAX) {
+      generation = 0;
+    }
+  }
+  if((str = getenv(SHUTTLESOCK_UPGRADE_FD_ENV)) != NULL) {
+    fd = strtol(str, &end, 10);
+    if(*str == '\0' || *end != '\0' || fd < 0 || fd > INT_MAX) {
+      fd = -1;
+    }
+  }
+  //not for anything this process starts
+  unsetenv(SHUTTLESOCK_UPGRADE_GENERATION_ENV);
+  unsetenv(SHUTTLESOCK_UPGRADE_FD_ENV);
+
+  S->common->process.master.generation = generation;
+  S->common->process.manager.generation = generation;
+  for(int i = 0; i < SHUTTLESOCK_MAX_WORKERS; i++) {
+    S->common->process.worker[i].generation = generation;
+  }
+
+  if(str && fd == -1) {
+    return shuso_set_error(S, "invalid %s value", SHUTTLESOCK_UPGRADE_FD_ENV);
+  }
+  if(fd == -1) {
+    return true;
+  }
+
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  upgrade_set_timeout(fd);
+  if(!shuso_upgrade_receive_fds(S, fd)) {
+    close(fd);
+    upgrade_fds_close(&up->inherited);
+    return false;
+  }
+  up->previous_fd = fd;
+  shuso_log_notice(S, "starting generation %d with %zu fds from the previous one", (int )generation, up->inherited.count);
+  return true;
+}
+
+bool shuso_upgrade_finish(shuso_t *S) {
+  shuso_upgrade_t *up = &S->common->upgrade;
+  char             msg = UPGRADE_MSG_READY;
+  ssize_t          rc;
+  if(up->previous_fd == -1) {
+    return true;
+  }
+  if(up->inherited.count > 0) {
+    shuso_log_notice(S, "closing %zu fds from the previous generation that weren't needed", up->inherited.count);
+    upgrade_fds_close(&up->inherited);
+  }
+  do {
+    rc = send(up->previous_fd, &msg, 1, MSG_NOSIGNAL);
+  } while(rc == -1 && errno == EINTR);
+  close(up->previous_fd);
+  up->previous_fd = -1;
+  if(rc == -1) {
+    return shuso_set_error_errno(S, "failed to tell the previous generation to stop: %s", strerror(errno));
+  }
+  return true;
+}
+
+static void upgrade_next_stop(shuso_t *S) {
+  shuso_upgrade_t *up = &S->common->upgrade;
+  if(shuso_ev_active(&up->next.watcher)) {
+    shuso_ev_io_stop(S, &up->next.watcher);
+  }
+  if(shuso_ev_active(&up->next.timeout)) {
+    shuso_ev_timer_stop(S, &up->next.timeout);
+  }
+  if(up->next.fd != -1) {
+    close(up->next.fd);
+    up->next.fd = -1;
+  }
+  up->next.pid = 0;
+}
+
+static void upgrade_next_cb(shuso_loop *loop, shuso_ev_io *w, int revents) {
+  shuso_t         *S = shuso_state(loop, w);
+  int              generation = S->process->generation + 1;
+  char             msg;
+  ssize_t          rc;
+  do {
+    rc = recv(w->ev.fd, &msg, 1, 0);
+  } while(rc == -1 && errno == EINTR);
+  if(rc == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return;
+  }
+  upgrade_next_stop(S);
+  if(rc == 1 && msg == UPGRADE_MSG_READY) {
+    shuso_log_notice(S, "generation %d is running, stopping generation %d", generation, generation - 1);
+    shuso_stop(S, SHUSO_STOP_ASK);
+  }
+  else {
+    shuso_log_error(S, "upgrade failed: generation %d exited before it was running", generation);
+  }
+}
+
+static void upgrade_next_timeout_cb(shuso_loop *loop, shuso_ev_timer *w, int revents) {
+  shuso_t         *S = shuso_state(loop, w);
+  shuso_log_error(S, "upgrade failed: generation %d didn't start in %.0f seconds", S->process->generation + 1, SHUTTLESOCK_UPGRADE_TIMEOUT);
+  kill(S->common->upgrade.next.pid, SIGTERM);
+  upgrade_next_stop(S);
+}
+
+static char *upgrade_read_cmdline(size_t *len) {
+  FILE   *f;
+  char   *buf = NULL, *newbuf;
+  size_t  sz = 0, n;
+  if((f = fopen("/proc/self/cmdline", "r")) == NULL) {
+    return NULL;
+  }
+  *len = 0;
+  do {
+    if((newbuf = realloc(buf, sz + 1024)) == NULL) {
+      free(buf);
+      fclose(f);
+      return NULL;
+    }
+    buf = newbuf;
+    sz += 1024;
+    n = fread(&buf[*len], 1, sz - *len, f);
+    *len += n;
+  } while(n > 0);
+  fclose(f);
+  if(*len > 0 && buf[*len - 1] != '\0') {
+    buf[(*len)++] = '\0';
+  }
+  return buf;
+}
+
+static void upgrade_exec(const char *path, char **argv, char **envp, int fd) {
+  sigset_t        sigset;
+  struct rlimit   rl;
+  int             maxfd = 65536;
+  //we're in the child of a fork(), so nothing fancy
+  sigemptyset(&sigset);
+  sigprocmask(SIG_SETMASK, &sigset, NULL);
+  if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) {
+    maxfd = rl.rlim_cur;
+  }
+  //nothing of this generation gets through but the channel. the fds it keeps are sent over that
+  for(int i = 3; i < maxfd; i++) {
+    if(i != fd) {
+      close(i);
+    }
+  }
+  fcntl(fd, F_SETFD, 0);
+  execve(path, argv, envp);
+  _exit(127);
+}
+
+bool shuso_upgrade_start(shuso_t *S) {
+  shuso_upgrade_t *up = &S->common->upgrade;
+  int              generation = S->process->generation + 1;
+  char             path[PATH_MAX];
+  char             fd_env[64], generation_env[64];
+  const char      *deleted = " (deleted)";
+  char            *cmdline = NULL;
+  char           **argv = NULL, **envp = NULL;
+  size_t           cmdline_len = 0, argc = 0, envc = 0, n;
+  ssize_t          len;
+  int              channel[2] = {-1, -1};
+  pid_t            pid;
+
+  if(S->procnum != SHUTTLESOCK_MASTER) {
+    return shuso_set_error(S, "only the master can start an upgrade");
+  }
+  if(*S->process->state != SHUSO_STATE_RUNNING) {
+    return shuso_set_error(S, "can't upgrade while %s", shuso_runstate_as_string(*S->process->state));
+  }
+  if(up->next.pid != 0) {
+    return shuso_set_error(S, "generation %d is already starting", generation);
+  }
+  if(up->previous_fd != -1) {
+    return shuso_set_error(S, "can't upgrade before generation %d has taken over from the previous one", generation - 1);
+  }
+
+  if((len = readlink("/proc/self/exe", path, sizeof(path) - 1)) == -1) {
+    return shuso_set_error_errno(S, "upgrade failed: can't find the binary: %s", strerror(errno));
+  }
+  path[len] = '\0';
+  //it's been replaced, which is the point
+  if((size_t )len > strlen(deleted) && strcmp(&path[len - strlen(deleted)], deleted) == 0) {
+    path[len - strlen(deleted)] = '\0';
+  }
+
+  if((cmdline = upgrade_read_cmdline(&cmdline_len)) == NULL || cmdline_len == 0) {
+    shuso_set_error(S, "upgrade failed: can't read the command line");
+    goto fail;
+  }
+  for(n = 0; n < cmdline_len; n++) {
+    if(cmdline[n] == '\0') {
+      argc++;
+    }
+  }
+  if((argv = calloc(argc + 1, sizeof(*argv))) == NULL) {
+    shuso_set_error(S, "upgrade failed: no memory for the arguments");
+    goto fail;
+  }
+  argc = 0;
+  for(n = 0; n < cmdline_len; n += strlen(&cmdline[n]) + 1) {
+    argv[argc++] = &cmdline[n];
+  }
+
+  for(n = 0; environ[n] != NULL; n++);
+  if((envp = calloc(n + 3, sizeof(*envp))) == NULL) {
+    shuso_set_error(S, "upgrade failed: no memory for the environment");
+    goto fail;
+  }
+  for(n = 0; environ[n] != NULL; n++) {
+    if(strncmp(environ[n], SHUTTLESOCK_UPGRADE_FD_ENV "=", strlen(SHUTTLESOCK_UPGRADE_FD_ENV "=")) != 0
+     && strncmp(environ[n], SHUTTLESOCK_UPGRADE_GENERATION_ENV "=", strlen(SHUTTLESOCK_UPGRADE_GENERATION_ENV "=")) != 0) {
+      envp[envc++] = environ[n];
+    }
+  }
+
+  if(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, channel) == -1) {
+    shuso_set_error_errno(S, "upgrade failed: can't create channel: %s", strerror(errno));
+    goto fail;
+  }
+  snprintf(fd_env, sizeof(fd_env), "%s=%d", SHUTTLESOCK_UPGRADE_FD_ENV, channel[1]);
+  snprintf(generation_env, sizeof(generation_env), "%s=%d", SHUTTLESOCK_UPGRADE_GENERATION_ENV, generation);
+  envp[envc++] = fd_env;
+  envp[envc++] = generation_env;
+
+  if((pid = fork()) == 0) {
+    upgrade_exec(path, argv, envp, channel[1]);
+  }
+  if(pid == -1) {
+    shuso_set_error_errno(S, "upgrade failed: can't fork: %s", strerror(errno));
+    goto fail;
+  }
+  close(channel[1]);
+  channel[1] = -1;
+  free(cmdline);
+  free(argv);
+  free(envp);
+
+  shuso_log_notice(S, "starting generation %d from %s", generation, path);
+  up->next.pid = pid;
+  up->next.fd = channel[0];
+  upgrade_set_timeout(channel[0]);
+  if(!shuso_upgrade_send_fds(S, channel[0])) {
+    kill(pid, SIGTERM);
+    upgrade_next_stop(S);
+    return false;
+  }
+  //this generation keeps running until the next one says otherwise
+  shuso_set_nonblocking(channel[0]);
+  shuso_ev_io_init(S, &up->next.watcher, channel[0], EV_READ, upgrade_next_cb, NULL);
+  shuso_ev_io_start(S, &up->next.watcher);
+  shuso_ev_timer_init(S, &up->next.timeout, SHUTTLESOCK_UPGRADE_TIMEOUT, 0, upgrade_next_timeout_cb, NULL);
+  shuso_ev_timer_start(S, &up->next.timeout);
+  return true;
+
+fail:
+  if(channel[0] != -1) close(channel[0]);
+  if(channel[1] != -1) close(channel[1]);
+  free(cmdline);
+  free(argv);
+  free(envp);
+  return false;
+}
+
+void shuso_upgrade_cleanup(shuso_t *S) {
+  shuso_upgrade_t *up = &S->common->upgrade;
+  upgrade_fds_close(&up->kept);
+  upgrade_fds_close(&up->inherited);
+  if(up->previous_fd != -1) {
+    close(up->previous_fd);
+    up->previous_fd = -1;
+  }
+  upgrade_next_stop(S);
+}
@@ -18,6 +18,9 @@ VG_MEMCHECK_OPT+=("--num-callers=20")
 TEST=build/shuso_test
 TEST_OPT=()
 
+#count the event loop's syscalls, across all the processes
+STRACE_OPT=( "-f" "-c" "-e" "trace=epoll_ctl,epoll_wait,epoll_pwait" )
+
 DEBUGGER_NAME="kdbg"
 DEBUGGER_CMD="dbus-run-session kdbg -p %s $TEST"
 
@@ -48,6 +51,9 @@ for opt in $*; do
     cachegrind)
       VALGRIND_OPT=( "--tool=cachegrind" )
       valgrind=1;;
+    strace|syscalls)
+      strace=1
+      ;;
     verbose)
       TEST_OPT+=("--verbose")
       ;;
@@ -96,6 +102,9 @@ if [[ $debugger == 1 ]]; then
 elif [[ $valgrind == 1 ]]; then
   echo $SUDO valgrind $VALGRIND_OPT $TEST $TEST_OPT
   $SUDO valgrind $VALGRIND_OPT $TEST $TEST_OPT
+elif [[ $strace == 1 ]]; then
+  echo $SUDO strace $STRACE_OPT $TEST $TEST_OPT
+  $SUDO strace $STRACE_OPT $TEST $TEST_OPT
 else
   echo $SUDO $TEST $TEST_OPT
   $SUDO $TEST $TEST_OPT &
@@ -0,0 +1,75 @@
+local Module = require "shuttlesock.module"
+local Watcher = require "shuttlesock.watcher"
+local Shuso = require "shuttlesock"
+local IO = require "shuttlesock.io"
+
+local testmod = Module.new {
+  name= "lua_testmod",
+  version = "0.0.0"
+}
+
+local function frame(type, flags, stream_id, payload)
+  return string.pack(">I3BBI4", #payload, type, flags, stream_id) .. payload
+end
+
+local function literal(name_index, value)
+  --HPACK literal header field without indexing, indexed name
+  return string.char(name_index, #value) .. value
+end
+
+local DATA, HEADERS, SETTINGS = 0, 1, 4
+local END_STREAM, END_HEADERS = 0x1, 0x4
+
+testmod:subscribe("server:manager.start", function()
+  Watcher.timer(10, function()
+    error("http2 request test timed out")
+  end):start()
+
+  coroutine.wrap(function()
+    local io = assert(IO.wrap("127.0.0.1:21606")())
+    assert(io:connect())
+    --prior knowledge: a GET and a POST with a body, on two concurrent streams
+    assert(io:write(table.concat{
+      "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n",
+      frame(SETTINGS, 0, 0, ""),
+      frame(HEADERS, END_STREAM | END_HEADERS, 1, "\x82\x86" .. literal(4, "/one") .. literal(1, "localhost")),
+      frame(HEADERS, END_HEADERS, 3, "\x83\x86" .. literal(4, "/two") .. literal(1, "localhost")),
+      frame(DATA, END_STREAM, 3, "hello")
+    }))
+    local bodies, done = {}, 0
+    while done < 2 do
+      local hd = assert(io:read(9))
+      local len, type, flags, stream_id = string.unpack(">I3BBI4", hd)
+      local payload = len > 0 and assert(io:read(len)) or ""
+      if type == DATA then
+        bodies[stream_id] = (bodies[stream_id] or "") .. payload
+      end
+      if (type == DATA or type == HEADERS) and flags & END_STREAM ~= 0 then
+        done = done + 1
+      end
+    end
+    assert(bodies[1] == "GET /one ", ("unexpected response: %q"):format(tostring(bodies[1])))
+    assert(bodies[3] == "POST /two hello", ("unexpected response: %q"):format(tostring(bodies[3])))
+    Shuso.stop()
+  end)()
+end)
+
+testmod:subscribe("server:http.request", function(self, event, rc, req)
+  assert(req.version == "2")
+  assert(req.headers.host == "localhost")
+  assert(req:respond(200, {["X-Path"] = req.path}, req.method .. " " .. req.path .. " " .. (req.body or "")))
+end)
+
+assert(testmod:add())
+
+local config =
+[[
+workers 1;
+http {
+  server {
+    listen 127.0.0.1:21606;
+  }
+}
+]]
+
+assert(Shuso.configure_string("test_conf", config))
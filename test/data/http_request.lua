@@ -0,0 +1,67 @@
+local Module = require "shuttlesock.module"
+local Watcher = require "shuttlesock.watcher"
+local Shuso = require "shuttlesock"
+local IO = require "shuttlesock.io"
+
+local testmod = Module.new {
+  name= "lua_testmod",
+  version = "0.0.0"
+}
+
+local function response(path, body, extra)
+  return ("HTTP/1.1 200 OK\r\nContent-Length: %d\r\nX-Path: %s\r\n%s\r\n%s"):format(#body, path, extra or "", body)
+end
+
+testmod:subscribe("server:manager.start", function()
+  Watcher.timer(10, function()
+    error("http request test timed out")
+  end):start()
+
+  coroutine.wrap(function()
+    local io = assert(IO.wrap("127.0.0.1:21605")())
+    assert(io:connect())
+    --three pipelined requests, one with a chunked body, the last one answered asynchronously
+    assert(io:write(table.concat{
+      "GET /one HTTP/1.1\r\nHost: localhost\r\nX-Thing: a\r\nx-thing: b\r\n\r\n",
+      "POST /two HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n",
+      "GET /three HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n"
+    }))
+    local expected = table.concat{
+      response("/one", "GET /one a, b"),
+      response("/two", "POST /two hello world"),
+      response("/three", "GET /three later", "Connection: close\r\n")
+    }
+    local str = io:read(#expected)
+    assert(str == expected, ("unexpected response: %q"):format(tostring(str)))
+    Shuso.stop()
+  end)()
+end)
+
+testmod:subscribe("server:http.request", function(self, event, rc, req)
+  assert(req.version == "1.1")
+  assert(req.headers.host == "localhost")
+  if req.path == "/one" then
+    assert(req:respond(200, {["X-Path"] = req.path}, req.method .. " " .. req.path .. " " .. req.headers["x-thing"]))
+    assert(not req:respond(200, nil, "again"))
+  elseif req.path == "/two" then
+    assert(req:respond(200, {["X-Path"] = req.path}, req.method .. " " .. req.path .. " " .. req.body))
+  else
+    Watcher.timer(0.1, function()
+      assert(req:respond(200, {["X-Path"] = req.path}, req.method .. " " .. req.path .. " later"))
+    end):start()
+  end
+end)
+
+assert(testmod:add())
+
+local config =
+[[
+workers 1;
+http {
+  server {
+    listen 127.0.0.1:21605;
+  }
+}
+]]
+
+assert(Shuso.configure_string("test_conf", config))
@@ -0,0 +1,60 @@
+local Module = require "shuttlesock.module"
+local Watcher = require "shuttlesock.watcher"
+local Shuso = require "shuttlesock"
+local IO = require "shuttlesock.io"
+
+local testmod = Module.new {
+  name= "lua_testmod",
+  version = "0.0.0"
+}
+
+--requests whose body could be framed more than one way, each on its own connection
+local requests = {
+  {400, "POST / HTTP/1.1\r\nHost: localhost\r\nContent-Length: 5\r\nContent-Length: 6\r\n\r\nhello!"},
+  {400, "POST / HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: chunked\r\nTransfer-Encoding: chunked\r\n\r\n0\r\n\r\n"},
+  {400, "POST / HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: chunked, gzip\r\n\r\n0\r\n\r\n"},
+  {400, "POST / HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: chunked, chunked\r\n\r\n0\r\n\r\n"},
+  {400, "POST / HTTP/1.1\r\nHost: localhost\r\nContent-Length: 5\r\nTransfer-Encoding: chunked\r\n\r\n0\r\n\r\n"},
+  {501, "POST / HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: gzip, chunked\r\n\r\n0\r\n\r\n"},
+  --the same length twice is fine
+  {200, "POST / HTTP/1.1\r\nHost: localhost\r\nContent-Length: 5\r\nContent-Length: 5\r\nConnection: close\r\n\r\nhello"}
+}
+
+testmod:subscribe("server:manager.start", function()
+  Watcher.timer(10, function()
+    error("http request smuggling test timed out")
+  end):start()
+
+  coroutine.wrap(function()
+    for i, req in ipairs(requests) do
+      local status, data = req[1], req[2]
+      local io = assert(IO.wrap("127.0.0.1:21615")())
+      assert(io:connect())
+      assert(io:write(data))
+      local expected = ("HTTP/1.1 %03d"):format(status)
+      local str = io:read(#expected)
+      assert(str == expected, ("request %d: expected %q, got %q"):format(i, expected, tostring(str)))
+      io:close()
+    end
+    Shuso.stop()
+  end)()
+end)
+
+testmod:subscribe("server:http.request", function(self, event, rc, req)
+  assert(req.body == "hello", "only the well-framed request should get this far")
+  assert(req:respond(200, nil, "ok"))
+end)
+
+assert(testmod:add())
+
+local config =
+[[
+workers 1;
+http {
+  server {
+    listen 127.0.0.1:21615;
+  }
+}
+]]
+
+assert(Shuso.configure_string("test_conf", config))
@@ -0,0 +1,45 @@
+local Module = require "shuttlesock.module"
+local Watcher = require "shuttlesock.watcher"
+local Shuso = require "shuttlesock"
+
+local data_path = ...
+
+local testmod = Module.new {
+  name= "lua_testmod",
+  version = "0.0.0"
+}
+
+local requests = 0
+
+testmod:subscribe("server:manager.start", function()
+  Watcher.timer(10, function()
+    error("TLS request test timed out")
+  end):start()
+end)
+
+testmod:subscribe("server:http.request", function(self, event, rc, req)
+  assert(req.headers.host == "localhost")
+  assert(req:respond(200, {["X-Path"] = req.path}, req.method .. " " .. req.path))
+  requests = requests + 1
+  if requests == 2 then
+    --the test client is done after its second request
+    Watcher.timer(0.5, function()
+      Shuso.stop()
+    end):start()
+  end
+end)
+
+assert(testmod:add())
+
+local config = ([[
+workers 1;
+http {
+  server {
+    listen 127.0.0.1:21607 ssl;
+    ssl_certificate %s/tls_test.crt;
+    ssl_certificate_key %s/tls_test.key;
+  }
+}
+]]):format(data_path, data_path)
+
+assert(Shuso.configure_string("test_conf", config))
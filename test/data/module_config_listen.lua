@@ -35,11 +35,20 @@ testmod:subscribe("server:manager.start", function()
   end)()
 end)
 
+--a table, so that both handlers still share it once they've been copied to the workers
+local accepted = {}
+
 testmod:subscribe("server:maybe_accept", function(self, event, rc, data)
-  --okay
+  assert(math.type(data.fd) == "integer")
+  assert(data.family == "IPv4" and data.address == "127.0.0.1" and math.type(data.port) == "integer")
+  assert(data.binding.address.port == 21595)
+  assert(data.nonexistent_field == nil)
+  accepted.maybe = data
 end)
 
 testmod:subscribe("server:http.accept", function(self, event, rc, data)
+  --accept event data doesn't outlive its event
+  assert(accepted.maybe and not pcall(function() return accepted.maybe.fd end))
   IO.wrap(data.socket, function(io)
     local str = assert(io:read_partial(20))
     assert(str == "oh hello there")
@@ -0,0 +1,60 @@
+local Module = require "shuttlesock.module"
+local Watcher = require "shuttlesock.watcher"
+local Shuso = require "shuttlesock"
+local IPC = require "shuttlesock.ipc"
+
+local bindings, workers, first_port, listen_opts = ...
+
+local testmod = Module.new {
+  name= "lua_testmod",
+  version = "0.0.0"
+}
+
+--watch the manager hand off the listener sockets: the requests it sends the workers, and their replies
+local stats = {messages = 0, listeners = 0, in_flight = 0, most_in_flight = 0}
+
+local function watch_listener_handoff()
+  local send, receive = IPC.send, IPC.receive_from_shuttlesock_core
+  IPC.send = function(dst, name, data, ...)
+    if name == "server:listener_socket_transfer" and type(data) == "table" then
+      stats.messages = stats.messages + 1
+      stats.listeners = stats.listeners + #data
+      stats.in_flight = stats.in_flight + 1
+      stats.most_in_flight = math.max(stats.most_in_flight, stats.in_flight)
+    end
+    return send(dst, name, data, ...)
+  end
+  IPC.receive_from_shuttlesock_core = function(name, src, data, ...)
+    if name == "server:listener_socket_transfer" then
+      stats.in_flight = stats.in_flight - 1
+    end
+    return receive(name, src, data, ...)
+  end
+end
+
+testmod:subscribe("server:manager.start", function()
+  assert(stats.messages > 0, "listener handoff didn't happen")
+  assert(stats.listeners == bindings * workers, ("handed off %d listeners, expected %d"):format(stats.listeners, bindings * workers))
+  assert(stats.messages == workers, ("listeners handed off in %d messages, expected one per worker"):format(stats.messages))
+  assert(stats.most_in_flight == workers, ("at most %d workers' handoffs in flight at once, expected all %d"):format(stats.most_in_flight, workers))
+  Shuso.stop()
+end)
+
+testmod:subscribe("core:manager.start", function()
+  --the server module starts handing off listeners once the master has opened them, so there's time to start watching
+  watch_listener_handoff()
+  Watcher.timer(20, function()
+    error("listener startup timed out")
+  end):start()
+end)
+
+assert(testmod:add())
+
+local servers = {}
+for i=0, bindings-1 do
+  table.insert(servers, ("  server {\n    listen 127.0.0.1:%d%s;\n  }"):format(first_port + i, listen_opts and (" " .. listen_opts) or ""))
+end
+
+local config = ("workers %d;\nhttp {\n%s\n}\n"):format(workers, table.concat(servers, "\n"))
+
+assert(Shuso.configure_string("test_conf", config))
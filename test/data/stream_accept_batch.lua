@@ -0,0 +1,50 @@
+local Module = require "shuttlesock.module"
+local Watcher = require "shuttlesock.watcher"
+local Shuso = require "shuttlesock"
+local IO = require "shuttlesock.io"
+
+local testmod = Module.new {
+  name= "lua_testmod",
+  version = "0.0.0"
+}
+
+local connections = ...
+local accepted = 0
+
+testmod:subscribe("server:manager.start", function()
+  Watcher.timer(10, function()
+    error("accept batch test timed out")
+  end):start()
+end)
+
+testmod:subscribe("server:stream.accept", function(self, event, rc, data)
+  accepted = accepted + 1
+  local n = accepted
+  if n == connections then
+    --the test client is done once it's read all the replies
+    Watcher.timer(0.5, function()
+      Shuso.stop()
+    end):start()
+  end
+  IO.wrap(data.socket, function(io)
+    local str = io:read_partial(64)
+    if str and #str > 0 then
+      assert(io:write(("accepted %d"):format(n)))
+    end
+    io:close()
+  end)()
+end)
+
+assert(testmod:add())
+
+local config =
+[[
+workers 1;
+stream {
+  server {
+    listen 127.0.0.1:21614 backlog=37 accept_batch=2;
+  }
+}
+]]
+
+assert(Shuso.configure_string("test_conf", config))
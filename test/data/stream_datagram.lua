@@ -0,0 +1,51 @@
+local Module = require "shuttlesock.module"
+local Watcher = require "shuttlesock.watcher"
+local Shuso = require "shuttlesock"
+local Core = require "shuttlesock.core"
+local IO = require "shuttlesock.io"
+
+local testmod = Module.new {
+  name= "lua_testmod",
+  version = "0.0.0"
+}
+
+testmod:subscribe("server:manager.start", function()
+  Watcher.timer(10, function()
+    error("stream datagram test timed out")
+  end):start()
+
+  coroutine.wrap(function()
+    local host = assert(Core.parse_host("127.0.0.1:21611"))
+    host.type = "udp"
+    local io = assert(IO.wrap(host)())
+    assert(io:connect())
+    for i = 1, 3 do
+      assert(io:write("hello " .. i))
+      local str = io:read_partial(64)
+      local expected = "echo: hello " .. i
+      assert(str == expected, ("unexpected response: %q"):format(tostring(str)))
+    end
+    assert(io:close())
+    Shuso.stop()
+  end)()
+end)
+
+testmod:subscribe("server:stream.datagram", function(self, event, rc, data)
+  assert(data.peer.address == "127.0.0.1")
+  assert(data.binding.address.port == 21611)
+  assert(data:reply("echo: " .. data.data))
+end)
+
+assert(testmod:add())
+
+local config =
+[[
+workers 2;
+stream {
+  server {
+    listen 127.0.0.1:21611 udp;
+  }
+}
+]]
+
+assert(Shuso.configure_string("test_conf", config))
@@ -0,0 +1,67 @@
+local Module = require "shuttlesock.module"
+local Watcher = require "shuttlesock.watcher"
+local Shuso = require "shuttlesock"
+local IO = require "shuttlesock.io"
+
+local testmod = Module.new {
+  name= "lua_testmod",
+  version = "0.0.0"
+}
+
+testmod:subscribe("server:manager.start", function()
+  Watcher.timer(10, function()
+    error("stream proxy test timed out")
+  end):start()
+
+  coroutine.wrap(function()
+    --one after another, so the later ones get idle upstream connections. nothing listens on the second upstream
+    for i = 1, 3 do
+      local io = assert(IO.wrap("127.0.0.1:21608")())
+      assert(io:connect())
+      assert(io:write("hello " .. i))
+      local expected = "echo: hello " .. i
+      local str = io:read(#expected)
+      assert(str == expected, ("unexpected response: %q"):format(tostring(str)))
+      --the upstream hung up, and the proxy passed it along
+      assert(io:wait("r"))
+      io:read_partial(16)
+      assert(io:closed() == "r")
+      assert(io:close())
+    end
+    Shuso.stop()
+  end)()
+end)
+
+testmod:subscribe("server:stream.accept", function(self, event, rc, data)
+  if data.binding.address.port ~= 21609 then
+    --the proxy's
+    return
+  end
+  IO.wrap(data.socket, function(io)
+    --idle connections the proxy never used just get closed
+    local str = io:read_partial(64)
+    if str and #str > 0 then
+      assert(io:write("echo: " .. str))
+    end
+    io:close()
+  end)()
+end)
+
+assert(testmod:add())
+
+local config =
+[[
+workers 1;
+stream {
+  server {
+    listen 127.0.0.1:21608;
+    proxy_pass 127.0.0.1:21609 127.0.0.1:21610;
+    proxy_idle_connections 1;
+  }
+  server {
+    listen 127.0.0.1:21609;
+  }
+}
+]]
+
+assert(Shuso.configure_string("test_conf", config))
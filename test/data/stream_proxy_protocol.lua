@@ -0,0 +1,79 @@
+local Module = require "shuttlesock.module"
+local Watcher = require "shuttlesock.watcher"
+local Shuso = require "shuttlesock"
+local IO = require "shuttlesock.io"
+
+local testmod = Module.new {
+  name= "lua_testmod",
+  version = "0.0.0"
+}
+
+local function connect()
+  local io = assert(IO.wrap("127.0.0.1:21613")())
+  assert(io:connect())
+  return io
+end
+
+local function expect_response(io, expected)
+  local str = assert(io:read_partial(128))
+  assert(str == expected, ("unexpected response: %q"):format(str))
+  assert(io:close())
+end
+
+testmod:subscribe("server:manager.start", function()
+  Watcher.timer(10, function()
+    error("PROXY protocol test timed out")
+  end):start()
+
+  coroutine.wrap(function()
+    local io = connect()
+    assert(io:write("PROXY TCP4 192.0.2.1 192.0.2.2 56324 443\r\nhello 1"))
+    expect_response(io, "192.0.2.1 56324 hello 1")
+
+    --an IPv6 client on an IPv4 listener, with the header in two pieces
+    local v2 = "\r\n\r\n\0\r\nQUIT\n" .. "\x21\x21" .. string.pack(">I2", 36)
+      .. "\x20\x01\x0d\xb8" .. ("\0"):rep(11) .. "\x01"
+      .. "\x20\x01\x0d\xb8" .. ("\0"):rep(11) .. "\x02"
+      .. string.pack(">I2I2", 1234, 443)
+    io = connect()
+    assert(io:write(v2:sub(1, 10)))
+    Watcher.timer(0.1):yield()
+    assert(io:write(v2:sub(11) .. "hello 2"))
+    expect_response(io, "2001:db8::1 1234 hello 2")
+
+    --no header, no connection
+    io = connect()
+    assert(io:write("GET / HTTP/1.1\r\n\r\n"))
+    assert(io:wait("r"))
+    io:read_partial(16)
+    assert(io:closed() == "r")
+    assert(io:close())
+
+    Shuso.stop()
+  end)()
+end)
+
+testmod:subscribe("server:stream.accept", function(self, event, rc, data)
+  local address, port = data.socket.address, data.socket.port
+  IO.wrap(data.socket, function(io)
+    local str = io:read_partial(64)
+    if str and #str > 0 then
+      assert(io:write(("%s %d %s"):format(address, port, str)))
+    end
+    io:close()
+  end)()
+end)
+
+assert(testmod:add())
+
+local config =
+[[
+workers 1;
+stream {
+  server {
+    listen 127.0.0.1:21613 proxy_protocol;
+  }
+}
+]]
+
+assert(Shuso.configure_string("test_conf", config))
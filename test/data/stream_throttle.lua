@@ -0,0 +1,72 @@
+local Module = require "shuttlesock.module"
+local Watcher = require "shuttlesock.watcher"
+local Shuso = require "shuttlesock"
+local IO = require "shuttlesock.io"
+
+local testmod = Module.new {
+  name= "lua_testmod",
+  version = "0.0.0"
+}
+
+--a table, so that the handlers still share it once they've been copied to the worker
+local counts = {paused = 0, resumed = 0}
+
+testmod:subscribe("server:manager.start", function()
+  Watcher.timer(10, function()
+    error("stream throttle test timed out")
+  end):start()
+
+  coroutine.wrap(function()
+    for i = 1, 2 do
+      local io = assert(IO.wrap("127.0.0.1:21612")())
+      assert(io:connect())
+      assert(io:write("hello " .. i))
+      local str = assert(io:read_partial(64))
+      assert(str:match("^echo: hello " .. i), ("unexpected response: %q"):format(str))
+      if i == 2 then
+        --the first connection paused the listener, and it resumed once that one was closed
+        assert(str == "echo: hello 2, paused 1, resumed 1", ("unexpected response: %q"):format(str))
+      end
+      assert(io:close())
+    end
+    Shuso.stop()
+  end)()
+end)
+
+testmod:subscribe("server:listener_pause", function(self, event, rc, data)
+  assert(data.paused == true)
+  assert(data.connections == 1)
+  assert(data.binding.address.port == 21612)
+  counts.paused = counts.paused + 1
+end)
+
+testmod:subscribe("server:listener_resume", function(self, event, rc, data)
+  assert(data.paused == false)
+  assert(data.connections == 0)
+  assert(math.type(data.loop_lag) == "float")
+  counts.resumed = counts.resumed + 1
+end)
+
+testmod:subscribe("server:stream.accept", function(self, event, rc, data)
+  IO.wrap(data.socket, function(io)
+    local str = io:read_partial(64)
+    if str and #str > 0 then
+      assert(io:write(("echo: %s, paused %d, resumed %d"):format(str, counts.paused, counts.resumed)))
+    end
+    io:close()
+  end)()
+end)
+
+assert(testmod:add())
+
+local config =
+[[
+workers 1;
+stream {
+  server {
+    listen 127.0.0.1:21612 max_connections=1;
+  }
+}
+]]
+
+assert(Shuso.configure_string("test_conf", config))
@@ -2,6 +2,15 @@
 #include <lua.h>
 #include <lauxlib.h>
 #include <lualib.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include <fcntl.h>
+#include <netinet/udp.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <openssl/ssl.h>
 #include <shuttlesock/modules/lua_bridge/api/ipc_lua_api.h>
 #ifndef __clang_analyzer__
 
@@ -669,6 +678,144 @@ describe(lua_features) {
   }
 }
 
+static void listener_handoff_run(shuso_t *S, int bindings, int workers) {
+  //the fixture checks how the listeners were handed off once the server's started
+  lua_State *L = S->lua.state;
+  lua_pushinteger(L, bindings);
+  lua_pushinteger(L, workers);
+  lua_pushinteger(L, 23100);
+  assert_luaL_dofile_args(L, "module_config_listen_many.lua", 3);
+  assert_shuso(S, shuso_configure_finish(S));
+  shuso_run(S);
+  assert_shuso_ran_ok(S);
+}
+
+typedef struct {
+  int           port;
+  int           responses;
+  bool          resumed;
+} tls_client_test_t;
+
+static int tls_client_connect(int port) {
+  struct sockaddr_in  addr = {.sin_family = AF_INET, .sin_port = htons(port)};
+  inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+  //the server may not be listening yet
+  for(int i = 0; i < 100; i++) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+      return fd;
+    }
+    close(fd);
+    usleep(50000);
+  }
+  return -1;
+}
+
+static SSL_SESSION *tls_client_request(SSL_CTX *ctx, SSL_SESSION *session, tls_client_test_t *t) {
+  static const char request[] = "GET /tls HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+  char         buf[1024];
+  size_t       len = 0;
+  int          n;
+  SSL_SESSION *next = NULL;
+  SSL         *ssl;
+  int          fd = tls_client_connect(t->port);
+  if(fd == -1) {
+    return NULL;
+  }
+  ssl = SSL_new(ctx);
+  SSL_set_fd(ssl, fd);
+  SSL_set_tlsext_host_name(ssl, "localhost");
+  if(session) {
+    SSL_set_session(ssl, session);
+  }
+  if(SSL_connect(ssl) == 1 && SSL_write(ssl, request, sizeof(request) - 1) == sizeof(request) - 1) {
+    while(len < sizeof(buf) - 1 && (n = SSL_read(ssl, &buf[len], sizeof(buf) - 1 - len)) > 0) {
+      len += n;
+    }
+    buf[len] = '\0';
+    if(strstr(buf, "HTTP/1.1 200") == buf && strstr(buf, "GET /tls")) {
+      t->responses++;
+    }
+    if(session && SSL_session_reused(ssl)) {
+      t->resumed = true;
+    }
+    //TLS 1.3 tickets arrive after the handshake, so the session is only complete now
+    next = SSL_get1_session(ssl);
+  }
+  SSL_free(ssl);
+  close(fd);
+  return next;
+}
+
+static void *tls_client_thread(void *pd) {
+  tls_client_test_t *t = pd;
+  SSL_CTX           *ctx = SSL_CTX_new(TLS_client_method());
+  SSL_SESSION       *session, *resumed;
+  SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+  session = tls_client_request(ctx, NULL, t);
+  if(session) {
+    if((resumed = tls_client_request(ctx, session, t)) != NULL) {
+      SSL_SESSION_free(resumed);
+    }
+    SSL_SESSION_free(session);
+  }
+  SSL_CTX_free(ctx);
+  return NULL;
+}
+
+typedef struct {
+  int           port;
+  int           connections;
+  int           responses;
+  int           backlog;
+} accept_batch_client_test_t;
+
+static void *accept_batch_client_thread(void *pd) {
+  accept_batch_client_test_t *t = pd;
+  int                         fds[32];
+  char                        buf[64];
+  int                         n;
+  
+  assert(t->connections <= 32);
+  //all connected before any of them gets a reply, so they're waiting in the accept queue together
+  for(int i = 0; i < t->connections; i++) {
+    fds[i] = tls_client_connect(t->port);
+  }
+  for(int i = 0; i < t->connections; i++) {
+    if(fds[i] != -1 && write(fds[i], "hi", 2) == 2 && (n = read(fds[i], buf, sizeof(buf) - 1)) > 0) {
+      buf[n] = '\0';
+      if(strncmp(buf, "accepted ", 9) == 0) {
+        t->responses++;
+      }
+    }
+  }
+#ifdef TCP_INFO
+  //the workers are threads in this process, so the listening socket is right here
+  for(int fd = 0; fd < 1024; fd++) {
+    struct sockaddr_in  addr;
+    struct tcp_info     info;
+    socklen_t           len = sizeof(addr);
+    int                 listening = 0;
+    socklen_t           listening_len = sizeof(listening);
+    if(getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &listening_len) == 0 && listening
+     && getsockname(fd, (struct sockaddr *)&addr, &len) == 0 && addr.sin_family == AF_INET && ntohs(addr.sin_port) == t->port) {
+      len = sizeof(info);
+      if(getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0) {
+        //for a listening socket, that's the accept queue's length limit
+        t->backlog = info.tcpi_sacked;
+      }
+      break;
+    }
+  }
+#endif
+  for(int i = 0; i < t->connections; i++) {
+    if(fds[i] != -1) {
+      close(fds[i]);
+    }
+  }
+  return NULL;
+}
+
 describe(lua_api) {
   static shuso_t          *S = NULL;
   static test_runcheck_t  *chk = NULL;
@@ -734,6 +881,106 @@ describe(lua_api) {
       shuso_run(S);
       assert_shuso_ran_ok(S);
     }
+    
+    test("listener handoff to a few workers") {
+      //one round-trip per worker, all at once. this used to take one per binding per worker, one at a time
+      listener_handoff_run(S, 4, 2);
+    }
+    
+    test("listener handoff with many bindings to many workers") {
+      listener_handoff_run(S, 24 * test_config.multiplier, 16);
+    }
+    
+    test("HTTP/1.1 requests") {
+      assert_luaL_dofile(S->lua.state, "http_request.lua");
+      assert_shuso(S, shuso_configure_finish(S));
+      shuso_run(S);
+      assert_shuso_ran_ok(S);
+    }
+    
+    test("HTTP/1.1 requests with ambiguous framing are refused") {
+      assert_luaL_dofile(S->lua.state, "http_request_smuggling.lua");
+      assert_shuso(S, shuso_configure_finish(S));
+      shuso_run(S);
+      assert_shuso_ran_ok(S);
+    }
+    
+    test("HTTP/2 requests with prior knowledge") {
+      assert_luaL_dofile(S->lua.state, "http2_request.lua");
+      assert_shuso(S, shuso_configure_finish(S));
+      shuso_run(S);
+      assert_shuso_ran_ok(S);
+    }
+    
+    test("TLS requests with session resumption") {
+      tls_client_test_t t = {.port = 21607};
+      pthread_t         client;
+      lua_pushstring(S->lua.state, test_config.data_path);
+      assert_luaL_dofile_args(S->lua.state, "http_tls_request.lua", 1);
+      assert_shuso(S, shuso_configure_finish(S));
+      assert(pthread_create(&client, NULL, tls_client_thread, &t) == 0);
+      shuso_run(S);
+      pthread_join(client, NULL);
+      assert_shuso_ran_ok(S);
+      assert(t.responses == 2);
+      assert(t.resumed);
+    }
+    
+    test("stream proxy with idle upstream connections") {
+      assert_luaL_dofile(S->lua.state, "stream_proxy.lua");
+      assert_shuso(S, shuso_configure_finish(S));
+      shuso_run(S);
+      assert_shuso_ran_ok(S);
+    }
+    
+    test("UDP listener datagrams and replies") {
+      assert_luaL_dofile(S->lua.state, "stream_datagram.lua");
+      assert_shuso(S, shuso_configure_finish(S));
+      shuso_run(S);
+      assert_shuso_ran_ok(S);
+    }
+    
+    test("PROXY protocol headers") {
+      assert_luaL_dofile(S->lua.state, "stream_proxy_protocol.lua");
+      assert_shuso(S, shuso_configure_finish(S));
+      shuso_run(S);
+      assert_shuso_ran_ok(S);
+    }
+    
+    test("accept queue drained in batches, with the configured backlog") {
+      accept_batch_client_test_t  t = {.port = 21614, .connections = 16, .backlog = -1};
+      pthread_t                   client;
+      lua_pushinteger(S->lua.state, t.connections);
+      assert_luaL_dofile_args(S->lua.state, "stream_accept_batch.lua", 1);
+      assert_shuso(S, shuso_configure_finish(S));
+      assert(pthread_create(&client, NULL, accept_batch_client_thread, &t) == 0);
+      shuso_run(S);
+      pthread_join(client, NULL);
+      assert_shuso_ran_ok(S);
+      asserteq(t.responses, t.connections, "every connection should be accepted, several batches' worth at once");
+#ifdef TCP_INFO
+      asserteq(t.backlog, 37, "listen() should use the backlog from the config");
+#endif
+    }
+    
+    test("listeners paused and resumed by max_connections") {
+      assert_luaL_dofile(S->lua.state, "stream_throttle.lua");
+      assert_shuso(S, shuso_configure_finish(S));
+      shuso_run(S);
+      assert_shuso_ran_ok(S);
+    }
+    
+    test("listeners with connection rebalancing") {
+      lua_State *L = S->lua.state;
+      lua_pushinteger(L, 2);
+      lua_pushinteger(L, 4);
+      lua_pushinteger(L, 23100);
+      lua_pushliteral(L, "rebalance");
+      assert_luaL_dofile_args(L, "module_config_listen_many.lua", 4);
+      assert_shuso(S, shuso_configure_finish(S));
+      shuso_run(S);
+      assert_shuso_ran_ok(S);
+    }
   }
   
   test("lazy atomics") {
@@ -1236,6 +1483,16 @@ describe(pool_allocator) {
       assert(pool.page.cur == stats.levels.array[2].page_cur);
       shuso_pool_drain_to_level(&pool, 0);
     }
+    
+    test("drain and re-mark as often as you like") {
+      int level = shuso_pool_mark_level(&pool);
+      for(int i=0; i<SHUTTLESOCK_POOL_MAX_LEVELS * 4; i++) {
+        shuso_palloc(&pool, 100);
+        assert(shuso_pool_drain_to_level(&pool, level));
+        asserteq(shuso_pool_mark_level(&pool), level);
+      }
+      asserteq(pool.levels.count, (unsigned )level);
+    }
   }
   
   /*subdesc(space_tracking) {
@@ -1249,6 +1506,912 @@ describe(pool_allocator) {
   }*/
 }
 
+static size_t heap_bytes_in_use(void) {
+#ifdef __GLIBC__
+#if __GLIBC_PREREQ(2, 33)
+  return mallinfo2().uordblks;
+#else
+  return (size_t )mallinfo().uordblks;
+#endif
+#else
+  //no portable way to ask. allocation checks always pass
+  return 0;
+#endif
+}
+
+typedef struct {
+  ssize_t   result;
+  int       error;
+  bool      done;
+} partial_writev_test_t;
+
+static void partial_writev_test_handler(shuso_t *S, shuso_io_t *io) {
+  partial_writev_test_t *t = io->privdata;
+  t->result = io->result;
+  t->error = io->error;
+  t->done = true;
+}
+
+static void coalesce_test_coroutine(shuso_t *S, shuso_io_t *io) {
+  partial_writev_test_t *t = io->privdata;
+  SHUSO_IO_CORO_BEGIN(io);
+  SHUSO_IO_CORO_YIELD(write, "header ", 7);
+  t->result = io->result;
+  SHUSO_IO_CORO_YIELD(write, "body ", 5);
+  t->result += io->result;
+  SHUSO_IO_CORO_YIELD(write, "trailer", 7);
+  t->result += io->result;
+  t->error = io->error;
+  t->done = true;
+  SHUSO_IO_CORO_END(io);
+}
+
+static void tcp_loopback_pair(int fds[2]) {
+  struct sockaddr_in  addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+  socklen_t           len = sizeof(addr);
+  int                 listener;
+  
+  listener = socket(AF_INET, SOCK_STREAM, 0);
+  assert(listener != -1);
+  assert(bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+  assert(listen(listener, 1) == 0);
+  assert(getsockname(listener, (struct sockaddr *)&addr, &len) == 0);
+  fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+  assert(connect(fds[0], (struct sockaddr *)&addr, sizeof(addr)) == 0);
+  fds[1] = accept(listener, NULL, NULL);
+  assert(fds[1] != -1);
+  for(int i = 0; i < 2; i++) {
+    assert(fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK) == 0);
+  }
+  close(listener);
+}
+
+typedef struct {
+  ssize_t   result;
+  int       error;
+  uint32_t  zerocopy_sent;
+  uint32_t  zerocopy_completed;
+  bool      done;
+} zerocopy_test_t;
+
+static void zerocopy_test_handler(shuso_t *S, shuso_io_t *io) {
+  zerocopy_test_t *t = io->privdata;
+  t->result = io->result;
+  t->error = io->error;
+  t->zerocopy_sent = io->zerocopy.sent;
+  t->zerocopy_completed = io->zerocopy.completed;
+  t->done = true;
+}
+
+typedef struct {
+  char      buf[16];
+  int       cycles;
+  bool      pinged;
+  bool      waiting;
+  bool      done;
+} persistent_watch_test_t;
+
+static void persistent_watch_test_coroutine(shuso_t *S, shuso_io_t *io) {
+  persistent_watch_test_t *t = io->privdata;
+  SHUSO_IO_CORO_BEGIN(io);
+  while(t->cycles < 10) {
+    SHUSO_IO_CORO_YIELD(read_partial, t->buf, sizeof(t->buf));
+    //like a keepalive connection waiting on its request's response
+    t->waiting = true;
+    SHUSO_IO_CORO_YIELD(suspend, NULL);
+    SHUSO_IO_CORO_YIELD(write, "pong", 4);
+    t->cycles++;
+  }
+  t->done = true;
+  SHUSO_IO_CORO_END(io);
+}
+
+static void persistent_watch_test_run(shuso_t *S, shuso_io_t *io, int fds[2], bool persistent) {
+  persistent_watch_test_t t = {.done = false};
+  char                    received[64];
+  
+  shuso_io_init(S, io, fds[0], SHUSO_IO_READ | SHUSO_IO_WRITE, persistent_watch_test_coroutine, &t);
+  shuso_io_set_persistent_watch(io, persistent);
+  shuso_io_start(io);
+  while(!t.done) {
+    if(io->watch_type == SHUSO_IO_WATCH_OP_RETRY && !t.pinged) {
+      assert(write(fds[1], "ping", 4) == 4);
+      t.pinged = true;
+    }
+    ev_run(S->ev.loop, EVRUN_NOWAIT);
+    if(t.waiting) {
+      t.waiting = false;
+      t.pinged = false;
+      ev_run(S->ev.loop, EVRUN_NOWAIT);
+      shuso_io_resume(io);
+    }
+    while(read(fds[1], received, sizeof(received)) > 0) {
+      //discard the pongs
+    }
+  }
+}
+
+describe(io) {
+  static shuso_t          *S = NULL;
+  static test_runcheck_t  *chk = NULL;
+  before_each() {
+    S = shusoT_create(&chk, 25.0);
+  }
+  after_each() {
+    shusoT_destroy(S, &chk);
+  }
+  
+  test("partial writev continuation doesn't allocate") {
+    static char             data[8][7001];
+    static char             received[sizeof(data)];
+    static shuso_io_t       io_storage;
+    shuso_io_t             *io = &io_storage;
+    struct iovec            iov[8];
+    int                     fds[2];
+    int                     sndbuf = 4096;
+    size_t                  total_received = 0;
+    bool                    trimmed = false;
+    partial_writev_test_t   t = {.done = false};
+    
+    shuso_configure_finish(S);
+    assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) == 0);
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    for(int i = 0; i < 8; i++) {
+      memset(data[i], 'a' + i, sizeof(data[i]));
+      iov[i] = (struct iovec ) {.iov_base = data[i], .iov_len = sizeof(data[i])};
+    }
+    
+    shuso_io_init(S, io, fds[0], SHUSO_IO_WRITE, partial_writev_test_handler, &t);
+    //start and stop the watcher once so that libev's per-fd bookkeeping is already allocated
+    shuso_io_wait(io, SHUSO_IO_WRITE);
+    shuso_io_suspend(io, NULL);
+    
+    size_t heap_before = heap_bytes_in_use();
+    shuso_io_writev(io, iov, 8);
+    while(!t.done) {
+      if(io->incomplete_iovec.iov) {
+        trimmed = true;
+      }
+      asserteq(heap_bytes_in_use(), heap_before, "partial writev shouldn't allocate");
+      ssize_t n = read(fds[1], &received[total_received], 3001);
+      if(n > 0) {
+        total_received += n;
+      }
+      ev_run(S->ev.loop, EVRUN_NOWAIT);
+    }
+    assert(trimmed, "writev should have stopped in the middle of an iovec at least once");
+    asserteq(t.error, 0);
+    asserteq(t.result, (ssize_t )sizeof(data));
+    
+    ssize_t n;
+    while(total_received < sizeof(received) && (n = read(fds[1], &received[total_received], sizeof(received) - total_received)) > 0) {
+      total_received += n;
+    }
+    asserteq(total_received, sizeof(data));
+    assert(memcmp(received, data, sizeof(data)) == 0, "received data should match what was written");
+    for(int i = 0; i < 8; i++) {
+      assert(iov[i].iov_base == data[i] && iov[i].iov_len == sizeof(data[i]), "caller's iovecs should be restored");
+    }
+    close(fds[0]);
+    close(fds[1]);
+  }
+  
+  test("coalesced writes are flushed together at the end of the loop iteration") {
+    static shuso_io_t       io_storage;
+    shuso_io_t             *io = &io_storage;
+    int                     fds[2];
+    char                    received[64];
+    partial_writev_test_t   t = {.done = false};
+    
+    shuso_configure_finish(S);
+    assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) == 0);
+    shuso_io_init(S, io, fds[0], SHUSO_IO_WRITE, coalesce_test_coroutine, &t);
+    assert(shuso_io_set_coalesce(io, true, 0));
+    shuso_io_start(io);
+    assert(t.done, "staged writes should complete right away");
+    asserteq(t.error, 0);
+    asserteq(t.result, 19);
+    asserteq(read(fds[1], received, sizeof(received)), -1, "nothing should be written before the end of the loop iteration");
+    
+    ev_run(S->ev.loop, EVRUN_NOWAIT);
+    asserteq(read(fds[1], received, sizeof(received)), 19, "all the writes should arrive at once");
+    assert(memcmp(received, "header body trailer", 19) == 0);
+    
+    shuso_io_set_coalesce(io, false, 0);
+    assert(io->coalesce == NULL);
+    close(fds[0]);
+    close(fds[1]);
+  }
+  
+  test("coalesced writes and buffer chains") {
+    static shuso_io_t       io_storage;
+    shuso_io_t             *io = &io_storage;
+    shuso_buffer_t          buf;
+    struct iovec           *iov;
+    int                     fds[2];
+    char                    received[64];
+    unsigned                free_batches;
+    void                  (*prev_sigpipe)(int);
+    partial_writev_test_t   t = {.done = false};
+    
+    shuso_configure_finish(S);
+    assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) == 0);
+    shuso_buffer_init(S, &buf, SHUSO_BUF_HEAP, NULL);
+    memcpy(shuso_buffer_add_charbuf(S, &buf, 5), "body ", 5);
+    iov = shuso_buffer_add_iovec(S, &buf, 1);
+    iov[0] = (struct iovec ) {.iov_base = "trailer", .iov_len = 7};
+    shuso_io_init(S, io, fds[0], SHUSO_IO_WRITE, partial_writev_test_handler, &t);
+    assert(shuso_io_set_coalesce(io, true, 0));
+    
+    shuso_io_write(io, "header ", 7);
+    assert(t.done);
+    asserteq(t.result, 7);
+    //buffer chains aren't staged, but what's staged goes out before them
+    t.done = false;
+    shuso_io_write_buffer(io, &buf);
+    assert(t.done);
+    asserteq(t.error, 0);
+    asserteq(t.result, 12, "result should be the chain's size only");
+    assert(buf.first == NULL && buf.last == NULL, "written links should be dequeued");
+    assert(io->write_buffer.buffer == NULL && io->write_buffer.batch == NULL);
+    free_batches = S->io.free_iovec_batches_count;
+    asserteq(read(fds[1], received, sizeof(received)), 19);
+    assert(memcmp(received, "header body trailer", 19) == 0, "staged bytes should go out first");
+    
+    //a failed flush is reported by the chain write, which leaves the chain alone
+    memcpy(shuso_buffer_add_charbuf(S, &buf, 5), "again", 5);
+    t.done = false;
+    shuso_io_write(io, "x", 1);
+    assert(t.done);
+    prev_sigpipe = signal(SIGPIPE, SIG_IGN);
+    shutdown(fds[0], SHUT_WR);
+    ev_run(S->ev.loop, EVRUN_NOWAIT);
+    signal(SIGPIPE, prev_sigpipe);
+    t.done = false;
+    shuso_io_write_buffer(io, &buf);
+    assert(t.done);
+    asserteq(t.result, -1);
+    asserteq(t.error, EPIPE);
+    assert(io->write_buffer.buffer == NULL && io->write_buffer.batch == NULL, "failed chain write shouldn't keep its buffer");
+    asserteq(S->io.free_iovec_batches_count, free_batches, "iovec batch should be back in the pool");
+    assert(buf.first != NULL && buf.first == buf.last, "unwritten link should still be queued");
+    
+    shuso_buffer_free(S, &buf, shuso_buffer_dequeue(S, &buf));
+    shuso_io_set_coalesce(io, false, 0);
+    close(fds[0]);
+    close(fds[1]);
+  }
+  
+  test("buffer chains are written out in one go") {
+    static char             data[4][5003];
+    static char             received[sizeof(data)];
+    static shuso_io_t       io_storage;
+    shuso_io_t             *io = &io_storage;
+    shuso_buffer_t          buf;
+    struct iovec           *iov;
+    int                     fds[2];
+    int                     sndbuf = 4096;
+    size_t                  total_received = 0;
+    partial_writev_test_t   t = {.done = false};
+    
+    shuso_configure_finish(S);
+    assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) == 0);
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    for(int i = 0; i < 4; i++) {
+      memset(data[i], 'a' + i, sizeof(data[i]));
+    }
+    shuso_buffer_init(S, &buf, SHUSO_BUF_HEAP, NULL);
+    memcpy(shuso_buffer_add_charbuf(S, &buf, sizeof(data[0])), data[0], sizeof(data[0]));
+    iov = shuso_buffer_add_iovec(S, &buf, 2);
+    iov[0] = (struct iovec ) {.iov_base = data[1], .iov_len = sizeof(data[1])};
+    iov[1] = (struct iovec ) {.iov_base = data[2], .iov_len = sizeof(data[2])};
+    memcpy(shuso_buffer_add_charbuf(S, &buf, sizeof(data[3])), data[3], sizeof(data[3]));
+    
+    shuso_io_init(S, io, fds[0], SHUSO_IO_WRITE, partial_writev_test_handler, &t);
+    shuso_io_write_buffer(io, &buf);
+    while(!t.done) {
+      ssize_t n = read(fds[1], &received[total_received], 3001);
+      if(n > 0) {
+        total_received += n;
+      }
+      ev_run(S->ev.loop, EVRUN_NOWAIT);
+    }
+    asserteq(t.error, 0);
+    asserteq(t.result, (ssize_t )sizeof(data));
+    assert(buf.first == NULL && buf.last == NULL, "written links should be dequeued");
+    
+    ssize_t n;
+    while(total_received < sizeof(received) && (n = read(fds[1], &received[total_received], sizeof(received) - total_received)) > 0) {
+      total_received += n;
+    }
+    asserteq(total_received, sizeof(data));
+    assert(memcmp(received, data, sizeof(data)) == 0, "received data should match the buffer");
+    close(fds[0]);
+    close(fds[1]);
+  }
+  
+  test("persistent watchers stay armed across suspended ops") {
+    //this counts shuttlesock's own watcher starts and stops. libev may or may not turn those into epoll_ctl calls
+    //(that's measured with './test.sh strace')
+    static shuso_io_t       io_storage;
+    shuso_io_t             *io = &io_storage;
+    int                     fds[2];
+    unsigned                starts, stops;
+    
+    shuso_configure_finish(S);
+    assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) == 0);
+    
+    starts = S->io.watcher_starts;
+    stops = S->io.watcher_stops;
+    persistent_watch_test_run(S, io, fds, false);
+    asserteq(S->io.watcher_starts - starts, 10, "watcher should be started for every read");
+    asserteq(S->io.watcher_stops - stops, 10, "watcher should be stopped for every suspend");
+    
+    starts = S->io.watcher_starts;
+    stops = S->io.watcher_stops;
+    persistent_watch_test_run(S, io, fds, true);
+    asserteq(S->io.watcher_starts - starts, 1, "persistent watcher should be started just once");
+    asserteq(S->io.watcher_stops - stops, 0, "persistent watcher shouldn't be stopped between ops");
+    assert(shuso_ev_active(&io->watcher));
+    
+    //nobody's waiting on it now. it's disarmed the first time it goes off
+    assert(write(fds[1], "ping", 4) == 4);
+    ev_run(S->ev.loop, EVRUN_NOWAIT);
+    assert(!shuso_ev_active(&io->watcher), "idle persistent watcher should be disarmed when it fires");
+    asserteq(S->io.watcher_stops - stops, 1);
+    close(fds[0]);
+    close(fds[1]);
+  }
+  
+#ifdef SHUTTLESOCK_HAVE_SPLICE
+  test("splices between sockets, with data left in the pipe") {
+    static char             data[48 * 1024];
+    static char             received[sizeof(data)];
+    static shuso_io_t       src_storage, dst_storage;
+    shuso_io_t             *src = &src_storage, *dst = &dst_storage;
+    int                     src_fds[2], dst_fds[2];
+    int                     sndbuf = 4096;
+    size_t                  total_received = 0;
+    partial_writev_test_t   t = {.done = false};
+    
+    shuso_configure_finish(S);
+    assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, src_fds) == 0);
+    assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, dst_fds) == 0);
+    setsockopt(dst_fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    for(size_t i = 0; i < sizeof(data); i++) {
+      data[i] = 'a' + i % 26;
+    }
+    asserteq(write(src_fds[1], data, sizeof(data)), (ssize_t )sizeof(data));
+    
+    shuso_io_init(S, src, src_fds[0], SHUSO_IO_READ, partial_writev_test_handler, &t);
+    shuso_io_init(S, dst, dst_fds[0], SHUSO_IO_WRITE, partial_writev_test_handler, &t);
+    shuso_io_splice(src, dst, sizeof(data));
+    assert(!t.done, "destination's send buffer is too small to take it all at once");
+    assert(src->splice.buffered > 0, "the rest should be waiting in the pipe");
+    assert(src->watch_type == SHUSO_IO_WATCH_OP_RETRY && src->watcher.ev.fd == dst_fds[0], "should be waiting on the destination");
+    
+    while(!t.done) {
+      ssize_t n = read(dst_fds[1], &received[total_received], 3001);
+      if(n > 0) {
+        total_received += n;
+      }
+      ev_run(S->ev.loop, EVRUN_NOWAIT);
+    }
+    asserteq(t.error, 0);
+    asserteq(t.result, (ssize_t )sizeof(data));
+    ssize_t n;
+    while(total_received < sizeof(received) && (n = read(dst_fds[1], &received[total_received], sizeof(received) - total_received)) > 0) {
+      total_received += n;
+    }
+    asserteq(total_received, sizeof(data));
+    assert(memcmp(received, data, sizeof(data)) == 0, "spliced data should arrive intact and in order");
+    asserteq(S->io.free_pipes_count, 1, "the emptied pipe should be kept for the next splice");
+    
+    //a partial splice finishes with whatever was there
+    t.done = false;
+    asserteq(write(src_fds[1], data, 1000), 1000);
+    shuso_io_splice_partial(src, dst, sizeof(data));
+    assert(t.done);
+    asserteq(t.result, 1000);
+    asserteq(S->io.free_pipes_count, 1, "the pipe should have been reused");
+    asserteq(read(dst_fds[1], received, sizeof(received)), 1000);
+    
+    for(int i = 0; i < 2; i++) {
+      close(src_fds[i]);
+      close(dst_fds[i]);
+    }
+  }
+#endif
+  
+#ifdef SHUTTLESOCK_HAVE_SENDFILE
+  test("sendfile across several writes") {
+    static char             data[96 * 1024];
+    static char             received[sizeof(data)];
+    static shuso_io_t       io_storage;
+    shuso_io_t             *io = &io_storage;
+    char                    path[] = "/tmp/shuttlesock-sendfile-XXXXXX";
+    int                     fds[2];
+    int                     file_fd;
+    int                     sndbuf = 4096;
+    int                     retries = 0;
+    size_t                  total_received = 0;
+    partial_writev_test_t   t = {.done = false};
+    
+    shuso_configure_finish(S);
+    for(size_t i = 0; i < sizeof(data); i++) {
+      data[i] = 'a' + i % 26;
+    }
+    file_fd = mkstemp(path);
+    assert(file_fd != -1);
+    unlink(path);
+    asserteq(write(file_fd, data, sizeof(data)), (ssize_t )sizeof(data));
+    assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) == 0);
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    
+    shuso_io_init(S, io, fds[0], SHUSO_IO_WRITE, partial_writev_test_handler, &t);
+    shuso_io_sendfile(io, file_fd, 100, sizeof(data) - 100);
+    while(!t.done) {
+      if(io->watch_type == SHUSO_IO_WATCH_OP_RETRY) {
+        retries++;
+      }
+      ssize_t n = read(fds[1], &received[total_received], 3001);
+      if(n > 0) {
+        total_received += n;
+      }
+      ev_run(S->ev.loop, EVRUN_NOWAIT);
+    }
+    assert(retries > 0, "the file shouldn't have fit in the socket buffer all at once");
+    asserteq(t.error, 0);
+    asserteq(t.result, (ssize_t )sizeof(data) - 100);
+    ssize_t n;
+    while(total_received < sizeof(received) && (n = read(fds[1], &received[total_received], sizeof(received) - total_received)) > 0) {
+      total_received += n;
+    }
+    asserteq(total_received, sizeof(data) - 100);
+    assert(memcmp(received, &data[100], sizeof(data) - 100) == 0, "file should arrive intact, starting at the offset");
+    
+    //asking for more than there is sends the rest of the file
+    t.done = false;
+    shuso_io_sendfile(io, file_fd, sizeof(data) - 10, 1000);
+    while(!t.done) {
+      ev_run(S->ev.loop, EVRUN_NOWAIT);
+    }
+    asserteq(t.result, 10, "should stop at the end of the file");
+    asserteq(read(fds[1], received, sizeof(received)), 10);
+    assert(memcmp(received, &data[sizeof(data) - 10], 10) == 0);
+    
+    close(file_fd);
+    close(fds[0]);
+    close(fds[1]);
+  }
+#endif
+  
+  test("sendmmsg batches that only partly fit") {
+    static char             data[32][1000];
+    static struct iovec     iov[32];
+    static shuso_mmsghdr_t  msgs[32];
+    static shuso_io_t       io_storage;
+    shuso_io_t             *io = &io_storage;
+    char                    received[sizeof(data[0]) + 1];
+    int                     fds[2];
+    int                     sndbuf = 4096;
+    int                     sent, next = 0;
+    partial_writev_test_t   t = {.done = false};
+    
+    shuso_configure_finish(S);
+    assert(socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, fds) == 0);
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    for(int i = 0; i < 32; i++) {
+      memset(data[i], 'a' + i % 26, sizeof(data[i]));
+      data[i][0] = i;
+      iov[i] = (struct iovec ) {.iov_base = data[i], .iov_len = sizeof(data[i])};
+      msgs[i] = (shuso_mmsghdr_t ) {.msg_hdr = {.msg_iov = &iov[i], .msg_iovlen = 1}};
+    }
+    shuso_io_init(S, io, fds[0], SHUSO_IO_WRITE, partial_writev_test_handler, &t);
+    
+    shuso_io_sendmmsg_partial(io, msgs, 32, 0);
+    assert(t.done, "a partial send should finish with however many fit");
+    asserteq(t.error, 0);
+    assert(t.result > 0 && t.result < 32, "the socket buffer should only take some of the batch");
+    sent = t.result;
+    for(; next < sent; next++) {
+      asserteq(recv(fds[1], received, sizeof(received), 0), (ssize_t )sizeof(data[next]));
+      assert(memcmp(received, data[next], sizeof(data[next])) == 0);
+    }
+    
+    //the whole rest of the batch, a few at a time
+    t.done = false;
+    shuso_io_sendmmsg(io, &msgs[sent], 32 - sent, 0);
+    while(!t.done) {
+      ssize_t n = recv(fds[1], received, sizeof(received), 0);
+      if(n > 0) {
+        asserteq(n, (ssize_t )sizeof(data[next]));
+        assert(memcmp(received, data[next], sizeof(data[next])) == 0, "datagrams should arrive whole and in order");
+        next++;
+      }
+      ev_run(S->ev.loop, EVRUN_NOWAIT);
+    }
+    asserteq(t.error, 0);
+    asserteq(t.result, 32 - sent, "result should count the datagrams sent over all the retries");
+    ssize_t n;
+    while((n = recv(fds[1], received, sizeof(received), 0)) > 0) {
+      asserteq(n, (ssize_t )sizeof(data[next]));
+      assert(memcmp(received, data[next], sizeof(data[next])) == 0, "datagrams should arrive whole and in order");
+      next++;
+    }
+    asserteq(next, 32);
+    close(fds[0]);
+    close(fds[1]);
+  }
+  
+  test("zero-copy writes resume only once the kernel's done with the buffer") {
+    static char             data[256 * 1024];
+    static char             received[sizeof(data)];
+    static shuso_io_t       io_storage;
+    shuso_io_t             *io = &io_storage;
+    int                     fds[2];
+    size_t                  total_received = 0;
+    zerocopy_test_t         t = {.done = false};
+    
+    shuso_configure_finish(S);
+    //MSG_ZEROCOPY is for TCP and UDP sockets only
+    tcp_loopback_pair(fds);
+    for(size_t i = 0; i < sizeof(data); i++) {
+      data[i] = 'a' + i % 26;
+    }
+    shuso_io_init(S, io, fds[0], SHUSO_IO_WRITE, zerocopy_test_handler, &t);
+    if(shuso_io_set_zerocopy(io, true, 4096)) {
+      shuso_io_write(io, data, sizeof(data));
+      while(!t.done) {
+        if(io->watch_type == SHUSO_IO_WATCH_OP_ZEROCOPY_FINISH) {
+          assert(!shuso_ev_active(&io->watcher), "the socket shouldn't be watched while waiting on completions");
+          assert(ev_is_active(&S->io.zerocopy_poll), "completions should be polled for");
+        }
+        ssize_t n = read(fds[1], &received[total_received], sizeof(received) - total_received);
+        if(n > 0) {
+          total_received += n;
+        }
+        ev_run(S->ev.loop, EVRUN_NOWAIT);
+      }
+      asserteq(t.error, 0);
+      asserteq(t.result, (ssize_t )sizeof(data));
+      assert(t.zerocopy_sent > 0, "payload over the threshold should be sent zero-copy");
+      asserteq(t.zerocopy_completed, t.zerocopy_sent, "coroutine resumed before all the completions came in");
+      assert(S->io.zerocopy_polled == NULL && !ev_is_active(&S->io.zerocopy_poll), "nothing should be left polling");
+      
+      ssize_t n;
+      while(total_received < sizeof(received) && (n = read(fds[1], &received[total_received], sizeof(received) - total_received)) > 0) {
+        total_received += n;
+      }
+      asserteq(total_received, sizeof(data));
+      assert(memcmp(received, data, sizeof(data)) == 0, "received data should match what was written");
+    }
+    //else there's no SO_ZEROCOPY here, and nothing to test
+    close(fds[0]);
+    close(fds[1]);
+  }
+  
+  test("zero-copy writes that time out still wait for the kernel to let go of the buffer") {
+    static char             data[256 * 1024];
+    static char             received[sizeof(data)];
+    static shuso_io_t       io_storage;
+    shuso_io_t             *io = &io_storage;
+    int                     fds[2];
+    bool                    expired = false;
+    zerocopy_test_t         t = {.done = false};
+    
+    shuso_configure_finish(S);
+    tcp_loopback_pair(fds);
+    memset(data, 'z', sizeof(data));
+    shuso_io_init(S, io, fds[0], SHUSO_IO_WRITE, zerocopy_test_handler, &t);
+    if(shuso_io_set_zerocopy(io, true, 4096)) {
+      shuso_io_write(io, data, sizeof(data));
+      while(!t.done) {
+        if(!expired && io->watch_type == SHUSO_IO_WATCH_OP_ZEROCOPY_FINISH) {
+          //fire the deadline right now, rather than hoping it lands in this window
+          io->deadline.callback(S, &io->deadline, io->deadline.pd);
+          expired = true;
+          assert(!t.done, "coroutine resumed before all the completions came in");
+          asserteq(io->watch_type, SHUSO_IO_WATCH_OP_ZEROCOPY_FINISH);
+        }
+        while(read(fds[1], received, sizeof(received)) > 0) {
+          //keep the receiver drained so the sends complete
+        }
+        ev_run(S->ev.loop, EVRUN_NOWAIT);
+      }
+      if(expired) {
+        asserteq(t.result, -1);
+        asserteq(t.error, ETIMEDOUT);
+        asserteq(t.zerocopy_completed, t.zerocopy_sent, "coroutine resumed before all the completions came in");
+        assert(!io->deadline_expired, "the timeout shouldn't carry over to the next op");
+      }
+      //else the completions came in before the op finished, and there was no window to time out in
+      assert(S->io.zerocopy_polled == NULL && !ev_is_active(&S->io.zerocopy_poll), "nothing should be left polling");
+    }
+    close(fds[0]);
+    close(fds[1]);
+  }
+  
+  test("ops that time out before they start let go of their buffers") {
+    static shuso_io_t       io_storage;
+    shuso_io_t             *io = &io_storage;
+    shuso_buffer_t          rbuf, wbuf;
+    struct iovec            iov = {.iov_base = "hello", .iov_len = 5};
+    int                     fds[2];
+    char                    received[16];
+    partial_writev_test_t   t = {.done = false};
+    
+    shuso_configure_finish(S);
+    assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) == 0);
+    shuso_buffer_init(S, &rbuf, SHUSO_BUF_HEAP, NULL);
+    shuso_buffer_init(S, &wbuf, SHUSO_BUF_HEAP, NULL);
+    memcpy(shuso_buffer_add_charbuf(S, &wbuf, 3), "abc", 3);
+    shuso_io_init(S, io, fds[0], SHUSO_IO_READ | SHUSO_IO_WRITE, partial_writev_test_handler, &t);
+    
+    //as if the deadline had gone off while the io was between ops
+    io->deadline_expired = 1;
+    shuso_io_read_into_buffer(io, &rbuf);
+    assert(t.done);
+    asserteq(t.error, ETIMEDOUT);
+    assert(io->read_buffer.buffer == NULL, "timed-out read shouldn't keep its buffer");
+    
+    t.done = false;
+    io->deadline_expired = 1;
+    shuso_io_write_buffer(io, &wbuf);
+    assert(t.done);
+    asserteq(t.error, ETIMEDOUT);
+    assert(io->write_buffer.buffer == NULL && io->write_buffer.batch == NULL, "timed-out write shouldn't keep its buffer");
+    assert(wbuf.first != NULL, "nothing should have been dequeued");
+    
+    //the next op's result goes nowhere near either buffer
+    t.done = false;
+    shuso_io_writev(io, &iov, 1);
+    assert(t.done);
+    asserteq(t.error, 0);
+    asserteq(t.result, 5);
+    assert(rbuf.first == NULL, "the write shouldn't have been committed to the read buffer");
+    asserteq(read(fds[1], received, sizeof(received)), 5);
+    
+    shuso_buffer_read_finish(S, &rbuf);
+    shuso_buffer_free(S, &wbuf, shuso_buffer_dequeue(S, &wbuf));
+    close(fds[0]);
+    close(fds[1]);
+  }
+  
+  test("reads into a buffer fill the tail slack before a fresh link") {
+    shuso_buffer_t        buf;
+    struct iovec          iov[2];
+    shuso_buffer_link_t  *link;
+    
+    shuso_buffer_init(S, &buf, SHUSO_BUF_HEAP, NULL);
+    asserteq(shuso_buffer_read_prepare(S, &buf, iov), 1, "empty buffer reads into a fresh link only");
+    asserteq(iov[0].iov_len, SHUSO_BUFFER_READ_SIZE_DEFAULT);
+    shuso_buffer_read_commit(S, &buf, 100);
+    assert(buf.first && buf.first == buf.last);
+    asserteq(buf.last->len, 100);
+    asserteq(buf.read.tail_slack, SHUSO_BUFFER_READ_SIZE_DEFAULT - 100);
+    asserteq(buf.read.size, SHUSO_BUFFER_READ_SIZE_DEFAULT / 2, "small reads shrink the read size");
+    
+    asserteq(shuso_buffer_read_prepare(S, &buf, iov), 1, "enough tail slack for a whole read");
+    asserteq((void *)iov[0].iov_base, (void *)&buf.last->buf[100]);
+    shuso_buffer_read_commit(S, &buf, iov[0].iov_len);
+    asserteq(buf.last->len, SHUSO_BUFFER_READ_SIZE_DEFAULT, "the link gets filled up");
+    asserteq(buf.read.tail_slack, 0);
+    asserteq(buf.read.size, SHUSO_BUFFER_READ_SIZE_DEFAULT, "full reads grow the read size");
+    
+    asserteq(shuso_buffer_read_prepare(S, &buf, iov), 1);
+    shuso_buffer_read_commit(S, &buf, SHUSO_BUFFER_READ_SIZE_DEFAULT - 10);
+    asserteq(buf.read.tail_slack, 10);
+    asserteq(shuso_buffer_read_prepare(S, &buf, iov), 2, "readv across tail slack and a fresh link");
+    asserteq(iov[0].iov_len, 10);
+    shuso_buffer_read_commit(S, &buf, 5);
+    assert(buf.read.fresh, "unused fresh link is kept for later");
+    shuso_buffer_read_finish(S, &buf);
+    assert(buf.read.fresh == NULL);
+    
+    while((link = shuso_buffer_dequeue(S, &buf)) != NULL) {
+      shuso_buffer_free(S, &buf, link);
+    }
+  }
+  
+  test("coalesced datagrams are split into views") {
+    static char               data[1000];
+    struct iovec              iov = {.iov_base = data, .iov_len = sizeof(data)};
+    shuso_io_datagram_view_t  views[8];
+    union {
+      char                      buf[SHUSO_IO_DATAGRAM_CONTROL_SIZE];
+      struct cmsghdr            align;
+    }                         control;
+    shuso_mmsghdr_t           msg = {
+      .msg_hdr = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1
+      },
+      .msg_len = 900
+    };
+    
+    asserteq(shuso_io_datagram_split(&msg, views, 8), 1, "no GRO cmsg means one datagram");
+    asserteq((void *)views[0].data, (void *)data);
+    asserteq(views[0].len, 900);
+#ifdef UDP_GRO
+    int gso_size = 400;
+    msg.msg_hdr.msg_control = control.buf;
+    msg.msg_hdr.msg_controllen = CMSG_SPACE(sizeof(gso_size));
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg.msg_hdr);
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type = UDP_GRO;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(gso_size));
+    memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+    
+    asserteq(shuso_io_datagram_split(&msg, views, 8), 3);
+    asserteq((void *)views[0].data, (void *)&data[0]);
+    asserteq(views[0].len, 400);
+    asserteq((void *)views[1].data, (void *)&data[400]);
+    asserteq(views[1].len, 400);
+    asserteq((void *)views[2].data, (void *)&data[800]);
+    asserteq(views[2].len, 100, "last datagram is the leftover");
+    memset(views, 0, sizeof(views));
+    asserteq(shuso_io_datagram_split(&msg, views, 2), 3, "should count the datagrams that didn't fit");
+    asserteq(views[1].len, 400);
+    asserteq(views[2].len, 0, "shouldn't overflow the views array");
+    asserteq(shuso_io_datagram_split(&msg, NULL, 0), 3, "should be able to just count the datagrams");
+#else
+    (void )control;
+#endif
+  }
+}
+
+typedef struct {
+  int       fired[4];
+  int       count;
+} timer_wheel_test_t;
+
+static timer_wheel_test_t timer_wheel_test_results;
+
+static void timer_wheel_test_callback(shuso_t *S, shuso_timer_t *timer, void *pd) {
+  timer_wheel_test_t *t = &timer_wheel_test_results;
+  t->fired[t->count++] = (int )(intptr_t )pd;
+}
+
+describe(timer_wheel) {
+  static shuso_t          *S = NULL;
+  static test_runcheck_t  *chk = NULL;
+  before_each() {
+    S = shusoT_create(&chk, 25.0);
+    shuso_configure_finish(S);
+  }
+  after_each() {
+    shusoT_destroy(S, &chk);
+  }
+  
+  test("timers go off in order, and stopped ones don't") {
+    shuso_timer_wheel_t  wheel;
+    shuso_timer_t        timer[4];
+    timer_wheel_test_t  *t = &timer_wheel_test_results;
+    *t = (timer_wheel_test_t ){.count = 0};
+    
+    shuso_timer_wheel_init(S, &wheel, 0.001);
+    for(int i = 0; i < 4; i++) {
+      shuso_timer_init(&timer[i], timer_wheel_test_callback, (void *)(intptr_t )i);
+    }
+    //the last one is far enough out to be cascaded down from a higher level
+    shuso_timer_start(&wheel, &timer[0], 0.030);
+    shuso_timer_start(&wheel, &timer[1], 0.010);
+    shuso_timer_start(&wheel, &timer[2], 0.020);
+    shuso_timer_start(&wheel, &timer[3], 0.150);
+    assert(shuso_timer_active(&timer[2]));
+    shuso_timer_stop(&wheel, &timer[2]);
+    assert(!shuso_timer_active(&timer[2]));
+    asserteq(wheel.count, 3);
+    
+    while(wheel.count > 0) {
+      ev_run(S->ev.loop, EVRUN_ONCE);
+    }
+    asserteq(t->count, 3);
+    asserteq(t->fired[0], 1);
+    asserteq(t->fired[1], 0);
+    asserteq(t->fired[2], 3);
+    assert(!shuso_ev_active(&wheel.tick), "the tick should stop when the wheel is empty");
+    shuso_timer_wheel_shutdown(&wheel);
+  }
+}
+
+describe(connections) {
+  static shuso_t          *S = NULL;
+  static test_runcheck_t  *chk = NULL;
+  before_each() {
+    S = shusoT_create(&chk, 25.0);
+    shuso_configure_finish(S);
+  }
+  after_each() {
+    shuso_connections_free(S);
+    shusoT_destroy(S, &chk);
+  }
+  
+  test("recycled connections keep their pool page and buffer") {
+    shuso_sockaddr_t    sockaddr = {.in = {.sin_family = AF_INET, .sin_port = htons(1234)}};
+    shuso_socket_t      socket = {.fd = 42, .host = {.sockaddr = &sockaddr, .family = AF_INET, .type = SOCK_STREAM}};
+    shuso_connection_t *c, *c2;
+    shuso_pool_page_t  *page;
+    char               *buf;
+    
+    c = shuso_connection_create(S, &socket);
+    assert(c);
+    asserteq(c->socket.fd, 42);
+    assert(c->socket.host.sockaddr == &c->sockaddr, "the sockaddr should be copied");
+    asserteq(ntohs(c->sockaddr.in.sin_port), 1234);
+    assert(shuso_connection_buffer_reserve(c, 0, 3000));
+    assert(c->size >= 3000);
+    assert(shuso_palloc(&c->pool, 100));
+    assert(shuso_palloc(&c->pool, SHUSO_CONNECTION_POOL_PAGE_SIZE * 2), "a big one, malloc'd separately");
+    c->claimed = true;
+    buf = c->buf;
+    page = c->pool.page.last;
+    shuso_connection_recycle(c);
+    
+    c2 = shuso_connection_create(S, &socket);
+    assert(c2 == c, "should have gotten the same connection back");
+    assert(!c2->claimed);
+    assert(c2->buf == buf, "the read buffer should be kept");
+    assert(c2->pool.page.last == page, "the pool's first page should be kept");
+#ifndef SHUTTLESOCK_DEBUG_NOPOOL
+    asserteq(c2->pool.allocd.last, NULL, "the big allocation should be gone");
+#endif
+    shuso_connection_recycle(c2);
+  }
+}
+
+describe(upgrade) {
+  static shuso_t          *S = NULL;
+  static test_runcheck_t  *chk = NULL;
+  before_each() {
+    S = shusoT_create(&chk, 25.0);
+    shuso_configure_finish(S);
+  }
+  after_each() {
+    shuso_upgrade_cleanup(S);
+    shusoT_destroy(S, &chk);
+  }
+  
+  test("kept fds are handed over in order") {
+    struct sockaddr_in  addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t           len;
+    int                 channel[2];
+    int                 fd;
+    in_port_t           port[3];
+    
+    for(int i = 0; i < 3; i++) {
+      fd = socket(AF_INET, SOCK_STREAM, 0);
+      assert(fd != -1);
+      assert(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+      len = sizeof(addr);
+      assert(getsockname(fd, (struct sockaddr *)&addr, &len) == 0);
+      port[i] = addr.sin_port;
+      addr.sin_port = 0;
+      assert(shuso_upgrade_keep_fd(S, i < 2 ? "TCP:stream:a" : "TCP:stream:b", fd));
+    }
+    
+    assert(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, channel) == 0);
+    assert(shuso_upgrade_send_fds(S, channel[0]));
+    assert(shuso_upgrade_receive_fds(S, channel[1]));
+    close(channel[0]);
+    close(channel[1]);
+    asserteq(S->common->upgrade.inherited.count, 3);
+    
+    asserteq(shuso_upgrade_take_inherited_fd(S, "TCP:stream:c"), -1);
+    for(int i = 0; i < 3; i++) {
+      fd = shuso_upgrade_take_inherited_fd(S, i < 2 ? "TCP:stream:a" : "TCP:stream:b");
+      assert(fd != -1);
+      len = sizeof(addr);
+      assert(getsockname(fd, (struct sockaddr *)&addr, &len) == 0);
+      asserteq(addr.sin_port, port[i], "should be the same socket, in the same order");
+      close(fd);
+    }
+    asserteq(shuso_upgrade_take_inherited_fd(S, "TCP:stream:a"), -1);
+    asserteq(S->common->upgrade.inherited.count, 0);
+  }
+}
+
 void resolve_check_ok(shuso_t *S, shuso_resolver_result_t result, struct hostent *hostent, void *pd) {
   assert(result == SHUSO_RESOLVER_SUCCESS);
   //printf("Found address name %s\n", hostent->h_name);